@@ -0,0 +1,595 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <array>
+#include <thread>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include "otbBVUtil.h"
+#include "otbPhiloxRNG.h"
+#include "otbBVRegressionModels.h"
+#include "otbProSailSimulatorFunctor.h"
+#include "itkListSample.h"
+
+namespace otb
+{
+namespace Wrapper
+{
+
+class BVActiveLearning : public Application
+{
+public:
+/** Standard class typedefs. */
+  typedef BVActiveLearning     Self;
+  typedef Application                   Superclass;
+
+/** Standard macro */
+  itkNewMacro(Self);
+
+  itkTypeMacro(BVActiveLearning, otb::Application);
+
+  using PrecisionType = otb::BV::PrecisionType;
+  typedef otb::SatelliteRSR<PrecisionType, PrecisionType>  SatRSRType;
+  typedef Functor::ProSailSimulator<SatRSRType> ProSailType;
+  typedef typename ProSailType::OutputType SimulationType;
+  typedef itk::FixedArray<PrecisionType, 1> OutputSampleType;
+  typedef itk::VariableLengthVector<PrecisionType> InputSampleType;
+  typedef itk::Statistics::ListSample<OutputSampleType> ListOutputSampleType;
+  typedef itk::Statistics::ListSample<InputSampleType> ListInputSampleType;
+  typedef otb::BV::RegressionModelType ModelType;
+
+  /** A simulated sample: the uniform values it was drawn from, its
+      reflectances and the value of the variable to be estimated */
+  struct SimulatedSample {
+    otb::BV::UniformsType u;
+    InputSampleType reflectances;
+    PrecisionType target;
+  };
+  using SampleSetType = std::vector<SimulatedSample>;
+
+private:
+  void DoInit() override
+  {
+    SetName("BVActiveLearning");
+    SetDescription("Learn an inversion model by rounds of simulations targeted at the regions where the model error is high.");
+
+    AddParameter(ParameterType_InputFilename, "rsrfile",
+                 "Input file containing the relative spectral responses.");
+    SetParameterDescription("rsrfile", "Input file containing the relative spectral responses of the sensor, as for ProSailSimulator.");
+    MandatoryOn("rsrfile");
+
+    AddParameter(ParameterType_Float, "solarzenith", "Solar zenith angle");
+    SetParameterDescription("solarzenith", "Solar zenith angle of the simulations.");
+    MandatoryOn("solarzenith");
+
+    AddParameter(ParameterType_Float, "sensorzenith", "Sensor zenith angle");
+    SetParameterDescription("sensorzenith", "Sensor zenith angle of the simulations.");
+    MandatoryOn("sensorzenith");
+
+    AddParameter(ParameterType_Float, "azimuth", "Relative azimuth");
+    SetParameterDescription("azimuth", "Relative azimuth between the sun and the sensor.");
+    MandatoryOn("azimuth");
+
+    AddParameter(ParameterType_Float, "noisestd",
+                 "Standard deviation of the noise added to the reflectances");
+    SetDefaultParameterFloat("noisestd", 0.0);
+    SetParameterDescription("noisestd", "Standard deviation of the gaussian noise added to all the simulated reflectances.");
+    MandatoryOff("noisestd");
+
+    AddParameter(ParameterType_Float, "minlai", "Minimum value for LAI");
+    SetDefaultParameterFloat("minlai", 0.0);
+    SetParameterDescription("minlai", "Minimum value for LAI");
+
+    AddParameter(ParameterType_Float, "maxlai", "Maximum value for LAI");
+    SetDefaultParameterFloat("maxlai", 15.0);
+    SetParameterDescription("maxlai", "Maximum value for LAI");
+
+    AddParameter(ParameterType_Float, "modlai", "Mode value for LAI");
+    SetDefaultParameterFloat("modlai", 2.0);
+    SetParameterDescription("modlai", "Mode value for LAI");
+
+    AddParameter(ParameterType_Float, "stdlai", "Standard deviation value for LAI");
+    SetDefaultParameterFloat("stdlai", 2.0);
+    SetParameterDescription("stdlai", "Standard deviation value for LAI");
+
+    AddParameter(ParameterType_String,
+                 "distlai", "Probability distribution for LAI [normal|lognormal(default)]");
+    SetParameterDescription("distlai", "Probability distribution for LAI (normal,lognormal)");
+    MandatoryOff("distlai");
+
+    AddParameter(ParameterType_String, "variable",
+                 "Variable to be estimated [lai(default)|fapar|fcover]");
+    SetParameterDescription("variable", "Variable to be estimated from the reflectances.");
+    MandatoryOff("variable");
+
+    AddParameter(ParameterType_String, "regression",
+                 "Regression to use for the training (nn, svr, rfr, mlr, mlp)");
+    SetParameterDescription("regression",
+                            "Choice of the regression to use for the training: svr, rfr, nn (default), mlr, mlp. The models are the ones of InverseModelLearning.");
+    MandatoryOff("regression");
+
+    AddParameter(ParameterType_Int, "initsamples", "Size of the initial training set");
+    SetParameterDescription("initsamples", "Number of samples drawn from the prior and simulated before the first round.");
+    SetDefaultParameterInt("initsamples", 1000);
+    MandatoryOff("initsamples");
+
+    AddParameter(ParameterType_Int, "roundsamples", "Number of samples simulated per round");
+    SetParameterDescription("roundsamples", "Number of samples added to the training set at each round.");
+    SetDefaultParameterInt("roundsamples", 500);
+    MandatoryOff("roundsamples");
+
+    AddParameter(ParameterType_Int, "candidates", "Number of candidates per selected sample");
+    SetParameterDescription("candidates", "At each round, candidates times roundsamples samples are drawn from the prior and scored, and the roundsamples with the highest expected error are simulated. The candidates are not simulated.");
+    SetDefaultParameterInt("candidates", 10);
+    MandatoryOff("candidates");
+
+    AddParameter(ParameterType_Int, "rounds", "Maximum number of rounds");
+    SetParameterDescription("rounds", "Maximum number of rounds of sample selection.");
+    SetDefaultParameterInt("rounds", 10);
+    MandatoryOff("rounds");
+
+    AddParameter(ParameterType_Int, "valsamples", "Size of the validation set");
+    SetParameterDescription("valsamples", "Number of samples drawn from the prior and simulated once to compute the validation RMSE after each round.");
+    SetDefaultParameterInt("valsamples", 2000);
+    MandatoryOff("valsamples");
+
+    AddParameter(ParameterType_Float, "targetrmse", "Target validation RMSE");
+    SetParameterDescription("targetrmse", "The rounds stop when the RMSE of the model on the validation set is below this value.");
+    MandatoryOff("targetrmse");
+
+    AddParameter(ParameterType_Int, "seed", "Seed for the sample generation");
+    SetParameterDescription("seed", "Seed for the generation of the samples and of the noise.");
+    SetDefaultParameterInt("seed", 0);
+    MandatoryOff("seed");
+
+    AddParameter(ParameterType_Int, "threads",
+                 "Number of parallel threads for the simulations");
+    SetParameterDescription("threads",
+                            "Number of parallel threads for the simulations and the scoring of the candidates.");
+    MandatoryOff("threads");
+
+    AddParameter(ParameterType_OutputFilename, "out", "Output regression model.");
+    SetParameterDescription("out", "Filename where the regression model of the last round is saved.");
+    MandatoryOn("out");
+
+    AddParameter(ParameterType_OutputFilename, "normalization",
+                 "Output file containing min and max values per sample component.");
+    SetParameterDescription("normalization", "Output file containing min and max values per sample component, to be used with the model by the inversion applications.");
+    MandatoryOn("normalization");
+
+    AddParameter(ParameterType_OutputFilename, "training",
+                 "Output file containing the selected training samples.");
+    SetParameterDescription("training", "The simulated training samples, in the format of the training files of InverseModelLearning and at full precision, so that InverseModelLearning learns the same model from them.");
+    MandatoryOff("training");
+  }
+
+  virtual ~BVActiveLearning() override
+  {
+  }
+
+  void DoUpdateParameters() override
+  {
+    // Nothing to do here : all parameters are independent
+  }
+
+  void DoExecute() override
+  {
+    using namespace otb::BV;
+    ReadParameters();
+
+    auto initSamples = static_cast<std::size_t>(std::max(GetParameterInt("initsamples"), 2));
+    auto roundSamples = static_cast<std::size_t>(std::max(GetParameterInt("roundsamples"), 1));
+    auto nbCandidates = roundSamples*std::max(GetParameterInt("candidates"), 1);
+    auto maxRounds = std::max(GetParameterInt("rounds"), 0);
+    auto valSamples = static_cast<std::size_t>(std::max(GetParameterInt("valsamples"), 1));
+    auto targetRMSE = IsParameterEnabled("targetrmse") ?
+      GetParameterFloat("targetrmse") : 0.0;
+
+    auto validation = Simulate(Indices(0, valSamples), ValidationStream);
+    auto training = Simulate(Indices(0, initSamples), PoolStream);
+    std::size_t nextIndex{initSamples};
+
+    NormalizationVectorType var_minmax;
+    ModelType::Pointer model;
+    for(int round = 0; ; ++round)
+      {
+      var_minmax = EstimateNormalization(training);
+      model = Train(training, var_minmax);
+      auto rmse = ValidationRMSE(model, validation, var_minmax);
+      otbAppLogINFO("Round " << round << ": " << training.size()
+                    << " training samples, validation RMSE = " << rmse
+                    << std::endl);
+      if(rmse <= targetRMSE)
+        {
+        otbAppLogINFO("Target RMSE reached." << std::endl);
+        break;
+        }
+      if(round == maxRounds)
+        break;
+
+      // expected error of the training samples, learned by the error
+      // model from out of fold residuals
+      auto expectedErrors = ExpectedErrors(training, var_minmax);
+      // the candidates are drawn from the prior and scored in the space
+      // of the uniform values (the quantiles of the variables) by the
+      // expected error of their nearest training samples
+      auto candidates = Indices(nextIndex, nextIndex+nbCandidates);
+      nextIndex += nbCandidates;
+      auto scores = ScoreCandidates(candidates, training, expectedErrors);
+      std::vector<std::size_t> order(candidates.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::partial_sort(order.begin(), order.begin()+roundSamples, order.end(),
+                        [&scores](std::size_t a, std::size_t b){
+                          return scores[a] > scores[b];
+                        });
+      std::vector<std::size_t> selected;
+      for(std::size_t k = 0; k < roundSamples; ++k)
+        selected.push_back(candidates[order[k]]);
+      std::sort(selected.begin(), selected.end());
+      auto newSamples = Simulate(selected, PoolStream);
+      training.insert(training.end(), newSamples.begin(), newSamples.end());
+      }
+
+    model->Save(GetParameterString("out"));
+    write_normalization_file(var_minmax, GetParameterString("normalization"));
+    if(IsParameterEnabled("training") && HasValue("training"))
+      WriteTrainingFile(training, GetParameterString("training"));
+    otbAppLogINFO("" << training.size()+validation.size()
+                  << " simulations in total, including " << validation.size()
+                  << " for the validation." << std::endl);
+  }
+
+  void ReadParameters()
+  {
+    using namespace otb::BV;
+    m_Distributions = BVDistributions{};
+    m_Distributions.MLAI.min = GetParameterFloat("minlai");
+    m_Distributions.MLAI.max = GetParameterFloat("maxlai");
+    m_Distributions.MLAI.mod = GetParameterFloat("modlai");
+    m_Distributions.MLAI.std = GetParameterFloat("stdlai");
+    if(IsParameterEnabled("distlai") && GetParameterString("distlai") == "normal")
+      m_Distributions.MLAI.dist = DistType::GAUSSIAN;
+
+    m_Variable = IsParameterEnabled("variable") ?
+      GetParameterString("variable") : "lai";
+    if(m_Variable != "lai" && m_Variable != "fapar" && m_Variable != "fcover")
+      {
+      itkGenericExceptionMacro(<< "Unknown variable " << m_Variable
+                               << ". Available ones are lai, fapar and fcover.");
+      }
+    m_RegressionType = IsParameterEnabled("regression") ?
+      GetParameterString("regression") : "nn";
+    if(m_RegressionType != "nn" && m_RegressionType != "svr" &&
+       m_RegressionType != "rfr" && m_RegressionType != "mlr" &&
+       m_RegressionType != "mlp")
+      {
+      itkGenericExceptionMacro(<< "Unknown regression type " << m_RegressionType
+                               << ". Available types are nn, svr, rfr, mlr and mlp.");
+      }
+
+    std::string rsrFileName = GetParameterString("rsrfile");
+    //The first 2 columns of the rsr file correspond to the wavelenght and the solar radiation
+    auto cols = countColumns(rsrFileName);
+    if(cols < 3)
+      {
+      itkGenericExceptionMacro(<< "No spectral band in " << rsrFileName);
+      }
+    m_NbBands = cols-2;
+    m_SatRSR = SatRSRType::New();
+    m_SatRSR->SetNbBands(m_NbBands);
+    m_SatRSR->SetSortBands(false);
+    m_SatRSR->Load(rsrFileName);
+    otbAppLogINFO("Simulating " << m_NbBands << " spectral bands."<<std::endl);
+
+    m_AcquisitionParameters[AcquisitionParameters::TTS] = GetParameterFloat("solarzenith");
+    m_AcquisitionParameters[AcquisitionParameters::TTS_FAPAR] = GetParameterFloat("solarzenith");
+    m_AcquisitionParameters[AcquisitionParameters::TTO] = GetParameterFloat("sensorzenith");
+    m_AcquisitionParameters[AcquisitionParameters::PSI] = GetParameterFloat("azimuth");
+    m_NoiseStd = GetParameterFloat("noisestd");
+    if(m_NoiseStd < 0)
+      {
+      itkGenericExceptionMacro(<< "The noise std cannot be negative.");
+      }
+    m_Seed = static_cast<std::uint64_t>(GetParameterInt("seed"));
+
+    m_NbThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(IsParameterEnabled("threads") && GetParameterInt("threads") > 0 &&
+       static_cast<unsigned int>(GetParameterInt("threads")) < m_NbThreads)
+      m_NbThreads = GetParameterInt("threads");
+  }
+
+  static std::vector<std::size_t> Indices(std::size_t first, std::size_t last)
+  {
+    std::vector<std::size_t> indices(last-first);
+    std::iota(indices.begin(), indices.end(), first);
+    return indices;
+  }
+
+  /** Uniform values of a sample. A sample only depends on the seed,
+      its index and the stream, as in BVInputVariableGeneration. */
+  otb::BV::UniformsType Uniforms(std::size_t index, std::uint32_t stream) const
+  {
+    otb::BV::PhiloxRNG rng(m_Seed, index, stream);
+    otb::BV::UniformsType u;
+    for(auto& v : u)
+      v = otb::BV::uniform_01(rng);
+    return u;
+  }
+
+  SampleSetType Simulate(const std::vector<std::size_t>& indices,
+                         std::uint32_t stream)
+  {
+    using namespace otb::BV;
+    SampleSetType samples(indices.size());
+    parallel_for_blocks(0, indices.size(), m_NbThreads,
+                        [&](std::size_t first, std::size_t last){
+      ProSailType prosail;
+      prosail.SetRSR(m_SatRSR);
+      prosail.SetParameters(m_AcquisitionParameters);
+      for(auto i = first; i < last; ++i)
+        {
+        auto& sample = samples[i];
+        sample.u = Uniforms(indices[i], stream);
+        auto bv = DrawSample(m_Distributions, sample.u);
+        prosail.SetBVs(bv);
+        auto simu = prosail();
+        // the last 2 values of the simulation are fapar and fcover
+        sample.reflectances.SetSize(m_NbBands);
+        PhiloxRNG rng(m_Seed, indices[i], stream+NoiseStreamOffset);
+        for(std::size_t band = 0; band < m_NbBands; ++band)
+          {
+          sample.reflectances[band] = simu[band];
+          // a normal distribution needs a positive std
+          if(m_NoiseStd > 0)
+            sample.reflectances[band] += 
+              std::normal_distribution<>(0, m_NoiseStd)(rng);
+          }
+        if(m_Variable == "fapar")
+          sample.target = simu[simu.size()-2];
+        else if(m_Variable == "fcover")
+          sample.target = simu[simu.size()-1];
+        else
+          sample.target = bv[IVNames::MLAI];
+        }
+    });
+    return samples;
+  }
+
+  otb::BV::NormalizationVectorType
+  EstimateNormalization(const SampleSetType& samples) const
+  {
+    auto ils = ListInputSampleType::New();
+    auto ols = ListOutputSampleType::New();
+    ils->SetMeasurementVectorSize(m_NbBands);
+    ols->SetMeasurementVectorSize(1);
+    for(const auto& s : samples)
+      {
+      ils->PushBack(s.reflectances);
+      OutputSampleType target;
+      target[0] = s.target;
+      ols->PushBack(target);
+      }
+    auto ilFirst = ils->Begin();
+    auto ilLast = ils->End();
+    auto olFirst = ols->Begin();
+    auto olLast = ols->End();
+    return otb::BV::estimate_var_minmax(ilFirst, ilLast, olFirst, olLast);
+  }
+
+  InputSampleType Normalize(const InputSampleType& in,
+                            const otb::BV::NormalizationVectorType& var_minmax) const
+  {
+    InputSampleType out(in);
+    for(std::size_t band = 0; band < m_NbBands; ++band)
+      out[band] = otb::BV::normalize(in[band], var_minmax[band]);
+    return out;
+  }
+
+  template <typename RegressionPointerType>
+  ModelType::Pointer Fit(RegressionPointerType regression,
+                         ListInputSampleType::Pointer ils,
+                         ListOutputSampleType::Pointer ols)
+  {
+    regression->SetInputListSample(ils);
+    regression->SetTargetListSample(ols);
+    regression->Train();
+    return regression.GetPointer();
+  }
+
+  /** Trains the regression on the samples of the set for which keep is
+      true, in the normalized space */
+  template <typename KeepType>
+  ModelType::Pointer Train(const SampleSetType& samples,
+                           const otb::BV::NormalizationVectorType& var_minmax,
+                           KeepType keep)
+  {
+    auto ils = ListInputSampleType::New();
+    auto ols = ListOutputSampleType::New();
+    ils->SetMeasurementVectorSize(m_NbBands);
+    ols->SetMeasurementVectorSize(1);
+    for(std::size_t i = 0; i < samples.size(); ++i)
+      {
+      if(!keep(i)) continue;
+      ils->PushBack(Normalize(samples[i].reflectances, var_minmax));
+      OutputSampleType target;
+      target[0] = otb::BV::normalize(samples[i].target, var_minmax[m_NbBands]);
+      ols->PushBack(target);
+      }
+    if(m_RegressionType == "svr")
+      return Fit(otb::BV::NewSVRRegression(), ils, ols);
+    if(m_RegressionType == "rfr")
+      return Fit(otb::BV::NewRFRRegression(), ils, ols);
+    if(m_RegressionType == "mlr")
+      return Fit(otb::BV::NewMLRRegression(m_NbThreads), ils, ols);
+    if(m_RegressionType == "mlp")
+      return Fit(otb::BV::NewMLPRegression(m_NbThreads, m_Seed), ils, ols);
+    return Fit(otb::BV::NewNNRegression(m_NbBands), ils, ols);
+  }
+
+  ModelType::Pointer Train(const SampleSetType& samples,
+                           const otb::BV::NormalizationVectorType& var_minmax)
+  {
+    return Train(samples, var_minmax, [](std::size_t){ return true; });
+  }
+
+  PrecisionType Predict(ModelType::Pointer model, const SimulatedSample& sample,
+                        const otb::BV::NormalizationVectorType& var_minmax) const
+  {
+    auto estimate = model->Predict(Normalize(sample.reflectances, var_minmax))[0];
+    return otb::BV::denormalize(estimate, var_minmax[m_NbBands]);
+  }
+
+  double ValidationRMSE(ModelType::Pointer model, const SampleSetType& validation,
+                        const otb::BV::NormalizationVectorType& var_minmax) const
+  {
+    double sse{0};
+    for(const auto& sample : validation)
+      {
+      auto err = Predict(model, sample, var_minmax)-sample.target;
+      sse += err*err;
+      }
+    return std::sqrt(sse/validation.size());
+  }
+
+  /** The residuals of each half of the training set are computed with a
+      model trained on the other half. The error model (the errest
+      neural network of InverseModelLearning) learns their absolute value
+      from the reflectances and gives a smooth estimation of the error
+      for every training sample. */
+  std::vector<double> ExpectedErrors(const SampleSetType& training,
+                                     const otb::BV::NormalizationVectorType& var_minmax)
+  {
+    auto even = Train(training, var_minmax,
+                      [](std::size_t i){ return i%2 == 0; });
+    auto odd = Train(training, var_minmax,
+                     [](std::size_t i){ return i%2 == 1; });
+    auto ils = ListInputSampleType::New();
+    auto ols = ListOutputSampleType::New();
+    ils->SetMeasurementVectorSize(m_NbBands);
+    ols->SetMeasurementVectorSize(1);
+    for(std::size_t i = 0; i < training.size(); ++i)
+      {
+      auto other = i%2 == 0 ? odd : even;
+      auto err = Predict(other, training[i], var_minmax)-training[i].target;
+      ils->PushBack(Normalize(training[i].reflectances, var_minmax));
+      OutputSampleType target;
+      target[0] = otb::BV::normalize(std::fabs(err), var_minmax[m_NbBands]);
+      ols->PushBack(target);
+      }
+    auto err_regression = otb::BV::NewErrorRegression(m_NbBands);
+    err_regression->SetInputListSample(ils);
+    err_regression->SetTargetListSample(ols);
+    otbAppLogINFO("Error model estimation ..." << std::endl);
+    err_regression->Train();
+    std::vector<double> errors;
+    auto sIt = ils->Begin();
+    while(sIt != ils->End())
+      {
+      errors.push_back(otb::BV::denormalize(
+                         err_regression->Predict(sIt.GetMeasurementVector())[0],
+                         var_minmax[m_NbBands]));
+      ++sIt;
+      }
+    return errors;
+  }
+
+  /** Score of a candidate: mean expected error of its nearest training
+      samples in the space of the uniform values */
+  std::vector<double> ScoreCandidates(const std::vector<std::size_t>& candidates,
+                                      const SampleSetType& training,
+                                      const std::vector<double>& expectedErrors) const
+  {
+    const std::size_t nbNeighbours{std::min<std::size_t>(5, training.size())};
+    std::vector<double> scores(candidates.size());
+    otb::parallel_for_blocks(0, candidates.size(), m_NbThreads,
+                             [&](std::size_t first, std::size_t last){
+      // sorted (distance, error) of the nearest neighbours
+      std::vector<std::pair<double, double>> nearest;
+      for(auto c = first; c < last; ++c)
+        {
+        auto u = Uniforms(candidates[c], PoolStream);
+        nearest.assign(nbNeighbours,
+                       {std::numeric_limits<double>::max(), 0.0});
+        for(std::size_t i = 0; i < training.size(); ++i)
+          {
+          double d{0};
+          for(std::size_t k = 0; k < u.size(); ++k)
+            d += (u[k]-training[i].u[k])*(u[k]-training[i].u[k]);
+          if(d < nearest.back().first)
+            {
+            nearest.back() = {d, expectedErrors[i]};
+            std::sort(nearest.begin(), nearest.end());
+            }
+          }
+        double score{0};
+        for(const auto& n : nearest)
+          score += n.second;
+        scores[c] = score/nbNeighbours;
+        }
+    });
+    return scores;
+  }
+
+  void WriteTrainingFile(const SampleSetType& training,
+                         const std::string& fileName) const
+  {
+    std::ofstream trainingFile(fileName);
+    if(!trainingFile)
+      {
+      itkGenericExceptionMacro(<< "Could not open file " << fileName);
+      }
+    // InverseModelLearning gives the same model from this file
+    trainingFile << std::setprecision(17);
+    for(const auto& sample : training)
+      {
+      trainingFile << sample.target;
+      for(std::size_t band = 0; band < m_NbBands; ++band)
+        trainingFile << " " << sample.reflectances[band];
+      trainingFile << "\n";
+      }
+  }
+
+  // streams of the random numbers of the training candidates and of the
+  // validation samples; the noise of a sample uses its stream plus
+  // NoiseStreamOffset
+  static constexpr std::uint32_t PoolStream{0};
+  static constexpr std::uint32_t ValidationStream{1};
+  static constexpr std::uint32_t NoiseStreamOffset{2};
+
+  otb::BV::BVDistributions m_Distributions;
+  otb::BV::AcquisitionParsType m_AcquisitionParameters;
+  SatRSRType::Pointer m_SatRSR;
+  std::size_t m_NbBands{0};
+  double m_NoiseStd{0};
+  std::uint64_t m_Seed{0};
+  unsigned int m_NbThreads{1};
+  std::string m_Variable;
+  std::string m_RegressionType;
+};
+
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::BVActiveLearning)
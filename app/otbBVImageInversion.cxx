@@ -19,30 +19,25 @@
 #include <fstream>
 #include <string>
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 #include "otbBVUtil.h"
 
 #include "otbMachineLearningModelFactory.h"
-#include "otbNeuralNetworkMachineLearningModel.h"
-#include "otbSVMMachineLearningModel.h"
-#include "otbRandomForestsMachineLearningModel.h"
-#include "otbMultiLinearRegressionModel.h"
+#include "otbBVRegressionModels.h"
 #include "itkListSample.h"
+#include "itkImageToImageFilter.h"
+#include "itkImageScanlineConstIterator.h"
+#include "itkImageScanlineIterator.h"
 
 typedef double PrecisionType;
 typedef itk::FixedArray<PrecisionType, 1> OutputSampleType;
 typedef itk::VariableLengthVector<PrecisionType> InputSampleType;
 typedef itk::Statistics::ListSample<OutputSampleType> ListOutputSampleType;
 typedef itk::Statistics::ListSample<InputSampleType> ListInputSampleType;
-typedef otb::MachineLearningModel<PrecisionType, PrecisionType> ModelType;
+typedef otb::BV::RegressionModelType ModelType;
 typedef ModelType::Pointer ModelPointerType;
-typedef otb::NeuralNetworkMachineLearningModel<PrecisionType, 
-                                                         PrecisionType> 
-NeuralNetworkType;
-typedef otb::RandomForestsMachineLearningModel<PrecisionType, 
-                                               PrecisionType> RFRType;
-typedef otb::SVMMachineLearningModel<PrecisionType, PrecisionType> SVRType;
-typedef otb::MultiLinearRegressionModel<PrecisionType> MLRType;
 
 namespace otb
 {
@@ -88,14 +83,114 @@ private:
 
 
 };
+/** Applies mlr models to an image line by line: the normalized pixels
+    of a line are copied to a row major block, which is given to the
+    batch prediction of each model, one band per model. The estimates
+    are the ones of BVEstimationFunctor. */
+template <class TInputImage, class TOutputImage>
+class ITK_EXPORT MLRInversionImageFilter :
+    public itk::ImageToImageFilter<TInputImage, TOutputImage>
+{
+public:
+  typedef MLRInversionImageFilter Self;
+  typedef itk::ImageToImageFilter<TInputImage, TOutputImage> Superclass;
+  typedef itk::SmartPointer<Self>       Pointer;
+  typedef itk::SmartPointer<const Self> ConstPointer;
+  typedef typename Superclass::OutputImageRegionType OutputImageRegionType;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Macro defining the type*/
+  itkTypeMacro(MLRInversionImageFilter, ImageToImageFilter);
+
+  void SetModels(const std::vector<BV::MLRType::ConstPointer>& models)
+  {
+    m_Models = models;
+    this->Modified();
+  }
+
+  void SetNormalization(const BV::NormalizationVectorType& normalization)
+  {
+    m_Normalization = normalization;
+    this->Modified();
+  }
+
+protected:
+  MLRInversionImageFilter() {}
+  virtual ~MLRInversionImageFilter() {}
+
+  virtual void GenerateOutputInformation()
+  {
+    Superclass::GenerateOutputInformation();
+    this->GetOutput()->SetNumberOfComponentsPerPixel(m_Models.size());
+  }
+
+  virtual void ThreadedGenerateData(const OutputImageRegionType& 
+                                    outputRegionForThread,
+                                    itk::ThreadIdType itkNotUsed(threadId))
+  {
+    auto input = this->GetInput();
+    auto output = this->GetOutput();
+    std::size_t nbInputVariables = input->GetNumberOfComponentsPerPixel();
+    auto nbOutputVariables = m_Models.size();
+    bool normalization{!m_Normalization.empty()};
+    std::size_t lineLength = outputRegionForThread.GetSize(0);
+    std::vector<PrecisionType> x(lineLength*nbInputVariables);
+    std::vector<std::vector<PrecisionType>> y(
+      nbOutputVariables, std::vector<PrecisionType>(lineLength));
+    typename TOutputImage::PixelType pix(nbOutputVariables);
+    itk::ImageScanlineConstIterator<TInputImage> inIt(input, 
+                                                      outputRegionForThread);
+    itk::ImageScanlineIterator<TOutputImage> outIt(output, 
+                                                   outputRegionForThread);
+    while(!inIt.IsAtEnd())
+      {
+      for(std::size_t p = 0; !inIt.IsAtEndOfLine(); ++inIt, ++p)
+        {
+        const auto& in_pix = inIt.Get();
+        for(std::size_t var = 0; var < nbInputVariables; ++var)
+          {
+          PrecisionType value = in_pix[var];
+          x[p*nbInputVariables+var] = normalization ? 
+            BV::normalize(value, m_Normalization[var]) : value;
+          }
+        }
+      for(std::size_t out = 0; out < nbOutputVariables; ++out)
+        m_Models[out]->PredictBatch(x.data(), lineLength, nbInputVariables,
+                                    y[out].data());
+      for(std::size_t p = 0; !outIt.IsAtEndOfLine(); ++outIt, ++p)
+        {
+        for(std::size_t out = 0; out < nbOutputVariables; ++out)
+          pix[out] = normalization ? 
+            BV::denormalize(y[out][p], 
+                            m_Normalization[nbInputVariables+out]) :
+            y[out][p];
+        outIt.Set(pix);
+        }
+      inIt.NextLine();
+      outIt.NextLine();
+      }
+  }
+
+private:
+  MLRInversionImageFilter(const Self &); //purposely not implemented
+  void operator =(const Self&); //purposely not implemented
+
+  std::vector<BV::MLRType::ConstPointer> m_Models;
+  BV::NormalizationVectorType m_Normalization;
+};
+
+/** Estimates the output variables of the models, one band per
+    model, from the same normalized input pixel */
 template <typename InputPixelType, typename OutputPixelType>
 class BVEstimationFunctor
 {
 public:
   BVEstimationFunctor() = default;
-  BVEstimationFunctor(ModelType* model, 
+  BVEstimationFunctor(const std::vector<ModelPointerType>& models, 
                       const BV::NormalizationVectorType& normalization) : 
-    m_Model{model}, m_Normalization{normalization} {}
+    m_Models{models}, m_Normalization{normalization} {}
 
   ~BVEstimationFunctor() {};
   
@@ -104,7 +199,7 @@ public:
   {
     bool normalization{m_Normalization!=BV::NormalizationVectorType{}};
     OutputPixelType pix{};
-    pix.SetSize(1);
+    pix.SetSize(m_Models.size());
     auto nbInputVariables = in_pix.GetSize();
     InputSampleType inputValue;
     inputValue.Reserve(nbInputVariables);
@@ -114,17 +209,20 @@ public:
       if( normalization )
         inputValue[var] = BV::normalize(inputValue[var], m_Normalization[var]);
       }
-    OutputSampleType outputValue = m_Model->Predict(inputValue);
-    pix[0] = outputValue[0];
-    if( normalization )
-      pix[0] = BV::denormalize(outputValue[0],
-                               m_Normalization[nbInputVariables]);
+    for(size_t out = 0; out < m_Models.size(); ++out)
+      {
+      OutputSampleType outputValue = m_Models[out]->Predict(inputValue);
+      pix[out] = outputValue[0];
+      if( normalization )
+        pix[out] = BV::denormalize(outputValue[0],
+                                   m_Normalization[nbInputVariables+out]);
+      }
     return pix;
   }
 
   bool operator !=(const BVEstimationFunctor& other) const
   {
-    return (this->m_Model!=other.m_Model ||
+    return (this->m_Models!=other.m_Models ||
             this->m_Normalization!=other.m_Normalization);
   }
 
@@ -134,7 +232,7 @@ public:
   }
 
 protected:
-  ModelPointerType m_Model;
+  std::vector<ModelPointerType> m_Models;
   BV::NormalizationVectorType m_Normalization;
 
 };
@@ -161,6 +259,8 @@ public:
   using FilterType = UnaryFunctorImageFilterWithNBands<FloatVectorImageType,
                                                        FloatVectorImageType,
                                                        FunctorType>;
+  using MLRFilterType = MLRInversionImageFilter<FloatVectorImageType,
+                                                FloatVectorImageType>;
   
 private:
   void DoInit() override
@@ -172,15 +272,15 @@ private:
     SetParameterDescription("in","Input image.");
 
     AddParameter(ParameterType_InputFilename, "model", "File containing the regression model.");
-    SetParameterDescription( "model", "File containing the regression model.");
+    SetParameterDescription( "model", "File containing the regression model. A model of several output variables, learned with the nboutputs parameter of InverseModelLearning, estimates all of them in a single pass over the image. A model container written by BVModelContainer also gives the normalization.");
     
     AddParameter(ParameterType_OutputImage, "out", "Output Image");
-    SetParameterDescription("out","Output image.");
+    SetParameterDescription("out","Output image, with one band per output variable of the model.");
 
     AddRAMParameter();
 
     AddParameter(ParameterType_InputFilename, "normalization", "Input file containing min and max values per sample component.");
-    SetParameterDescription( "normalization", "Input file containing min and max values per sample component. This file can be produced by the invers model learning application. If no file is given as parameter, the variables are not normalized." );
+    SetParameterDescription( "normalization", "Input file containing min and max values per sample component. This file can be produced by the invers model learning application. If no file is given as parameter, the variables are normalized with the normalization of the model container, if any, or are not normalized." );
     MandatoryOff("normalization");
 
   }
@@ -203,66 +303,79 @@ private:
     otbAppLogINFO("Input image has " << nb_bands << " bands."<< std::endl);            
     auto nbInputVariables = nb_bands;
 
-    BV::NormalizationVectorType var_minmax{};
+    // the header of a container gives the type of its models and their
+    // normalization without loading them
+    std::string model_type;
+    BV::ModelContainer container;
+    auto isContainer = BV::read_model_container(GetParameterString("model"),
+                                                container);
+    if(isContainer)
+      {
+      otbAppLogINFO("Model container of "
+                    << BV::describe_model_container(container) << std::endl);
+      if(!container.bands.empty() &&
+         container.bands.size() != nbInputVariables)
+        itkGenericExceptionMacro(<< "The models of " << container.filename
+                                 << " have " << container.bands.size()
+                                 << " input variables, not "
+                                 << nbInputVariables << ".");
+      }
+    auto regressors = isContainer ? BV::LoadContainerModels(container) :
+      BV::LoadRegressionModels(GetParameterString("model"), model_type);
+    if(isContainer) model_type = container.type;
+    auto nbOutputVariables = regressors.size();
+    otbAppLogINFO("Applying " << model_type << " regression of " 
+                  << nbOutputVariables << " output variables ..." << std::endl);
+
+    // a normalization file overrides the normalization of the container
+    auto var_minmax = container.normalization;
     if( HasValue( "normalization" )==true )
+      var_minmax = BV::read_normalization_file(GetParameterString("normalization"));
+    if(!var_minmax.empty())
       {
       otbAppLogINFO("Variable normalization."<< std::endl);            
-      var_minmax = BV::read_normalization_file(GetParameterString("normalization"));
-      if(var_minmax.size()!=nbInputVariables+1)
+      if(var_minmax.size()!=nbInputVariables+nbOutputVariables)
         itkGenericExceptionMacro(<< "Normalization file ("<< var_minmax.size() 
-                                 << " - 1) is not coherent with the number of "
+                                 << " - " << nbOutputVariables 
+                                 << ") is not coherent with the number of "
                                  << "input variables ("<< nbInputVariables 
                                  <<").");
       for(size_t var = 0; var < nbInputVariables; ++var)
         otbAppLogINFO("Variable "<< var+1 << " min=" << var_minmax[var].first <<
                       " max=" << var_minmax[var].second <<std::endl);
-      otbAppLogINFO("Output min=" << var_minmax[nbInputVariables].first <<
-                    " max=" << var_minmax[nbInputVariables].second 
-                    << std::endl)
+      for(size_t out = 0; out < nbOutputVariables; ++out)
+        otbAppLogINFO("Output " << out+1 << " min=" 
+                      << var_minmax[nbInputVariables+out].first <<
+                      " max=" << var_minmax[nbInputVariables+out].second 
+                      << std::endl);
         }
-    auto model_file = GetParameterString("model");
-    ModelType* regressor;
-    auto nn_regressor = NeuralNetworkType::New();
-    auto svr_regressor = SVRType::New();
-    auto rfr_regressor = RFRType::New();
-    auto mlr_regressor = MLRType::New();
-    if(nn_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(nn_regressor.GetPointer());
-      otbAppLogINFO("Applying NN regression ..." << std::endl);
-      }
-    else if(svr_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(svr_regressor.GetPointer());
-      otbAppLogINFO("Applying SVR regression ..." << std::endl);
-      }
-    else if(rfr_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(rfr_regressor.GetPointer());
-      otbAppLogINFO("Applying RF regression ..." << std::endl);
-      }
-    else if(mlr_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(mlr_regressor.GetPointer());
-      otbAppLogINFO("Applying MLR regression ..." << std::endl);
-      }
-    else
+
+    // the mlr models estimate the pixels of a line at once
+    std::vector<BV::MLRType::ConstPointer> mlrModels;
+    for(const auto& regressor : regressors)
+      mlrModels.push_back(
+        dynamic_cast<const BV::MLRType*>(regressor.GetPointer()));
+    if(std::find(mlrModels.begin(), mlrModels.end(), nullptr) ==
+       mlrModels.end())
       {
-      itkGenericExceptionMacro(<< "Model in file " << model_file 
-                               << " is not valid.\n");
+      mlr_filter = MLRFilterType::New();
+      mlr_filter->SetModels(mlrModels);
+      mlr_filter->SetNormalization(var_minmax);
+      mlr_filter->SetInput(input_image);
+      SetParameterOutputImage("out", mlr_filter->GetOutput());
+      return;
       }
-    regressor->Load(model_file);    
-    regressor->SetRegressionMode(true);
 
     //instantiate a functor with the regressor and pass it to the
     //unary functor image filter pass also the normalization values
     bv_filter = FilterType::New();
-    bv_filter->SetFunctor(FunctorType(regressor,var_minmax));
+    bv_filter->SetFunctor(FunctorType(regressors,var_minmax));
     bv_filter->SetInput(input_image);
-    bv_filter->SetNumberOfOutputBands(1);
+    bv_filter->SetNumberOfOutputBands(nbOutputVariables);
     SetParameterOutputImage("out", bv_filter->GetOutput());
   }
   FilterType::Pointer bv_filter;
+  MLRFilterType::Pointer mlr_filter;
 };
 
 }
@@ -16,6 +16,9 @@
 #include "otbBVUtil.h"
 #include <random>
 #include <fstream>
+#include <cstdio>
+#include <thread>
+#include <future>
 
 namespace otb
 {
@@ -72,49 +75,71 @@ namespace Wrapper
     SetDefaultParameterFloat("stdala", 20.0);
     SetParameterDescription("stdala", "Standard deviation value for ALA");
 
+    AddParameter(ParameterType_Int, "seed", "Seed for the random generation");
+    SetParameterDescription("seed", "Seed for the random generation. A sample only depends on the seed and on its index, so that runs with the same seed give the same samples. If no seed is given, a random one is used.");
+    MandatoryOff("seed");
+
+    AddParameter(ParameterType_String, "shard", 
+                 "Generate only one shard of the samples (i/n)");
+    SetParameterDescription("shard", "Split the samples into n contiguous shards and only generate shard i (0 <= i < n). The seed is mandatory. Every shard file has a header line and the shards can be merged with the ShardMerge application.");
+    MandatoryOff("shard");
+
+    AddParameter(ParameterType_Int, "threads", 
+                 "Number of parallel threads for the generation");
+    SetParameterDescription("threads", 
+                            "Number of parallel threads for the generation. The output does not depend on the number of threads.");
+    MandatoryOff("threads");
+
+    AddParameter(ParameterType_String, "sampling", 
+                 "Sampling scheme [random(default)|lhs|sobol]");
+    SetParameterDescription("sampling", "Sampling scheme of the variables. random draws independent samples. lhs draws a Latin hypercube: each of the samples intervals of equal probability of every variable holds exactly one sample. sobol uses a randomly shifted Sobol sequence, whose first 2^k points are evenly spread over the variable space. The stratified schemes cover the space better than random sampling for the same sample size. With lhs, the stratification is over the whole sample set, including all its shards.");
+    MandatoryOff("sampling");
+
   }
 
   
-///Builds the map with the values of the sample
-otb::BV::SampleType BVInputVariableGeneration::DrawSample()
+///Draws the uniform values of the sample: independent values for the
+///random sampling, or coordinates of a point of a Latin hypercube or of
+///a Sobol sequence over all the samples
+BVInputVariableGeneration::UniformsType 
+BVInputVariableGeneration::DrawUniforms(std::uint64_t sampleIndex, 
+                                        std::uint64_t seed, 
+                                        std::size_t nbSamples) const
 {
   using namespace otb::BV;
-  SampleType s;
-  s[IVNames::MLAI] = Rng(m_MLAI, m_RNG);
-  s[IVNames::ALA] = CorrelateValue(Rng(m_ALA, m_RNG), 
-                                   s[IVNames::MLAI], m_ALA, m_MLAI);
-  s[IVNames::CrownCover] = CorrelateValue(Rng(m_CrownCover, m_RNG), 
-                                          s[IVNames::MLAI], m_CrownCover, m_MLAI);
-  s[IVNames::HsD] = CorrelateValue(Rng(m_HsD, m_RNG), 
-                                   s[IVNames::MLAI], m_HsD, m_MLAI);
-  s[IVNames::N] = CorrelateValue(Rng(m_N, m_RNG), 
-                                 s[IVNames::MLAI], m_N, m_MLAI);
-  s[IVNames::Cab] = CorrelateValue(Rng(m_Cab, m_RNG), 
-                                   s[IVNames::MLAI], m_Cab, m_MLAI);
-  // We don't use the Car distribution to match INRA's approach and set it to Cab/4
-  (void)m_Car; // ugly way of removing unused var warning
-  s[IVNames::Car] = s[IVNames::Cab]*0.25; 
-  s[IVNames::Cdm] = CorrelateValue(Rng(m_Cdm, m_RNG), 
-                                   s[IVNames::MLAI], m_Cdm, m_MLAI);
-  s[IVNames::CwRel] = CorrelateValue(Rng(m_CwRel, m_RNG), 
-                                     s[IVNames::MLAI], m_CwRel, m_MLAI);
-  s[IVNames::Cbp] = CorrelateValue(Rng(m_Cbp, m_RNG), 
-                                   s[IVNames::MLAI], m_Cbp, m_MLAI);
-  s[IVNames::Bs] = CorrelateValue(Rng(m_Bs,m_RNG), 
-                                  s[IVNames::MLAI], m_Bs, m_MLAI);
-
-  return s;
+  UniformsType u;
+  switch(m_Sampling)
+    {
+    case SamplingType::LHS:
+      for(unsigned int dim = 0; dim < NbDrawnVariables; ++dim)
+        u[dim] = lhs_value(sampleIndex, nbSamples, dim, seed);
+      break;
+    case SamplingType::SOBOL:
+      for(unsigned int dim = 0; dim < NbDrawnVariables; ++dim)
+        u[dim] = m_Sobol->Get(sampleIndex, dim);
+      break;
+    default:
+      {
+      // the stream of a sample only depends on the seed and its index
+      PhiloxRNG rng(seed, sampleIndex);
+      for(auto& v : u)
+        v = uniform_01(rng);
+      }
+    }
+  return u;
 }
 
-void BVInputVariableGeneration::WriteSample(otb::BV::SampleType s)
+void BVInputVariableGeneration::WriteSample(const otb::BV::SampleType& s, 
+                                            std::string& buffer) const
 {
-  auto si = s.begin();
-  while( si != s.end())
+  // same format as std::setw(12) << std::left with a precision of 4
+  char field[32];
+  for(const auto& v : s)
     {
-    m_SampleFile << std::setw(12) << std::left << (*si).second ;
-    ++si;
+    auto length = std::snprintf(field, sizeof(field), "%-12.4g", v.second);
+    buffer.append(field, length);
     }
-  m_SampleFile << std::endl;
+  buffer += '\n';
 }
 
 void BVInputVariableGeneration::DoExecute()
@@ -126,19 +151,19 @@ void BVInputVariableGeneration::DoExecute()
      
   */
 
-  m_MLAI.min = GetParameterFloat("minlai");
-  m_MLAI.max = GetParameterFloat("maxlai");
-  m_MLAI.mod = GetParameterFloat("modlai");
-  m_MLAI.std = GetParameterFloat("stdlai");
+  m_Distributions.MLAI.min = GetParameterFloat("minlai");
+  m_Distributions.MLAI.max = GetParameterFloat("maxlai");
+  m_Distributions.MLAI.mod = GetParameterFloat("modlai");
+  m_Distributions.MLAI.std = GetParameterFloat("stdlai");
 
   if(IsParameterEnabled("distlai"))
     {
     if( GetParameterString("distlai") == "normal" )
       {
-      m_MLAI.dist = otb::BV::DistType::GAUSSIAN;
+      m_Distributions.MLAI.dist = otb::BV::DistType::GAUSSIAN;
       }
     }
-  if( m_MLAI.dist == otb::BV::DistType::GAUSSIAN)
+  if( m_Distributions.MLAI.dist == otb::BV::DistType::GAUSSIAN)
     {
     otbAppLogINFO("LAI distribution is normal\n");
     }
@@ -147,10 +172,48 @@ void BVInputVariableGeneration::DoExecute()
     otbAppLogINFO("LAI distribution is lognormal\n");
     }
 
-  m_ALA.min = GetParameterFloat("minala");
-  m_ALA.max = GetParameterFloat("maxala");
-  m_ALA.mod = GetParameterFloat("modala");
-  m_ALA.std = GetParameterFloat("stdala");
+  m_Distributions.ALA.min = GetParameterFloat("minala");
+  m_Distributions.ALA.max = GetParameterFloat("maxala");
+  m_Distributions.ALA.mod = GetParameterFloat("modala");
+  m_Distributions.ALA.std = GetParameterFloat("stdala");
+
+  auto maxSamples = static_cast<std::size_t>(GetParameterInt("samples"));
+  std::pair<std::size_t, std::size_t> range{0, maxSamples};
+  if(IsParameterEnabled("shard"))
+    {
+    if(!IsParameterEnabled("seed"))
+      {
+      itkGenericExceptionMacro(<< "A seed is needed for generating shards.");
+      }
+    auto shard = otb::BV::parse_shard(GetParameterString("shard"));
+    range = otb::BV::shard_range(maxSamples, shard.first, shard.second);
+    otbAppLogINFO("Shard " << shard.first << "/" << shard.second 
+                  << ": samples " << range.first << " to " 
+                  << range.second << std::endl);
+    }
+  std::uint64_t seed = IsParameterEnabled("seed") ? 
+    static_cast<std::uint64_t>(GetParameterInt("seed")) : 
+    std::random_device{}();
+  otbAppLogINFO("Seed is " << seed << std::endl);
+
+  std::string sampling{"random"};
+  if(IsParameterEnabled("sampling"))
+    sampling = GetParameterString("sampling");
+  if(sampling == "random")
+    m_Sampling = otb::BV::SamplingType::RANDOM;
+  else if(sampling == "lhs")
+    m_Sampling = otb::BV::SamplingType::LHS;
+  else if(sampling == "sobol")
+    {
+    m_Sampling = otb::BV::SamplingType::SOBOL;
+    m_Sobol.reset(new otb::BV::SobolSequence(NbDrawnVariables, seed));
+    }
+  else
+    {
+    itkGenericExceptionMacro(<< "Unknown sampling scheme " << sampling 
+                             << ". Available schemes are random, lhs and sobol.");
+    }
+  otbAppLogINFO("Sampling scheme is " << sampling << std::endl);
 
   try
     {
@@ -174,22 +237,72 @@ void BVInputVariableGeneration::DoExecute()
   m_SampleFile << std::setw(12) << std::left    << "Cbp";
   m_SampleFile << std::setw(12) << std::left    << "Bs" << std::endl;
     
-  auto maxSamples = GetParameterInt("samples");
-  auto sampleCount = 0;
+  std::uintmax_t bytes = m_SampleFile.tellp();
 
-  m_RNG = std::mt19937(std::random_device{}());
+  auto num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  if(IsParameterEnabled("threads") && GetParameterInt("threads") > 0 &&
+     static_cast<unsigned int>(GetParameterInt("threads")) < num_threads)
+    num_threads = GetParameterInt("threads");
+  otbAppLogINFO("Generating BV samples using " << num_threads << " threads." 
+                << std::endl);
 
-  otbAppLogINFO("Generating BV samples" << std::endl);
-  while(sampleCount < maxSamples)
-      {
-      this->WriteSample( this->DrawSample() );
-      ++sampleCount;
-      }
-    m_SampleFile.close();
+  // Each chunk is split into pieces which are drawn and formatted in
+  // parallel, and then written in order while the next chunk is drawn
+  const std::size_t nb_pieces{4*num_threads};
+  const std::size_t chunk_size{16384*num_threads};
+  std::vector<std::string> pieces(nb_pieces);
+  std::vector<std::string> written_pieces(nb_pieces);
+  std::future<void> writing;
+  for(auto chunk_first = range.first; chunk_first < range.second; 
+      chunk_first += chunk_size)
+    {
+    auto chunk_last = std::min(chunk_first+chunk_size, range.second);
+    auto n = chunk_last-chunk_first;
+    otb::parallel_for_blocks(0, nb_pieces, num_threads, 
+                             [&](std::size_t first, std::size_t last){
+      for(auto piece = first; piece < last; ++piece)
+        {
+        pieces[piece].clear();
+        for(auto sampleIndex = chunk_first+(n*piece)/nb_pieces; 
+            sampleIndex < chunk_first+(n*(piece+1))/nb_pieces; ++sampleIndex)
+          {
+          auto u = this->DrawUniforms(sampleIndex, seed, maxSamples);
+          this->WriteSample(otb::BV::DrawSample(m_Distributions, u), 
+                            pieces[piece]);
+          }
+        }
+      });
+    if(writing.valid()) writing.get();
+    std::swap(pieces, written_pieces);
+    for(const auto& piece : written_pieces)
+      bytes += piece.size();
+    writing = std::async(std::launch::async, [&](){
+        for(const auto& piece : written_pieces)
+          m_SampleFile.write(piece.data(), piece.size());
+      });
+    }
+  if(writing.valid()) writing.get();
+  m_SampleFile.close();
+  if(!m_SampleFile)
+    {
+    itkGenericExceptionMacro(<< "Could not write file " << GetParameterString("out"));
+    }
 
-    otbAppLogINFO("" << sampleCount << " samples generated and saved in "
-                  << GetParameterString("out") << std::endl);
-  }
+  std::stringstream parameters;
+  const auto& lai = m_Distributions.MLAI;
+  const auto& ala = m_Distributions.ALA;
+  parameters << lai.min << " " << lai.max << " " << lai.mod << " "
+             << lai.std << " " << static_cast<int>(lai.dist) << " "
+             << ala.min << " " << ala.max << " " << ala.mod << " "
+             << ala.std << " " << sampling;
+  auto sampleCount = range.second-range.first;
+  otb::BV::write_manifest({range.first, range.second, maxSamples, sampleCount, 
+        bytes, seed, true, true, parameters.str()},
+    GetParameterString("out")+".progress");
+
+  otbAppLogINFO("" << sampleCount << " samples generated and saved in "
+                << GetParameterString("out") << std::endl);
+}
 
 }//namespace Wrapper
 }//namespace otb
@@ -19,14 +19,13 @@
 #include <fstream>
 #include <string>
 #include <memory>
+#include <thread>
+#include <algorithm>
 
 #include "otbBVUtil.h"
 
 #include "otbMachineLearningModelFactory.h"
-#include "otbNeuralNetworkMachineLearningModel.h"
-#include "otbSVMMachineLearningModel.h"
-#include "otbRandomForestsMachineLearningModel.h"
-#include "otbMultiLinearRegressionModel.h"
+#include "otbBVRegressionModels.h"
 #include "itkListSample.h"
 
 namespace otb
@@ -52,14 +51,7 @@ public:
   typedef itk::VariableLengthVector<PrecisionType> InputSampleType;
   typedef itk::Statistics::ListSample<OutputSampleType> ListOutputSampleType;
   typedef itk::Statistics::ListSample<InputSampleType> ListInputSampleType;
-  typedef MachineLearningModel<PrecisionType, PrecisionType> ModelType;
-  typedef otb::NeuralNetworkMachineLearningModel<PrecisionType, 
-                                                          PrecisionType> 
-  NeuralNetworkType;
-  typedef otb::RandomForestsMachineLearningModel<PrecisionType, 
-                                                 PrecisionType> RFRType;
-  typedef otb::SVMMachineLearningModel<PrecisionType, PrecisionType> SVRType;
-  typedef otb::MultiLinearRegressionModel<PrecisionType> MLRType;
+  typedef otb::BV::RegressionModelType ModelType;
   
 private:
   void DoInit() override
@@ -72,15 +64,15 @@ private:
     MandatoryOn("reflectances");
 
     AddParameter(ParameterType_InputFilename, "model", "File containing the regression model.");
-    SetParameterDescription( "model", "File containing the regression model.");
+    SetParameterDescription( "model", "File containing the regression model. A model of several output variables, learned with the nboutputs parameter of InverseModelLearning, estimates all of them from each sample. A model container written by BVModelContainer also gives the normalization.");
     MandatoryOn("model");
     
     AddParameter(ParameterType_OutputFilename, "out", "Output estimated variable.");
-    SetParameterDescription( "out", "Filename where the estimated variables will be saved." );
+    SetParameterDescription( "out", "Filename where the estimated variables will be saved. A line contains the estimates of the output variables of the model for a sample." );
     MandatoryOn("out");
 
     AddParameter(ParameterType_InputFilename, "normalization", "Input file containing min and max values per sample component.");
-    SetParameterDescription( "normalization", "Input file containing min and max values per sample component. This file can be produced by the invers model learning application. If no file is given as parameter, the variables are not normalized." );
+    SetParameterDescription( "normalization", "Input file containing min and max values per sample component. This file can be produced by the invers model learning application. If no file is given as parameter, the variables are normalized with the normalization of the model container, if any, or are not normalized." );
     MandatoryOff("normalization");
   }
 
@@ -99,16 +91,9 @@ private:
   {
    
     auto reflectancesFileName = GetParameterString("reflectances");
-    std::ifstream reflectancesFile;
-    try
-      {
-      reflectancesFile.open(reflectancesFileName.c_str());
-      }
-    catch(...)
-      {
-      itkGenericExceptionMacro(<< "Could not open file " 
-                               << reflectancesFileName);
-      }
+    std::size_t nbThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    auto reflectances = otb::read_text_table(reflectancesFileName, 0, false, 
+                                             nbThreads);
 
 
     auto outFileName = GetParameterString("out");
@@ -122,86 +107,107 @@ private:
       itkGenericExceptionMacro(<< "Could not open file " << outFileName);
       }
 
-    size_t nbInputVariables = countColumns(reflectancesFileName);
+    size_t nbInputVariables = reflectances.nbColumns;
     otbAppLogINFO("Found " << nbInputVariables << " input variables in "
                   << reflectancesFileName << std::endl);
 
-    otb::BV::NormalizationVectorType var_minmax;
+    // the header of a container gives the type of its models and their
+    // normalization without loading them
+    std::string model_type;
+    otb::BV::ModelContainer container;
+    auto isContainer = otb::BV::read_model_container(
+      GetParameterString("model"), container);
+    if(isContainer)
+      {
+      otbAppLogINFO("Model container of "
+                    << otb::BV::describe_model_container(container)
+                    << std::endl);
+      if(!container.bands.empty() &&
+         container.bands.size() != nbInputVariables)
+        itkGenericExceptionMacro(<< "The models of " << container.filename
+                                 << " have " << container.bands.size()
+                                 << " input variables, not "
+                                 << nbInputVariables << ".");
+      }
+    auto regressors = isContainer ? otb::BV::LoadContainerModels(container) :
+      otb::BV::LoadRegressionModels(GetParameterString("model"), model_type);
+    if(isContainer) model_type = container.type;
+    auto nbOutputVariables = regressors.size();
+    otbAppLogINFO("Applying " << model_type << " regression of " 
+                  << nbOutputVariables << " output variables ..." << std::endl);
+
+    // a normalization file overrides the normalization of the container
+    auto var_minmax = container.normalization;
     if( HasValue( "normalization" )==true )
+      var_minmax = otb::BV::read_normalization_file(GetParameterString("normalization"));
+    if(!var_minmax.empty())
       {
       otbAppLogINFO("Variable normalization."<< std::endl);            
-      var_minmax = otb::BV::read_normalization_file(GetParameterString("normalization"));
-      if(var_minmax.size()!=nbInputVariables+1)
+      if(var_minmax.size()!=nbInputVariables+nbOutputVariables)
         itkGenericExceptionMacro(<< "Normalization file ("<< var_minmax.size() 
-                                 << " - 1) is not coherent with the number of "
+                                 << " - " << nbOutputVariables 
+                                 << ") is not coherent with the number of "
                                  << "input variables ("<< nbInputVariables 
                                  <<").");
       for(size_t var = 0; var < nbInputVariables; ++var)
         otbAppLogINFO("Variable "<< var+1 << " min=" << var_minmax[var].first <<
                       " max=" << var_minmax[var].second <<std::endl);
-      otbAppLogINFO("Output min=" << var_minmax[nbInputVariables].first <<
-                    " max=" << var_minmax[nbInputVariables].second 
-                    << std::endl)
+      for(size_t out = 0; out < nbOutputVariables; ++out)
+        otbAppLogINFO("Output " << out+1 << " min=" 
+                      << var_minmax[nbInputVariables+out].first <<
+                      " max=" << var_minmax[nbInputVariables+out].second 
+                      << std::endl);
+      // the reflectances are normalized in place, in the layout of the
+      // samples given to the model
+      otb::BV::normalize_rows(reflectances.values.data(), reflectances.Rows(),
+                              nbInputVariables, var_minmax, nbThreads);
         }
-    auto model_file = GetParameterString("model");
-    ModelType* regressor;
-    auto nn_regressor = NeuralNetworkType::New();
-    auto svr_regressor = SVRType::New();
-    auto rfr_regressor = RFRType::New();
-    auto mlr_regressor = MLRType::New();
-    if(nn_regressor->CanReadFile(model_file))
-      {
-      otbAppLogINFO("Loading model ..." << std::endl);
-      regressor = dynamic_cast<ModelType*>(nn_regressor.GetPointer());
-      otbAppLogINFO("Applying NN regression ..." << std::endl);
-      }
-    else if(svr_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(svr_regressor.GetPointer());
-      otbAppLogINFO("Applying SVR regression ..." << std::endl);
-      }
-    else if(rfr_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(rfr_regressor.GetPointer());
-      otbAppLogINFO("Applying RF regression ..." << std::endl);
-      }
-    else if(mlr_regressor->CanReadFile(model_file))
-      {
-      regressor = dynamic_cast<ModelType*>(mlr_regressor.GetPointer());
-      otbAppLogINFO("Applying MLR regression ..." << std::endl);
-      }
-    else
+
+    // the mlr models estimate all the samples of the table at once, by
+    // blocks of rows shared by the threads
+    auto sampleCount = reflectances.Rows();
+    std::vector<const otb::BV::MLRType*> mlrModels;
+    for(const auto& regressor : regressors)
+      mlrModels.push_back(
+        dynamic_cast<const otb::BV::MLRType*>(regressor.GetPointer()));
+    bool batch = std::find(mlrModels.begin(), mlrModels.end(), nullptr) == 
+      mlrModels.end();
+    std::vector<std::vector<PrecisionType>> estimates;
+    if(batch)
       {
-      itkGenericExceptionMacro(<< "Model in file " << model_file 
-                               << " is not valid.\n");
+      estimates.assign(nbOutputVariables, 
+                       std::vector<PrecisionType>(sampleCount));
+      otb::parallel_for_blocks(0, sampleCount, nbThreads,
+                               [&](std::size_t first, std::size_t last){
+        for(std::size_t out = 0; out < nbOutputVariables; ++out)
+          mlrModels[out]->PredictBatch(reflectances.Row(first), last-first,
+                                       nbInputVariables, 
+                                       estimates[out].data()+first);
+        });
       }
-    regressor->Load(model_file);    
-    regressor->SetRegressionMode(true);
-
 
-    auto sampleCount = 0;
-    for(std::string line; std::getline(reflectancesFile, line); )
+    // all the output variables of a sample are estimated from the same
+    // input sample
+    InputSampleType inputValue;
+    for(std::size_t sample = 0; sample < sampleCount; ++sample)
       {
-      if(line.size() > 1)
+      if(!batch)
+        {
+        // the sample points to the row of the table
+        inputValue.SetData(reflectances.Row(sample), 
+                           static_cast<unsigned int>(nbInputVariables), false);
+        }
+      for(std::size_t out = 0; out < nbOutputVariables; ++out)
         {
-        std::istringstream ss(line);
-        InputSampleType inputValue;
-        inputValue.Reserve(nbInputVariables);
-        for(size_t var = 0; var < nbInputVariables; ++var)
-          {
-          ss >> inputValue[var];
-          if( HasValue( "normalization" )==true )
-            inputValue[var] = otb::BV::normalize(inputValue[var], var_minmax[var]);
-          }
-        OutputSampleType outputValue = regressor->Predict(inputValue);
-        if( HasValue( "normalization" )==true )
-          outputValue[0] = otb::BV::denormalize(outputValue[0],
-                                                var_minmax[nbInputVariables]);
-        outFile << outputValue[0] << std::endl;
-        ++sampleCount;
+        auto estimate = batch ? estimates[out][sample] :
+          regressors[out]->Predict(inputValue)[0];
+        if(!var_minmax.empty())
+          estimate = otb::BV::denormalize(estimate, 
+                                          var_minmax[nbInputVariables+out]);
+        outFile << (out ? " " : "") << estimate;
         }
+      outFile << '\n';
       }
-    reflectancesFile.close();
     outFile.close();
     otbAppLogINFO("" << sampleCount << " samples processed. Results saved in "
                   << outFileName << std::endl);
@@ -0,0 +1,156 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+
+#include <string>
+#include <vector>
+
+#include "otbBVUtil.h"
+#include "otbBVRegressionModels.h"
+
+namespace otb
+{
+namespace Wrapper
+{
+
+class BVModelContainer : public Application
+{
+public:
+/** Standard class typedefs. */
+  typedef BVModelContainer     Self;
+  typedef Application                   Superclass;
+
+/** Standard macro */
+  itkNewMacro(Self);
+
+  itkTypeMacro(BVModelContainer, otb::Application);
+
+private:
+  void DoInit() override
+  {
+    SetName("BVModelContainer");
+    SetDescription("Pack a regression model, its normalization and the description of its inputs and outputs into a single model container.");
+
+    AddParameter(ParameterType_InputFilename, "model", "Regression model");
+    SetParameterDescription("model", "Model of any type (nn, svr, rfr, mlr, mlp), or list of models of several output variables, learned by InverseModelLearning.");
+    MandatoryOn("model");
+
+    AddParameter(ParameterType_InputFilename, "normalization",
+                 "Normalization file of the model");
+    SetParameterDescription("normalization", "Min and max values of the input and output variables written with the model. The inversion applications use it when they are not given another normalization file.");
+    MandatoryOff("normalization");
+
+    AddParameter(ParameterType_StringList, "targets", "Output variables");
+    SetParameterDescription("targets", "Name of each output variable of the model (lai, fcover, etc.), in the order of the outputs.");
+    MandatoryOff("targets");
+
+    AddParameter(ParameterType_StringList, "bands", "Input variables");
+    SetParameterDescription("bands", "Name of each input variable of the model (the bands of the sensor and the indices, if any), in the order of the training. The inversion applications check that the number of bands of their input is the number of names.");
+    MandatoryOff("bands");
+
+    AddParameter(ParameterType_String, "sensor", "Sensor");
+    SetParameterDescription("sensor", "Sensor of the simulations, for instance the name of the relative spectral response file.");
+    MandatoryOff("sensor");
+
+    AddParameter(ParameterType_Float, "solarzenith", "Solar zenith angle");
+    SetParameterDescription("solarzenith", "Solar zenith angle of the simulations. The geometry is recorded when the three angles are given.");
+    MandatoryOff("solarzenith");
+    AddParameter(ParameterType_Float, "sensorzenith", "Sensor zenith angle");
+    SetParameterDescription("sensorzenith", "Sensor zenith angle of the simulations.");
+    MandatoryOff("sensorzenith");
+    AddParameter(ParameterType_Float, "azimuth", "Relative azimuth");
+    SetParameterDescription("azimuth", "Relative azimuth angle of the simulations.");
+    MandatoryOff("azimuth");
+
+    AddParameter(ParameterType_OutputFilename, "out", "Output model container");
+    SetParameterDescription("out", "Filename of the container, which can be given as the model of BVInversion and BVImageInversion without a normalization file.");
+    MandatoryOn("out");
+  }
+
+  virtual ~BVModelContainer() override
+  {
+  }
+
+  void DoUpdateParameters() override
+  {
+    // Nothing to do here : all parameters are independent
+  }
+
+  void DoExecute() override
+  {
+    using namespace otb::BV;
+    auto modelFileName = GetParameterString("model");
+    ModelContainer container;
+    if(read_model_container(modelFileName, container))
+      {
+      itkGenericExceptionMacro(<< modelFileName
+                               << " is already a model container.");
+      }
+    // the models are loaded to check them and to find their type
+    auto regressors = LoadRegressionModels(modelFileName, container.type);
+    auto modelFileNames = read_model_list(modelFileName);
+    if(modelFileNames.empty())
+      modelFileNames.push_back(modelFileName);
+    auto nbOutputVariables = regressors.size();
+
+    if(IsParameterEnabled("targets"))
+      container.targets = GetParameterStringList("targets");
+    if(IsParameterEnabled("bands"))
+      container.bands = GetParameterStringList("bands");
+    if(IsParameterEnabled("sensor"))
+      container.sensor = GetParameterString("sensor");
+    auto nbAngles = 0;
+    for(const auto& angle : {"solarzenith", "sensorzenith", "azimuth"})
+      if(IsParameterEnabled(angle))
+        ++nbAngles;
+    if(nbAngles == 3)
+      container.geometry = {GetParameterFloat("solarzenith"),
+                            GetParameterFloat("sensorzenith"),
+                            GetParameterFloat("azimuth")};
+    else if(nbAngles > 0)
+      {
+      itkGenericExceptionMacro(<< "The geometry needs the solar zenith, "
+                               << "sensor zenith and azimuth angles.");
+      }
+    if(HasValue("normalization"))
+      {
+      container.normalization =
+        read_normalization_file(GetParameterString("normalization"));
+      if(container.normalization.size() <= nbOutputVariables)
+        {
+        itkGenericExceptionMacro(<< "Normalization file ("
+                                 << container.normalization.size()
+                                 << ") is not coherent with the number of "
+                                 << "output variables ("
+                                 << nbOutputVariables << ").");
+        }
+      }
+
+    auto outFileName = GetParameterString("out");
+    write_model_container(container, modelFileNames, nbOutputVariables,
+                          outFileName);
+    otbAppLogINFO("Container of " << nbOutputVariables << " " << container.type
+                  << " models written to " << outFileName
+                  << (container.normalization.empty() ?
+                      " without normalization" : " with its normalization")
+                  << std::endl);
+  }
+};
+
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::BVModelContainer)
@@ -0,0 +1,397 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "otbBVUtil.h"
+#include "otbBVTypes.h"
+#include "otbPhiloxRNG.h"
+#include "otbBVSampling.h"
+#include "otbBVSampleStore.h"
+#include "otbBVRegressionModels.h"
+
+namespace otb
+{
+namespace Wrapper
+{
+
+class BVModelDistillation : public Application
+{
+public:
+/** Standard class typedefs. */
+  typedef BVModelDistillation     Self;
+  typedef Application                   Superclass;
+
+/** Standard macro */
+  itkNewMacro(Self);
+
+  itkTypeMacro(BVModelDistillation, otb::Application);
+
+  using PrecisionType = otb::BV::PrecisionType;
+  typedef itk::VariableLengthVector<PrecisionType> InputSampleType;
+  using MLPType = otb::BV::MLPType;
+
+private:
+  void DoInit() override
+  {
+    SetName("BVModelDistillation");
+    SetDescription("Distill a regression model into a small multilayer perceptron which mimics it.");
+
+    AddParameter(ParameterType_InputFilename, "model",
+                 "Regression model to distill");
+    SetParameterDescription("model", "Regression model of any type (nn, svr, rfr, mlr, mlp), or list of models of several output variables, learned by InverseModelLearning. Its estimates are the targets of the mlp.");
+    MandatoryOn("model");
+
+    AddParameter(ParameterType_InputFilename, "normalization",
+                 "Normalization file of the model");
+    SetParameterDescription("normalization", "Normalization file of the model, as for BVInversion. The mlp is learned in the same normalized variables, so that this file is also the one of the mlp.");
+    MandatoryOff("normalization");
+
+    AddParameter(ParameterType_InputFilename, "in",
+                 "Input file containing the samples to label");
+    SetParameterDescription("in", "ASCII file where each line is a sample, whose input variables are in the order used for the training of the model: the training file of the model, simulations or reflectances to invert. They are labeled with the estimates of the model.");
+    MandatoryOn("in");
+
+    AddParameter(ParameterType_Int, "skip",
+                 "Number of leading fields which are not input variables");
+    SetParameterDescription("skip", "Number of fields at the beginning of a line of the input file which are not input variables, for instance the output variables of a training file.");
+    SetDefaultParameterInt("skip", 0);
+    MandatoryOff("skip");
+
+    AddParameter(ParameterType_Int, "synthetic",
+                 "Number of synthetic samples added to the input ones");
+    SetParameterDescription("synthetic", "Number of synthetic samples labeled by the model in addition to the input ones. A synthetic sample is an input sample drawn at random whose input variables are moved by a gaussian noise, so that the mlp also learns the model around the input samples.");
+    SetDefaultParameterInt("synthetic", 0);
+    MandatoryOff("synthetic");
+
+    AddParameter(ParameterType_Float, "jitter",
+                 "Noise of the synthetic samples");
+    SetParameterDescription("jitter", "Standard deviation of the noise of the synthetic samples, as a fraction of the standard deviation of each input variable over the input samples.");
+    SetDefaultParameterFloat("jitter", 0.1);
+    MandatoryOff("jitter");
+
+    AddParameter(ParameterType_Int, "hidden",
+                 "Number of neurons of the hidden layer of the mlp");
+    SetParameterDescription("hidden", "Number of neurons of the single hidden layer of the mlp. The default gives the per sample cost of the nn regression.");
+    SetDefaultParameterInt("hidden", 5);
+    MandatoryOff("hidden");
+
+    AddParameter(ParameterType_String, "mlpmethod",
+                 "Training method of the mlp (adam, lbfgs)");
+    SetParameterDescription("mlpmethod", "adam (the default) uses mini-batches and suits large sets of labeled samples. lbfgs uses the gradient of all the samples at each iteration.");
+    MandatoryOff("mlpmethod");
+
+    AddParameter(ParameterType_OutputFilename, "out", "Output mlp model");
+    SetParameterDescription("out", "Filename where the mlp is saved. With several output variables, a mlp is learned for each of them and out is the list of these models, which are saved next to it as out_1, out_2, etc.");
+    MandatoryOn("out");
+
+    AddParameter(ParameterType_Int, "threads",
+                 "Number of parallel threads");
+    SetParameterDescription("threads", "Number of threads of the labeling, of the gradients of the mlp and of the fidelity estimation. The default is the number of cores.");
+    MandatoryOff("threads");
+
+    AddParameter(ParameterType_Int, "seed", "Seed of the random draws");
+    SetParameterDescription("seed", "Seed of the synthetic samples, of the samples kept for the fidelity and of the mlp.");
+    SetDefaultParameterInt("seed", 0);
+    MandatoryOff("seed");
+  }
+
+  virtual ~BVModelDistillation() override
+  {
+  }
+
+  void DoUpdateParameters() override
+  {
+    // Nothing to do here : all parameters are independent
+  }
+
+  void DoExecute() override
+  {
+    m_NbThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(IsParameterEnabled("threads") && GetParameterInt("threads") > 0 &&
+       static_cast<unsigned int>(GetParameterInt("threads")) < m_NbThreads)
+      m_NbThreads = GetParameterInt("threads");
+    m_Seed = static_cast<std::uint64_t>(GetParameterInt("seed"));
+
+    std::string model_type;
+    auto teachers = otb::BV::LoadRegressionModels(GetParameterString("model"),
+                                                  model_type);
+    auto nbOutputs = teachers.size();
+
+    auto inFileName = GetParameterString("in");
+    auto table = otb::read_text_table(inFileName, 0, false, m_NbThreads);
+    if(GetParameterInt("skip") < 0 ||
+       static_cast<std::size_t>(GetParameterInt("skip")) >= table.nbColumns)
+      {
+      itkGenericExceptionMacro(<< "The input file " << inFileName << " has "
+                               << table.nbColumns << " fields: skip must be "
+                               << "between 0 and " << table.nbColumns-1
+                               << ".");
+      }
+    std::size_t skip = static_cast<std::size_t>(GetParameterInt("skip"));
+    auto nbInputs = table.nbColumns-skip;
+    if(GetParameterInt("synthetic") < 0)
+      {
+      itkGenericExceptionMacro(<< "The number of synthetic samples must not "
+                               << "be negative.");
+      }
+    std::size_t nbSynthetic = static_cast<std::size_t>(
+      GetParameterInt("synthetic"));
+
+    otb::BV::NormalizationVectorType var_minmax;
+    bool normalization{HasValue("normalization")};
+    if(normalization)
+      {
+      var_minmax = otb::BV::read_normalization_file(
+        GetParameterString("normalization"));
+      if(var_minmax.size() != nbInputs+nbOutputs)
+        {
+        itkGenericExceptionMacro(<< "Normalization file (" << var_minmax.size()
+                                 << " - " << nbOutputs << ") is not coherent "
+                                 << "with the number of input variables ("
+                                 << nbInputs << ").");
+        }
+      }
+
+    // the samples without NaN are stored with the input variables
+    // followed by the estimates of the model
+    auto rowSize = nbInputs+nbOutputs;
+    std::vector<PrecisionType> values;
+    values.reserve((table.Rows()+nbSynthetic)*rowSize);
+    for(std::size_t i = 0; i < table.Rows(); ++i)
+      {
+      auto first = table.Row(i)+skip;
+      auto last = table.Row(i)+table.nbColumns;
+      if(std::any_of(first, last, [](double v){ return std::isnan(v); }))
+        continue;
+      values.insert(values.end(), first, last);
+      values.resize(values.size()+nbOutputs);
+      }
+    auto nbRows = values.size()/rowSize;
+    otbAppLogINFO("Found " << nbRows << " samples of " << nbInputs
+                  << " input variables without NaN in " << inFileName 
+                  << std::endl);
+    auto nbSamples = nbRows+nbSynthetic;
+    values.resize(nbSamples*rowSize);
+    if(nbSynthetic > 0)
+      AddSyntheticSamples(values, nbRows, nbSynthetic, nbInputs, rowSize,
+                          GetParameterFloat("jitter"));
+    table = otb::TextTable{0, {}};
+    // the outputs, normalized too, are overwritten by the labels
+    if(normalization)
+      otb::BV::normalize_rows(values.data(), nbSamples, rowSize, var_minmax,
+                              m_NbThreads);
+
+    otbAppLogINFO("Labeling " << nbSamples << " samples (" << nbSynthetic
+                  << " synthetic) with the " << model_type
+                  << " model using " << m_NbThreads << " threads ..."
+                  << std::endl);
+    auto start = std::chrono::steady_clock::now();
+    otb::parallel_for_blocks(0, nbSamples, m_NbThreads,
+                             [&](std::size_t first, std::size_t last){
+      InputSampleType inputValue;
+      for(auto i = first; i < last; ++i)
+        {
+        auto row = values.data()+i*rowSize;
+        inputValue.SetData(row, static_cast<unsigned int>(nbInputs), false);
+        for(std::size_t out = 0; out < nbOutputs; ++out)
+          row[nbInputs+out] = teachers[out]->Predict(inputValue)[0];
+        }
+      });
+    auto teacherTime = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now()-start).count();
+    otb::BV::SampleStore samples(nbInputs, std::move(values), nbOutputs);
+
+    // the fidelity is estimated on samples the mlp has not seen
+    auto nbFidelity = std::max<std::size_t>(
+      1, static_cast<std::size_t>(FidelityFraction*nbSamples));
+    if(nbFidelity >= nbSamples)
+      {
+      itkGenericExceptionMacro(<< "Not enough samples for the distillation.");
+      }
+    auto key = otb::BV::PhiloxRNG(m_Seed, 0, FidelityStream)();
+    std::vector<std::size_t> training, fidelity;
+    for(std::size_t k = 0; k < nbSamples; ++k)
+      {
+      auto i = static_cast<std::size_t>(
+        otb::BV::permute_index(k, nbSamples, key));
+      (k < nbFidelity ? fidelity : training).push_back(i);
+      }
+    std::sort(training.begin(), training.end());
+    std::sort(fidelity.begin(), fidelity.end());
+    otb::BV::SampleView trainingSamples(samples, std::move(training));
+    otb::BV::SampleView fidelitySamples(samples, std::move(fidelity));
+
+    auto method = MLPType::TrainMethodType::ADAM;
+    if(IsParameterEnabled("mlpmethod") &&
+       GetParameterString("mlpmethod") == "lbfgs")
+      method = MLPType::TrainMethodType::LBFGS;
+    else if(IsParameterEnabled("mlpmethod") &&
+            GetParameterString("mlpmethod") != "adam")
+      {
+      itkGenericExceptionMacro(<< "Unknown mlp training method "
+                               << GetParameterString("mlpmethod")
+                               << ". Use adam or lbfgs.");
+      }
+    if(GetParameterInt("hidden") < 1)
+      {
+      itkGenericExceptionMacro(<< "The hidden layer needs at least one "
+                               << "neuron.");
+      }
+    std::vector<MLPType::Pointer> students;
+    for(std::size_t out = 0; out < nbOutputs; ++out)
+      {
+      otbAppLogINFO("Training the mlp"
+                    << (nbOutputs > 1 ? " of output variable "+
+                        std::to_string(out+1) : "")
+                    << " on " << trainingSamples.Size() << " samples ..."
+                    << std::endl);
+      auto student = otb::BV::NewMLPRegression(m_NbThreads, m_Seed, method);
+      student->SetHiddenLayerSizes({
+          static_cast<unsigned int>(GetParameterInt("hidden"))});
+      student->Train(trainingSamples.ForOutput(out));
+      students.push_back(student);
+      }
+
+    // estimates of the mlp on the samples kept for the fidelity, whose
+    // time is compared to the one of the model
+    auto nbFidelitySamples = fidelitySamples.Size();
+    std::vector<double> estimates(nbOutputs*nbFidelitySamples);
+    start = std::chrono::steady_clock::now();
+    otb::parallel_for_blocks(0, nbFidelitySamples, m_NbThreads,
+                             [&](std::size_t first, std::size_t last){
+      InputSampleType inputValue;
+      for(auto k = first; k < last; ++k)
+        {
+        inputValue.SetData(const_cast<PrecisionType*>(
+                             fidelitySamples.Input(k)),
+                           static_cast<unsigned int>(nbInputs), false);
+        for(std::size_t out = 0; out < nbOutputs; ++out)
+          estimates[out*nbFidelitySamples+k] =
+            students[out]->Predict(inputValue)[0];
+        }
+      });
+    auto studentTime = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now()-start).count();
+
+    // fidelity in the units of the output variables
+    for(std::size_t out = 0; out < nbOutputs; ++out)
+      {
+      auto view = fidelitySamples.ForOutput(out);
+      std::vector<double> student_estimates(
+        estimates.begin()+out*nbFidelitySamples,
+        estimates.begin()+(out+1)*nbFidelitySamples);
+      std::vector<double> model_estimates;
+      for(std::size_t k = 0; k < nbFidelitySamples; ++k)
+        model_estimates.push_back(view.Output(k));
+      if(normalization)
+        {
+        for(auto& v : student_estimates)
+          v = otb::BV::denormalize(v, var_minmax[nbInputs+out]);
+        for(auto& v : model_estimates)
+          v = otb::BV::denormalize(v, var_minmax[nbInputs+out]);
+        }
+      auto m = otb::BV::regression_metrics(student_estimates, model_estimates);
+      otbAppLogINFO("Fidelity" << (nbOutputs > 1 ? " of output variable "+
+                                   std::to_string(out+1) : "")
+                    << ": " << m.n << " samples, RMSE = " << m.rmse
+                    << ", bias = " << m.bias << ", R2 = " << m.r2
+                    << ", absolute error percentiles 50/90/95 = " << m.p50
+                    << "/" << m.p90 << "/" << m.p95 << std::endl);
+      }
+    otbAppLogINFO("Time per sample with " << m_NbThreads << " threads: "
+                  << teacherTime/nbSamples << " us for the " << model_type
+                  << " model, " << studentTime/nbFidelitySamples
+                  << " us for the mlp" << std::endl);
+
+    auto outFileName = GetParameterString("out");
+    std::vector<std::string> model_files;
+    for(std::size_t out = 0; out < nbOutputs; ++out)
+      {
+      model_files.push_back(nbOutputs == 1 ? outFileName :
+                            outFileName+"_"+std::to_string(out+1));
+      students[out]->Save(model_files.back());
+      }
+    if(nbOutputs > 1)
+      otb::BV::write_model_list(model_files, outFileName);
+    otbAppLogINFO("mlp saved in " << outFileName << std::endl);
+  }
+
+  /** Fills the rows [nbRows, nbRows+nbSynthetic) of the samples with
+      copies of input samples drawn at random whose input variables are
+      moved by a gaussian noise of jitter times their standard
+      deviation. A synthetic sample only depends on the seed and its
+      number. */
+  void AddSyntheticSamples(std::vector<PrecisionType>& values,
+                           std::size_t nbRows, std::size_t nbSynthetic,
+                           std::size_t nbInputs, std::size_t rowSize,
+                           double jitter) const
+  {
+    if(nbRows == 0)
+      {
+      itkGenericExceptionMacro(<< "The synthetic samples are drawn around "
+                               << "input samples.");
+      }
+    std::vector<double> mean(nbInputs, 0), stddev(nbInputs, 0);
+    for(std::size_t i = 0; i < nbRows; ++i)
+      for(std::size_t j = 0; j < nbInputs; ++j)
+        mean[j] += values[i*rowSize+j];
+    for(auto& m : mean)
+      m /= nbRows;
+    for(std::size_t i = 0; i < nbRows; ++i)
+      for(std::size_t j = 0; j < nbInputs; ++j)
+        stddev[j] += (values[i*rowSize+j]-mean[j])*(values[i*rowSize+j]-mean[j]);
+    for(auto& s : stddev)
+      s = jitter*std::sqrt(s/nbRows);
+    otb::parallel_for_blocks(0, nbSynthetic, m_NbThreads,
+                             [&](std::size_t first, std::size_t last){
+      for(auto s = first; s < last; ++s)
+        {
+        otb::BV::PhiloxRNG rng(m_Seed, s, SyntheticStream);
+        auto source = std::min(static_cast<std::size_t>(
+                                 otb::BV::uniform_01(rng)*nbRows), nbRows-1);
+        auto row = values.data()+(nbRows+s)*rowSize;
+        for(std::size_t j = 0; j < nbInputs; ++j)
+          {
+          row[j] = values[source*rowSize+j];
+          if(stddev[j] > 0)
+            row[j] += std::normal_distribution<>(0, stddev[j])(rng);
+          }
+        }
+      });
+  }
+
+  unsigned int m_NbThreads{1};
+  std::uint64_t m_Seed{0};
+  // fraction of the labeled samples kept for the fidelity
+  static constexpr double FidelityFraction{0.2};
+  // streams of the random numbers of the synthetic samples and of the
+  // samples kept for the fidelity
+  static constexpr std::uint32_t SyntheticStream{0xffffffff};
+  static constexpr std::uint32_t FidelityStream{0xfffffffe};
+};
+
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::BVModelDistillation)
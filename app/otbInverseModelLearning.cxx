@@ -20,15 +20,27 @@
 #include <string>
 #include <limits>
 #include <cmath>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <future>
+#include <utility>
+#include <boost/lexical_cast.hpp>
 
 #include "otbBVUtil.h"
 #include "otbBVTypes.h"
+#include "otbPhiloxRNG.h"
+#include "otbBVSampling.h"
+#include "otbBVSampleStore.h"
+#include "otbBVSampleReduction.h"
 
 #include "otbMachineLearningModelFactory.h"
-#include "otbNeuralNetworkMachineLearningModel.h"
-#include "otbSVMMachineLearningModel.h"
-#include "otbRandomForestsMachineLearningModel.h"
-#include "otbMultiLinearRegressionModel.h"
+#include "otbBVRegressionModels.h"
 #include "itkListSample.h"
 
 namespace otb
@@ -56,13 +68,20 @@ public:
   typedef itk::VariableLengthVector<PrecisionType> InputSampleType;
   typedef itk::Statistics::ListSample<OutputSampleType> ListOutputSampleType;
   typedef itk::Statistics::ListSample<InputSampleType> ListInputSampleType;
-  typedef otb::NeuralNetworkMachineLearningModel<PrecisionType, 
-                                                          PrecisionType> 
-  NeuralNetworkType;
-  typedef otb::SVMMachineLearningModel<PrecisionType, PrecisionType> SVRType;
-  typedef otb::RandomForestsMachineLearningModel<PrecisionType, 
-                                                 PrecisionType> RFRType;
-  typedef otb::MultiLinearRegressionModel<PrecisionType> MLRType;
+  typedef otb::BV::NeuralNetworkType NeuralNetworkType;
+  typedef otb::BV::SVRType SVRType;
+  typedef otb::BV::RFRType RFRType;
+  typedef otb::BV::MLRType MLRType;
+  typedef otb::BV::MLPType MLPType;
+  /** Hyperparameters of a regression by name */
+  using HyperParametersType = std::map<std::string, double>;
+  /** Values (or min and max of the range) of a searched hyperparameter */
+  struct SearchDimension
+  {
+    std::string name;
+    std::vector<double> values;
+    bool isRange;
+  };
   
 private:
   void DoInit() override
@@ -76,6 +95,12 @@ private:
                              "Input file containing the training samples. This is an ASCII file where each line is a training sample. A line is a set of fields containing numerical values. The first field is the value of the output variable and the other contain the values of the input variables." );
     MandatoryOn("training");
 
+    AddParameter(ParameterType_Int, "nboutputs", 
+                 "Number of output variables of the training samples");
+    SetParameterDescription("nboutputs", "The first N fields of a line of the training file are the values of N output variables (for instance LAI, fAPAR and fCover) and the other ones the values of the input variables. A model is learned for each output variable, all of them during the same run and in parallel, and out is then a list of these models, which are saved next to it as out_1, out_2, etc. BVInversion and BVImageInversion estimate all the output variables of such a model from a single read of the input. The normalization file has a line per output variable after the ones of the input variables, and the error models are saved in the same way as the models.");
+    SetDefaultParameterInt("nboutputs", 1);
+    MandatoryOff("nboutputs");
+
     AddParameter(ParameterType_OutputFilename, "out", 
                  "Output regression model.");
     SetParameterDescription( "out", 
@@ -94,16 +119,132 @@ private:
                              "Output file containing min and max values per sample component. This file can be used by the inversion application. If no file is given as parameter, the variables are not normalized." );
     MandatoryOff("normalization");
 
+    AddParameter(ParameterType_InputFilename, "init", 
+                 "Model to go on training from (mlp and mlr regressions)");
+    SetParameterDescription("init", "Model (or list of models) learned by a previous run with the same regression and number of output variables. The training goes on from it instead of starting from scratch, for instance to refresh a model with the simulations of a new geometry or of a wider LAI range. The mlp regression starts from the weights of the model and keeps its topology, its activation and its standardization; it ends with the initial network if the training does not decrease its validation error. The mlr regression adds the normal equations saved with the model to the ones of the training samples, which gives the fit of the samples of both runs: only the new samples have to be given. nn networks are trained by OpenCV from random weights and cannot be updated: mlp has the same topology and can. All the models of the run (cross-validation, search, bestof) start from this model; the search can then only tune rate and batch.");
+    MandatoryOff("init");
+
+    AddParameter(ParameterType_InputFilename, "initnormalization", 
+                 "Normalization file of the init model");
+    SetParameterDescription("initnormalization", "Normalization file written with the init model. The samples are normalized with it instead of their own min and max, so that the training goes on in the variables of the init model, and it is copied to normalization. It is needed, with normalization, when the init model was learned with normalized variables.");
+    MandatoryOff("initnormalization");
+
     AddParameter(ParameterType_String, "regression", 
-                 "Regression to use for the training (nn, svr, rfr, mlr)");
+                 "Regression to use for the training (nn, svr, rfr, mlr, mlp)");
     SetParameterDescription("regression", 
-                            "Choice of the regression to use for the training: svr, rfr, nn, mlr.");
+                            "Choice of the regression to use for the training: svr, rfr, nn, mlr, mlp. mlp is a multilayer perceptron with the topology of nn (one hidden layer of 5 neurons with a symmetric sigmoid) trained by the module itself, with multithreaded gradients and early stopping on 10% of the samples kept for validation. It uses the seed and gives the same model whatever the number of threads.");
     MandatoryOff("regression");
 
+    AddParameter(ParameterType_String, "mlpmethod", 
+                 "Training method of the mlp regression (adam, lbfgs)");
+    SetParameterDescription("mlpmethod", 
+                            "adam (the default) uses mini-batches of 1024 samples and suits large training sets. lbfgs uses the gradient of all the training samples at each iteration.");
+    MandatoryOff("mlpmethod");
+
+    AddParameter(ParameterType_StringList, "ridge", 
+                 "Ridge penalties of the mlr regression");
+    SetParameterDescription("ridge", "Path of ridge penalties tried by the mlr regression, for instance 0 0.001 0.01 0.1. The intercept is not penalized and a penalty is relative to the diagonal of the normal equations of the centered input variables. The penalty of each output variable is the one of the lowest generalized cross-validation error, which is computed for the whole path from a single eigen decomposition of the normal equations. Without it, the fit is the least squares one.");
+    MandatoryOff("ridge");
+
+    AddParameter(ParameterType_StringList, "mlrfeatures", 
+                 "Features of the mlr regression");
+    SetParameterDescription("mlrfeatures", "Features computed from the input variables during the training and the inversion, so that the training file only holds the input variables: degree=N adds the powers of the input variables up to N, products adds their pairwise products and ndi=a,b adds the normalized difference (a-b)/(a+b) of the input variables a and b (starting at 1), and can be repeated. For instance degree=2 ndi=4,3. ndi cannot be used with normalization, since the normalized difference of normalized variables is not bounded. The features are saved with the model. With init, they are the ones of the init model.");
+    MandatoryOff("mlrfeatures");
+
     AddParameter(ParameterType_Int, "bestof", "Select the best of N models.");
-    SetParameterDescription("bestof", "");
+    SetParameterDescription("bestof", "The training samples are split into N slices, a model is trained on each of them and the one with the lowest RMSE is kept. The models are trained in parallel.");
     MandatoryOff("bestof");
 
+    AddParameter(ParameterType_String, "reduction", 
+                 "Reduction of the training samples (stratified, kmeans, farthest)");
+    SetParameterDescription("reduction", "Trains the regression on a representative subset of the training samples, for the regressions whose training time grows faster than the number of samples (svr with its parameter optimization, rfr). stratified draws a sample at random in each of reductionsize strata of equal sizes of the output variable (the first one with nboutputs), which keeps its distribution. kmeans clusters the input variables, scaled to [0, 1], into reductionsize clusters and keeps the sample closest to the centroid of each cluster. farthest adds, from a sample drawn at random, the sample the farthest from the ones already kept, which covers the whole input space, extremes included. The noisy copies of a sample are kept or dropped together. The subset depends on the seed only, and the search, the cross-validation and bestof use it too. The kept fraction is reported, and the RMSE of the model on all the training samples is given with the one on the subset.");
+    MandatoryOff("reduction");
+
+    AddParameter(ParameterType_Int, "reductionsize", 
+                 "Number of training samples kept by the reduction");
+    SetParameterDescription("reductionsize", "Number of training samples kept by the reduction, noisy copies included.");
+    MandatoryOff("reductionsize");
+
+    AddParameter(ParameterType_Int, "threads", 
+                 "Number of parallel threads for the training");
+    SetParameterDescription("threads", 
+                            "Number of models trained in parallel. The mlp regression also shares them among the gradient computations of its models. The default is the number of cores.");
+    MandatoryOff("threads");
+
+    AddParameter(ParameterType_Int, "kfold", 
+                 "Number of folds of the cross-validation");
+    SetParameterDescription("kfold", "Evaluates the regression by K-fold cross-validation before the training of the output model, which still uses all the samples. The samples are split into K folds (the noisy copies of a sample stay in the same fold), and K models, each one trained without one of the folds, are trained in parallel and evaluated on the fold they have not seen. RMSE, bias, R2 and the 50th, 90th and 95th percentiles of the absolute error are reported per fold and for all the folds, in the units of the output variable.");
+    MandatoryOff("kfold");
+
+    AddParameter(ParameterType_OutputFilename, "kfoldout", 
+                 "Output file for the cross-validation metrics");
+    SetParameterDescription("kfoldout", "ASCII file where the metrics of the cross-validation are written, one line per fold and a last line for all the folds.");
+    MandatoryOff("kfoldout");
+
+    AddParameter(ParameterType_StringList, "search",
+                 "Hyperparameters to search (name=v1,v2,... or name=min:max)");
+    SetParameterDescription("search", "Searches the hyperparameters of the regression before the cross-validation and the training of the output model, which use the best configuration found. Each hyperparameter is given as name=v1,v2,... for a list of values or name=min:max for a range, which needs searchbudget. The hyperparameters are hidden and alpha for nn; nu for svr; depth, trees and minsamples for rfr; hidden, alpha, rate and batch for mlp. The ones which are not searched keep their default value. Without searchbudget, all the combinations of the values are tried. 20% of the samples (the noisy copies of a sample stay together) are kept for validation. The candidates are trained in parallel by successive halving: all of them are trained on a small subset of the other samples, the best third goes on with three times more samples, and so on until a single candidate trained on all of them is left. The RMSE on the validation samples, in the units of the output variable, ranks the candidates. With several output variables, a candidate is trained for each of them and the candidates are ranked by the mean of the RMSE of the output variables divided by their standard deviation.");
+    MandatoryOff("search");
+
+    AddParameter(ParameterType_Int, "searchbudget",
+                 "Number of random configurations of the search");
+    SetParameterDescription("searchbudget", "Number of configurations drawn at random, given the seed, instead of the full grid of the search. A list of values is sampled uniformly and a range min:max is sampled uniformly between min and max.");
+    MandatoryOff("searchbudget");
+
+    AddParameter(ParameterType_OutputFilename, "searchout",
+                 "Output file for the hyperparameter search");
+    SetParameterDescription("searchout", "ASCII file where the validation RMSE of every candidate is written, one line per candidate and round of the successive halving, and a last line for the selected configuration.");
+    MandatoryOff("searchout");
+
+    AddParameter(ParameterType_StringList, "noisestd", 
+                 "Standard deviation of the noise to be added per input variable");
+    SetParameterDescription("noisestd",
+                            "Gaussian noise is added to the reflectances of the training file when it is read, so that a single set of noise free simulations can be used for any noise level. The reflectances are the first input variables: a single value is used for the noisebands first ones, otherwise the values are used for as many first input variables. The remaining ones (angles, vegetation indices computed from the clean reflectances, etc.) are left unchanged.");
+    MandatoryOff("noisestd");
+
+    AddParameter(ParameterType_Int, "noisebands", 
+                 "Number of reflectance bands which get noise");
+    SetParameterDescription("noisebands", 
+                            "Number of reflectances at the start of the input variables, the only ones to which the noise is added. It is needed when a single noise standard deviation is given.");
+    MandatoryOff("noisebands");
+
+    AddParameter(ParameterType_Int, "noisecopies", 
+                 "Number of noisy copies of each training sample");
+    SetParameterDescription("noisecopies", 
+                            "Each training sample is replaced by this number of noisy copies.");
+    SetDefaultParameterInt("noisecopies", 1);
+    MandatoryOff("noisecopies");
+
+    AddParameter(ParameterType_Int, "seed", "Seed for the noise generation, the resampling and the mlp regression");
+    SetParameterDescription("seed", "Seed for the noise generation, the resampling and the mlp regression. The noise of a copy only depends on the seed, the row of the sample in the training file and the copy number.");
+    SetDefaultParameterInt("seed", 0);
+    MandatoryOff("seed");
+
+    AddParameter(ParameterType_StringList, "targetlai", 
+                 "Target distribution of the LAI (dist min max mod std)");
+    SetParameterDescription("targetlai", "Distribution of the LAI the model has to be learned for, given as the law (normal, lognormal or uniform) followed by min, max, mod and std with the same meaning as in BVInputVariableGeneration. The training samples, which were simulated with the proposal distribution, are reweighted or resampled so that they follow this distribution. This emulates a new simulation set for another LAI prior without running the simulations again.");
+    MandatoryOff("targetlai");
+
+    AddParameter(ParameterType_StringList, "proposallai", 
+                 "Distribution of the LAI of the training samples (dist min max mod std)");
+    SetParameterDescription("proposallai", "Distribution used to generate the LAI of the training samples, in the same format as targetlai. The default is the one of BVInputVariableGeneration: lognormal 0 15 2 2.");
+    MandatoryOff("proposallai");
+
+    AddParameter(ParameterType_InputFilename, "laifile", 
+                 "File with the LAI of the training samples");
+    SetParameterDescription("laifile", "Input variable file (output of BVInputVariableGeneration) used to simulate the training samples, in the same order. The LAI of the samples is read from its first column. If no file is given, the output variable of the training file is the LAI.");
+    MandatoryOff("laifile");
+
+    AddParameter(ParameterType_String, "reweighting", 
+                 "Use of the importance weights [resample(default)|weights]");
+    SetParameterDescription("reweighting", "resample draws, without replacement, a subset of the training samples with probabilities proportional to their importance weights, and can be used with all the regressions. weights keeps all the samples and uses the weights in the fit; it is only available for the mlr and mlp regressions, and the error model is learned without weights.");
+    MandatoryOff("reweighting");
+
+    AddParameter(ParameterType_Int, "resamplesize", 
+                 "Number of samples kept by the resampling");
+    SetParameterDescription("resamplesize", "Number of samples kept by the resampling. The default is half the effective sample size of the weights, which keeps the inclusion probabilities close to proportional to the weights.");
+    MandatoryOff("resamplesize");
+
   }
 
   virtual ~InverseModelLearning() override
@@ -120,330 +261,1548 @@ private:
   void DoExecute() override
   {
    
-    auto trainingFileName = GetParameterString("training");
-    std::ifstream trainingFile;
-    try
+    m_NbThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    if(IsParameterEnabled("threads") && GetParameterInt("threads") > 0 &&
+       static_cast<unsigned int>(GetParameterInt("threads")) < m_NbThreads)
+      m_NbThreads = GetParameterInt("threads");
+
+    if(GetParameterInt("nboutputs") < 1)
       {
-      trainingFile.open(trainingFileName.c_str());
+      itkGenericExceptionMacro(<< "The number of output variables must be "
+                               << "positive.");
       }
-    catch(...)
+    m_NbOutputs = static_cast<std::size_t>(GetParameterInt("nboutputs"));
+    auto trainingFileName = GetParameterString("training");
+    auto table = otb::read_text_table(trainingFileName, 0, false, m_NbThreads);
+    if(table.nbColumns < m_NbOutputs+1)
       {
-      itkGenericExceptionMacro(<< "Could not open file " << trainingFileName);
+      itkGenericExceptionMacro(<< "The training file " << trainingFileName
+                               << " needs " << m_NbOutputs << " output and "
+                               << "input variables.");
       }
-
-    std::size_t nbInputVariables = countColumns(trainingFileName) - 1;
+    std::size_t nbInputVariables = table.nbColumns - m_NbOutputs;
 
     otbAppLogINFO("Found " << nbInputVariables << " input variables in "
                   << trainingFileName << std::endl);
 
-    auto inputListSample = ListInputSampleType::New();
-    auto outputListSample = ListOutputSampleType::New();
-
-    inputListSample->SetMeasurementVectorSize(nbInputVariables);
-    outputListSample->SetMeasurementVectorSize(1);
-
-    // Samples for the error estimation
-    auto inputListSample_err = ListInputSampleType::New();
-    auto outputListSample_err = ListOutputSampleType::New();
+    ReadNoiseParameters(nbInputVariables);
+    ReadPriorParameters();
+    ReadInitModels();
 
-    inputListSample_err->SetMeasurementVectorSize(nbInputVariables);
-    outputListSample_err->SetMeasurementVectorSize(1);
-
-    auto nbSamples = read_input_samples(trainingFile, nbInputVariables, 
-                                        inputListSample, outputListSample, 
-                                        inputListSample_err, 
-                                        outputListSample_err);
+    // all the samples are in a single store: the training samples
+    // first and the samples for the error model after them
+    otb::BV::SampleStore samples(nbInputVariables, m_NbOutputs);
+    auto nbSamples = read_input_samples(std::move(table), samples);
     otbAppLogINFO("Found " << nbSamples << " samples in "
                   << trainingFileName << std::endl);
-    trainingFile.close();
+    if(!m_NoiseStd.empty())
+      otbAppLogINFO("Using " << samples.Size() << " noisy samples." 
+                    << std::endl);
+    otb::BV::SampleView allTrainingSamples(samples, 0, m_NbTrainingSamples);
+    otb::BV::SampleView errorSamples(samples, m_NbTrainingSamples, 
+                                     samples.Size());
+    auto trainingSamples = IsParameterEnabled("reduction") ?
+      ReduceTrainingSamples(allTrainingSamples) : allTrainingSamples;
 
-    double rmse{0.0};
     std::string regressor_type{"nn"};
     unsigned int nbModels{1};
     if (IsParameterEnabled("bestof"))
       nbModels = static_cast<unsigned int>(GetParameterInt("bestof"));    
+    if (nbModels < 1)
+      {
+      itkGenericExceptionMacro(<< "The number of models must be positive.");
+      }
     if (IsParameterEnabled("regression"))
-      regressor_type = GetParameterString("regression");    
-    if (regressor_type == "svr")
-      rmse = EstimateSVRRegresionModel(inputListSample, outputListSample, 
-                                       nbModels);
-    if (regressor_type == "rfr")
-      rmse = EstimateRFRRegresionModel(inputListSample, outputListSample, 
-                                       nbModels);
-    else if (regressor_type == "nn")
-      rmse = EstimateNNRegresionModel(inputListSample, outputListSample, 
-                                      nbModels, nbInputVariables);
-    else if (regressor_type == "mlr")
-      rmse = EstimateMLRRegresionModel(inputListSample, outputListSample, 
-                                       nbModels);
-    otbAppLogINFO("RMSE = " << rmse << std::endl);
-    if (IsParameterEnabled("errest"))
-      {
-      otbAppLogINFO("Learning regression model for the error " << std::endl);
-
-      if (regressor_type == "svr")       
-        EstimateErrorModel<SVRType>(inputListSample_err, 
-                                    outputListSample_err,
-                                    nbInputVariables);
-      if (regressor_type == "rfr")
-        EstimateErrorModel<RFRType>(inputListSample_err, 
-                                    outputListSample_err,
-                                    nbInputVariables);
-      else if (regressor_type == "nn")
-        EstimateErrorModel<NeuralNetworkType>(inputListSample_err, 
-                                              outputListSample_err,
+      regressor_type = GetParameterString("regression");
+    ReadMLPMethod();
+    ReadRidgePath(regressor_type);
+    ReadMLRFeatures(regressor_type);
+    // the hyperparameters which are not given keep the values of the
+    // factories of otbBVRegressionModels.h
+    HyperParametersType hyperParameters;
+    if (IsParameterEnabled("search"))
+      hyperParameters = SearchHyperParameters(regressor_type, trainingSamples,
                                               nbInputVariables);
-      else if (regressor_type == "mlr")
-        EstimateErrorModel<MLRType>(inputListSample_err, 
-                                    outputListSample_err,
-                                    nbInputVariables);
+    if (IsParameterEnabled("kfold"))
+      CrossValidateRegressionModel(regressor_type, hyperParameters,
+                                   trainingSamples, nbInputVariables);
+    otbAppLogINFO("Regression " << regressor_type
+                  << HyperParametersToString(hyperParameters) << std::endl);
+    WithRegressionFactory(regressor_type, hyperParameters, nbInputVariables,
+                          nbModels*m_NbOutputs, [&](auto newRegression){
+        std::vector<double> rmses;
+        auto models = EstimateRegressionModel(newRegression, trainingSamples,
+                                              nbModels, rmses);
+        if(m_NbOutputs == 1)
+          otbAppLogINFO("RMSE = " << rmses[0] << std::endl);
+        for(std::size_t output = 0; m_NbOutputs > 1 && output < m_NbOutputs; 
+            ++output)
+          otbAppLogINFO("RMSE of output variable " << output+1 << " = " 
+                        << rmses[output] << std::endl);
+        if(trainingSamples.Size() < allTrainingSamples.Size())
+          for(std::size_t output = 0; output < m_NbOutputs; ++output)
+            otbAppLogINFO("RMSE" << (m_NbOutputs > 1 ? 
+                                     " of output variable "+
+                                     std::to_string(output+1) : "")
+                          << " on all the " << allTrainingSamples.Size() 
+                          << " training samples = " 
+                          << ParallelRMSE(models[output], 
+                                          allTrainingSamples.ForOutput(output))
+                          << std::endl);
+        LogRidgePenalties(models);
+        // the models are saved while the error models are learned from
+        // them
+        auto saving = std::async(std::launch::async, 
+                                 [this, &models](const std::string& out){
+                                   SaveRegressionModels(models, out);
+                                 }, GetParameterString("out"));
+        if (IsParameterEnabled("errest"))
+          EstimateErrorModels(models, errorSamples, nbInputVariables);
+        saving.get();
+      });
+  }
+
+  /** File of the model of an output variable: the name of the output
+      model when there is a single output variable, and the name
+      followed by the number of the output variable otherwise */
+  std::string OutputModelFileName(const std::string& name, 
+                                  std::size_t output) const
+  {
+    return m_NbOutputs == 1 ? name : name+"_"+std::to_string(output+1);
+  }
+
+  /** Makes sample point to the values of a sample of the store, without
+      copying them. */
+  void WrapSample(const PrecisionType* values, std::size_t size, 
+                  InputSampleType& sample) const
+  {
+    sample.SetData(const_cast<PrecisionType*>(values), 
+                   static_cast<unsigned int>(size), false);
+  }
+
+  /** Trains a regression on a view of the samples. The OpenCV based
+      regressions take ListSamples, which are filled for the training
+      only and emptied once it is done. */
+  template <typename RegressionPointerType>
+  void TrainRegression(RegressionPointerType rgrsn, 
+                       const otb::BV::SampleView& samples)
+  {
+    auto ils = ListInputSampleType::New();
+    auto ols = ListOutputSampleType::New();
+    ils->SetMeasurementVectorSize(samples.NbInputs());
+    ols->SetMeasurementVectorSize(1);
+    InputSampleType inputValue;
+    OutputSampleType outputValue;
+    for(std::size_t k = 0; k < samples.Size(); ++k)
+      {
+      WrapSample(samples.Input(k), samples.NbInputs(), inputValue);
+      outputValue[0] = samples.Output(k);
+      ils->PushBack(inputValue);
+      ols->PushBack(outputValue);
+      }
+    rgrsn->SetInputListSample(ils);
+    rgrsn->SetTargetListSample(ols);
+    rgrsn->Train();
+    ils->Clear();
+    ols->Clear();
+  }
+
+  /** The multilinear regression is trained directly on the view. The
+      importance weights are used by its weighted least squares (the
+      variance of a sample is the inverse of its weight). The other
+      regressions, but the mlp one, do not support weights. */
+  void TrainRegression(MLRType::Pointer rgrsn, 
+                       const otb::BV::SampleView& samples)
+  {
+    WarmStart(rgrsn, samples);
+    if(!m_SampleWeights.empty())
+      {
+      MLRType::VectorType sigmas;
+      for(std::size_t k = 0; k < samples.Size(); ++k)
+        sigmas.push_back(1.0/std::sqrt(m_SampleWeights[samples.Index(k)]));
+      rgrsn->SetWeightVector(sigmas);
+      }
+    rgrsn->Train(samples);
+  }
+
+  /** The mlp regression is trained directly on the view, with the
+      importance weights in its mean square error */
+  void TrainRegression(MLPType::Pointer rgrsn, 
+                       const otb::BV::SampleView& samples)
+  {
+    WarmStart(rgrsn, samples);
+    if(!m_SampleWeights.empty())
+      {
+      MLPType::VectorType weights;
+      for(std::size_t k = 0; k < samples.Size(); ++k)
+        weights.push_back(m_SampleWeights[samples.Index(k)]);
+      rgrsn->SetSampleWeights(weights);
+      }
+    rgrsn->Train(samples);
+  }
+
+  /** The mlr regression fits all the output variables of the samples
+      at once, with a single factorization of the normal equations, and
+      gives the model of each of them. The other regressions, and the
+      mlr one when it goes on from init models, are trained output
+      variable by output variable. */
+  template <typename RegressionPointerType>
+  bool FitsAllOutputs(RegressionPointerType) const
+  {
+    return false;
+  }
+
+  bool FitsAllOutputs(MLRType::Pointer) const
+  {
+    return m_NbOutputs > 1 && m_InitModelFiles.empty();
+  }
+
+  template <typename RegressionPointerType>
+  std::vector<RegressionPointerType> 
+  TrainAllOutputs(RegressionPointerType, const otb::BV::SampleView&)
+  {
+    return {};
+  }
+
+  std::vector<MLRType::Pointer> 
+  TrainAllOutputs(MLRType::Pointer rgrsn, const otb::BV::SampleView& samples)
+  {
+    if(!m_SampleWeights.empty())
+      {
+      MLRType::VectorType sigmas;
+      for(std::size_t k = 0; k < samples.Size(); ++k)
+        sigmas.push_back(1.0/std::sqrt(m_SampleWeights[samples.Index(k)]));
+      rgrsn->SetWeightVector(sigmas);
       }
+    rgrsn->TrainTargets(samples);
+    std::vector<MLRType::Pointer> models;
+    for(std::size_t output = 0; output < m_NbOutputs; ++output)
+      models.push_back(rgrsn->GetTargetModel(output));
+    return models;
+  }
+
+  /** Logs the ridge penalties chosen by the mlr regression */
+  template <typename RegressionPointerType>
+  void LogRidgePenalties(const std::vector<RegressionPointerType>&) const
+  {
+  }
+
+  void LogRidgePenalties(const std::vector<MLRType::Pointer>& models) const
+  {
+    for(std::size_t output = 0; output < models.size(); ++output)
+      for(auto lambda : models[output]->GetRidgeParameters())
+        otbAppLogINFO("Ridge penalty" << (m_NbOutputs > 1 ? 
+                                          " of output variable "+
+                                          std::to_string(output+1) : "")
+                      << " chosen by generalized cross-validation = " 
+                      << lambda << std::endl);
   }
 
-  template <typename RegressionType>
-  double EstimateRegressionModel(RegressionType rgrsn, 
-                                 ListInputSampleType::Pointer ils, 
-                                 ListOutputSampleType::Pointer ols, 
-                                 unsigned int nbModels=1)
+  /** Loads the init model of the output variable of the samples into
+      the regression, which then goes on from it */
+  template <typename RegressionPointerType>
+  void WarmStart(RegressionPointerType rgrsn, 
+                 const otb::BV::SampleView& samples) const
   {
-    double min_rmse{std::numeric_limits<double>::max()};
-    auto sIt = ils->Begin();
-    auto rIt = ols->Begin();
-    auto total_n_samples = ils->Size();
+    if(m_InitModelFiles.empty())
+      return;
+    rgrsn->Load(m_InitModelFiles[samples.OutputVariable()]);
+    rgrsn->SetWarmStart(true);
+  }
+
+  /** Reads the files of the init models, one per output variable, and
+      checks that the regression can go on from them */
+  void ReadInitModels()
+  {
+    m_InitModelFiles.clear();
+    // the training goes on in the variables of the init model
+    if(IsParameterEnabled("initnormalization") && 
+       !(IsParameterEnabled("init") && HasValue("normalization")))
+      {
+      itkGenericExceptionMacro(<< "initnormalization is used with init and "
+                               << "normalization.");
+      }
+    if(!IsParameterEnabled("init"))
+      return;
+    if(HasValue("normalization") && !IsParameterEnabled("initnormalization"))
+      {
+      itkGenericExceptionMacro(<< "The normalization of the init model has "
+                               << "to be given by initnormalization.");
+      }
+    auto init = GetParameterString("init");
+    std::string type{"nn"};
+    if (IsParameterEnabled("regression"))
+      type = GetParameterString("regression");
+    if(type != "mlp" && type != "mlr")
+      {
+      itkGenericExceptionMacro(<< "The " << type << " regression cannot go on "
+                               << "from a model. Use mlp, which has the "
+                               << "topology of nn, or mlr.");
+      }
+    auto files = otb::BV::read_model_list(init);
+    if(files.empty())
+      files.push_back(init);
+    if(files.size() != m_NbOutputs)
+      {
+      itkGenericExceptionMacro(<< "The init model " << init << " has " 
+                               << files.size() << " output variables instead"
+                               << " of " << m_NbOutputs << ".");
+      }
+    for(const auto& f : files)
+      if(type == "mlp" ? !MLPType::New()->CanReadFile(f) :
+         !MLRType::New()->CanReadFile(f))
+        {
+        itkGenericExceptionMacro(<< "The init model " << f << " is not a "
+                                 << type << " model.");
+        }
+    m_InitModelFiles = files;
+    otbAppLogINFO("Training goes on from " << init << std::endl);
+  }
+
+  void ReadMLPMethod()
+  {
+    m_MLPMethod = MLPType::TrainMethodType::ADAM;
+    if(!IsParameterEnabled("mlpmethod"))
+      return;
+    auto name = GetParameterString("mlpmethod");
+    if(name == "lbfgs")
+      m_MLPMethod = MLPType::TrainMethodType::LBFGS;
+    else if(name != "adam")
+      {
+      itkGenericExceptionMacro(<< "Unknown mlp training method " << name
+                               << ". Use adam or lbfgs.");
+      }
+  }
+
+  void ReadRidgePath(const std::string& type)
+  {
+    m_RidgePath.clear();
+    if(!IsParameterEnabled("ridge"))
+      return;
+    if(type != "mlr")
+      {
+      itkGenericExceptionMacro(<< "The ridge penalties are used by the mlr "
+                               << "regression only.");
+      }
+    for(const auto& lambda : GetParameterStringList("ridge"))
+      m_RidgePath.push_back(boost::lexical_cast<PrecisionType>(lambda));
+    for(auto lambda : m_RidgePath)
+      if(!(lambda >= 0))
+        {
+        itkGenericExceptionMacro(<< "The ridge penalties must be non "
+                                 << "negative.");
+        }
+  }
+
+  void ReadMLRFeatures(const std::string& type)
+  {
+    m_MLRFeatures = MLRType::FeatureMapType();
+    if(!IsParameterEnabled("mlrfeatures"))
+      return;
+    if(type != "mlr")
+      {
+      itkGenericExceptionMacro(<< "The features are computed by the mlr "
+                               << "regression only.");
+      }
+    for(const auto& spec : GetParameterStringList("mlrfeatures"))
+      {
+      std::string name = spec.substr(0, spec.find('='));
+      std::string value = spec.find('=') == std::string::npos ? 
+        "" : spec.substr(spec.find('=')+1);
+      std::size_t a{0}, b{0};
+      char comma{0};
+      std::istringstream values(value);
+      if(name == "degree" && (values >> a) && a > 0 && values.eof())
+        m_MLRFeatures.SetDegree(a);
+      else if(name == "products" && value.empty())
+        m_MLRFeatures.SetPairwiseProducts(true);
+      else if(name == "ndi" && (values >> a >> comma >> b) && comma == ',' &&
+              a > 0 && b > 0 && values.eof())
+        m_MLRFeatures.AddNormalizedDifference(a-1, b-1);
+      else
+        {
+        itkGenericExceptionMacro(<< "Bad feature " << spec << ". Use "
+                                 << "degree=N, products or ndi=a,b.");
+        }
+      }
+    // the sum of two normalized inputs can be close to 0, and their
+    // normalized difference is not bounded any more
+    if(HasValue("normalization") &&
+       m_MLRFeatures.GetNumberOfDifferences() > 0)
+      {
+      itkGenericExceptionMacro(<< "ndi cannot be used with normalization: "
+                               << "the normalized differences of normalized "
+                               << "input variables are not bounded.");
+      }
+  }
+
+  /** Names of the hyperparameters of a regression which can be set
+      instead of the defaults of its factory */
+  static std::vector<std::string> HyperParameterNames(const std::string& type)
+  {
+    if(type == "nn") return {"hidden", "alpha"};
+    if(type == "svr") return {"nu"};
+    if(type == "rfr") return {"depth", "trees", "minsamples"};
+    if(type == "mlp") return {"hidden", "alpha", "rate", "batch"};
+    return {};
+  }
+
+  /** Value of a hyperparameter which is a number of neurons, trees,
+      etc. */
+  static unsigned int CountHyperParameter(double value)
+  {
+    return static_cast<unsigned int>(std::max(1L, std::lround(value)));
+  }
+
+  static std::string HyperParametersToString(const HyperParametersType& hp)
+  {
+    std::ostringstream s;
+    for(const auto& p : hp)
+      s << ' ' << p.first << '=' << p.second;
+    return s.str();
+  }
+
+  /** Calls f with the factory of the regressions of the given type,
+      configured with the hyperparameters hp. The threads of the mlp
+      regression are shared by the nbConcurrent models trained at the
+      same time. */
+  template <typename F>
+  void WithRegressionFactory(const std::string& type,
+                             const HyperParametersType& hp,
+                             std::size_t nbVars, std::size_t nbConcurrent,
+                             F f)
+  {
+    auto names = HyperParameterNames(type);
+    for(const auto& p : hp)
+      if(std::find(names.begin(), names.end(), p.first) == names.end())
+        {
+        itkGenericExceptionMacro(<< "The " << type << " regression has no "
+                                 << "hyperparameter " << p.first << ".");
+        }
+    auto has = [hp](const std::string& name){
+      return hp.find(name) != hp.end();
+    };
+    // the threads of the mlr and mlp regressions are shared by the
+    // models trained concurrently
+    auto nbThreads = std::max<std::size_t>(
+      1, m_NbThreads/std::max<std::size_t>(
+        1, std::min<std::size_t>(m_NbThreads, nbConcurrent)));
+    if (type == "svr")
+      f([hp, has](){
+          auto regression = otb::BV::NewSVRRegression();
+          if(has("nu")) regression->SetNu(hp.at("nu"));
+          return regression;
+        });
+    else if (type == "rfr")
+      f([hp, has](){
+          auto regression = otb::BV::NewRFRRegression();
+          if(has("depth"))
+            regression->SetMaxDepth(CountHyperParameter(hp.at("depth")));
+          if(has("trees"))
+            regression->SetMaxNumberOfTrees(CountHyperParameter(hp.at("trees")));
+          if(has("minsamples"))
+            regression->SetMinSampleCount(
+              CountHyperParameter(hp.at("minsamples")));
+          return regression;
+        });
+    else if (type == "nn")
+      f([hp, has, nbVars](){
+          auto regression = otb::BV::NewNNRegression(nbVars);
+          if(has("hidden"))
+            regression->SetLayerSizes(std::vector<unsigned int>{
+                static_cast<unsigned int>(nbVars),
+                  CountHyperParameter(hp.at("hidden")), 1});
+          if(has("alpha")) regression->SetAlpha(hp.at("alpha"));
+          return regression;
+        });
+    else if (type == "mlr")
+      {
+      auto ridgePath = m_RidgePath;
+      auto features = m_MLRFeatures;
+      f([nbThreads, ridgePath, features](){
+          auto regression = otb::BV::NewMLRRegression(nbThreads);
+          regression->SetRidgePath(ridgePath);
+          regression->SetFeatureMap(features);
+          return regression;
+        });
+      }
+    else if (type == "mlp")
+      {
+      if(!m_InitModelFiles.empty() && (has("hidden") || has("alpha")))
+        {
+        itkGenericExceptionMacro(<< "The hidden layer and alpha of the mlp "
+                                 << "regression are the ones of the init "
+                                 << "model.");
+        }
+      auto seed = m_Seed;
+      auto method = m_MLPMethod;
+      f([hp, has, nbThreads, seed, method](){
+          auto regression = otb::BV::NewMLPRegression(nbThreads, seed, method);
+          if(has("hidden"))
+            regression->SetHiddenLayerSizes({
+                CountHyperParameter(hp.at("hidden"))});
+          if(has("alpha")) regression->SetAlpha(hp.at("alpha"));
+          if(has("rate")) regression->SetLearningRate(hp.at("rate"));
+          if(has("batch"))
+            regression->SetBatchSize(CountHyperParameter(hp.at("batch")));
+          return regression;
+        });
+      }
+    else
+      {
+      itkGenericExceptionMacro(<< "Unknown regression " << type);
+      }
+  }
+
+  template <typename RegressionPointerType>
+  double ComputeRMSE(RegressionPointerType rgrsn, 
+                     const otb::BV::SampleView& samples) const
+  {
+    InputSampleType inputValue;
+    double sse{0};
+    for(std::size_t k = 0; k < samples.Size(); ++k)
+      {
+      WrapSample(samples.Input(k), samples.NbInputs(), inputValue);
+      sse += pow(rgrsn->Predict(inputValue)[0]-samples.Output(k), 2.0);
+      }
+    return sqrt(sse/samples.Size());
+  }
+
+  /** RMSE of a trained model on the samples, predicted by m_NbThreads
+      threads */
+  template <typename RegressionPointerType>
+  double ParallelRMSE(RegressionPointerType rgrsn, 
+                      const otb::BV::SampleView& samples) const
+  {
+    std::vector<double> partial_sse(m_NbThreads, 0);
+    otb::parallel_for_blocks(0, m_NbThreads, m_NbThreads, 
+                             [&](std::size_t t_first, std::size_t t_last){
+      InputSampleType inputValue;
+      for(auto t = t_first; t < t_last; ++t)
+        {
+        auto range = otb::BV::shard_range(samples.Size(), t, m_NbThreads);
+        for(auto k = range.first; k < range.second; ++k)
+          {
+          WrapSample(samples.Input(k), samples.NbInputs(), inputValue);
+          partial_sse[t] += pow(rgrsn->Predict(inputValue)[0]-
+                                samples.Output(k), 2.0);
+          }
+        }
+      });
+    double sse{0};
+    for(auto p : partial_sse)
+      sse += p;
+    return sqrt(sse/samples.Size());
+  }
+
+  /** The training samples kept by the reduction. The noisy copies of a
+      sample are consecutive and kept together. */
+  otb::BV::SampleView ReduceTrainingSamples(const otb::BV::SampleView& samples)
+  {
+    auto name = GetParameterString("reduction");
+    otb::BV::ReductionType type;
+    if(name == "stratified")
+      type = otb::BV::ReductionType::STRATIFIED;
+    else if(name == "kmeans")
+      type = otb::BV::ReductionType::KMEANS;
+    else if(name == "farthest")
+      type = otb::BV::ReductionType::FARTHEST;
+    else
+      {
+      itkGenericExceptionMacro(<< "Unknown reduction " << name 
+                               << ". Use stratified, kmeans or farthest.");
+      }
+    if(!IsParameterEnabled("reductionsize") || 
+       GetParameterInt("reductionsize") < 1)
+      {
+      itkGenericExceptionMacro(<< "The reduction needs a positive "
+                               << "reductionsize.");
+      }
+    std::size_t groupSize = m_NoiseStd.empty() ? 1 : m_NoiseCopies;
+    auto nbKept = std::max<std::size_t>(
+      1, static_cast<std::size_t>(GetParameterInt("reductionsize"))/groupSize);
+    otbAppLogINFO("Reduction of the training samples by " << name 
+                  << " using " << m_NbThreads << " threads ..." << std::endl);
+    auto firsts = otb::BV::reduce_samples(type, samples, groupSize, nbKept, 
+                                          m_Seed, ReductionStream, 
+                                          m_NbThreads);
+    std::vector<std::size_t> indices;
+    for(auto k : firsts)
+      for(std::size_t copy = 0; copy < groupSize; ++copy)
+        indices.push_back(samples.Index(k+copy));
+    otbAppLogINFO("Kept " << indices.size() << " of " << samples.Size() 
+                  << " training samples (" 
+                  << 100.0*indices.size()/samples.Size() << "%)" 
+                  << std::endl);
+    return otb::BV::SampleView(samples.Store(), std::move(indices));
+  }
+
+  /** Trains nbModels models on disjoint slices of the samples for each
+      output variable and keeps the one with the lowest RMSE. The
+      models are independent instances given by newRegression and the
+      ones of all the output variables are trained concurrently.
+      Returns the selected model of each output variable, and its RMSE
+      in rmses. */
+  template <typename RegressionFactoryType>
+  std::vector<decltype(std::declval<RegressionFactoryType>()())>
+  EstimateRegressionModel(RegressionFactoryType newRegression, 
+                          const otb::BV::SampleView& samples,
+                          unsigned int nbModels, std::vector<double>& rmses)
+  {
+    auto total_n_samples = samples.Size();
+    auto slice_size = total_n_samples/nbModels;
     otbAppLogINFO("Selecting best of " << nbModels << " models." 
                   << " Total nb samples is " << total_n_samples << std::endl);
-    for(size_t iteration=0; iteration<nbModels; ++iteration)
+
+    using RegressionPointerType = decltype(newRegression());
+    // task t trains the model t%nbModels of the output variable
+    // t/nbModels
+    auto nbTasks = nbModels*m_NbOutputs;
+    std::vector<RegressionPointerType> models(nbTasks);
+    std::vector<double> task_rmses(nbTasks);
+    // when a model fits all the output variables, the tasks of the first
+    // output variable train the models of all of them
+    auto allOutputs = FitsAllOutputs(newRegression());
+    auto nbTrainings = allOutputs ? nbModels : nbTasks;
+    otbAppLogINFO("Model estimation using " 
+                  << std::min<std::size_t>(m_NbThreads, nbTrainings) 
+                  << " threads ..." << std::endl);
+    otb::parallel_for_blocks(0, nbTrainings, m_NbThreads, 
+                             [&](std::size_t first, std::size_t last){
+      for(auto task = first; task < last; ++task)
+        {
+        auto iteration = task%nbModels;
+        auto slice = samples.Slice(iteration*slice_size, 
+                                   (iteration+1)*slice_size)
+          .ForOutput(task/nbModels);
+        if(allOutputs)
+          {
+          auto outputModels = TrainAllOutputs(newRegression(), slice);
+          for(std::size_t output = 0; output < m_NbOutputs; ++output)
+            {
+            auto t = output*nbModels+iteration;
+            task_rmses[t] = ComputeRMSE(outputModels[output], 
+                                        slice.ForOutput(output));
+            models[t] = outputModels[output];
+            }
+          continue;
+          }
+        auto rgrsn = newRegression();
+        TrainRegression(rgrsn, slice);
+        // Estimation of prediction error from training samples
+        task_rmses[task] = ComputeRMSE(rgrsn, slice);
+        models[task] = rgrsn;
+        }
+      });
+    std::vector<RegressionPointerType> best_models;
+    rmses.clear();
+    for(std::size_t output = 0; output < m_NbOutputs; ++output)
       {
-      auto ils_slice = ListInputSampleType::New();
-      auto ols_slice = ListOutputSampleType::New();
+      auto output_rmses = task_rmses.begin()+output*nbModels;
+      if(m_NbOutputs > 1)
+        otbAppLogINFO("Output variable " << output+1 << std::endl);
+      for(size_t iteration=0; iteration<nbModels; ++iteration)
+        otbAppLogINFO("RMSE for model number "<< iteration+1 
+                      << " = " << output_rmses[iteration] << " using " 
+                      << slice_size << " samples. " << std::endl);
+      auto best = static_cast<std::size_t>(
+        std::min_element(output_rmses, output_rmses+nbModels)-output_rmses);
+      otbAppLogINFO("Selecting model number " << best+1 << std::endl);
+      best_models.push_back(models[output*nbModels+best]);
+      rmses.push_back(output_rmses[best]);
+      }
+    return best_models;
+  }
 
-      ils_slice->SetMeasurementVectorSize(ils->GetMeasurementVectorSize());
-      ols_slice->SetMeasurementVectorSize(1);
+  /** Saves the models of the output variables to out, or to the files
+      of the output variables listed in out */
+  template <typename RegressionPointerType>
+  void SaveRegressionModels(const std::vector<RegressionPointerType>& models,
+                            const std::string& out) const
+  {
+    std::vector<std::string> model_files;
+    for(std::size_t output = 0; output < models.size(); ++output)
+      {
+      model_files.push_back(OutputModelFileName(out, output));
+      models[output]->Save(model_files.back());
+      }
+    if(m_NbOutputs > 1)
+      otb::BV::write_model_list(model_files, out);
+  }
+
+  /** K-fold cross-validation. The folds are views of the training
+      samples: the test samples of a fold are predicted in place. The
+      folds of all the output variables are processed in parallel by
+      m_NbThreads threads. */
+  template <typename RegressionFactoryType>
+  void CrossValidate(RegressionFactoryType newRegression, 
+                     const otb::BV::SampleView& samples,
+                     std::size_t nbFolds, std::size_t nbVars)
+  {
+    // the noisy copies of a sample are consecutive and form a group
+    // which goes to a single fold, otherwise a model would be tested
+    // on copies of its training samples
+    std::size_t groupSize = m_NoiseStd.empty() ? 1 : m_NoiseCopies;
+    auto nbGroups = samples.Size()/groupSize;
+    if(nbFolds < 2 || nbFolds > nbGroups)
+      {
+      itkGenericExceptionMacro(<< "The number of folds must be between 2 and "
+                               << "the number of samples (" << nbGroups 
+                               << ").");
+      }
+    // a random permutation of the groups dealt to the folds gives folds
+    // whose sizes differ by at most one group
+    auto key = otb::BV::PhiloxRNG(m_Seed, 0, KFoldStream)();
+    std::vector<std::size_t> fold_of_group(nbGroups);
+    for(std::size_t g = 0; g < nbGroups; ++g)
+      fold_of_group[g] = otb::BV::permute_index(g, nbGroups, key)%nbFolds;
+    std::vector<std::vector<std::size_t>> folds(nbFolds);
+    for(std::size_t k = 0; k < nbGroups*groupSize; ++k)
+      folds[fold_of_group[k/groupSize]].push_back(samples.Index(k));
 
-      for(size_t nsamples=0; nsamples<total_n_samples/nbModels; ++nsamples)
+    // the metrics are computed in the units of the output variables
+    auto output_value = [&](double v, std::size_t output){
+      return HasValue("normalization") ? 
+      otb::BV::denormalize(v, var_minmax[nbVars+output]) : v;
+    };
+    // task t is the fold t%nbFolds of the output variable t/nbFolds
+    auto nbTasks = nbFolds*m_NbOutputs;
+    std::vector<std::vector<double>> estimates(nbTasks);
+    std::vector<std::vector<double>> references(nbTasks);
+    std::vector<otb::BV::RegressionMetrics> metrics(nbTasks);
+    otbAppLogINFO(nbFolds << "-fold cross-validation using " 
+                  << std::min<std::size_t>(m_NbThreads, nbTasks) 
+                  << " threads ..." << std::endl);
+    otb::parallel_for_blocks(0, nbTasks, m_NbThreads, 
+                             [&](std::size_t first, std::size_t last){
+      for(auto task = first; task < last; ++task)
         {
-        ils_slice->PushBack(sIt.GetMeasurementVector());
-        ols_slice->PushBack(rIt.GetMeasurementVector());
-        ++sIt;
-        ++rIt;
+        auto fold = task%nbFolds;
+        auto output = task/nbFolds;
+        std::vector<std::size_t> train_indices;
+        for(std::size_t k = 0; k < nbGroups*groupSize; ++k)
+          if(fold_of_group[k/groupSize] != fold) 
+            train_indices.push_back(samples.Index(k));
+        auto rgrsn = newRegression();
+        TrainRegression(rgrsn, otb::BV::SampleView(samples.Store(), 
+                                                   train_indices)
+                        .ForOutput(output));
+        auto test = otb::BV::SampleView(samples.Store(), folds[fold])
+          .ForOutput(output);
+        InputSampleType inputValue;
+        for(std::size_t k = 0; k < test.Size(); ++k)
+          {
+          WrapSample(test.Input(k), test.NbInputs(), inputValue);
+          estimates[task].push_back(
+            output_value(rgrsn->Predict(inputValue)[0], output));
+          references[task].push_back(output_value(test.Output(k), output));
+          }
+        metrics[task] = otb::BV::regression_metrics(estimates[task], 
+                                                    references[task]);
         }
-      rgrsn->SetInputListSample(ils_slice);
-      rgrsn->SetTargetListSample(ols_slice);
-      otbAppLogINFO("Model estimation ..." << std::endl);
-      rgrsn->Train();
-      otbAppLogINFO("Estimation of prediction error from training samples ..."
+      });
+
+    std::unique_ptr<std::ofstream> out;
+    if(IsParameterEnabled("kfoldout"))
+      {
+      out.reset(new std::ofstream{GetParameterString("kfoldout")});
+      *out << (m_NbOutputs > 1 ? "output " : "") 
+           << "fold n rmse bias r2 p50 p90 p95\n";
+      }
+    for(std::size_t output = 0; output < m_NbOutputs; ++output)
+      {
+      auto prefix = m_NbOutputs > 1 ? 
+        "Output " + std::to_string(output+1) + ", " : std::string{};
+      auto write = [&](const std::string& name, 
+                       const otb::BV::RegressionMetrics& m){
+        if(!out) return;
+        if(m_NbOutputs > 1)
+          *out << output+1 << ' ';
+        *out << name << ' ' << m.n << ' ' << m.rmse << ' ' << m.bias << ' ' 
+             << m.r2 << ' ' << m.p50 << ' ' << m.p90 << ' ' << m.p95 << '\n';
+      };
+      double mean_rmse{0}, mean_rmse2{0};
+      std::vector<double> all_estimates, all_references;
+      for(auto task = output*nbFolds; task < (output+1)*nbFolds; ++task)
+        {
+        auto fold = task%nbFolds;
+        LogMetrics(prefix + (prefix.empty() ? "Fold " : "fold ") + 
+                   std::to_string(fold+1), metrics[task]);
+        write(std::to_string(fold+1), metrics[task]);
+        mean_rmse += metrics[task].rmse/nbFolds;
+        mean_rmse2 += metrics[task].rmse*metrics[task].rmse/nbFolds;
+        all_estimates.insert(all_estimates.end(), estimates[task].begin(),
+                             estimates[task].end());
+        all_references.insert(all_references.end(), references[task].begin(),
+                              references[task].end());
+        }
+      auto all = otb::BV::regression_metrics(all_estimates, all_references);
+      LogMetrics(prefix + (prefix.empty() ? "All folds" : "all folds"), all);
+      write("all", all);
+      otbAppLogINFO(prefix << "RMSE over the folds: mean = " << mean_rmse 
+                    << " std = " 
+                    << std::sqrt(std::max(mean_rmse2-mean_rmse*mean_rmse, 0.0))
                     << std::endl);
-      auto nbSamples = 0;
-      auto rmse = 0.0;
-      auto sampleIt = ils_slice->Begin();
-      auto resultIt = ols_slice->Begin();
-      while(sampleIt != ils_slice->End() && resultIt != ols_slice->End())
+      }
+  }
+
+  void LogMetrics(const std::string& name, 
+                  const otb::BV::RegressionMetrics& m)
+  {
+    otbAppLogINFO(name << ": " << m.n << " samples, RMSE = " << m.rmse 
+                  << ", bias = " << m.bias << ", R2 = " << m.r2 
+                  << ", absolute error percentiles 50/90/95 = " << m.p50 
+                  << "/" << m.p90 << "/" << m.p95 << std::endl);
+  }
+
+  void CrossValidateRegressionModel(const std::string& regressor_type,
+                                    const HyperParametersType& hp,
+                                    const otb::BV::SampleView& samples,
+                                    std::size_t nbVars)
+  {
+    if(GetParameterInt("kfold") < 2)
+      {
+      itkGenericExceptionMacro(<< "The number of folds must be at least 2.");
+      }
+    auto nbFolds = static_cast<std::size_t>(GetParameterInt("kfold"));
+    WithRegressionFactory(regressor_type, hp, nbVars, nbFolds,
+                          [&](auto newRegression){
+        CrossValidate(newRegression, samples, nbFolds, nbVars);
+      });
+  }
+
+  /** Parses the -search parameter into the values (or the min and max
+      of the range) of each hyperparameter */
+  std::vector<SearchDimension> ReadSearchSpace(const std::string& type)
+  {
+    auto names = HyperParameterNames(type);
+    if(names.empty())
+      {
+      itkGenericExceptionMacro(<< "The " << type << " regression has no "
+                               << "hyperparameter to search.");
+      }
+    std::vector<SearchDimension> space;
+    for(const auto& spec : GetParameterStringList("search"))
+      {
+      auto eq = spec.find('=');
+      SearchDimension dim;
+      dim.name = spec.substr(0, eq);
+      if(eq == std::string::npos || 
+         std::find(names.begin(), names.end(), dim.name) == names.end())
         {
-        rmse += pow(rgrsn->Predict(sampleIt.GetMeasurementVector())[0] -
-                    resultIt.GetMeasurementVector()[0], 2.0);
-        ++sampleIt;
-        ++resultIt;
-        ++nbSamples;
+        std::ostringstream available;
+        for(const auto& n : names) available << ' ' << n;
+        itkGenericExceptionMacro(<< "Wrong search parameter " << spec 
+                                 << ". The hyperparameters of the " << type
+                                 << " regression are:" << available.str());
         }
-      rmse = sqrt(rmse)/nbSamples;
-      otbAppLogINFO("RMSE for model number "<< iteration+1 
-                    << " = " << rmse << " using " << nbSamples 
-                    << " samples. " << std::endl);
-      if(rmse<min_rmse) 
+      auto values = spec.substr(eq+1);
+      auto colon = values.find(':');
+      dim.isRange = (colon != std::string::npos);
+      if(dim.isRange)
         {
-        min_rmse=rmse;
-        rgrsn->Save(GetParameterString("out"));
-        otbAppLogINFO("Selecting model number " << iteration+1 << std::endl);
+        dim.values = {boost::lexical_cast<double>(values.substr(0, colon)),
+                      boost::lexical_cast<double>(values.substr(colon+1))};
+        if(dim.values[0] > dim.values[1])
+          {
+          itkGenericExceptionMacro(<< "Empty range in " << spec);
+          }
         }
-      }
-    return min_rmse;
-  }
-
-  double EstimateNNRegresionModel(ListInputSampleType::Pointer ils, 
-                                  ListOutputSampleType::Pointer ols, 
-                                  unsigned int nbModels, std::size_t nbVars)
-  {
-    otbAppLogINFO("Neural networks");
-    auto regression = NeuralNetworkType::New();
-    regression->SetRegressionMode(true);
-    regression->SetTrainMethod(CvANN_MLP_TrainParams::BACKPROP);
-    // One hidden layer with 5 neurons and one output variable
-    otbAppLogINFO("Input layer : " << nbVars);
-    regression->SetLayerSizes(std::vector<unsigned int>(
-      {static_cast<unsigned int>(nbVars), 5, 1}));
-    regression->SetActivateFunction(CvANN_MLP::SIGMOID_SYM);
-    regression->SetAlpha(0.5);
-    regression->SetBeta(1.0);
-    regression->SetBackPropDWScale(0.1);
-    regression->SetBackPropMomentScale(0.1);
-    regression->SetTermCriteriaType(CV_TERMCRIT_EPS);
-    regression->SetEpsilon(1e-10);
-    return EstimateRegressionModel(regression, ils, ols, nbModels);
-  }
-
-  double EstimateSVRRegresionModel(ListInputSampleType::Pointer ils, 
-                                   ListOutputSampleType::Pointer ols, 
-                                   unsigned int nbModels)
-  {
-    otbAppLogINFO("Support vectors");
-    auto regression = SVRType::New();
-    regression->SetSVMType(CvSVM::NU_SVR);
-    regression->SetNu(0.5);
-    regression->SetKernelType(CvSVM::RBF);
-    regression->SetTermCriteriaType(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS);
-    regression->SetMaxIter(100000);
-    regression->SetEpsilon(FLT_EPSILON);
-    regression->SetParameterOptimization(true);
-    return EstimateRegressionModel(regression, ils, ols, nbModels);
-  }
-
-  double EstimateRFRRegresionModel(ListInputSampleType::Pointer ils, 
-                                   ListOutputSampleType::Pointer ols, 
-                                   unsigned int nbModels)
-  {
-    otbAppLogINFO("Support vectors");
-    auto regression = RFRType::New();
-    regression->SetMaxDepth(10);
-    regression->SetMinSampleCount(1000);
-    regression->SetRegressionAccuracy(0.01);
-    regression->SetMaxNumberOfVariables(4);
-    regression->SetMaxNumberOfTrees(100);
-    regression->SetForestAccuracy(0.01);
-    regression->SetRegressionMode(true);
-    return EstimateRegressionModel(regression, ils, ols, nbModels);
-  }
-
-  double EstimateMLRRegresionModel(ListInputSampleType::Pointer ils, 
-                                   ListOutputSampleType::Pointer ols, 
-                                   unsigned int nbModels)
-  {
-    otbAppLogINFO("Multilinear regression");
-    auto regression = MLRType::New();
-    return EstimateRegressionModel(regression, ils, ols, nbModels);
-  }
-
-  template <typename RegressionType>
-  void EstimateErrorModel(ListInputSampleType::Pointer ils, 
-                          ListOutputSampleType::Pointer ols,
-                          std::size_t nbVars)
-  {
-    // Generate the values of the error
-    auto bv_regression = RegressionType::New();
-    bv_regression->Load(GetParameterString("out"));    
-    bv_regression->SetRegressionMode(true);
-
-    auto err_ls = ListOutputSampleType::New();
-    auto sIt = ils->Begin();
-    auto rIt = ols->Begin();
-    while(sIt != ils->End() && rIt != ols->End())
-      {
-      auto est_err = (bv_regression->Predict(sIt.GetMeasurementVector())[0] -
-                      rIt.GetMeasurementVector()[0]);
-      OutputSampleType outputValue;
-      if( HasValue( "normalization" )==true )
-        // we use the same normalization as for the BV
-        outputValue[0] = otb::BV::normalize(est_err, var_minmax[nbVars]);
       else
-        outputValue[0] = est_err;
-      err_ls->PushBack(outputValue);
-      ++sIt;
-      ++rIt;
-      }
-
-    auto err_regression = NeuralNetworkType::New();
-    err_regression->SetRegressionMode(1);
-    err_regression->SetTrainMethod(CvANN_MLP_TrainParams::RPROP);
-    // One hidden layer with 5 neurons and one output variable
-    err_regression->SetLayerSizes(std::vector<unsigned int>(
-                                    {static_cast<unsigned int>(nbVars), 5, 1}));
-    err_regression->SetActivateFunction(CvANN_MLP::SIGMOID_SYM);
-    err_regression->SetAlpha(1.0);
-    err_regression->SetBeta(1.0);
-    err_regression->SetBackPropDWScale(0.1);
-    err_regression->SetBackPropMomentScale(0.1);
-    err_regression->SetTermCriteriaType(CV_TERMCRIT_EPS);
-    err_regression->SetEpsilon(1e-7);
-    err_regression->SetInputListSample(ils);
-    err_regression->SetTargetListSample(err_ls);
-    otbAppLogINFO("Error model estimation ..." << std::endl);
-    err_regression->Train();
-    err_regression->Save(GetParameterString("errest"));
+        {
+        std::size_t start{0};
+        for(auto comma = values.find(','); ; comma = values.find(',', start))
+          {
+          dim.values.push_back(boost::lexical_cast<double>(
+                                 values.substr(start, comma-start)));
+          if(comma == std::string::npos) break;
+          start = comma+1;
+          }
+        }
+      space.push_back(dim);
+      }
+    return space;
   }
 
-  std::size_t read_input_samples(std::ifstream& trainingFile, 
-                                 std::size_t nbInputVariables,
-                          ListInputSampleType::Pointer inputListSample,
-                          ListOutputSampleType::Pointer outputListSample,
-                          ListInputSampleType::Pointer inputListSample_err,
-                          ListOutputSampleType::Pointer outputListSample_err)
+  /** Configurations tried by the search: the grid of the values, or
+      searchbudget configurations drawn at random */
+  std::vector<HyperParametersType> SearchCandidates(
+    const std::vector<SearchDimension>& space)
   {
-    auto nbSamples = 0;
-    for(std::string line; std::getline(trainingFile, line); )
+    std::vector<HyperParametersType> candidates;
+    if(IsParameterEnabled("searchbudget"))
       {
-      if(line.size() > 1)
+      if(GetParameterInt("searchbudget") < 1)
         {
-        std::istringstream ss(line);
-        OutputSampleType outputValue;
-        ss >> outputValue[0];
+        itkGenericExceptionMacro(<< "The search budget must be positive.");
+        }
+      auto budget = static_cast<std::size_t>(GetParameterInt("searchbudget"));
+      for(std::size_t c = 0; c < budget; ++c)
+        {
+        // the draws of a candidate only depend on the seed and on its
+        // number (the index 0 of the stream is the validation split)
+        otb::BV::PhiloxRNG rng(m_Seed, c+1, SearchStream);
+        HyperParametersType hp;
+        for(const auto& dim : space)
+          {
+          auto u = otb::BV::uniform_01(rng);
+          if(dim.isRange)
+            hp[dim.name] = dim.values[0]+u*(dim.values[1]-dim.values[0]);
+          else
+            hp[dim.name] = dim.values[std::min(
+                static_cast<std::size_t>(u*dim.values.size()),
+                dim.values.size()-1)];
+          }
+        candidates.push_back(hp);
+        }
+      return candidates;
+      }
+    candidates.push_back({});
+    for(const auto& dim : space)
+      {
+      if(dim.isRange)
+        {
+        itkGenericExceptionMacro(<< "The range of " << dim.name 
+                                 << " needs a search budget.");
+        }
+      std::vector<HyperParametersType> grid;
+      for(const auto& hp : candidates)
+        for(auto v : dim.values)
+          {
+          grid.push_back(hp);
+          grid.back()[dim.name] = v;
+          }
+      candidates = std::move(grid);
+      }
+    return candidates;
+  }
+
+  /** Successive halving over the candidates of -search. Part of the
+      samples is kept for validation. All the candidates are trained in
+      parallel on a subset of the other samples, the best 1/Eta of them
+      go on with Eta times more samples, and so on: the last round
+      trains the remaining candidates on all the training samples of
+      the search. Returns the configuration with the lowest validation
+      RMSE in the last round. */
+  HyperParametersType SearchHyperParameters(const std::string& type,
+                                            const otb::BV::SampleView& samples,
+                                            std::size_t nbVars)
+  {
+    auto candidates = SearchCandidates(ReadSearchSpace(type));
+    // the noisy copies of a sample go to the same set, as in the
+    // cross-validation
+    std::size_t groupSize = m_NoiseStd.empty() ? 1 : m_NoiseCopies;
+    auto nbGroups = samples.Size()/groupSize;
+    auto nbValidationGroups = nbGroups/5;
+    if(nbValidationGroups < 1 || nbGroups-nbValidationGroups < 1)
+      {
+      itkGenericExceptionMacro(<< "Not enough samples for the search.");
+      }
+    auto nbTrainingGroups = nbGroups-nbValidationGroups;
+    // the groups in a random order: the first ones are the validation
+    // samples, and the training subsets of the rounds are the first
+    // training groups of the order
+    auto key = otb::BV::PhiloxRNG(m_Seed, 0, SearchStream)();
+    std::vector<std::size_t> order(nbGroups);
+    for(std::size_t g = 0; g < nbGroups; ++g)
+      order[g] = otb::BV::permute_index(g, nbGroups, key);
+    auto group_indices = [&](std::size_t first, std::size_t last){
+      std::vector<std::size_t> indices;
+      for(auto g = first; g < last; ++g)
+        for(std::size_t k = 0; k < groupSize; ++k)
+          indices.push_back(samples.Index(order[g]*groupSize+k));
+      return indices;
+    };
+    otb::BV::SampleView validation(samples.Store(), 
+                                   group_indices(0, nbValidationGroups));
+    // the RMSE in the units of the output variable, or, with several
+    // output variables, the mean of their RMSE relative to their
+    // standard deviation
+    double scale{1};
+    if(HasValue("normalization"))
+      scale = (var_minmax[nbVars].second-var_minmax[nbVars].first+
+               std::numeric_limits<PrecisionType>::epsilon())/2;
+    std::vector<double> validation_std(m_NbOutputs);
+    for(std::size_t output = 0; output < m_NbOutputs; ++output)
+      {
+      auto values = validation.ForOutput(output);
+      double sum{0}, sum2{0};
+      for(std::size_t k = 0; k < values.Size(); ++k)
+        {
+        sum += values.Output(k);
+        sum2 += values.Output(k)*values.Output(k);
+        }
+      auto mean = sum/values.Size();
+      validation_std[output] = std::max(
+        std::sqrt(std::max(sum2/values.Size()-mean*mean, 0.0)),
+        std::numeric_limits<double>::epsilon());
+      }
+    std::string score_name{m_NbOutputs == 1 ? "RMSE" : "relative RMSE"};
+
+    std::size_t nbRounds{1};
+    for(std::size_t n = Eta; n <= candidates.size(); n *= Eta)
+      ++nbRounds;
+    otbAppLogINFO("Searching " << candidates.size() << " configurations of the "
+                  << type << " regression in " << nbRounds << " rounds using "
+                  << validation.Size() << " validation samples" << std::endl);
+    std::unique_ptr<std::ofstream> out;
+    if(IsParameterEnabled("searchout"))
+      {
+      out.reset(new std::ofstream{GetParameterString("searchout")});
+      *out << "round samples candidate rmse";
+      for(const auto& p : candidates[0])
+        *out << ' ' << p.first;
+      *out << '\n';
+      }
+    auto write = [&out, &candidates](const std::string& round, std::size_t n,
+                                     std::size_t c, double rmse){
+      if(!out) return;
+      *out << round << ' ' << n << ' ' << c+1 << ' ' << rmse;
+      for(const auto& p : candidates[c])
+        *out << ' ' << p.second;
+      *out << '\n';
+    };
+
+    std::vector<std::size_t> alive(candidates.size());
+    std::iota(alive.begin(), alive.end(), 0);
+    std::vector<double> rmses(candidates.size(), 
+                              std::numeric_limits<double>::infinity());
+    std::size_t nbSamples{0};
+    for(std::size_t round = 0; round < nbRounds; ++round)
+      {
+      // the training subset grows by Eta at each round, but is never
+      // smaller than the number of input variables
+      std::size_t divisor{1};
+      for(auto r = round+1; r < nbRounds; ++r)
+        divisor *= Eta;
+      auto nbRoundGroups = std::min(nbTrainingGroups, 
+                                    std::max(nbTrainingGroups/divisor, nbVars+2));
+      otb::BV::SampleView training(
+        samples.Store(), group_indices(nbValidationGroups, 
+                                       nbValidationGroups+nbRoundGroups));
+      nbSamples = training.Size();
+      otb::parallel_for_blocks(0, alive.size(), m_NbThreads,
+                               [&](std::size_t first, std::size_t last){
+        for(auto k = first; k < last; ++k)
+          {
+          auto c = alive[k];
+          WithRegressionFactory(type, candidates[c], nbVars, alive.size(),
+                                [&](auto newRegression){
+              double score{0};
+              for(std::size_t output = 0; output < m_NbOutputs; ++output)
+                {
+                auto rgrsn = newRegression();
+                TrainRegression(rgrsn, training.ForOutput(output));
+                auto rmse = ComputeRMSE(rgrsn, validation.ForOutput(output));
+                score += m_NbOutputs == 1 ? rmse*scale : 
+                  rmse/validation_std[output]/m_NbOutputs;
+                }
+              rmses[c] = score;
+            });
+          // a diverging model ranks last
+          if(std::isnan(rmses[c]))
+            rmses[c] = std::numeric_limits<double>::infinity();
+          }
+        });
+      std::stable_sort(alive.begin(), alive.end(), 
+                       [&rmses](std::size_t a, std::size_t b){
+                         return rmses[a] < rmses[b];
+                       });
+      for(auto c : alive)
+        {
+        otbAppLogINFO("Round " << round+1 << ", " << nbSamples 
+                      << " samples, candidate " << c+1 
+                      << HyperParametersToString(candidates[c]) 
+                      << ": " << score_name << " = " << rmses[c] << std::endl);
+        write(std::to_string(round+1), nbSamples, c, rmses[c]);
+        }
+      if(round+1 < nbRounds)
+        alive.resize((alive.size()+Eta-1)/Eta);
+      }
+    auto best = alive[0];
+    otbAppLogINFO("Best configuration:" 
+                  << HyperParametersToString(candidates[best])
+                  << ", " << score_name << " = " << rmses[best] << std::endl);
+    write("best", nbSamples, best, rmses[best]);
+    return candidates[best];
+  }
+
+  /** Learns the error model of each output variable from the
+      residuals of its model on the error samples. The models are the
+      trained ones, used in memory while they are saved. The residuals
+      are computed by m_NbThreads threads and the error models of the
+      output variables are trained in parallel. */
+  template <typename RegressionPointerType>
+  void EstimateErrorModels(const std::vector<RegressionPointerType>& models,
+                           const otb::BV::SampleView& samples, 
+                           std::size_t nbVars)
+  {
+    otbAppLogINFO("Learning regression model for the error " << std::endl);
+    // we use the same normalization as for the BV
+    auto nbSamples = samples.Size();
+    auto errors = otb::BV::ModelResiduals(
+      models, samples, nbVars, HasValue("normalization") ? var_minmax :
+      otb::BV::NormalizationVectorType{}, m_NbThreads);
+
+    auto errest = GetParameterString("errest");
+    std::vector<std::string> errorModelFiles;
+    for(std::size_t output = 0; output < m_NbOutputs; ++output)
+      errorModelFiles.push_back(OutputModelFileName(errest, output));
+    otbAppLogINFO("Error model estimation ..." << std::endl);
+    otb::parallel_for_blocks(0, m_NbOutputs, m_NbThreads, 
+                             [&](std::size_t first, std::size_t last){
+      for(auto output = first; output < last; ++output)
+        {
+        auto ils = ListInputSampleType::New();
+        auto err_ls = ListOutputSampleType::New();
+        ils->SetMeasurementVectorSize(nbVars);
+        err_ls->SetMeasurementVectorSize(1);
         InputSampleType inputValue;
-        inputValue.Reserve(nbInputVariables);
-        bool has_nan = false;
-        for(size_t var = 0; var < nbInputVariables; ++var)
+        OutputSampleType outputValue;
+        for(std::size_t k = 0; k < nbSamples; ++k)
           {
-          bool nan_var = false;
-          std::tie(nan_var, inputValue[var]) = read_value_or_nan(ss);
-          has_nan = has_nan || nan_var;
+          WrapSample(samples.Input(k), nbVars, inputValue);
+          outputValue[0] = errors[output*nbSamples+k];
+          ils->PushBack(inputValue);
+          err_ls->PushBack(outputValue);
           }
-        if(!has_nan)
+        auto err_regression = otb::BV::NewErrorRegression(nbVars);
+        err_regression->SetInputListSample(ils);
+        err_regression->SetTargetListSample(err_ls);
+        err_regression->Train();
+        err_regression->Save(errorModelFiles[output]);
+        }
+      });
+    if(m_NbOutputs > 1)
+      otb::BV::write_model_list(errorModelFiles, errest);
+  }
+
+  /** Moves the samples without NaN of the training file into the
+      store, the training samples first and the ones for the error
+      model after them, and sets m_NbTrainingSamples. A row of the
+      table is the output variables followed by the input ones. Returns
+      the number of samples without NaN in the file. */
+  std::size_t read_input_samples(otb::TextTable&& table, 
+                                 otb::BV::SampleStore& samples)
+  {
+    auto nbInputVariables = table.nbColumns-m_NbOutputs;
+    auto nbRows = table.Rows();
+    otb::TextTable laiTable{0, {}};
+    if(m_UsePrior && IsParameterEnabled("laifile"))
+      {
+      // the rows of the lai file follow the ones of the training file
+      laiTable = otb::read_text_table(GetParameterString("laifile"), 1, true,
+                                      m_NbThreads);
+      if(laiTable.Rows() < nbRows)
+        {
+        itkGenericExceptionMacro(<< "The LAI file has less samples than "
+                                 << "the training file.");
+        }
+      }
+    // each thread turns its rows without NaN into the layout of the
+    // store (inputs then output) and accumulates their min/max
+    auto nbColumns = table.nbColumns;
+    std::vector<char> is_clean(nbRows);
+    std::vector<double> row_log_weights(m_UsePrior ? nbRows : 0);
+    std::vector<otb::BV::VarMinMax> partial_minmax(m_NbThreads,
+                                                   otb::BV::VarMinMax(nbColumns));
+    otb::parallel_for_blocks(
+      0, m_NbThreads, m_NbThreads, [&](std::size_t t_first, std::size_t t_last){
+        for(auto t = t_first; t < t_last; ++t)
           {
-          if (IsParameterEnabled("errest") && (nbSamples%2 == 0))
+          auto rows = otb::BV::shard_range(nbRows, t, m_NbThreads);
+          for(auto r = rows.first; r < rows.second; ++r)
             {
-            inputListSample_err->PushBack(inputValue);
-            outputListSample_err->PushBack(outputValue);
+            auto row = table.Row(r);
+            is_clean[r] = std::none_of(row, row+nbColumns, 
+                                       [](double v){ return std::isnan(v); });
+            if(!is_clean[r]) continue;
+            if(m_UsePrior)
+              {
+              double lai = laiTable.Rows() ? laiTable.Row(r)[0] : row[0];
+              row_log_weights[r] = 
+                otb::BV::VarLogDensity(m_TargetLAI, lai)-
+                otb::BV::VarLogDensity(m_ProposalLAI, lai);
+              }
+            std::rotate(row, row+m_NbOutputs, row+nbColumns);
+            partial_minmax[t].Add(row);
             }
-          else
+          }
+      });
+    // the clean rows are moved down over the ones with NaN, and the
+    // noise of a sample is keyed by its row in the file
+    std::vector<double> log_weights;
+    std::vector<std::size_t> file_rows;
+    std::size_t nbSamples{0};
+    for(std::size_t r = 0; r < nbRows; ++r)
+      {
+      if(!is_clean[r]) continue;
+      file_rows.push_back(r);
+      if(m_UsePrior)
+        log_weights.push_back(row_log_weights[r]);
+      if(nbSamples != r)
+        std::copy(table.Row(r), table.Row(r)+nbColumns, table.Row(nbSamples));
+      ++nbSamples;
+      }
+    table.values.resize(nbSamples*nbColumns);
+    otb::BV::SampleStore clean_samples(nbInputVariables, 
+                                       std::move(table.values), m_NbOutputs);
+
+    // indices of the samples to be used, in the order of the file
+    std::vector<std::size_t> selected;
+    m_SampleWeights.clear();
+    std::vector<double> weights;
+    if(m_UsePrior)
+      {
+      weights = ImportanceWeights(log_weights);
+      if(m_Resample)
+        selected = ResampleIndices(weights);
+      else
+        for(std::size_t i = 0; i < nbSamples; ++i)
+          if(weights[i] > 0) selected.push_back(i);
+      }
+    else
+      {
+      selected.resize(nbSamples);
+      std::iota(selected.begin(), selected.end(), 0);
+      }
+
+    // all the copies of a sample go to the same set
+    std::vector<std::size_t> training_set, error_set;
+    for(auto i : selected)
+      {
+      if(IsParameterEnabled("errest") && (i%2 == 0))
+        error_set.push_back(i);
+      else
+        training_set.push_back(i);
+      }
+    std::size_t nbCopies = m_NoiseStd.empty() ? 1 : m_NoiseCopies;
+    m_NbTrainingSamples = training_set.size()*nbCopies;
+    auto use_weights = m_UsePrior && !m_Resample;
+    if(m_NoiseStd.empty() && training_set.size() == nbSamples)
+      {
+      // the samples are used as they are read and all of them are
+      // training samples, whose min/max are the ones of the clean rows
+      samples = std::move(clean_samples);
+      if(use_weights)
+        m_SampleWeights = weights;
+      }
+    else
+      {
+      // the copy k of the i-th sample of the sets goes to the row
+      // i*nbCopies+k of the store
+      std::vector<std::size_t> sources(training_set);
+      sources.insert(sources.end(), error_set.begin(), error_set.end());
+      samples = otb::BV::SampleStore(
+        nbInputVariables, 
+        std::vector<PrecisionType>(sources.size()*nbCopies*nbColumns),
+        m_NbOutputs);
+      if(use_weights)
+        m_SampleWeights.resize(samples.Size());
+      for(auto& p : partial_minmax)
+        p = otb::BV::VarMinMax(nbColumns);
+      otb::parallel_for_blocks(
+        0, m_NbThreads, m_NbThreads, 
+        [&](std::size_t t_first, std::size_t t_last){
+          for(auto t = t_first; t < t_last; ++t)
             {
-            inputListSample->PushBack(inputValue);
-            outputListSample->PushBack(outputValue);
+            auto rows = otb::BV::shard_range(samples.Size(), t, m_NbThreads);
+            for(auto s = rows.first; s < rows.second; ++s)
+              {
+              auto i = sources[s/nbCopies];
+              auto in = samples.Input(s);
+              std::copy(clean_samples.Input(i), 
+                        clean_samples.Input(i)+nbColumns, in);
+              if(!m_NoiseStd.empty())
+                AddNoise(in, file_rows[i], s%nbCopies);
+              if(use_weights)
+                m_SampleWeights[s] = weights[i];
+              if(s < m_NbTrainingSamples)
+                partial_minmax[t].Add(in);
+              }
             }
-          ++nbSamples;
-          }
-        }
+        });
       }
 
     if( HasValue( "normalization" )==true )
       {
       otbAppLogINFO("Variable normalization."<< std::endl);
-      typename ListInputSampleType::Iterator ilFirst = inputListSample->Begin();
-      typename ListOutputSampleType::Iterator olFirst = outputListSample->Begin();
-      typename ListInputSampleType::Iterator ilLast = inputListSample->End();
-      typename ListOutputSampleType::Iterator olLast = outputListSample->End();
-      var_minmax = otb::BV::estimate_var_minmax(ilFirst, ilLast, olFirst, olLast);
+      // only the training samples are normalized, with their min/max
+      // or the ones of the init model
+      if(IsParameterEnabled("initnormalization"))
+        {
+        var_minmax = otb::BV::read_normalization_file(
+          GetParameterString("initnormalization"));
+        if(var_minmax.size() != nbColumns)
+          {
+          itkGenericExceptionMacro(<< "The normalization of the init model "
+                                   << "has " << var_minmax.size() 
+                                   << " variables instead of " << nbColumns
+                                   << ".");
+          }
+        }
+      else
+        {
+        for(std::size_t t = 1; t < partial_minmax.size(); ++t)
+          partial_minmax[0].Merge(partial_minmax[t]);
+        var_minmax = partial_minmax[0].MinMax();
+        }
       otb::BV::write_normalization_file(var_minmax, GetParameterString("normalization"));
-      otb::BV::normalize_variables(inputListSample, outputListSample, var_minmax);
+      otb::BV::normalize_samples(samples, 0, m_NbTrainingSamples, var_minmax,
+                                 m_NbThreads);
       for(size_t var = 0; var < nbInputVariables; ++var)
         otbAppLogINFO("Variable "<< var+1 << " min=" << var_minmax[var].first <<
                       " max=" << var_minmax[var].second <<std::endl);
-      otbAppLogINFO("Output min=" << var_minmax[nbInputVariables].first <<
-                    " max=" << var_minmax[nbInputVariables].second <<std::endl)
+      for(size_t output = 0; output < m_NbOutputs; ++output)
+        otbAppLogINFO("Output" << (m_NbOutputs > 1 ? " "+std::to_string(output+1) : "")
+                      << " min=" << var_minmax[nbInputVariables+output].first <<
+                      " max=" << var_minmax[nbInputVariables+output].second 
+                      <<std::endl);
         }
     return nbSamples;
 
   }
-  std::tuple<bool, PrecisionType> read_value_or_nan(std::istringstream& ss)
+
+  /** Parses a "dist min max mod std" distribution */
+  otb::BV::VarParams ParseLAIDistribution(const std::vector<std::string>& spec)
   {
-    bool nan_var = false;
-    std::string in_value;
-    ss >> in_value;
-    if(in_value=="nan")
+    if(spec.size() != 5)
       {
-      nan_var = true;
+      itkGenericExceptionMacro(<< "A LAI distribution is given as: "
+                               << "dist min max mod std");
       }
-    return std::make_tuple(nan_var,
-                           static_cast<PrecisionType>(std::stod(in_value)));
+    otb::BV::VarParams vpars{0.0, 15.0, 2.0, 2.0, 0, 0, false, 6, 
+        otb::BV::DistType::LOGNORMAL};
+    if(spec[0] == "normal")
+      vpars.dist = otb::BV::DistType::GAUSSIAN;
+    else if(spec[0] == "uniform")
+      vpars.dist = otb::BV::DistType::UNIFORM;
+    else if(spec[0] != "lognormal")
+      {
+      itkGenericExceptionMacro(<< "Unknown distribution " << spec[0] 
+                               << ". Available ones are normal, lognormal and uniform.");
+      }
+    vpars.min = boost::lexical_cast<double>(spec[1]);
+    vpars.max = boost::lexical_cast<double>(spec[2]);
+    vpars.mod = boost::lexical_cast<double>(spec[3]);
+    vpars.std = boost::lexical_cast<double>(spec[4]);
+    if(vpars.min > vpars.max)
+      {
+      itkGenericExceptionMacro(<< "The minimum of the LAI distribution is "
+                               << "greater than its maximum.");
+      }
+    return vpars;
   }
+
+  void ReadPriorParameters()
+  {
+    m_UsePrior = IsParameterEnabled("targetlai");
+    if(!m_UsePrior)
+      return;
+    m_TargetLAI = ParseLAIDistribution(GetParameterStringList("targetlai"));
+    m_ProposalLAI = IsParameterEnabled("proposallai") ?
+      ParseLAIDistribution(GetParameterStringList("proposallai")) :
+      ParseLAIDistribution({"lognormal", "0", "15", "2", "2"});
+    std::string reweighting{"resample"};
+    if(IsParameterEnabled("reweighting"))
+      reweighting = GetParameterString("reweighting");
+    if(reweighting != "resample" && reweighting != "weights")
+      {
+      itkGenericExceptionMacro(<< "Unknown reweighting " << reweighting
+                               << ". Use resample or weights.");
+      }
+    m_Resample = (reweighting == "resample");
+    if(!m_Resample && (!IsParameterEnabled("regression") || 
+                       (GetParameterString("regression") != "mlr" &&
+                        GetParameterString("regression") != "mlp")))
+      {
+      itkGenericExceptionMacro(<< "Importance weights are only available for "
+                               << "the mlr and mlp regressions. Use resample "
+                               << "for the other ones.");
+      }
+    if(m_TargetLAI.min < m_ProposalLAI.min || m_TargetLAI.max > m_ProposalLAI.max)
+      {
+      otbAppLogWARNING("The target LAI range [" << m_TargetLAI.min << ", "
+                       << m_TargetLAI.max << "] is not included in the proposal"
+                       << " one [" << m_ProposalLAI.min << ", " 
+                       << m_ProposalLAI.max << "]: the samples cannot represent"
+                       << " the part of the target outside the proposal range."
+                       << std::endl);
+      }
+    otbAppLogINFO("Reweighting the training samples to the target LAI "
+                  << "distribution using " << reweighting << std::endl);
+  }
+
+  /** Weights normalized to a mean of 1. The effective sample size
+      (sum w)^2/sum w^2 tells how many independent samples of the
+      target distribution the weighted set is worth. */
+  std::vector<double> ImportanceWeights(const std::vector<double>& log_weights)
+  {
+    if(log_weights.empty())
+      {
+      itkGenericExceptionMacro(<< "No training sample.");
+      }
+    auto max_log_weight = *std::max_element(log_weights.begin(), 
+                                            log_weights.end());
+    if(max_log_weight == -std::numeric_limits<double>::infinity())
+      {
+      itkGenericExceptionMacro(<< "No training sample has its LAI in the "
+                               << "range of the target distribution.");
+      }
+    std::vector<double> weights;
+    double sum{0}, sum2{0};
+    for(auto lw : log_weights)
+      {
+      weights.push_back(std::exp(lw-max_log_weight));
+      sum += weights.back();
+      sum2 += weights.back()*weights.back();
+      }
+    for(auto& w : weights)
+      w *= weights.size()/sum;
+    m_EffectiveSampleSize = sum*sum/sum2;
+    otbAppLogINFO("Effective sample size is " 
+                  << static_cast<std::size_t>(m_EffectiveSampleSize) 
+                  << " out of " << weights.size() << " samples" << std::endl);
+    return weights;
+  }
+
+  /** Weighted sampling without replacement (Efraimidis and Spirakis,
+      2006): the samples with the largest log(u)/w keys are kept, u
+      being uniform. The key of a sample only depends on the seed and
+      on its position in the training file. */
+  std::vector<std::size_t> ResampleIndices(const std::vector<double>& weights)
+  {
+    std::size_t size = IsParameterEnabled("resamplesize") ?
+      static_cast<std::size_t>(std::max(GetParameterInt("resamplesize"), 0)) :
+      static_cast<std::size_t>(m_EffectiveSampleSize/2);
+    auto nbPositive = static_cast<std::size_t>(
+      std::count_if(weights.begin(), weights.end(), 
+                    [](double w){ return w > 0; }));
+    if(size > nbPositive)
+      size = nbPositive;
+    if(size < 1)
+      {
+      itkGenericExceptionMacro(<< "No sample left after resampling.");
+      }
+    std::vector<std::pair<double, std::size_t>> keys;
+    for(std::size_t i = 0; i < weights.size(); ++i)
+      {
+      if(weights[i] > 0)
+        {
+        otb::BV::PhiloxRNG rng(m_Seed, i, ResamplingStream);
+        keys.push_back(std::make_pair(std::log(otb::BV::uniform_01(rng))/
+                                      weights[i], i));
+        }
+      }
+    std::nth_element(keys.begin(), keys.begin()+(size-1), keys.end(),
+                     std::greater<std::pair<double, std::size_t>>());
+    std::vector<std::size_t> selected;
+    for(std::size_t k = 0; k < size; ++k)
+      selected.push_back(keys[k].second);
+    std::sort(selected.begin(), selected.end());
+    otbAppLogINFO("Resampled " << size << " out of " << weights.size() 
+                  << " samples" << std::endl);
+    return selected;
+  }
+
+  void ReadNoiseParameters(std::size_t nbInputVariables)
+  {
+    m_NoiseStd.clear();
+    m_Seed = static_cast<std::uint64_t>(GetParameterInt("seed"));
+    if(!IsParameterEnabled("noisestd"))
+      return;
+    auto std_str = GetParameterStringList("noisestd");
+    if(IsParameterEnabled("noisebands"))
+      {
+      auto nbBands = GetParameterInt("noisebands");
+      if(nbBands < 1 || 
+         (std_str.size() > 1 && std_str.size() != std::size_t(nbBands)))
+        {
+        itkGenericExceptionMacro(<< "Wrong number of noisy bands (" << nbBands
+                                 << ") for " << std_str.size() 
+                                 << " noise stds.");
+        }
+      std_str.resize(nbBands, std_str[0]);
+      }
+    else if(std_str.size()==1)
+      {
+      itkGenericExceptionMacro(<< "The number of reflectance bands (noisebands) "
+                               << "is needed for a single noise std.");
+      }
+    if(std_str.size()>nbInputVariables)
+      {
+      itkGenericExceptionMacro(<< "Number of noise stds (" << std_str.size()
+                               << ") is greater than the number of input variables ("
+                               << nbInputVariables << ")");
+      }
+    for(size_t i=0; i<std_str.size(); i++)
+      {
+      m_NoiseStd.push_back(boost::lexical_cast<PrecisionType>(std_str[i]));
+      if(m_NoiseStd.back() < 0)
+        {
+        itkGenericExceptionMacro(<< "The noise std of variable " << i+1
+                                 << " is negative.");
+        }
+      otbAppLogINFO("Noise std for variable " << i+1 << " equal to " << 
+                    m_NoiseStd[i] << "\n");
+      }
+    if(GetParameterInt("noisecopies") < 1)
+      {
+      itkGenericExceptionMacro(<< "The number of noisy copies must be positive.");
+      }
+    m_NoiseCopies = GetParameterInt("noisecopies");
+    otbAppLogINFO("Using " << m_NoiseCopies << " noisy copies per sample and "
+                  << "seed " << m_Seed << std::endl);
+  }
+
+  /** Adds the noise of the given copy of a sample to its reflectances,
+      the sample being the given row of the training file */
+  void AddNoise(PrecisionType* in, std::size_t fileRow,
+                std::size_t copy) const
+  {
+    otb::BV::PhiloxRNG rng(m_Seed, fileRow, 
+                           static_cast<std::uint32_t>(copy));
+    for(size_t var = 0; var < m_NoiseStd.size(); ++var)
+      if(m_NoiseStd[var] > 0)
+        in[var] += std::normal_distribution<>(0, m_NoiseStd[var])(rng);
+  }
+
 protected:
   otb::BV::NormalizationVectorType var_minmax;
+  std::vector<PrecisionType> m_NoiseStd;
+  std::size_t m_NoiseCopies{1};
+  std::uint64_t m_Seed{0};
+  unsigned int m_NbThreads{1};
+  std::size_t m_NbOutputs{1};
+  // the training samples are the first ones of the store
+  std::size_t m_NbTrainingSamples{0};
+  // stream of the random numbers of the resampling (the noise of the
+  // copies uses the streams from 0 to noisecopies-1)
+  static constexpr std::uint32_t ResamplingStream{0xffffffff};
+  // stream of the assignment of the samples to the folds
+  static constexpr std::uint32_t KFoldStream{0xfffffffe};
+  // stream of the validation split and of the random configurations of
+  // the hyperparameter search
+  static constexpr std::uint32_t SearchStream{0xfffffffd};
+  // stream of the random draws of the reduction of the training samples
+  static constexpr std::uint32_t ReductionStream{0xfffffffc};
+  // reduction factor of the successive halving
+  static constexpr std::size_t Eta{3};
+  MLPType::TrainMethodType m_MLPMethod{MLPType::TrainMethodType::ADAM};
+  // ridge penalties tried by the mlr regression
+  std::vector<PrecisionType> m_RidgePath;
+  // features of the input variables fitted by the mlr regression
+  MLRType::FeatureMapType m_MLRFeatures;
+  // models the training goes on from, one per output variable
+  std::vector<std::string> m_InitModelFiles;
+  bool m_UsePrior{false};
+  bool m_Resample{true};
+  otb::BV::VarParams m_TargetLAI;
+  otb::BV::VarParams m_ProposalLAI;
+  double m_EffectiveSampleSize{0};
+  // importance weights of the samples of the store (only used by the
+  // weighted fit of the multilinear regression)
+  std::vector<double> m_SampleWeights;
 };
 
 }
@@ -22,39 +22,27 @@
 #include <thread>
 #include <boost/lexical_cast.hpp>
 #include <random>
+#include <algorithm>
 
 #include "otbBVUtil.h"
+#include "otbPhiloxRNG.h"
 #include "otbProSailSimulatorFunctor.h"
 
 namespace otb
 {
 
 
-std::vector<otb::BV::BVType> parse_bv_sample_file(std::ifstream& sample_file)
+std::vector<otb::BV::BVType> parse_bv_sample_file(const std::string& fileName,
+                                                  std::size_t nbThreads)
 {    
   using namespace otb::BV;
-//read variable names (first line)
-  std::string line;
-  std::getline(sample_file, line);
-
-  std::vector<BVType> bv_vec{};
-  while(sample_file.good())
-    {
-    BVType prosailBV;
-    // Read the variable values
-    std::getline(sample_file, line);
-    std::stringstream ss(line);
-    for(auto varName = 0; 
-        varName != static_cast<unsigned int>(IVNames::IVNamesEnd);
-        ++ varName)
-      {
-      double bvValue;
-      ss >> bvValue;
-      prosailBV[static_cast<IVNames>(varName)] = bvValue;
-      }
-    bv_vec.push_back(prosailBV);
-    }
-  sample_file.close();
+  // the first line holds the variable names
+  auto nbVariables = static_cast<std::size_t>(IVNames::IVNamesEnd);
+  auto table = read_text_table(fileName, nbVariables, true, nbThreads);
+  std::vector<BVType> bv_vec(table.Rows());
+  for(std::size_t sample = 0; sample < table.Rows(); ++sample)
+    for(std::size_t varName = 0; varName < nbVariables; ++varName)
+      bv_vec[sample][static_cast<IVNames>(varName)] = table.Row(sample)[varName];
   return bv_vec;
 }
 
@@ -127,6 +115,29 @@ private:
                             "Number of parallel threads for the simulation");
     MandatoryOff("threads");
 
+    AddParameter(ParameterType_Int, "seed", 
+                 "Seed for the noise generation");
+    SetParameterDescription("seed", 
+                            "Seed for the noise generation. The noise added to a sample only depends on the seed and on the position of the sample in the input file. If no seed is given, a random one is used and recorded in the progress manifest. Without noise, the seed is not used and 0 is recorded.");
+    MandatoryOff("seed");
+
+    AddParameter(ParameterType_Int, "chunk", 
+                 "Number of samples per committed output chunk");
+    SetParameterDescription("chunk", 
+                            "The simulations are appended to the output file by chunks of this number of samples. After each chunk, the progress manifest (the output file name followed by .progress) is updated.");
+    SetDefaultParameterInt("chunk", 10000);
+    MandatoryOff("chunk");
+
+    AddParameter(ParameterType_String, "shard", 
+                 "Process only one shard of the samples (i/n)");
+    SetParameterDescription("shard", 
+                            "Split the samples of the input file into n contiguous shards and only simulate shard i (0 <= i < n). Together with a fixed seed, the outputs of the n shards merged with the ShardMerge application are identical to the output of a single run.");
+    MandatoryOff("shard");
+
+    AddParameter(ParameterType_Bool, "resume", 
+                 "Resume an interrupted simulation");
+    SetParameterDescription("resume", 
+                            "If the progress manifest of a previous run with the same parameters exists, the samples already committed to the output file are skipped and only the remaining ones are simulated and appended.");
 
   }
 
@@ -140,11 +151,11 @@ private:
     // Nothing to do here : all parameters are independent
   }
 
-  void WriteSimulation(SimulationType simu)
+  void WriteSimulation(const SimulationType& simu, std::ostream& os)
   {
     for(size_t i=0; i<simu.size(); ++i)
-      m_SimulationsFile << simu[i] << " " ;
-    m_SimulationsFile << std::endl;
+      os << simu[i] << " " ;
+    os << "\n";
   }
   
   void DoExecute() override
@@ -177,12 +188,20 @@ private:
 
     otbAppLogINFO(""<<ss.str());
 
+    std::string bvFileName = GetParameterString("bvfile");
+    std::string outFileName = GetParameterString("out");
+    std::string manifestFileName = outFileName+".progress";
+
+    // Everything which changes the content of the output file
+    std::stringstream parameters;
+    parameters << bvFileName << " " << rsrFileName << " " << m_SolarZenith 
+               << " " << m_SolarZenith_Fapar << " " << m_SensorZenith 
+               << " " << m_Azimuth;
+
     bool add_noise =IsParameterEnabled("noisestd");
     std::vector<std::normal_distribution<>> noise_generators;
-    std::mt19937 RNG;
     if(add_noise)
       {
-      RNG = std::mt19937(std::random_device{}());
       std::vector<std::string> std_str = GetParameterStringList("noisestd");
       if(std_str.size()==1)
         {
@@ -199,32 +218,12 @@ private:
         {
         auto noise_std = boost::lexical_cast<PrecisionType>(std_str[i]);
         noise_generators.push_back(std::normal_distribution<>(0,noise_std));
+        parameters << " " << noise_std;
         otbAppLogINFO("Noise std for band " << i << " equal to " << 
                       noise_std << "\n");
         }
       }    
 
-    std::string bvFileName = GetParameterString("bvfile");
-    std::string outFileName = GetParameterString("out");
-
-    try
-      {
-      m_SampleFile.open(bvFileName.c_str());
-      }
-    catch(...)
-      {
-      itkGenericExceptionMacro(<< "Could not open file " << bvFileName);
-      }
-
-    try
-      {
-      m_SimulationsFile.open(outFileName.c_str(), std::ofstream::out);
-      }
-    catch(...)
-      {
-      itkGenericExceptionMacro(<< "Could not open file " << outFileName);
-      }    
-
     AcquisitionParsType prosailPars;
     prosailPars[AcquisitionParameters::TTS] = m_SolarZenith;
     prosailPars[AcquisitionParameters::TTS_FAPAR] = m_SolarZenith_Fapar;
@@ -232,77 +231,122 @@ private:
     prosailPars[AcquisitionParameters::PSI] = m_Azimuth;
     
 
+    auto num_threads = std::thread::hardware_concurrency();
+    decltype(num_threads) num_requested_threads = 
+      num_threads;
+    if(IsParameterEnabled("threads"))
+      num_requested_threads = GetParameterInt("threads");
+
+    if(num_requested_threads < num_threads)
+      num_threads = num_requested_threads;
+
     otbAppLogINFO("Processing simulations ..." << std::endl);
-    auto bv_vec = parse_bv_sample_file(m_SampleFile);
+    auto bv_vec = parse_bv_sample_file(bvFileName, num_threads);
     auto sampleCount = bv_vec.size();
     otbAppLogINFO("" << sampleCount << " samples read."<< std::endl);
 
-    std::vector<SimulationType> simus{sampleCount};
-    
-    auto simulator = [&](std::vector<BVType>::const_iterator sample_first,
-                         std::vector<BVType>::const_iterator sample_last,
-                         std::vector<SimulationType>::iterator simu_first){
+    std::pair<std::size_t, std::size_t> range{0, sampleCount};
+    if(IsParameterEnabled("shard"))
+      {
+      auto shard = parse_shard(GetParameterString("shard"));
+      if(add_noise && !IsParameterEnabled("seed"))
+        {
+        itkGenericExceptionMacro(<< "A seed is needed for simulating shards "
+                                 << "with noise.");
+        }
+      range = shard_range(sampleCount, shard.first, shard.second);
+      otbAppLogINFO("Shard " << shard.first << "/" << shard.second 
+                    << ": samples " << range.first << " to " 
+                    << range.second << std::endl);
+      }
+
+    // without noise the output does not depend on the seed, which is 0
+    std::uint64_t seed{0};
+    if(add_noise)
+      seed = IsParameterEnabled("seed") ? 
+        static_cast<std::uint64_t>(GetParameterInt("seed")) : 
+        std::random_device{}();
+    SimulationManifest manifest{range.first, range.second, sampleCount, 0, 0, 
+        seed, false, false, parameters.str()};
+
+    if(GetParameterInt("resume") && std::ifstream(manifestFileName).good())
+      {
+      auto previous = read_manifest(manifestFileName);
+      if(previous.parameters != manifest.parameters || 
+         previous.first != manifest.first || previous.last != manifest.last ||
+         previous.total != manifest.total ||
+         (IsParameterEnabled("seed") && previous.seed != seed))
+        {
+        itkGenericExceptionMacro(<< "The progress manifest " << manifestFileName
+                                 << " does not match the current parameters.");
+        }
+      manifest = previous;
+      if(manifest.complete)
+        {
+        otbAppLogINFO("Simulation already complete in " << outFileName 
+                      << std::endl);
+        return;
+        }
+      // drop anything written after the last commit
+      resume_output(outFileName, manifest);
+      otbAppLogINFO("Resuming after " << manifest.committed 
+                    << " committed samples." << std::endl);
+      }
+    else
+      {
+      std::ofstream(outFileName.c_str(), std::ofstream::out);
+      }
+    write_manifest(manifest, manifestFileName);
+    seed = manifest.seed;
+    if(add_noise)
+      otbAppLogINFO("Noise seed is " << seed << std::endl);
+
+    otbAppLogINFO("Using " << num_threads << " threads for the simulations."
+                  << std::endl);
+
+    std::size_t chunk_size = std::max(GetParameterInt("chunk"), 1);
+    std::vector<SimulationType> simus(chunk_size);
+
+    auto simulator = [&](std::size_t chunk_first, 
+                         std::size_t sample_first, std::size_t sample_last){
       ProSailType prosail;
       prosail.SetRSR(satRSR);
       prosail.SetParameters(prosailPars);
-      while(sample_first != sample_last)
+      auto noise = noise_generators;
+      for(auto sample = sample_first; sample != sample_last; ++sample)
         {
-        prosail.SetBVs(*sample_first);
-        *simu_first = prosail();
+        auto& simu = simus[sample-chunk_first];
+        prosail.SetBVs(bv_vec[sample]);
+        simu = prosail();
         if(add_noise)
           {
+          // the noise of a sample only depends on the seed and its index
+          PhiloxRNG rng(seed, sample, SimulationNoiseStream);
           for(size_t i=0; i<nbBands; i++)
             {
-            (*simu_first)[i] += noise_generators[i](RNG);
+            noise[i].reset();
+            simu[i] += noise[i](rng);
             }
           }
-        ++sample_first;
-        ++simu_first;
         }
     };    
 
-    auto num_threads = std::thread::hardware_concurrency();
-    decltype(num_threads) num_requested_threads = 
-      num_threads;
-    if(IsParameterEnabled("threads"))
-      num_requested_threads = GetParameterInt("threads");
-
-    if(num_requested_threads < num_threads)
-      num_threads = num_requested_threads;
-
-
-    otbAppLogINFO("Using " << num_threads << " threads for the simulations."
-                  << std::endl);
-
-    auto block_size = sampleCount/num_threads;
-    auto remainder =  sampleCount%num_threads;
-    if(num_threads>=sampleCount) block_size = sampleCount;
-    std::vector<std::thread> threads(num_threads);
-    auto input_start = std::begin(bv_vec);
-    auto output_start = std::begin(simus);
-
-    for(size_t t=0; t<num_threads; ++t)
-      {
-      auto input_end = input_start;
-      std::advance(input_end, block_size);
-      if(t==(num_threads-1)) 
-        std::advance(input_end, remainder-1);
-      threads[t] = std::thread(simulator,
-                               input_start,
-                               input_end,
-                               output_start);
-      input_start = input_end;
-      std::advance(output_start, block_size);
-      }
-    std::for_each(threads.begin(),threads.end(),
-                  std::mem_fn(&std::thread::join));
-    
-    otbAppLogINFO("" << sampleCount << " samples processed."<< std::endl);
-
-    for(const auto& s : simus)
-      this->WriteSimulation(s);
+    append_committed_chunks(manifest, outFileName, manifestFileName, 
+                            chunk_size,
+                            [&](std::size_t chunk_first, 
+                                std::size_t chunk_last, std::ostream& os){
+      parallel_for_blocks(chunk_first, chunk_last, num_threads, 
+                          [&](std::size_t first, std::size_t last){
+                            simulator(chunk_first, first, last);
+                          });
+      for(auto sample = chunk_first; sample != chunk_last; ++sample)
+        this->WriteSimulation(simus[sample-chunk_first], os);
+      otbAppLogINFO("" << chunk_last-manifest.first << " / " 
+                    << manifest.last-manifest.first 
+                    << " samples simulated." << std::endl);
+      });
     
-    m_SimulationsFile.close();
+    otbAppLogINFO("" << manifest.committed << " samples processed."<< std::endl);
     otbAppLogINFO("Results saved in " << outFileName << std::endl);
   }
 
@@ -310,10 +354,6 @@ private:
   double m_SolarZenith;
   double m_SolarZenith_Fapar;
   double m_SensorZenith;
-  // the input file
-  std::ifstream m_SampleFile;
-  // the output file
-  std::ofstream m_SimulationsFile;
 };
 
 }
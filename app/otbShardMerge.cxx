@@ -0,0 +1,193 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbWrapperApplication.h"
+#include "otbWrapperApplicationFactory.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "otbBVUtil.h"
+
+namespace otb
+{
+namespace Wrapper
+{
+
+class ShardMerge : public Application
+{
+public:
+/** Standard class typedefs. */
+  typedef ShardMerge     Self;
+  typedef Application                   Superclass;
+
+/** Standard macro */
+  itkNewMacro(Self);
+
+  itkTypeMacro(ShardMerge, otb::Application);
+
+private:
+  void DoInit() override
+  {
+    SetName("ShardMerge");
+    SetDescription("Merge the shards produced by BVInputVariableGeneration or ProSailSimulator with the -shard option.");
+
+    AddParameter(ParameterType_InputFilenameList, "il", "Input shard files");
+    SetParameterDescription("il", "Output files of the shards. Their progress manifests (file name followed by .progress) are used to order and check them.");
+    MandatoryOn("il");
+
+    AddParameter(ParameterType_OutputFilename, "out", "Output file");
+    SetParameterDescription("out", "Filename where the merged samples are saved. The file is identical to the one produced by a single run with the same parameters and seed.");
+    MandatoryOn("out");
+  }
+
+  virtual ~ShardMerge() override
+  {
+  }
+
+  void DoUpdateParameters() override
+  {
+    // Nothing to do here : all parameters are independent
+  }
+
+  void DoExecute() override
+  {
+    using namespace otb::BV;
+    auto shardFileNames = GetParameterStringList("il");
+    std::vector<std::pair<SimulationManifest, std::string>> shards;
+    for(const auto& fileName : shardFileNames)
+      {
+      auto manifest = read_manifest(fileName+".progress");
+      if(!manifest.complete)
+        {
+        itkGenericExceptionMacro(<< "Shard " << fileName << " is not complete.");
+        }
+      shards.push_back(std::make_pair(manifest, fileName));
+      }
+    if(shards.empty())
+      {
+      itkGenericExceptionMacro(<< "No shard to merge.");
+      }
+    std::sort(shards.begin(), shards.end(),
+              [](const std::pair<SimulationManifest, std::string>& a,
+                 const std::pair<SimulationManifest, std::string>& b){
+                return a.first.first < b.first.first;
+              });
+
+    // The shards must come from the same configuration and cover all
+    // the samples without gaps nor overlaps
+    const auto& reference = shards.front().first;
+    std::size_t next_first{0};
+    for(const auto& shard : shards)
+      {
+      const auto& manifest = shard.first;
+      if(manifest.parameters != reference.parameters ||
+         manifest.seed != reference.seed ||
+         manifest.total != reference.total ||
+         manifest.header != reference.header)
+        {
+        itkGenericExceptionMacro(<< "Shard " << shard.second
+                                 << " was produced with different parameters than "
+                                 << shards.front().second);
+        }
+      if(manifest.first != next_first)
+        {
+        itkGenericExceptionMacro(<< "Samples " << next_first << " to "
+                                 << manifest.first << " are missing or duplicated before shard "
+                                 << shard.second);
+        }
+      if(manifest.committed != manifest.last-manifest.first)
+        {
+        itkGenericExceptionMacro(<< "Shard " << shard.second
+                                 << " does not contain all its samples.");
+        }
+      next_first = manifest.last;
+      }
+    if(next_first != reference.total)
+      {
+      itkGenericExceptionMacro(<< "Samples " << next_first << " to "
+                               << reference.total << " are missing.");
+      }
+
+    auto outFileName = GetParameterString("out");
+    std::ofstream outFile{outFileName, std::ofstream::out | std::ofstream::binary};
+    if(!outFile)
+      {
+      itkGenericExceptionMacro(<< "Could not open file " << outFileName);
+      }
+    std::uintmax_t bytes{0};
+    bool first_shard{true};
+    for(const auto& shard : shards)
+      {
+      std::ifstream shardFile{shard.second, std::ifstream::binary};
+      if(!shardFile)
+        {
+        itkGenericExceptionMacro(<< "Could not open file " << shard.second);
+        }
+      std::uintmax_t shard_bytes{0};
+      std::size_t lines{0};
+      std::string line;
+      if(shard.first.header)
+        {
+        // only the header of the first shard is kept
+        std::getline(shardFile, line);
+        shard_bytes += line.size()+1;
+        if(first_shard)
+          {
+          outFile << line << "\n";
+          bytes += line.size()+1;
+          }
+        }
+      while(std::getline(shardFile, line))
+        {
+        outFile << line << "\n";
+        shard_bytes += line.size()+1;
+        bytes += line.size()+1;
+        ++lines;
+        }
+      if(lines != shard.first.committed || shard_bytes != shard.first.bytes)
+        {
+        itkGenericExceptionMacro(<< "Shard " << shard.second << " has " << lines
+                                 << " samples (" << shard_bytes
+                                 << " bytes) but its manifest says "
+                                 << shard.first.committed << " ("
+                                 << shard.first.bytes << " bytes).");
+        }
+      otbAppLogINFO("Shard " << shard.second << ": samples "
+                    << shard.first.first << " to " << shard.first.last
+                    << std::endl);
+      first_shard = false;
+      }
+    outFile.close();
+    if(!outFile)
+      {
+      itkGenericExceptionMacro(<< "Could not write file " << outFileName);
+      }
+
+    // The merged file can itself be checked or merged
+    write_manifest({0, reference.total, reference.total, reference.total,
+          bytes, reference.seed, reference.header, true, reference.parameters},
+      outFileName+".progress");
+    otbAppLogINFO("" << reference.total << " samples from " << shards.size()
+                  << " shards saved in " << outFileName << std::endl);
+  }
+
+};
+
+}
+}
+
+OTB_APPLICATION_EXPORT(otb::Wrapper::ShardMerge)
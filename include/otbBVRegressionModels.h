@@ -0,0 +1,324 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBBVREGRESSIONMODELS_H
+#define __OTBBVREGRESSIONMODELS_H
+
+#include <vector>
+#include <string>
+#include <cfloat>
+#include <cstdio>
+#include "itkMacro.h"
+#include "otbBVTypes.h"
+#include "otbBVUtil.h"
+#include "otbBVSampleStore.h"
+#include "otbNeuralNetworkMachineLearningModel.h"
+#include "otbSVMMachineLearningModel.h"
+#include "otbRandomForestsMachineLearningModel.h"
+#include "otbMultiLinearRegressionModel.h"
+#include "otbMLPRegressionModel.h"
+
+namespace otb
+{
+namespace BV
+{
+/** The regression models used for the inversion and their
+    configuration, shared by the applications which learn them. */
+typedef MachineLearningModel<PrecisionType, PrecisionType> RegressionModelType;
+typedef otb::NeuralNetworkMachineLearningModel<PrecisionType,
+                                               PrecisionType> NeuralNetworkType;
+typedef otb::SVMMachineLearningModel<PrecisionType, PrecisionType> SVRType;
+typedef otb::RandomForestsMachineLearningModel<PrecisionType,
+                                               PrecisionType> RFRType;
+typedef otb::MultiLinearRegressionModel<PrecisionType> MLRType;
+typedef otb::MLPRegressionModel<PrecisionType> MLPType;
+
+inline
+NeuralNetworkType::Pointer NewNNRegression(std::size_t nbVars)
+{
+  auto regression = NeuralNetworkType::New();
+  regression->SetRegressionMode(true);
+  regression->SetTrainMethod(CvANN_MLP_TrainParams::BACKPROP);
+  // One hidden layer with 5 neurons and one output variable
+  regression->SetLayerSizes(std::vector<unsigned int>(
+    {static_cast<unsigned int>(nbVars), 5, 1}));
+  regression->SetActivateFunction(CvANN_MLP::SIGMOID_SYM);
+  regression->SetAlpha(0.5);
+  regression->SetBeta(1.0);
+  regression->SetBackPropDWScale(0.1);
+  regression->SetBackPropMomentScale(0.1);
+  regression->SetTermCriteriaType(CV_TERMCRIT_EPS);
+  regression->SetEpsilon(1e-10);
+  return regression;
+}
+
+inline
+SVRType::Pointer NewSVRRegression()
+{
+  auto regression = SVRType::New();
+  regression->SetSVMType(CvSVM::NU_SVR);
+  regression->SetNu(0.5);
+  regression->SetKernelType(CvSVM::RBF);
+  regression->SetTermCriteriaType(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS);
+  regression->SetMaxIter(100000);
+  regression->SetEpsilon(FLT_EPSILON);
+  regression->SetParameterOptimization(true);
+  return regression;
+}
+
+inline
+RFRType::Pointer NewRFRRegression()
+{
+  auto regression = RFRType::New();
+  regression->SetMaxDepth(10);
+  regression->SetMinSampleCount(1000);
+  regression->SetRegressionAccuracy(0.01);
+  regression->SetMaxNumberOfVariables(4);
+  regression->SetMaxNumberOfTrees(100);
+  regression->SetForestAccuracy(0.01);
+  regression->SetRegressionMode(true);
+  return regression;
+}
+
+inline
+MLRType::Pointer NewMLRRegression(std::size_t nbThreads=1)
+{
+  auto regression = MLRType::New();
+  regression->SetNumberOfThreads(nbThreads);
+  return regression;
+}
+
+/** Native multilayer perceptron with the topology of the neural
+    network ([nbVars, 5, 1] with a symmetric sigmoid) */
+inline
+MLPType::Pointer NewMLPRegression(std::size_t nbThreads, std::uint64_t seed,
+                                  MLPType::TrainMethodType method=
+                                  MLPType::TrainMethodType::ADAM)
+{
+  auto regression = MLPType::New();
+  regression->SetHiddenLayerSizes({5});
+  regression->SetAlpha(0.5);
+  regression->SetBeta(1.0);
+  regression->SetTrainMethod(method);
+  regression->SetNumberOfThreads(nbThreads);
+  regression->SetSeed(seed);
+  return regression;
+}
+
+/** Neural network learning the error of a regression model */
+inline
+NeuralNetworkType::Pointer NewErrorRegression(std::size_t nbVars)
+{
+  auto err_regression = NeuralNetworkType::New();
+  err_regression->SetRegressionMode(1);
+  err_regression->SetTrainMethod(CvANN_MLP_TrainParams::RPROP);
+  // One hidden layer with 5 neurons and one output variable
+  err_regression->SetLayerSizes(std::vector<unsigned int>(
+                                  {static_cast<unsigned int>(nbVars), 5, 1}));
+  err_regression->SetActivateFunction(CvANN_MLP::SIGMOID_SYM);
+  err_regression->SetAlpha(1.0);
+  err_regression->SetBeta(1.0);
+  err_regression->SetBackPropDWScale(0.1);
+  err_regression->SetBackPropMomentScale(0.1);
+  err_regression->SetTermCriteriaType(CV_TERMCRIT_EPS);
+  err_regression->SetEpsilon(1e-7);
+  return err_regression;
+}
+
+/** Empty model of a type named as by LoadRegressionModel, or a null
+    pointer if the name is unknown */
+inline
+RegressionModelType::Pointer NewRegressionModel(const std::string& typeName)
+{
+  RegressionModelType::Pointer regressor;
+  if(typeName == "NN")
+    regressor = NeuralNetworkType::New().GetPointer();
+  else if(typeName == "SVR")
+    regressor = SVRType::New().GetPointer();
+  else if(typeName == "RF")
+    regressor = RFRType::New().GetPointer();
+  else if(typeName == "MLR")
+    regressor = MLRType::New().GetPointer();
+  else if(typeName == "MLP")
+    regressor = MLPType::New().GetPointer();
+  return regressor;
+}
+
+/** Loads a model saved by one of the regressions. Its type is found in
+    the first lines of the file, or by the CanReadFile of each of the
+    regressions, which may parse the whole file, for the files which
+    are not recognized. The name of the type is returned in typeName. */
+inline
+RegressionModelType::Pointer LoadRegressionModel(const std::string& filename,
+                                                 std::string& typeName)
+{
+  typeName = sniff_model_type(filename);
+  auto regressor = NewRegressionModel(typeName);
+  if(regressor == nullptr)
+    {
+    auto nn_regressor = NeuralNetworkType::New();
+    auto svr_regressor = SVRType::New();
+    auto rfr_regressor = RFRType::New();
+    auto mlr_regressor = MLRType::New();
+    auto mlp_regressor = MLPType::New();
+    if(nn_regressor->CanReadFile(filename))
+      {
+      regressor = nn_regressor.GetPointer();
+      typeName = "NN";
+      }
+    else if(svr_regressor->CanReadFile(filename))
+      {
+      regressor = svr_regressor.GetPointer();
+      typeName = "SVR";
+      }
+    else if(rfr_regressor->CanReadFile(filename))
+      {
+      regressor = rfr_regressor.GetPointer();
+      typeName = "RF";
+      }
+    else if(mlr_regressor->CanReadFile(filename))
+      {
+      regressor = mlr_regressor.GetPointer();
+      typeName = "MLR";
+      }
+    else if(mlp_regressor->CanReadFile(filename))
+      {
+      regressor = mlp_regressor.GetPointer();
+      typeName = "MLP";
+      }
+    else
+      {
+      itkGenericExceptionMacro(<< "Model in file " << filename 
+                               << " is not valid.\n");
+      }
+    }
+  regressor->Load(filename);
+  regressor->SetRegressionMode(true);
+  return regressor;
+}
+
+/** Appends a loaded model to the models of the output variables: a
+    mlr model of several targets gives the model of each of them */
+inline
+void AppendOutputModels(RegressionModelType::Pointer regressor,
+                        std::vector<RegressionModelType::Pointer>& models)
+{
+  auto mlr = dynamic_cast<MLRType*>(regressor.GetPointer());
+  if(mlr == nullptr || mlr->GetNumberOfTargets() < 2)
+    {
+    models.push_back(regressor);
+    return;
+    }
+  for(std::size_t k = 0; k < mlr->GetNumberOfTargets(); ++k)
+    {
+    auto target = mlr->GetTargetModel(k);
+    target->SetRegressionMode(true);
+    models.push_back(target.GetPointer());
+    }
+}
+
+/** Loads the models of a container read by read_model_container,
+    with the loader of the type given by its header, and checks its
+    targets and normalization against the output variables */
+inline
+std::vector<RegressionModelType::Pointer>
+LoadContainerModels(const ModelContainer& container)
+{
+  if(NewRegressionModel(container.type) == nullptr)
+    {
+    itkGenericExceptionMacro(<< "Unknown model type " << container.type
+                             << " in model container " << container.filename);
+    }
+  std::vector<RegressionModelType::Pointer> models;
+  for(std::size_t k = 0; k < container.models.size(); ++k)
+    {
+    auto regressor = NewRegressionModel(container.type);
+    auto model_filename = extract_container_model(container, k);
+    try
+      {
+      regressor->Load(model_filename);
+      }
+    catch(...)
+      {
+      std::remove(model_filename.c_str());
+      throw;
+      }
+    std::remove(model_filename.c_str());
+    regressor->SetRegressionMode(true);
+    AppendOutputModels(regressor, models);
+    }
+  check_container_outputs(container, models.size(), container.filename);
+  return models;
+}
+
+/** Loads the models of the output variables: the ones of a model
+    container or of a model list written by write_model_list, or the
+    model of a single output variable (or of all of them for a mlr
+    model of several targets). */
+inline
+std::vector<RegressionModelType::Pointer> 
+LoadRegressionModels(const std::string& filename, std::string& typeName)
+{
+  ModelContainer container;
+  if(read_model_container(filename, container))
+    {
+    typeName = container.type;
+    return LoadContainerModels(container);
+    }
+  auto filenames = read_model_list(filename);
+  if(filenames.empty())
+    filenames.push_back(filename);
+  std::vector<RegressionModelType::Pointer> models;
+  for(const auto& f : filenames)
+    AppendOutputModels(LoadRegressionModel(f, typeName), models);
+  return models;
+}
+
+/** Residuals (estimate minus reference) of the models of the output
+    variables on the samples of a view, computed by blocks of samples
+    shared by nbThreads threads. The residual of the output variable o
+    for the sample k is at o*samples.Size()+k. Unless var_minmax is
+    empty, the residuals are normalized with the range of their output
+    variable, which follows the nbVars input ones. */
+template <typename ModelPointerType>
+std::vector<PrecisionType>
+ModelResiduals(const std::vector<ModelPointerType>& models,
+               const SampleView& samples, std::size_t nbVars,
+               const NormalizationVectorType& var_minmax,
+               std::size_t nbThreads)
+{
+  auto nbSamples = samples.Size();
+  auto nbOutputs = models.size();
+  std::vector<PrecisionType> errors(nbSamples*nbOutputs);
+  parallel_for_blocks(0, nbSamples, nbThreads,
+                      [&](std::size_t first, std::size_t last){
+    itk::VariableLengthVector<PrecisionType> inputValue;
+    for(auto k = first; k < last; ++k)
+      {
+      inputValue.SetData(const_cast<PrecisionType*>(samples.Input(k)),
+                         static_cast<unsigned int>(nbVars), false);
+      for(std::size_t output = 0; output < nbOutputs; ++output)
+        {
+        auto est_err = (models[output]->Predict(inputValue)[0] -
+                        samples.ForOutput(output).Output(k));
+        errors[output*nbSamples+k] = var_minmax.empty() ? est_err :
+          normalize(est_err, var_minmax[nbVars+output]);
+        }
+      }
+    });
+  return errors;
+}
+
+}//namespace BV
+}//namespace otb
+#endif
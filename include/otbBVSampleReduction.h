@@ -0,0 +1,292 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBBVSAMPLEREDUCTION_H
+#define __OTBBVSAMPLEREDUCTION_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include "itkMacro.h"
+#include "otbBVUtil.h"
+#include "otbBVSampleStore.h"
+#include "otbBVSampling.h"
+#include "otbPhiloxRNG.h"
+
+namespace otb
+{
+namespace BV
+{
+/** Reduction of a training set to a representative subset, for the
+    regressions whose training does not scale with the number of
+    samples. The samples come by groups of groupSize consecutive
+    samples of the view (the noisy copies of a simulation), which are
+    kept or dropped together, and a group is represented by its first
+    sample. The functions return the positions in the view of the
+    first samples of the kept groups, in increasing order. */
+enum class ReductionType {STRATIFIED, KMEANS, FARTHEST};
+
+/** Stratified sampling on the output variable of the view: the groups
+    sorted by output are split into nbKept strata of equal sizes and a
+    group is drawn at random in each of them, so that the subset
+    follows the distribution of the output. */
+inline
+std::vector<std::size_t> stratified_reduction(const SampleView& samples,
+                                              std::size_t groupSize,
+                                              std::size_t nbKept,
+                                              std::uint64_t seed,
+                                              std::uint32_t stream)
+{
+  auto nbGroups = samples.Size()/groupSize;
+  nbKept = std::min(nbKept, nbGroups);
+  std::vector<std::size_t> order(nbGroups);
+  for(std::size_t g = 0; g < nbGroups; ++g)
+    order[g] = g;
+  std::stable_sort(order.begin(), order.end(),
+                   [&samples, groupSize](std::size_t a, std::size_t b){
+                     return samples.Output(a*groupSize) <
+                       samples.Output(b*groupSize);
+                   });
+  std::vector<std::size_t> kept;
+  for(std::size_t s = 0; s < nbKept; ++s)
+    {
+    auto stratum = shard_range(nbGroups, s, nbKept);
+    PhiloxRNG rng(seed, s, stream);
+    auto k = stratum.first+static_cast<std::size_t>(
+      uniform_01(rng)*(stratum.second-stratum.first));
+    kept.push_back(order[std::min(k, stratum.second-1)]*groupSize);
+    }
+  std::sort(kept.begin(), kept.end());
+  return kept;
+}
+
+/** Input variables of the first samples of the groups scaled to [0, 1]
+    with their min and max, in which the distances of the k-means and
+    farthest point reductions are computed. The groups are stored one
+    after the other. */
+inline
+std::vector<PrecisionType> scaled_group_inputs(const SampleView& samples,
+                                               std::size_t groupSize)
+{
+  auto nbGroups = samples.Size()/groupSize;
+  auto nbVars = samples.NbInputs();
+  VarMinMax minmax(nbVars);
+  for(std::size_t g = 0; g < nbGroups; ++g)
+    minmax.Add(samples.Input(g*groupSize));
+  std::vector<PrecisionType> scaled(nbGroups*nbVars);
+  for(std::size_t g = 0; g < nbGroups; ++g)
+    for(std::size_t j = 0; j < nbVars; ++j)
+      {
+      auto range = minmax.MinMax()[j].second-minmax.MinMax()[j].first;
+      scaled[g*nbVars+j] = range > 0 ?
+        (samples.Input(g*groupSize)[j]-minmax.MinMax()[j].first)/range : 0;
+      }
+  return scaled;
+}
+
+inline
+PrecisionType square_distance(const PrecisionType* a, const PrecisionType* b,
+                              std::size_t nbVars)
+{
+  PrecisionType d{0};
+  for(std::size_t j = 0; j < nbVars; ++j)
+    d += (a[j]-b[j])*(a[j]-b[j]);
+  return d;
+}
+
+/** K-means (Lloyd's algorithm) with nbKept clusters of the scaled
+    inputs, started from groups drawn at random, and the group closest
+    to the centroid of each cluster. The groups are assigned to the
+    clusters by nbThreads threads and the centroids are summed in the
+    order of the groups, so that the subset only depends on the
+    seed. */
+inline
+std::vector<std::size_t> kmeans_reduction(const SampleView& samples,
+                                          std::size_t groupSize,
+                                          std::size_t nbKept,
+                                          std::uint64_t seed,
+                                          std::uint32_t stream,
+                                          std::size_t nbThreads,
+                                          std::size_t maxIterations=20)
+{
+  auto nbGroups = samples.Size()/groupSize;
+  auto nbVars = samples.NbInputs();
+  nbKept = std::min(nbKept, nbGroups);
+  if(nbKept == 0) return {};
+  auto x = scaled_group_inputs(samples, groupSize);
+  std::vector<PrecisionType> centroids(nbKept*nbVars);
+  auto key = PhiloxRNG(seed, 0, stream)();
+  for(std::size_t c = 0; c < nbKept; ++c)
+    {
+    auto g = static_cast<std::size_t>(permute_index(c, nbGroups, key));
+    std::copy(x.begin()+g*nbVars, x.begin()+(g+1)*nbVars,
+              centroids.begin()+c*nbVars);
+    }
+  std::vector<std::size_t> cluster(nbGroups, nbKept);
+  std::vector<PrecisionType> distance(nbGroups);
+  for(std::size_t iteration = 0; iteration < maxIterations; ++iteration)
+    {
+    std::vector<std::size_t> changes(nbThreads, 0);
+    parallel_for_blocks(0, nbThreads, nbThreads,
+                        [&](std::size_t t_first, std::size_t t_last){
+      for(auto t = t_first; t < t_last; ++t)
+        {
+        auto groups = shard_range(nbGroups, t, nbThreads);
+        for(auto g = groups.first; g < groups.second; ++g)
+          {
+          auto best = nbKept;
+          auto best_d = std::numeric_limits<PrecisionType>::max();
+          for(std::size_t c = 0; c < nbKept; ++c)
+            {
+            auto d = square_distance(x.data()+g*nbVars,
+                                     centroids.data()+c*nbVars, nbVars);
+            if(d < best_d)
+              {
+              best_d = d;
+              best = c;
+              }
+            }
+          if(best != cluster[g]) ++changes[t];
+          cluster[g] = best;
+          distance[g] = best_d;
+          }
+        }
+      });
+    std::size_t nbChanges{0};
+    for(auto c : changes)
+      nbChanges += c;
+    // the last assignment is the one to the current centroids
+    if(nbChanges == 0 || iteration+1 == maxIterations) break;
+    // the centroids of the empty clusters are left where they are
+    std::vector<PrecisionType> sums(nbKept*nbVars, 0);
+    std::vector<std::size_t> counts(nbKept, 0);
+    for(std::size_t g = 0; g < nbGroups; ++g)
+      {
+      ++counts[cluster[g]];
+      for(std::size_t j = 0; j < nbVars; ++j)
+        sums[cluster[g]*nbVars+j] += x[g*nbVars+j];
+      }
+    for(std::size_t c = 0; c < nbKept; ++c)
+      if(counts[c] > 0)
+        for(std::size_t j = 0; j < nbVars; ++j)
+          centroids[c*nbVars+j] = sums[c*nbVars+j]/counts[c];
+    }
+  std::vector<std::size_t> closest(nbKept, nbGroups);
+  for(std::size_t g = 0; g < nbGroups; ++g)
+    {
+    auto c = cluster[g];
+    if(closest[c] == nbGroups || distance[g] < distance[closest[c]])
+      closest[c] = g;
+    }
+  std::vector<std::size_t> kept;
+  for(auto g : closest)
+    if(g < nbGroups)
+      kept.push_back(g*groupSize);
+  std::sort(kept.begin(), kept.end());
+  return kept;
+}
+
+/** Greedy farthest point coreset (Gonzalez, 1985) of the scaled
+    inputs: starting from a group drawn at random, the group the
+    farthest from the ones already kept is added until nbKept groups
+    are kept. The subset covers the input space, extremes included, with
+    a radius at most twice the optimal one. */
+inline
+std::vector<std::size_t> farthest_point_reduction(const SampleView& samples,
+                                                  std::size_t groupSize,
+                                                  std::size_t nbKept,
+                                                  std::uint64_t seed,
+                                                  std::uint32_t stream,
+                                                  std::size_t nbThreads)
+{
+  auto nbGroups = samples.Size()/groupSize;
+  auto nbVars = samples.NbInputs();
+  nbKept = std::min(nbKept, nbGroups);
+  if(nbKept == 0) return {};
+  auto x = scaled_group_inputs(samples, groupSize);
+  // distance of each group to the closest kept one
+  std::vector<PrecisionType> distance(nbGroups,
+                                      std::numeric_limits<PrecisionType>::max());
+  std::vector<std::size_t> kept;
+  PhiloxRNG rng(seed, 0, stream);
+  auto next = std::min(static_cast<std::size_t>(uniform_01(rng)*nbGroups),
+                       nbGroups-1);
+  // farthest group of each thread, the first one in case of a tie
+  std::vector<std::pair<PrecisionType, std::size_t>> farthest(nbThreads);
+  while(kept.size() < nbKept)
+    {
+    kept.push_back(next);
+    parallel_for_blocks(0, nbThreads, nbThreads,
+                        [&](std::size_t t_first, std::size_t t_last){
+      for(auto t = t_first; t < t_last; ++t)
+        {
+        auto groups = shard_range(nbGroups, t, nbThreads);
+        farthest[t] = {-1, nbGroups};
+        for(auto g = groups.first; g < groups.second; ++g)
+          {
+          distance[g] = std::min(distance[g],
+                                 square_distance(x.data()+g*nbVars,
+                                                 x.data()+next*nbVars,
+                                                 nbVars));
+          if(distance[g] > farthest[t].first)
+            farthest[t] = {distance[g], g};
+          }
+        }
+      });
+    auto best = farthest[0];
+    for(const auto& f : farthest)
+      if(f.first > best.first)
+        best = f;
+    // only duplicates of the kept groups are left
+    if(best.first <= 0) break;
+    next = best.second;
+    }
+  for(auto& g : kept)
+    g *= groupSize;
+  std::sort(kept.begin(), kept.end());
+  return kept;
+}
+
+/** Positions of the first samples of the groups kept by a reduction */
+inline
+std::vector<std::size_t> reduce_samples(ReductionType type,
+                                        const SampleView& samples,
+                                        std::size_t groupSize,
+                                        std::size_t nbKept,
+                                        std::uint64_t seed,
+                                        std::uint32_t stream,
+                                        std::size_t nbThreads)
+{
+  if(groupSize == 0 || nbThreads == 0)
+    {
+    itkGenericExceptionMacro(<< "The groups of samples and the number of "
+                             << "threads of a reduction must be positive.");
+    }
+  switch(type)
+    {
+    case ReductionType::STRATIFIED:
+      return stratified_reduction(samples, groupSize, nbKept, seed, stream);
+    case ReductionType::KMEANS:
+      return kmeans_reduction(samples, groupSize, nbKept, seed, stream,
+                              nbThreads);
+    case ReductionType::FARTHEST:
+      return farthest_point_reduction(samples, groupSize, nbKept, seed,
+                                      stream, nbThreads);
+    }
+  return {};
+}
+
+}//namespace BV
+}//namespace otb
+#endif
@@ -0,0 +1,292 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBBVSAMPLESTORE_H
+#define __OTBBVSAMPLESTORE_H
+
+#include <vector>
+#include <limits>
+#include <utility>
+#include "itkMacro.h"
+#include "otbBVTypes.h"
+#include "otbBVUtil.h"
+
+namespace otb
+{
+namespace BV
+{
+
+/** Samples of a regression stored in a single contiguous buffer. A
+    sample is a row made of the nbInputs input variables followed by
+    the nbOutputs output variables, which is the order of the
+    normalization vectors. */
+class SampleStore
+{
+public:
+  explicit SampleStore(std::size_t nbInputs=0, std::size_t nbOutputs=1) : 
+    m_NbInputs{nbInputs}, m_NbOutputs{nbOutputs} {}
+
+  /** Store taking over rows of nbInputs+nbOutputs values already laid
+      out as the ones of the store */
+  SampleStore(std::size_t nbInputs, std::vector<PrecisionType>&& data,
+              std::size_t nbOutputs=1) :
+    m_NbInputs{nbInputs}, m_NbOutputs{nbOutputs}, m_Data(std::move(data))
+  {
+    if(m_Data.size()%RowSize() != 0)
+      {
+      itkGenericExceptionMacro(<< "The number of values is not a multiple "
+                               << "of the size of a sample.");
+      }
+  }
+
+  std::size_t Size() const
+  {
+    return m_Data.size()/RowSize();
+  }
+
+  std::size_t NbInputs() const
+  {
+    return m_NbInputs;
+  }
+
+  std::size_t NbOutputs() const
+  {
+    return m_NbOutputs;
+  }
+
+  /** Number of values of a sample */
+  std::size_t RowSize() const
+  {
+    return m_NbInputs+m_NbOutputs;
+  }
+
+  void Reserve(std::size_t nbSamples)
+  {
+    m_Data.reserve(nbSamples*RowSize());
+  }
+
+  /** Appends a sample of a single output variable given by its input
+      variables (anything indexable from 0 to nbInputs-1) and its output
+      value */
+  template<typename InputType>
+  void PushBack(const InputType& inputs, PrecisionType output)
+  {
+    for(std::size_t var = 0; var < m_NbInputs; ++var)
+      m_Data.push_back(inputs[var]);
+    m_Data.push_back(output);
+  }
+
+  const PrecisionType* Input(std::size_t i) const
+  {
+    return m_Data.data()+i*RowSize();
+  }
+
+  PrecisionType* Input(std::size_t i)
+  {
+    return m_Data.data()+i*RowSize();
+  }
+
+  PrecisionType Output(std::size_t i, std::size_t output=0) const
+  {
+    return m_Data[i*RowSize()+m_NbInputs+output];
+  }
+
+  PrecisionType& Output(std::size_t i, std::size_t output=0)
+  {
+    return m_Data[i*RowSize()+m_NbInputs+output];
+  }
+
+protected:
+  std::size_t m_NbInputs;
+  std::size_t m_NbOutputs;
+  std::vector<PrecisionType> m_Data;
+};
+
+/** Subset of the samples of a store, used instead of a copy of the
+    samples for the training and the evaluation of the models. The
+    subset is either a range of the store or a list of indices, which
+    can be any selection or permutation of the samples. The output of
+    the view is one of the output variables of the store (the first one
+    by default). The store must outlive the view. */
+class SampleView
+{
+public:
+  SampleView(const SampleStore& store, std::size_t first, std::size_t last) :
+    m_Store{&store}, m_First{first}, m_Last{last}, m_IsRange{true},
+    m_Output{0}
+  {
+    if(first > last || last > store.Size())
+      {
+      itkGenericExceptionMacro(<< "Range [" << first << ", " << last
+                               << ") out of a store of " << store.Size()
+                               << " samples.");
+      }
+  }
+
+  SampleView(const SampleStore& store, std::vector<std::size_t> indices) :
+    m_Store{&store}, m_First{0}, m_Last{0}, m_IsRange{false}, m_Output{0},
+    m_Indices(std::move(indices)) {}
+
+  std::size_t Size() const
+  {
+    return m_IsRange ? m_Last-m_First : m_Indices.size();
+  }
+
+  std::size_t NbInputs() const
+  {
+    return m_Store->NbInputs();
+  }
+
+  const SampleStore& Store() const
+  {
+    return *m_Store;
+  }
+
+  /** Index in the store of the k-th sample of the view */
+  std::size_t Index(std::size_t k) const
+  {
+    return m_IsRange ? m_First+k : m_Indices[k];
+  }
+
+  const PrecisionType* Input(std::size_t k) const
+  {
+    return m_Store->Input(Index(k));
+  }
+
+  PrecisionType Output(std::size_t k) const
+  {
+    return m_Store->Output(Index(k), m_Output);
+  }
+
+  std::size_t NbOutputs() const
+  {
+    return m_Store->NbOutputs();
+  }
+
+  /** Output variable number output of the k-th sample, for the
+      regressions which fit all the output variables at once */
+  PrecisionType Output(std::size_t k, std::size_t output) const
+  {
+    return m_Store->Output(Index(k), output);
+  }
+
+  /** Output variable of the store given by Output() */
+  std::size_t OutputVariable() const
+  {
+    return m_Output;
+  }
+
+  /** The same samples with the output variable number output */
+  SampleView ForOutput(std::size_t output) const
+  {
+    if(output >= m_Store->NbOutputs())
+      {
+      itkGenericExceptionMacro(<< "Output variable " << output 
+                               << " out of a store of " 
+                               << m_Store->NbOutputs() << " outputs.");
+      }
+    auto view = *this;
+    view.m_Output = output;
+    return view;
+  }
+
+  /** View of the samples [first, last) of this view */
+  SampleView Slice(std::size_t first, std::size_t last) const
+  {
+    if(m_IsRange)
+      return SampleView(*m_Store, m_First+first, 
+                        m_First+last).ForOutput(m_Output);
+    return SampleView(*m_Store,
+                      std::vector<std::size_t>(m_Indices.begin()+first,
+                                               m_Indices.begin()+last))
+      .ForOutput(m_Output);
+  }
+
+protected:
+  const SampleStore* m_Store;
+  std::size_t m_First;
+  std::size_t m_Last;
+  bool m_IsRange;
+  std::size_t m_Output;
+  std::vector<std::size_t> m_Indices;
+};
+
+/** Minimum and maximum of each variable of rows of samples, updated
+    row by row. Each thread accumulates the rows it handles in its own
+    instance and the partial results are merged at the end. */
+class VarMinMax
+{
+public:
+  explicit VarMinMax(std::size_t nbVariables=0) :
+    m_MinMax{nbVariables, {std::numeric_limits<PrecisionType>::max(),
+          std::numeric_limits<PrecisionType>::lowest()}} {}
+
+  void Add(const PrecisionType* row)
+  {
+    for(std::size_t var = 0; var < m_MinMax.size(); ++var)
+      {
+      if(row[var] < m_MinMax[var].first)
+        m_MinMax[var].first = row[var];
+      if(row[var] > m_MinMax[var].second)
+        m_MinMax[var].second = row[var];
+      }
+  }
+
+  void Merge(const VarMinMax& other)
+  {
+    for(std::size_t var = 0; var < m_MinMax.size(); ++var)
+      {
+      if(other.m_MinMax[var].first < m_MinMax[var].first)
+        m_MinMax[var].first = other.m_MinMax[var].first;
+      if(other.m_MinMax[var].second > m_MinMax[var].second)
+        m_MinMax[var].second = other.m_MinMax[var].second;
+      }
+  }
+
+  const NormalizationVectorType& MinMax() const
+  {
+    return m_MinMax;
+  }
+
+protected:
+  NormalizationVectorType m_MinMax;
+};
+
+/** Minimum and maximum of each input variable and of the output
+    variables of the samples */
+inline
+NormalizationVectorType estimate_var_minmax(const SampleView& samples)
+{
+  // the output variables follow the input ones in the row
+  VarMinMax minmax(samples.Store().RowSize());
+  for(std::size_t k = 0; k < samples.Size(); ++k)
+    minmax.Add(samples.Input(k));
+  return minmax.MinMax();
+}
+
+/** Normalizes in place the input and output variables of the samples
+    [first, last) of the store with nbThreads threads */
+inline
+void normalize_samples(SampleStore& store, std::size_t first, 
+                       std::size_t last, 
+                       const NormalizationVectorType& var_minmax,
+                       std::size_t nbThreads=1)
+{
+  if(first >= last) return;
+  normalize_rows(store.Input(first), last-first, store.RowSize(),
+                 var_minmax, nbThreads);
+}
+
+}//namespace BV
+}//namespace otb
+#endif
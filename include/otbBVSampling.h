@@ -0,0 +1,156 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBBVSAMPLING_H
+#define __OTBBVSAMPLING_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include "itkMacro.h"
+#include "otbBVUtil.h"
+#include "otbPhiloxRNG.h"
+
+namespace otb
+{
+namespace BV
+{
+
+enum class SamplingType {RANDOM, LHS, SOBOL};
+
+/** Sobol low discrepancy sequence with the direction numbers of Joe and
+    Kuo (2008, new-joe-kuo-6.21201) for the first dimensions. Any point
+    is computed directly from its index, so that the sequence can be
+    split among threads and processes. A random digital shift and a
+    random position inside the 2^-32 cell, both keyed by the seed, make
+    the points unbiased while keeping the stratification of the
+    sequence. */
+class SobolSequence
+{
+public:
+  static constexpr unsigned int MaxDimension = 10;
+  static constexpr unsigned int NbBits = 32;
+
+  SobolSequence(unsigned int dimension, std::uint64_t seed) :
+    m_Dimension{dimension}, m_Seed{seed}
+  {
+    if(dimension > MaxDimension)
+      {
+      itkGenericExceptionMacro(<< "Sobol sequences are available up to "
+                               << MaxDimension << " dimensions.");
+      }
+    // s, a and the s first m_k for the dimensions 2 to MaxDimension
+    const std::vector<std::vector<std::uint32_t>> joe_kuo{
+      {1, 0, 1}, {2, 1, 1, 3}, {3, 1, 1, 3, 1}, {3, 2, 1, 1, 1},
+      {4, 1, 1, 1, 3, 3}, {4, 4, 1, 3, 5, 13}, {5, 2, 1, 1, 5, 5, 17},
+      {5, 4, 1, 1, 5, 5, 5}, {5, 7, 1, 1, 7, 11, 19}};
+    m_Directions.resize(dimension);
+    for(unsigned int dim = 0; dim < dimension; ++dim)
+      {
+      auto& v = m_Directions[dim];
+      if(dim == 0)
+        {
+        for(unsigned int k = 0; k < NbBits; ++k)
+          v[k] = std::uint32_t{1} << (NbBits-1-k);
+        }
+      else
+        {
+        const auto& pars = joe_kuo[dim-1];
+        auto s = pars[0];
+        auto a = pars[1];
+        for(unsigned int k = 0; k < s; ++k)
+          v[k] = pars[2+k] << (NbBits-1-k);
+        for(unsigned int k = s; k < NbBits; ++k)
+          {
+          v[k] = v[k-s] ^ (v[k-s] >> s);
+          for(unsigned int j = 1; j < s; ++j)
+            if((a >> (s-1-j)) & 1) v[k] ^= v[k-j];
+          }
+        }
+      m_Shift.push_back(PhiloxRNG(seed, dim, 0xffffffff)());
+      }
+  }
+
+  /** Coordinate dim of the point of the given index, in (0, 1) */
+  double Get(std::uint64_t index, unsigned int dim) const
+  {
+    if(index >> NbBits)
+      {
+      itkGenericExceptionMacro(<< "Sobol sequences are limited to 2^"
+                               << NbBits << " points.");
+      }
+    // Gray code order: point i is the xor of the directions of the
+    // bits of i^(i>>1)
+    auto gray = index ^ (index >> 1);
+    std::uint32_t x{m_Shift[dim]};
+    for(unsigned int k = 0; gray; ++k, gray >>= 1)
+      if(gray & 1) x ^= m_Directions[dim][k];
+    PhiloxRNG rng(m_Seed, index, dim+1);
+    return (x+uniform_01(rng))/4294967296.0;
+  }
+
+protected:
+  unsigned int m_Dimension;
+  std::uint64_t m_Seed;
+  std::vector<std::array<std::uint32_t, NbBits>> m_Directions;
+  std::vector<std::uint32_t> m_Shift;
+};
+
+/** Pseudo-random permutation of [0, n) evaluated index by index: a 4
+    round Feistel network on the smallest even number of bits covering
+    n, with cycle walking for the values outside [0, n). */
+inline
+std::uint64_t permute_index(std::uint64_t index, std::uint64_t n,
+                            std::uint64_t key)
+{
+  if(n < 2) return 0;
+  unsigned int half_bits{1};
+  while((std::uint64_t{1} << (2*half_bits)) < n) ++half_bits;
+  const std::uint64_t mask{(std::uint64_t{1} << half_bits)-1};
+  auto mix = [](std::uint64_t z){
+    // splitmix64 finalizer
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  };
+  do
+    {
+    auto left = index >> half_bits;
+    auto right = index & mask;
+    for(std::uint64_t round = 0; round < 4; ++round)
+      {
+      auto f = mix(right ^ mix(key+round)) & mask;
+      auto new_right = left ^ f;
+      left = right;
+      right = new_right;
+      }
+    index = (left << half_bits) | right;
+    }
+  while(index >= n);
+  return index;
+}
+
+/** Coordinate dim of point index of a Latin hypercube of n points: each
+    of the n strata of every dimension holds exactly one point. */
+inline
+double lhs_value(std::uint64_t index, std::uint64_t n, unsigned int dim,
+                 std::uint64_t seed)
+{
+  auto stratum = permute_index(index, n, PhiloxRNG(seed, dim, 0xfffffffe)());
+  PhiloxRNG rng(seed, index, dim+1);
+  return (stratum+uniform_01(rng))/n;
+}
+
+}//namespace BV
+}//namespace otb
+#endif
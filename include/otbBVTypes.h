@@ -48,6 +48,23 @@ struct VarParams {
 };
   
 typedef std::map< IVNames, double > SampleType;
+
+/** Distributions of the input variables of the simulations. The
+    defaults are the ones of BV-Net. */
+struct BVDistributions {
+  VarParams MLAI = {0.0, 15.0, 2.0, 2.0, 0, 0, true, 6, DistType::LOGNORMAL};
+  VarParams ALA = {30.0, 80.0, 60.0, 20.0, 55, 65, true, 3, DistType::GAUSSIAN};
+  VarParams CrownCover = {0.95, 1.0, 0.8, 0.4, 0.95, 1.0, true, 1, DistType::UNIFORM};
+  VarParams HsD = {0.1, 0.5, 0.2, 0.5, 0.1, 0.5, true, 1, DistType::GAUSSIAN};
+  VarParams N = {1.20, 2.20, 1.50, 0.30, 1.30, 1.80, true, 3, DistType::GAUSSIAN};
+  VarParams Cab = {20.0, 90.0, 45.0, 30.0, 45, 90, true, 4, DistType::GAUSSIAN};
+  /* Car distribution will not be used and Car=Cab/4, but we keep it here for future evolutions*/
+  VarParams Car = {0.0, 25.0, 8.58, 3.95, 0, 0, true, 1, DistType::GAUSSIAN};
+  VarParams Cdm = {0.0030, 0.0110, 0.0050, 0.0050, 0.0050, 0.0110, true, 4, DistType::GAUSSIAN};
+  VarParams CwRel = {0.60, 0.85, 0.75, 0.08, 0.70, 0.80, true, 4, DistType::UNIFORM};
+  VarParams Cbp = {0.00, 2.00, 0.00, 0.30, 0.00, 0.20, true, 3, DistType::GAUSSIAN};
+  VarParams Bs = {0.0, 1.00, 0.5, 2.00, 0.50, 1.20, true, 4, DistType::GAUSSIAN};
+};
 }//namespace BV
 }//namespace otb
 #endif
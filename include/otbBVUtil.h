@@ -16,29 +16,152 @@
 
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <limits>
+#include <vector>
+#include <thread>
+#include <exception>
+#include <cstdint>
+#include <array>
+#include <algorithm>
+#include "itkMacro.h"
 #include "otbBVTypes.h"
 
 namespace otb
 {
 size_t countColumns(std::string fileName);
 
+/** Truncates a file to the given size in bytes. */
+void truncate_file(const std::string& fileName, std::uintmax_t size);
+
+/** Values of an ASCII file of whitespace separated numbers, one row per
+    line which is not blank. Only the first nbColumns values of a line
+    are kept, and a line with fewer values is an error. "nan" values
+    are read as NaN and left to the caller. */
+struct TextTable {
+  std::size_t nbColumns;
+  std::vector<double> values;
+
+  std::size_t Rows() const
+  {
+    return nbColumns ? values.size()/nbColumns : 0;
+  }
+
+  const double* Row(std::size_t i) const
+  {
+    return values.data()+i*nbColumns;
+  }
+
+  double* Row(std::size_t i)
+  {
+    return values.data()+i*nbColumns;
+  }
+};
+
+/** Reads a file of whitespace separated numbers. The file is memory
+    mapped and split into chunks of whole lines which are parsed by
+    nbThreads threads. When nbColumns is 0, it is the number of values
+    of the first row. The first line is skipped if skipHeader is
+    true. */
+TextTable read_text_table(const std::string& fileName, 
+                          std::size_t nbColumns=0, bool skipHeader=false, 
+                          std::size_t nbThreads=1);
+
+/** Splits [first, last) into nbThreads contiguous blocks and calls
+    f(block_first, block_last) for each of them in its own thread. An
+    exception thrown by any block is rethrown in the calling thread once
+    all the blocks have finished. */
+template<typename F>
+void parallel_for_blocks(std::size_t first, std::size_t last,
+                         std::size_t nbThreads, F f)
+{
+  auto n = last-first;
+  if(nbThreads > n) nbThreads = n;
+  if(nbThreads < 2)
+    {
+    if(n > 0) f(first, last);
+    return;
+    }
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(nbThreads);
+  for(std::size_t t=0; t<nbThreads; ++t)
+    {
+    auto block_first = first+(n*t)/nbThreads;
+    auto block_last = first+(n*(t+1))/nbThreads;
+    threads.emplace_back([&f, &errors, t, block_first, block_last](){
+        try
+          {
+          f(block_first, block_last);
+          }
+        catch(...)
+          {
+          errors[t] = std::current_exception();
+          }
+      });
+    }
+  for(auto& th : threads)
+    th.join();
+  for(auto& e : errors)
+    if(e) std::rethrow_exception(e);
+}
+
 namespace BV
 {
 
 //Generates a random number of the appropriate distribution and respecting the bounds
 template<typename RNGType>
 double Rng(otb::BV::VarParams vpars, RNGType& rngen);
+//Uniform random number in (0,1) with 53 random bits
+template<typename RNGType>
+double uniform_01(RNGType& rngen);
+
+/** Cumulative distribution function of the standard normal law */
+double normal_cdf(double x);
+/** Inverse of normal_cdf (Acklam's approximation refined by a Halley
+    step, relative error below 1e-15) */
+double normal_quantile(double p);
+/** Quantile function of the standard normal law truncated to [a, b].
+    The computation is done in the tail where the CDF is accurate, and
+    an exponential approximation is used when the whole interval is so
+    far in the tail that the CDF underflows. */
+double truncated_normal_quantile(double u, double a, double b);
+/** Quantile function of the distribution of a variable: uniform,
+    gaussian or lognormal (the gaussian being the one of the log) of
+    parameters mod and std, truncated to [min, max]. It maps a uniform
+    value in [0, 1] to a sample of the variable. */
+double VarQuantile(VarParams vpars, double u);
+/** Logarithm of the probability mass of the standard normal law on
+    [a, b], accurate in the tails */
+double log_normal_mass(double a, double b);
+/** Logarithm of the probability density of the distribution sampled
+    by VarQuantile (-infinity outside [min, max]). Used to compute
+    importance weights between two distributions of a variable. */
+double VarLogDensity(VarParams vpars, double x);
 double CorrelateValue(double v, double lai, VarParams vpars, VarParams laipars);
 
+/// Number of independently drawn variables of a sample (Car is derived from Cab)
+constexpr std::size_t NbDrawnVariables = 10;
+using UniformsType = std::array<double, NbDrawnVariables>;
+/** PhiloxRNG stream of the noise that ProSailSimulator adds to the
+    simulation of a sample. The variables of the sample are drawn from
+    the streams 0 to NbDrawnVariables with the same seed and index, so
+    this one keeps the noise independent of the variables when both
+    applications are given the same seed. */
+constexpr std::uint32_t SimulationNoiseStream{0xfffffff0};
+/** Builds a sample from NbDrawnVariables uniform values in (0,1), in
+    the order MLAI, ALA, CrownCover, HsD, N, Cab, Cdm, CwRel, Cbp, Bs:
+    each value is mapped by the quantile function of its variable and
+    the variables are correlated with the LAI. */
+SampleType DrawSample(const BVDistributions& d, const UniformsType& u);
+
 template<typename II, typename OI>
 inline
 NormalizationVectorType estimate_var_minmax(II& ivIt, II& ivLast, OI& ovIt, OI& ovLast)
 {
 
   std::size_t nbInputVariables{ivIt.GetMeasurementVector().Size()};
-  NormalizationVectorType var_minmax{nbInputVariables+1, {std::numeric_limits<PrecisionType>::max(), std::numeric_limits<PrecisionType>::min()}};
+  NormalizationVectorType var_minmax{nbInputVariables+1, {std::numeric_limits<PrecisionType>::max(), std::numeric_limits<PrecisionType>::lowest()}};
       while(ovIt != ovLast &&
             ivIt != ivLast)
         {
@@ -77,6 +200,172 @@ void write_normalization_file(const NVT& var_minmax, const std::string out_filen
 
 NormalizationVectorType read_normalization_file(const std::string in_filename);
 
+/** The model of several output variables is a text file listing the
+    models of the output variables, in the order of the outputs, after
+    a header line. The names of the models are relative to the
+    directory of the list. */
+void write_model_list(const std::vector<std::string>& model_filenames,
+                      const std::string out_filename);
+
+/** Paths of the models listed in a model list file, or an empty
+    vector if the file is not a model list */
+std::vector<std::string> read_model_list(const std::string in_filename);
+
+/** Model container: a single file holding the regression models of
+    the output variables and what is needed to apply them. The header
+    is made of text lines:
+
+    # BV model container
+    type MLP                    (the type of all the models)
+    targets lai fcover          (name of each output variable)
+    bands B3 B4 B8 B11          (order of the input variables)
+    sensor sentinel2_10m.rsr    (sensor or RSR id)
+    geometry 30 0 0             (solar zenith, sensor zenith, azimuth)
+    normalization 6             (min and max of the input and output
+    ...                          variables, one line per variable)
+    models 2
+    model 1234                  (size in bytes of the saved model)
+    ...                         (the saved model)
+
+    Only type and models are mandatory. The models are the files saved
+    by the regressions, copied byte for byte. */
+struct ModelContainer {
+  std::string type;
+  std::vector<std::string> targets;
+  std::vector<std::string> bands;
+  std::string sensor;
+  std::vector<PrecisionType> geometry;
+  NormalizationVectorType normalization;
+  /** Container file and position and size of the saved models in it,
+      filled by read_model_container */
+  std::string filename;
+  std::vector<std::pair<std::uintmax_t, std::uintmax_t>> models;
+};
+
+/** Writes a container with the header and the model files, in the
+    order of the output variables. nbOutputs is the number of output
+    variables of the models, which is larger than the number of files
+    when a mlr model has several targets. */
+void write_model_container(const ModelContainer& container,
+                           const std::vector<std::string>& model_filenames,
+                           std::size_t nbOutputs,
+                           const std::string out_filename);
+
+/** Checks the targets and the normalization of a container against
+    the number of output variables of its models */
+void check_container_outputs(const ModelContainer& container,
+                             std::size_t nbOutputs,
+                             const std::string& filename);
+
+/** Reads the header of a container and the positions of its models,
+    which are skipped: only the first line is read if the file is not
+    a container, in which case false is returned. */
+bool read_model_container(const std::string in_filename,
+                          ModelContainer& container);
+
+/** Copies the model k of a container to a temporary file, for the
+    loaders of the regressions which read files, and returns its
+    name. The caller removes the file. */
+std::string extract_container_model(const ModelContainer& container,
+                                    std::size_t k);
+
+/** Description of the models of a container (number, type, targets,
+    sensor and geometry) for the logs */
+std::string describe_model_container(const ModelContainer& container);
+
+/** Type of the model saved in a file (NN, SVR, RF, MLR or MLP) found in
+    its first lines, or an empty string if it is not recognized */
+std::string sniff_model_type(const std::string in_filename);
+
+/** Progress of a long simulation run. The manifest is rewritten after
+    every committed chunk of output, so that an interrupted run can be
+    resumed from the last commit: the first "bytes" bytes of the output
+    file are the header line, if there is one, and the samples [first,
+    first+committed), so that a resumed run truncates the file to
+    "bytes". [first, last) is the range of sample indices handled
+    by the run out of total samples (a shard when it is not [0,
+    total)). The parameters string is used to check that a resumed run
+    or the shards to be merged use the same configuration. */
+struct SimulationManifest {
+  std::size_t first;
+  std::size_t last;
+  std::size_t total;
+  std::size_t committed;
+  std::uintmax_t bytes;
+  std::uint64_t seed;
+  bool header;
+  bool complete;
+  std::string parameters;
+};
+
+/** Writes the manifest to a temporary file which is then renamed, so
+    that the manifest on disk is always a complete one. */
+void write_manifest(const SimulationManifest& manifest, 
+                    const std::string out_filename);
+
+SimulationManifest read_manifest(const std::string in_filename);
+
+/** Drops what was written to the output file of an interrupted run
+    after the last commit of its manifest. An output file shorter than
+    the committed bytes (a partial copy, for instance) is an error, as
+    it cannot hold the committed samples. */
+void resume_output(const std::string& out_filename, 
+                   const SimulationManifest& manifest);
+
+/** Appends the samples [first+committed, last) of the manifest to the
+    output file by chunks of chunkSize samples. write_chunk(first, last,
+    os) writes the lines of the samples [first, last) to os. The
+    manifest is written to manifest_filename after each chunk, which
+    commits it, and marked complete after the last one. */
+template<typename F>
+void append_committed_chunks(SimulationManifest& manifest, 
+                             const std::string& out_filename,
+                             const std::string& manifest_filename,
+                             std::size_t chunkSize, F write_chunk)
+{
+  std::ofstream out_file(out_filename.c_str(), 
+                         std::ofstream::out | std::ofstream::app);
+  if(!out_file)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << out_filename);
+    }
+  auto chunk_first = manifest.first+manifest.committed;
+  while(chunk_first < manifest.last)
+    {
+    auto chunk_last = std::min(chunk_first+chunkSize, manifest.last);
+    std::ostringstream chunk;
+    write_chunk(chunk_first, chunk_last, chunk);
+    auto chunk_str = chunk.str();
+    out_file.write(chunk_str.data(), chunk_str.size());
+    out_file.flush();
+    if(!out_file)
+      {
+      itkGenericExceptionMacro(<< "Could not write to file " << out_filename);
+      }
+    // the chunk is committed once the manifest says so
+    manifest.committed = chunk_last-manifest.first;
+    manifest.bytes += chunk_str.size();
+    write_manifest(manifest, manifest_filename);
+    chunk_first = chunk_last;
+    }
+  out_file.close();
+  manifest.complete = true;
+  write_manifest(manifest, manifest_filename);
+}
+
+/** Parses a "i/n" shard specification (shard i out of n, starting at
+    0). */
+std::pair<std::size_t, std::size_t> parse_shard(const std::string& shard);
+
+/** Range [first, last) of the sample indices of shard i out of n. The
+    ranges of the n shards are contiguous and cover [0, total). */
+inline
+std::pair<std::size_t, std::size_t> shard_range(std::size_t total,
+                                                std::size_t i, std::size_t n)
+{
+  return std::make_pair(total*i/n, total*(i+1)/n);
+}
+
 template<typename T, typename U>
 inline
 T normalize(T x, U p)
@@ -95,30 +384,31 @@ T denormalize(T x, U p)
     +p.first;
 }
 
-template<typename IS, typename OS, typename NVT>
-inline
-void normalize_variables(IS& isl, OS& osl, const NVT& var_minmax)
-{
-  auto ivIt = isl->Begin();
-  auto ovIt = osl->Begin();
-  auto ivLast = isl->End();
-  auto ovLast = osl->End();
+/** Normalizes in place nbRows contiguous rows of nbColumns values,
+    column j with var_minmax[j]. This gives the values of normalize()
+    with a scale and an offset computed once per column, so that the
+    rows are processed in a single pass by nbThreads threads. */
+void normalize_rows(PrecisionType* rows, std::size_t nbRows,
+                    std::size_t nbColumns,
+                    const NormalizationVectorType& var_minmax,
+                    std::size_t nbThreads=1);
 
-  std::size_t nbInputVariables{ivIt.GetMeasurementVector().Size()};
-  while(ovIt != ovLast &&
-        ivIt != ivLast)
-    {
-    auto ovInstId = ovIt.GetInstanceIdentifier();
-    osl->SetMeasurement(ovInstId, 0, normalize(ovIt.GetMeasurementVector()[0],var_minmax[nbInputVariables]));
-    auto ivInstId = ivIt.GetInstanceIdentifier();
-    for(size_t var = 0; var < nbInputVariables; ++var)
-      {
-      isl->SetMeasurement(ivInstId, var, normalize(ivIt.GetMeasurementVector()[var],var_minmax[var]));
-      }
-    ++ovIt;
-    ++ivIt;
-    }
-}
+/** Accuracy of the estimates of a variable with respect to reference
+    values: root mean square error, bias (mean of estimate-reference),
+    coefficient of determination and percentiles of the absolute
+    error. */
+struct RegressionMetrics {
+  std::size_t n;
+  double rmse;
+  double bias;
+  double r2;
+  double p50;
+  double p90;
+  double p95;
+};
+
+RegressionMetrics regression_metrics(const std::vector<double>& estimates,
+                                     const std::vector<double>& references);
 
 }//namespace BV
 }//namespace otb
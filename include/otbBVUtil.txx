@@ -12,6 +12,7 @@
 
 =========================================================================*/
 #include <random>
+#include <cstdint>
 
 #include "otbBVTypes.h"
 
@@ -20,48 +21,21 @@ namespace otb
 namespace BV
 {
 template<typename RNGType>
-double Rng(VarParams vpars, RNGType& rngen)
+double uniform_01(RNGType& rngen)
 {
-  //TODO : why us stdev defined for uniform?
-  double min = vpars.min;
-  double max = vpars.max;
-  double mod = vpars.mod;
-  double stdev = vpars.std;
-  DistType dist = vpars.dist;
-
-  double rn;
-  if(dist == DistType::GAUSSIAN)
-    {
-    auto sampleInsideBounds = false;
-    while(!sampleInsideBounds)
-      {
-      std::normal_distribution<> d(mod,stdev);
-      rn = d(rngen);
-      if( rn >= min && rn <= max)
-        sampleInsideBounds = true;
-      }
-    }
-  if(dist == DistType::LOGNORMAL)
-    {
-    auto sampleInsideBounds = false;
-    while(!sampleInsideBounds)
-      {
-      std::lognormal_distribution<> d(mod, stdev);
-      rn = d(rngen);
-      if( rn >= min && rn <= max)
-        sampleInsideBounds = true;
-      }
-    }
-  else
-    {
-    std::uniform_real_distribution<> d(min, max);
-    rn = d(rngen);
-    }
-
-
-
+  static_assert(RNGType::min() == 0 && RNGType::max() == 0xffffffff,
+                "A generator of 32 bit values is needed");
+  // 53 random bits from 2 draws, centered in [0,1]
+  auto hi = static_cast<std::uint64_t>(rngen()) >> 5;
+  auto lo = static_cast<std::uint64_t>(rngen()) >> 6;
+  return ((hi << 26) + lo + 0.5)/9007199254740992.0;
+}
 
-  return rn;
+template<typename RNGType>
+double Rng(VarParams vpars, RNGType& rngen)
+{
+  // inverse CDF sampling: constant cost whatever the bounds
+  return VarQuantile(vpars, uniform_01(rngen));
 }
 
 }//namespace BV 
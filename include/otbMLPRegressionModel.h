@@ -0,0 +1,345 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBMLPRM_H
+#define __OTBMLPRM_H
+
+#include "itkMacro.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "otbMachineLearningModel.h"
+
+namespace otb{
+/** Multilayer perceptron regressing one output variable. The hidden
+    neurons use the symmetric sigmoid of OpenCV's CvANN_MLP,
+    f(x) = beta*(1-exp(-alpha*x))/(1+exp(-alpha*x)), and the output
+    neuron is linear. The inputs and the output are standardized with
+    the mean and the standard deviation of the training samples, which
+    are saved with the model.
+
+    The training minimizes the (weighted) mean square error with Adam
+    on mini-batches or with L-BFGS on the whole training set. The
+    gradient of a batch is computed on chunks of samples in parallel
+    and the chunks are summed in a fixed order, so the model does not
+    depend on the number of threads. A fraction of the samples is kept
+    for validation: the training stops when the validation error has
+    not decreased for a number of epochs and the best network is
+    kept. All the random draws (initial weights, validation split and
+    order of the samples) are given by the seed. */
+template <typename PrecisionType=double>
+class  MLPRegressionModel :
+    public MachineLearningModel<PrecisionType, PrecisionType>
+{
+public:
+  using VectorType = std::vector<PrecisionType>;
+  using MatrixType = std::vector<VectorType>;
+  using TargetSampleType = typename
+    MachineLearningModel<PrecisionType,
+                         PrecisionType>::TargetSampleType;
+  using InputSampleType = typename
+    MachineLearningModel<PrecisionType,
+                         PrecisionType>::InputSampleType;
+
+  typedef itk::Statistics::ListSample<TargetSampleType> TargetListSampleType;
+  typedef itk::Statistics::ListSample<InputSampleType> InputListSampleType;
+
+  enum class TrainMethodType {ADAM, LBFGS};
+
+  MLPRegressionModel() {};
+
+  /** Standard class typedefs. */
+  typedef MLPRegressionModel           Self;
+  typedef MachineLearningModel<PrecisionType, PrecisionType> Superclass;
+  typedef itk::SmartPointer<Self>                         Pointer;
+  typedef itk::SmartPointer<const Self>                   ConstPointer;
+  typedef typename Superclass::ConfidenceValueType     ConfidenceValueType;
+  typedef typename Superclass::ProbaSampleType             ProbaSampleType;
+
+  itkNewMacro(Self);
+  itkTypeMacro(MLPRegressionModel, itk::MachineLearningModel);
+
+  /** Number of neurons of each hidden layer (one layer of 5 neurons by
+      default). The input layer has one neuron per input variable and
+      the output layer has one neuron. */
+  void SetHiddenLayerSizes(const std::vector<unsigned int>& sizes)
+  {
+    m_HiddenLayerSizes = sizes;
+  }
+  /** Sizes of all the layers of a trained or loaded network */
+  std::vector<unsigned int> GetLayerSizes() const
+  {
+    return m_LayerSizes;
+  }
+  void SetAlpha(PrecisionType alpha)
+  {
+    m_Alpha = alpha;
+  }
+  void SetBeta(PrecisionType beta)
+  {
+    m_Beta = beta;
+  }
+  void SetTrainMethod(TrainMethodType method)
+  {
+    m_TrainMethod = method;
+  }
+  /** Step size of Adam */
+  void SetLearningRate(double rate)
+  {
+    m_LearningRate = rate;
+  }
+  /** Number of samples of the mini-batches of Adam */
+  void SetBatchSize(std::size_t size)
+  {
+    m_BatchSize = size;
+  }
+  /** Maximum number of epochs (passes over the training samples for
+      Adam, iterations for L-BFGS) */
+  void SetMaxEpochs(std::size_t epochs)
+  {
+    m_MaxEpochs = epochs;
+  }
+  /** Number of epochs without a decrease of the validation error of
+      more than 0.1% after which the training stops */
+  void SetPatience(std::size_t epochs)
+  {
+    m_Patience = epochs;
+  }
+  /** Fraction of the samples used for the validation. With 0, the
+      error on the training samples is monitored instead. */
+  void SetValidationFraction(double fraction)
+  {
+    m_ValidationFraction = fraction;
+  }
+  void SetSeed(std::uint64_t seed)
+  {
+    m_Seed = seed;
+  }
+  void SetNumberOfThreads(std::size_t nbThreads)
+  {
+    m_NbThreads = nbThreads;
+  }
+  /** Weights of the training samples in the mean square error, indexed
+      as the samples */
+  void SetSampleWeights(VectorType w)
+  {
+    m_SampleWeights = w;
+  }
+  /** The next training goes on from the loaded (or trained) network
+      instead of random weights. The topology, the activation and the
+      standardization of the inputs and of the output are the ones of
+      the network, and the training keeps it if no epoch decreases its
+      validation error. */
+  void SetWarmStart(bool warmStart)
+  {
+    m_WarmStart = warmStart;
+  }
+  /** Number of epochs run by the last training */
+  std::size_t GetNumberOfEpochs() const
+  {
+    return m_NbEpochs;
+  }
+  /** Validation error of the kept network, in the standardized units
+      of the output */
+  double GetValidationError() const
+  {
+    return m_ValidationError;
+  }
+
+  /** Trains the model on the input and target list samples */
+  void Train() ITK_OVERRIDE
+  {
+    auto ils = this->GetInputListSample();
+    auto tls = this->GetTargetListSample();
+    if(ils == nullptr || tls == nullptr || ils->Size() == 0)
+      {
+      itkExceptionMacro(<< "No training samples.");
+      }
+    if(ils->Size() != tls->Size())
+      {
+      itkExceptionMacro(<< "The input and target list samples have "
+                        << "different sizes.");
+      }
+    this->Fit(ils->Size(), ils->GetMeasurementVectorSize(),
+              [ils](std::size_t i, std::size_t j){
+                return ils->GetMeasurementVector(i)[j];
+              },
+              [tls](std::size_t i){
+                return tls->GetMeasurementVector(i)[0];
+              });
+  }
+
+  /** Trains the model on samples which are not copied into list
+      samples. SampleViewType provides Size(), NbInputs(), Input(i)
+      (the input variables of sample i) and Output(i). The sample
+      weights, if any, are indexed as the samples. */
+  template<typename SampleViewType>
+  void Train(const SampleViewType& samples)
+  {
+    if(samples.Size() == 0)
+      {
+      itkExceptionMacro(<< "No training samples.");
+      }
+    this->Fit(samples.Size(), samples.NbInputs(),
+              [&samples](std::size_t i, std::size_t j){
+                return samples.Input(i)[j];
+              },
+              [&samples](std::size_t i){
+                return samples.Output(i);
+              });
+  }
+
+  /** Save the model to file */
+  void Save(const std::string & filename, const std::string & name="");
+
+  /** Load the model from file */
+  void Load(const std::string & filename, const std::string & name="");
+
+  bool CanReadFile(const std::string &);
+
+  bool CanWriteFile(const std::string &);
+
+  PrecisionType PredictVector(const VectorType& x) const
+  {
+    if(m_LayerSizes.empty())
+      {
+      itkExceptionMacro(<< "Model is not initialized.");
+      }
+    if(x.size() != m_LayerSizes[0])
+      {
+      itkExceptionMacro(<< "Predictor vector and model have different sizes.");
+      }
+    return this->PredictValues(x.data());
+  }
+
+protected:
+
+  TargetSampleType DoPredict(const InputSampleType& input,
+                             ConfidenceValueType * itkNotUsed(quality)=nullptr,
+                             ProbaSampleType * itkNotUsed(proba)=nullptr) const override
+  {
+    if(m_LayerSizes.empty())
+      {
+      itkExceptionMacro(<< "Model is not initialized.");
+      }
+    if(input.Size() != m_LayerSizes[0])
+      {
+      itkExceptionMacro(<< "Predictor vector and model have different sizes.");
+      }
+    TargetSampleType target;
+    target[0] = this->PredictValues(input.GetDataPointer());
+    return target;
+  }
+
+  /** Output for the nbInputs values x, in the units of the samples */
+  PrecisionType PredictValues(const PrecisionType* x) const;
+
+  /** Trains the network on the n samples of nbVars input variables
+      x(i, j) and output y(i) */
+  template<typename XType, typename YType>
+  void Fit(std::size_t n, std::size_t nbVars, XType x, YType y);
+
+  /** Mean and standard deviation of the input and output variables of
+      the n samples, used to standardize them */
+  template<typename XType, typename YType>
+  void EstimateStandardization(std::size_t n, std::size_t nbVars,
+                               XType x, YType y);
+
+  /** Sets the layer sizes and the offsets of the parameters and of the
+      activations of the layers */
+  void SetUpLayers(std::size_t nbVars);
+
+  /** Output of the network with parameters params for the standardized
+      inputs x. The activations of all the layers are stored in acts. */
+  PrecisionType Forward(const PrecisionType* params, const PrecisionType* x,
+                        PrecisionType* acts) const;
+
+  /** Weighted sum of the square errors (halved) of the training
+      samples given by indices[0, n), and its gradient added to grad if
+      grad is not null. The samples are processed by chunks in
+      parallel. Returns the sum of the weights in sumWeights. */
+  double Loss(const VectorType& params, const std::size_t* indices,
+              std::size_t n, VectorType* grad, double& sumWeights) const;
+
+  /** Mean square error (halved) of the samples given by indices and
+      its gradient */
+  double MeanLoss(const VectorType& params,
+                  const std::vector<std::size_t>& indices,
+                  VectorType* grad) const;
+
+  void InitializeParameters();
+  void TrainAdam(const std::vector<std::size_t>& train,
+                 const std::vector<std::size_t>& validation);
+  void TrainLBFGS(const std::vector<std::size_t>& train,
+                  const std::vector<std::size_t>& validation);
+
+  /** Early stopping: records the error of an epoch and returns true
+      when the training has to stop */
+  bool StopTraining(double error);
+
+  std::string GetNameOfClass()
+  {
+    return std::string{"MLPRegressionModel"};
+  }
+
+  // configuration
+  std::vector<unsigned int> m_HiddenLayerSizes{5};
+  PrecisionType m_Alpha{0.5};
+  PrecisionType m_Beta{1.0};
+  TrainMethodType m_TrainMethod{TrainMethodType::ADAM};
+  double m_LearningRate{1e-2};
+  std::size_t m_BatchSize{1024};
+  std::size_t m_MaxEpochs{500};
+  std::size_t m_Patience{20};
+  double m_ValidationFraction{0.1};
+  std::uint64_t m_Seed{0};
+  std::size_t m_NbThreads{1};
+  VectorType m_SampleWeights;
+  bool m_WarmStart{false};
+
+  // the model
+  std::vector<unsigned int> m_LayerSizes;
+  std::vector<std::size_t> m_ParamOffsets;
+  std::vector<std::size_t> m_ActOffsets;
+  VectorType m_Params;
+  VectorType m_InputMean;
+  VectorType m_InputStd;
+  PrecisionType m_OutputMean{0};
+  PrecisionType m_OutputStd{1};
+
+  // training state
+  VectorType m_X;
+  VectorType m_Y;
+  VectorType m_W;
+  VectorType m_BestParams;
+  double m_BestError{0};
+  std::size_t m_EpochsSinceBest{0};
+  std::size_t m_NbEpochs{0};
+  double m_ValidationError{0};
+
+  // relative decrease of the validation error counted as an improvement
+  static constexpr double MinRelativeDecrease{1e-3};
+  // number of samples of the chunks of the batch gradients
+  static constexpr std::size_t ChunkSize{256};
+  // streams of the random numbers
+  static constexpr std::uint32_t InitStream{0};
+  static constexpr std::uint32_t SplitStream{1};
+  static constexpr std::uint32_t ShuffleStream{2};
+};
+}//namespace otb
+
+#ifndef OTB_MANUAL_INSTANTIATION
+#include "otbMLPRegressionModel.txx"
+#endif
+
+#endif
@@ -0,0 +1,596 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBMLPRM_TXX
+#define __OTBMLPRM_TXX
+
+#include "otbMLPRegressionModel.h"
+#include "otbBVUtil.h"
+#include "otbBVSampling.h"
+#include "otbPhiloxRNG.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <limits>
+#include <deque>
+#include <algorithm>
+
+namespace otb{
+template <typename PrecisionType>
+template<typename XType, typename YType>
+void MLPRegressionModel<PrecisionType>::Fit(std::size_t n, std::size_t nbVars,
+                                            XType x, YType y)
+{
+  if(!m_SampleWeights.empty() && m_SampleWeights.size() != n)
+    {
+    itkExceptionMacro(<< "The number of sample weights ("
+                      << m_SampleWeights.size() << ") is not the number "
+                      << "of samples (" << n << ").");
+    }
+  if(!m_WarmStart)
+    {
+    SetUpLayers(nbVars);
+    EstimateStandardization(n, nbVars, x, y);
+    }
+  else if(m_LayerSizes.empty())
+    {
+    itkExceptionMacro(<< "No network to go on training from.");
+    }
+  else if(m_LayerSizes[0] != nbVars)
+    {
+    itkExceptionMacro(<< "The network to go on training from has "
+                      << m_LayerSizes[0] << " input variables instead of "
+                      << nbVars << ".");
+    }
+
+  // standardized copy of the samples
+  m_X.resize(n*nbVars);
+  m_Y.resize(n);
+  for(std::size_t i = 0; i < n; ++i)
+    {
+    for(std::size_t j = 0; j < nbVars; ++j)
+      m_X[i*nbVars+j] = (x(i, j)-m_InputMean[j])/m_InputStd[j];
+    m_Y[i] = (y(i)-m_OutputMean)/m_OutputStd;
+    }
+  m_W = m_SampleWeights;
+
+  // validation samples drawn by a random permutation of the samples
+  std::size_t nbValidation = static_cast<std::size_t>(
+    m_ValidationFraction*n);
+  if(nbValidation >= n) nbValidation = n-1;
+  auto split_key = otb::BV::PhiloxRNG(m_Seed, 0, SplitStream)();
+  std::vector<std::size_t> train, validation;
+  for(std::size_t k = 0; k < n; ++k)
+    {
+    auto i = static_cast<std::size_t>(otb::BV::permute_index(k, n, split_key));
+    if(k < nbValidation)
+      validation.push_back(i);
+    else
+      train.push_back(i);
+    }
+  std::sort(train.begin(), train.end());
+  std::sort(validation.begin(), validation.end());
+
+  if(!m_WarmStart)
+    InitializeParameters();
+  m_BestParams = m_Params;
+  // a warm start keeps the initial network unless the training
+  // improves it
+  m_BestError = m_WarmStart ? 
+    MeanLoss(m_Params, validation.empty() ? train : validation, nullptr) :
+    std::numeric_limits<double>::infinity();
+  m_EpochsSinceBest = 0;
+  m_NbEpochs = 0;
+  if(m_TrainMethod == TrainMethodType::LBFGS)
+    TrainLBFGS(train, validation);
+  else
+    TrainAdam(train, validation);
+  m_Params = m_BestParams;
+  m_ValidationError = m_BestError;
+
+  m_X = VectorType{};
+  m_Y = VectorType{};
+  m_W = VectorType{};
+  m_BestParams = VectorType{};
+}
+
+template <typename PrecisionType>
+template<typename XType, typename YType>
+void MLPRegressionModel<PrecisionType>::EstimateStandardization(
+  std::size_t n, std::size_t nbVars, XType x, YType y)
+{
+  m_InputMean.assign(nbVars, 0);
+  m_InputStd.assign(nbVars, 0);
+  m_OutputMean = 0;
+  m_OutputStd = 0;
+  for(std::size_t i = 0; i < n; ++i)
+    {
+    for(std::size_t j = 0; j < nbVars; ++j)
+      m_InputMean[j] += x(i, j);
+    m_OutputMean += y(i);
+    }
+  for(std::size_t j = 0; j < nbVars; ++j)
+    m_InputMean[j] /= n;
+  m_OutputMean /= n;
+  for(std::size_t i = 0; i < n; ++i)
+    {
+    for(std::size_t j = 0; j < nbVars; ++j)
+      m_InputStd[j] += (x(i, j)-m_InputMean[j])*(x(i, j)-m_InputMean[j]);
+    m_OutputStd += (y(i)-m_OutputMean)*(y(i)-m_OutputMean);
+    }
+  auto to_std = [n](PrecisionType ss){
+    auto s = std::sqrt(ss/n);
+    return s > 0 ? s : PrecisionType{1};
+  };
+  for(std::size_t j = 0; j < nbVars; ++j)
+    m_InputStd[j] = to_std(m_InputStd[j]);
+  m_OutputStd = to_std(m_OutputStd);
+}
+
+template <typename PrecisionType>
+void MLPRegressionModel<PrecisionType>::SetUpLayers(std::size_t nbVars)
+{
+  m_LayerSizes.assign(1, static_cast<unsigned int>(nbVars));
+  for(auto s : m_HiddenLayerSizes)
+    {
+    if(s == 0)
+      {
+      itkExceptionMacro(<< "A hidden layer has no neuron.");
+      }
+    m_LayerSizes.push_back(s);
+    }
+  m_LayerSizes.push_back(1);
+  m_ParamOffsets.assign(1, 0);
+  m_ActOffsets.assign(1, 0);
+  for(std::size_t l = 0; l+1 < m_LayerSizes.size(); ++l)
+    {
+    // weights (one row per neuron of layer l+1) followed by the biases
+    m_ParamOffsets.push_back(m_ParamOffsets.back()+
+                             (m_LayerSizes[l]+1)*m_LayerSizes[l+1]);
+    m_ActOffsets.push_back(m_ActOffsets.back()+m_LayerSizes[l]);
+    }
+  m_ActOffsets.push_back(m_ActOffsets.back()+m_LayerSizes.back());
+}
+
+template <typename PrecisionType>
+void MLPRegressionModel<PrecisionType>::InitializeParameters()
+{
+  // Glorot uniform initialization. The weights of the hidden layers
+  // are divided by the slope of the sigmoid at 0 (alpha*beta/2), which
+  // is the one of tanh for alpha=2 and beta=1.
+  m_Params.assign(m_ParamOffsets.back(), 0);
+  otb::BV::PhiloxRNG rng(m_Seed, 0, InitStream);
+  auto nbLayers = m_LayerSizes.size();
+  for(std::size_t l = 0; l+1 < nbLayers; ++l)
+    {
+    auto nin = m_LayerSizes[l];
+    auto nout = m_LayerSizes[l+1];
+    auto range = std::sqrt(6.0/(nin+nout));
+    if(l+2 < nbLayers)
+      range /= m_Alpha*m_Beta/2;
+    auto w = m_Params.data()+m_ParamOffsets[l];
+    for(std::size_t k = 0; k < nin*nout; ++k)
+      w[k] = (2*otb::BV::uniform_01(rng)-1)*range;
+    }
+}
+
+template <typename PrecisionType>
+PrecisionType MLPRegressionModel<PrecisionType>::Forward(
+  const PrecisionType* params, const PrecisionType* x,
+  PrecisionType* acts) const
+{
+  auto nbLayers = m_LayerSizes.size();
+  std::copy(x, x+m_LayerSizes[0], acts);
+  for(std::size_t l = 0; l+1 < nbLayers; ++l)
+    {
+    auto nin = m_LayerSizes[l];
+    auto nout = m_LayerSizes[l+1];
+    auto in = acts+m_ActOffsets[l];
+    auto out = acts+m_ActOffsets[l+1];
+    auto w = params+m_ParamOffsets[l];
+    auto b = w+nin*nout;
+    auto hidden = l+2 < nbLayers;
+    for(std::size_t o = 0; o < nout; ++o)
+      {
+      PrecisionType z = b[o];
+      for(std::size_t i = 0; i < nin; ++i)
+        z += w[o*nin+i]*in[i];
+      // beta*(1-exp(-alpha*z))/(1+exp(-alpha*z)) = beta*tanh(alpha*z/2)
+      out[o] = hidden ? m_Beta*std::tanh(m_Alpha*z/2) : z;
+      }
+    }
+  return acts[m_ActOffsets[nbLayers-1]];
+}
+
+template <typename PrecisionType>
+PrecisionType MLPRegressionModel<PrecisionType>::PredictValues(
+  const PrecisionType* x) const
+{
+  auto nbVars = m_LayerSizes[0];
+  VectorType buffer(nbVars+m_ActOffsets.back());
+  auto xs = buffer.data();
+  for(std::size_t j = 0; j < nbVars; ++j)
+    xs[j] = (x[j]-m_InputMean[j])/m_InputStd[j];
+  auto out = Forward(m_Params.data(), xs, xs+nbVars);
+  return out*m_OutputStd+m_OutputMean;
+}
+
+template <typename PrecisionType>
+double MLPRegressionModel<PrecisionType>::Loss(
+  const VectorType& params, const std::size_t* indices, std::size_t n,
+  VectorType* grad, double& sumWeights) const
+{
+  auto nbParams = params.size();
+  auto nbVars = m_LayerSizes[0];
+  auto nbLayers = m_LayerSizes.size();
+  auto nbChunks = (n+ChunkSize-1)/ChunkSize;
+  std::vector<double> chunk_loss(nbChunks, 0), chunk_weights(nbChunks, 0);
+  VectorType chunk_grads(grad ? nbChunks*nbParams : 0, 0);
+  otb::parallel_for_blocks(0, nbChunks, m_NbThreads,
+                           [&](std::size_t first, std::size_t last){
+    VectorType acts(m_ActOffsets.back());
+    VectorType deltas(m_ActOffsets.back());
+    for(auto c = first; c < last; ++c)
+      {
+      auto g = grad ? chunk_grads.data()+c*nbParams : nullptr;
+      for(auto k = c*ChunkSize; k < std::min(n, (c+1)*ChunkSize); ++k)
+        {
+        auto i = indices[k];
+        double weight = m_W.empty() ? 1.0 : m_W[i];
+        auto err = Forward(params.data(), m_X.data()+i*nbVars,
+                           acts.data())-m_Y[i];
+        chunk_loss[c] += 0.5*weight*err*err;
+        chunk_weights[c] += weight;
+        if(!g) continue;
+        // back propagation of the error, layer by layer
+        deltas[m_ActOffsets[nbLayers-1]] = weight*err;
+        for(auto l = nbLayers-1; l > 0; --l)
+          {
+          auto nin = m_LayerSizes[l-1];
+          auto nout = m_LayerSizes[l];
+          auto in = acts.data()+m_ActOffsets[l-1];
+          auto delta_out = deltas.data()+m_ActOffsets[l];
+          auto delta_in = deltas.data()+m_ActOffsets[l-1];
+          auto w = params.data()+m_ParamOffsets[l-1];
+          auto gw = g+m_ParamOffsets[l-1];
+          auto gb = gw+nin*nout;
+          if(l > 1)
+            std::fill(delta_in, delta_in+nin, 0);
+          for(std::size_t o = 0; o < nout; ++o)
+            {
+            for(std::size_t j = 0; j < nin; ++j)
+              {
+              gw[o*nin+j] += delta_out[o]*in[j];
+              if(l > 1)
+                delta_in[j] += w[o*nin+j]*delta_out[o];
+              }
+            gb[o] += delta_out[o];
+            }
+          if(l > 1)
+            // derivative of the sigmoid from its value a:
+            // alpha/(2*beta)*(beta^2-a^2)
+            for(std::size_t j = 0; j < nin; ++j)
+              delta_in[j] *= m_Alpha/(2*m_Beta)*(m_Beta*m_Beta-in[j]*in[j]);
+          }
+        }
+      }
+    });
+  // the chunks are summed in order whatever the number of threads
+  double loss{0};
+  sumWeights = 0;
+  for(std::size_t c = 0; c < nbChunks; ++c)
+    {
+    loss += chunk_loss[c];
+    sumWeights += chunk_weights[c];
+    if(grad)
+      for(std::size_t p = 0; p < nbParams; ++p)
+        (*grad)[p] += chunk_grads[c*nbParams+p];
+    }
+  return loss;
+}
+
+template <typename PrecisionType>
+double MLPRegressionModel<PrecisionType>::MeanLoss(
+  const VectorType& params, const std::vector<std::size_t>& indices,
+  VectorType* grad) const
+{
+  if(grad)
+    grad->assign(params.size(), 0);
+  double sumWeights{0};
+  auto loss = Loss(params, indices.data(), indices.size(), grad, sumWeights);
+  if(sumWeights <= 0)
+    return 0;
+  if(grad)
+    for(auto& g : *grad)
+      g /= sumWeights;
+  return loss/sumWeights;
+}
+
+template <typename PrecisionType>
+bool MLPRegressionModel<PrecisionType>::StopTraining(double error)
+{
+  ++m_NbEpochs;
+  // the best network is always kept, but decreases of the error below
+  // MinRelativeDecrease do not reset the patience
+  if(error < m_BestError*(1-MinRelativeDecrease))
+    m_EpochsSinceBest = 0;
+  else
+    ++m_EpochsSinceBest;
+  if(error < m_BestError)
+    {
+    m_BestError = error;
+    m_BestParams = m_Params;
+    }
+  return m_EpochsSinceBest >= m_Patience || m_NbEpochs >= m_MaxEpochs;
+}
+
+template <typename PrecisionType>
+void MLPRegressionModel<PrecisionType>::TrainAdam(
+  const std::vector<std::size_t>& train,
+  const std::vector<std::size_t>& validation)
+{
+  const double beta1{0.9}, beta2{0.999}, eps{1e-8};
+  auto nbParams = m_Params.size();
+  auto n = train.size();
+  auto batchSize = std::max<std::size_t>(1, std::min(m_BatchSize, n));
+  VectorType m(nbParams, 0), v(nbParams, 0), grad(nbParams);
+  std::vector<std::size_t> order(n);
+  double beta1_t{1}, beta2_t{1};
+  const auto& monitored = validation.empty() ? train : validation;
+  if(m_MaxEpochs == 0) return;
+  for(std::size_t epoch = 0; ; ++epoch)
+    {
+    // the samples are visited in a new random order at each epoch
+    auto key = otb::BV::PhiloxRNG(m_Seed, epoch, ShuffleStream)();
+    for(std::size_t k = 0; k < n; ++k)
+      order[k] = train[otb::BV::permute_index(k, n, key)];
+    for(std::size_t first = 0; first < n; first += batchSize)
+      {
+      auto size = std::min(batchSize, n-first);
+      std::fill(grad.begin(), grad.end(), 0);
+      double sumWeights{0};
+      Loss(m_Params, order.data()+first, size, &grad, sumWeights);
+      if(sumWeights <= 0) continue;
+      beta1_t *= beta1;
+      beta2_t *= beta2;
+      for(std::size_t p = 0; p < nbParams; ++p)
+        {
+        auto g = grad[p]/sumWeights;
+        m[p] = beta1*m[p]+(1-beta1)*g;
+        v[p] = beta2*v[p]+(1-beta2)*g*g;
+        m_Params[p] -= m_LearningRate*(m[p]/(1-beta1_t))/
+          (std::sqrt(v[p]/(1-beta2_t))+eps);
+        }
+      }
+    if(StopTraining(MeanLoss(m_Params, monitored, nullptr)))
+      break;
+    }
+}
+
+template <typename PrecisionType>
+void MLPRegressionModel<PrecisionType>::TrainLBFGS(
+  const std::vector<std::size_t>& train,
+  const std::vector<std::size_t>& validation)
+{
+  const std::size_t memory{10};
+  const double c1{1e-4};
+  auto nbParams = m_Params.size();
+  auto dot = [nbParams](const VectorType& a, const VectorType& b){
+    double r{0};
+    for(std::size_t p = 0; p < nbParams; ++p)
+      r += a[p]*b[p];
+    return r;
+  };
+  std::deque<VectorType> s_hist, y_hist;
+  std::deque<double> rho_hist;
+  VectorType grad, new_grad, direction(nbParams), new_params(nbParams);
+  auto loss = MeanLoss(m_Params, train, &grad);
+  if(m_MaxEpochs == 0) return;
+  for(std::size_t iteration = 0; ; ++iteration)
+    {
+    // two loop recursion: direction = -H*grad
+    direction = grad;
+    std::vector<double> a(s_hist.size());
+    for(auto k = s_hist.size(); k-- > 0;)
+      {
+      a[k] = rho_hist[k]*dot(s_hist[k], direction);
+      for(std::size_t p = 0; p < nbParams; ++p)
+        direction[p] -= a[k]*y_hist[k][p];
+      }
+    double gamma = s_hist.empty() ?
+      1.0/std::max(std::sqrt(dot(grad, grad)), 1.0) :
+      dot(s_hist.back(), y_hist.back())/dot(y_hist.back(), y_hist.back());
+    for(auto& d : direction)
+      d *= gamma;
+    for(std::size_t k = 0; k < s_hist.size(); ++k)
+      {
+      auto b = rho_hist[k]*dot(y_hist[k], direction);
+      for(std::size_t p = 0; p < nbParams; ++p)
+        direction[p] += s_hist[k][p]*(a[k]-b);
+      }
+    for(auto& d : direction)
+      d = -d;
+    auto slope = dot(grad, direction);
+    if(!(slope < 0))
+      {
+      // not a descent direction: restart from the steepest descent
+      s_hist.clear(); y_hist.clear(); rho_hist.clear();
+      for(std::size_t p = 0; p < nbParams; ++p)
+        direction[p] = -grad[p];
+      slope = -dot(grad, grad);
+      if(!(slope < 0)) break;
+      }
+    // backtracking line search (Armijo condition)
+    double step{1};
+    double new_loss{0};
+    bool found{false};
+    for(int trial = 0; trial < 40; ++trial, step /= 2)
+      {
+      for(std::size_t p = 0; p < nbParams; ++p)
+        new_params[p] = m_Params[p]+step*direction[p];
+      new_loss = MeanLoss(new_params, train, &new_grad);
+      if(new_loss <= loss+c1*step*slope)
+        {
+        found = true;
+        break;
+        }
+      }
+    if(!found) break;
+    VectorType s(nbParams), y(nbParams);
+    for(std::size_t p = 0; p < nbParams; ++p)
+      {
+      s[p] = new_params[p]-m_Params[p];
+      y[p] = new_grad[p]-grad[p];
+      }
+    auto sy = dot(s, y);
+    if(sy > 1e-12)
+      {
+      s_hist.push_back(s);
+      y_hist.push_back(y);
+      rho_hist.push_back(1/sy);
+      if(s_hist.size() > memory)
+        {
+        s_hist.pop_front(); y_hist.pop_front(); rho_hist.pop_front();
+        }
+      }
+    m_Params.swap(new_params);
+    grad.swap(new_grad);
+    loss = new_loss;
+    if(StopTraining(validation.empty() ? loss :
+                    MeanLoss(m_Params, validation, nullptr)))
+      break;
+    }
+}
+
+template <typename PrecisionType>
+void  MLPRegressionModel<PrecisionType>::Save(const std::string & filename,
+                                              const std::string & name){
+  if(name==""){};//ugly silenting of unused variable
+  std::ofstream model_file;
+  try
+    {
+    model_file.open(filename.c_str(), std::ofstream::out);
+    }
+  catch(...)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << filename);
+    }
+  model_file << "# Multilayer perceptron regression model\n";
+  model_file << std::setprecision(17);
+  auto write = [&model_file](const std::string& key,
+                             const std::vector<PrecisionType>& values){
+    model_file << key;
+    for(auto v : values)
+      model_file << ' ' << v;
+    model_file << '\n';
+  };
+  model_file << "layers";
+  for(auto s : m_LayerSizes)
+    model_file << ' ' << s;
+  model_file << '\n';
+  write("activation", {m_Alpha, m_Beta});
+  write("input_mean", m_InputMean);
+  write("input_std", m_InputStd);
+  write("output", {m_OutputMean, m_OutputStd});
+  write("parameters", m_Params);
+  model_file.close();
+}
+
+template <typename PrecisionType>
+void  MLPRegressionModel<PrecisionType>::Load(const std::string & filename,
+                                              const std::string & name){
+  if(name==""){};//ugly silenting of unused variable
+  std::ifstream model_file;
+  try
+    {
+    model_file.open(filename.c_str());
+    }
+  catch(...)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << filename.c_str());
+    }
+  std::string line;
+  std::getline(model_file, line); //skip header line
+  std::vector<unsigned int> sizes;
+  VectorType activation, output;
+  m_InputMean.clear();
+  m_InputStd.clear();
+  m_Params.clear();
+  while(std::getline(model_file, line))
+    {
+    std::istringstream ss(line);
+    std::string key;
+    ss >> key;
+    if(key == "layers")
+      {
+      unsigned int s;
+      while(ss >> s)
+        sizes.push_back(s);
+      continue;
+      }
+    VectorType* values{nullptr};
+    if(key == "activation") values = &activation;
+    else if(key == "input_mean") values = &m_InputMean;
+    else if(key == "input_std") values = &m_InputStd;
+    else if(key == "output") values = &output;
+    else if(key == "parameters") values = &m_Params;
+    else
+      itkGenericExceptionMacro(<< "Bad format in model file " << filename
+                               << "\n" << line << "\n");
+    PrecisionType value;
+    while(ss >> value)
+      values->push_back(value);
+    }
+  model_file.close();
+  if(sizes.size() < 2 || sizes.back() != 1 || activation.size() != 2 ||
+     output.size() != 2 || m_InputMean.size() != sizes[0] ||
+     m_InputStd.size() != sizes[0])
+    itkGenericExceptionMacro(<< "Bad format in model file " << filename);
+  m_Alpha = activation[0];
+  m_Beta = activation[1];
+  m_OutputMean = output[0];
+  m_OutputStd = output[1];
+  m_HiddenLayerSizes.assign(sizes.begin()+1, sizes.end()-1);
+  SetUpLayers(sizes[0]);
+  if(m_Params.size() != m_ParamOffsets.back())
+    itkGenericExceptionMacro(<< "Bad number of parameters in model file "
+                             << filename);
+}
+
+template <typename PrecisionType>
+bool MLPRegressionModel<PrecisionType>::CanReadFile(const std::string & file)
+{
+  std::ifstream ifs;
+  ifs.open(file.c_str());
+
+  if (!ifs)
+    {
+    std::cerr << "Could not read file " << file << std::endl;
+    return false;
+    }
+
+  std::string line;
+  std::getline(ifs, line);
+  return line.find("Multilayer perceptron") != std::string::npos;
+}
+
+template <typename PrecisionType>
+bool MLPRegressionModel<PrecisionType>::CanWriteFile(const std::string &
+                                                     itkNotUsed(file))
+{
+  return false;
+}
+
+}//namespace otb
+#endif
@@ -0,0 +1,175 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBMLRFEATUREMAP_H
+#define __OTBMLRFEATUREMAP_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <utility>
+#include "itkMacro.h"
+
+namespace otb
+{
+/** Features computed from the input variables of a multilinear
+    regression, so that the training files only hold the input
+    variables: the inputs x_j, their powers x_j^p up to the degree, the
+    pairwise products x_j x_k (j < k) and normalized differences
+    (x_a-x_b)/(x_a+x_b) of chosen inputs, in this order. The identity
+    map, the default, gives the inputs alone. */
+template <typename PrecisionType=double>
+class MultiLinearFeatureMap
+{
+public:
+  bool IsIdentity() const
+  {
+    return m_Degree < 2 && !m_Products && m_Differences.empty();
+  }
+
+  void SetDegree(std::size_t degree)
+  {
+    m_Degree = degree;
+  }
+
+  std::size_t GetDegree() const
+  {
+    return m_Degree;
+  }
+
+  void SetPairwiseProducts(bool products)
+  {
+    m_Products = products;
+  }
+
+  bool GetPairwiseProducts() const
+  {
+    return m_Products;
+  }
+
+  /** Adds the normalized difference (x_a-x_b)/(x_a+x_b), a and b
+      starting at 0 */
+  void AddNormalizedDifference(std::size_t a, std::size_t b)
+  {
+    m_Differences.emplace_back(a, b);
+  }
+
+  std::size_t GetNumberOfDifferences() const
+  {
+    return m_Differences.size();
+  }
+
+  /** Number of input variables, set by the training */
+  void SetNumberOfInputs(std::size_t nbInputs)
+  {
+    for(const auto& d : m_Differences)
+      if(d.first >= nbInputs || d.second >= nbInputs || d.first == d.second)
+        {
+        itkGenericExceptionMacro(<< "Normalized difference of inputs "
+                                 << d.first+1 << " and " << d.second+1
+                                 << " for " << nbInputs << " inputs.");
+        }
+    m_NbInputs = nbInputs;
+  }
+
+  std::size_t GetNumberOfInputs() const
+  {
+    return m_NbInputs;
+  }
+
+  std::size_t GetNumberOfFeatures() const
+  {
+    auto n = m_NbInputs;
+    if(m_Degree > 1)
+      n += (m_Degree-1)*m_NbInputs;
+    if(m_Products)
+      n += m_NbInputs*(m_NbInputs-1)/2;
+    return n+m_Differences.size();
+  }
+
+  /** Writes the features of the inputs x to f */
+  template <typename T>
+  void Expand(const T* x, PrecisionType* f) const
+  {
+    std::size_t k{0};
+    for(std::size_t j = 0; j < m_NbInputs; ++j)
+      f[k++] = x[j];
+    for(std::size_t p = 2; p <= m_Degree; ++p)
+      for(std::size_t j = 0; j < m_NbInputs; ++j, ++k)
+        f[k] = f[k-m_NbInputs]*x[j];
+    if(m_Products)
+      for(std::size_t j = 0; j < m_NbInputs; ++j)
+        for(std::size_t l = j+1; l < m_NbInputs; ++l)
+          f[k++] = PrecisionType(x[j])*x[l];
+    // a null sum (two null reflectances) gives 0
+    for(const auto& d : m_Differences)
+      {
+      PrecisionType sum = PrecisionType(x[d.first])+x[d.second];
+      f[k++] = sum != 0 ? (PrecisionType(x[d.first])-x[d.second])/sum : 0;
+      }
+  }
+
+  /** Description saved with the model, for instance "inputs 4 degree
+      2 products ndi 3 2", the inputs of the differences starting at
+      0 */
+  std::string ToString() const
+  {
+    std::ostringstream s;
+    s << "inputs " << m_NbInputs << " degree " << m_Degree;
+    if(m_Products)
+      s << " products";
+    for(const auto& d : m_Differences)
+      s << " ndi " << d.first << ' ' << d.second;
+    return s.str();
+  }
+
+  static MultiLinearFeatureMap FromString(const std::string& description)
+  {
+    MultiLinearFeatureMap map;
+    std::istringstream s(description);
+    std::string key;
+    std::size_t nbInputs{0};
+    while(s >> key)
+      {
+      if(key == "inputs")
+        s >> nbInputs;
+      else if(key == "degree")
+        s >> map.m_Degree;
+      else if(key == "products")
+        map.m_Products = true;
+      else if(key == "ndi")
+        {
+        std::size_t a{0}, b{0};
+        s >> a >> b;
+        map.AddNormalizedDifference(a, b);
+        }
+      else
+        s.setstate(std::ios::failbit);
+      if(!s)
+        {
+        itkGenericExceptionMacro(<< "Bad feature map: " << description);
+        }
+      }
+    map.SetNumberOfInputs(nbInputs);
+    return map;
+  }
+
+protected:
+  std::size_t m_NbInputs{0};
+  std::size_t m_Degree{1};
+  bool m_Products{false};
+  std::vector<std::pair<std::size_t, std::size_t>> m_Differences;
+};
+
+}//namespace otb
+#endif
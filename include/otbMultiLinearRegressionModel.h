@@ -15,9 +15,9 @@
 #define __OTBMLRM_H
 
 #include "itkMacro.h"
-#include "gsl/gsl_multifit.h"
 #include <vector>
 #include "otbMachineLearningModel.h"
+#include "otbMultiLinearFeatureMap.h"
 #if defined(__GNUC__) || defined(__clang__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wshadow"
@@ -51,6 +51,8 @@ public:
     MachineLearningModel<PrecisionType, 
                          PrecisionType>::InputSampleType;
 
+  using FeatureMapType = MultiLinearFeatureMap<PrecisionType>;
+
   typedef itk::Statistics::ListSample<TargetSampleType> TargetListSampleType;
   typedef itk::Statistics::ListSample<InputSampleType> InputListSampleType;
 
@@ -74,15 +76,133 @@ public:
   void SetTargetVector(VectorType y)
   {
     m_y = y;
+    m_Y.clear();
+  }
+  /** Target vectors of several output variables, which are fitted on
+      the same predictors with a single factorization of the normal
+      equations. The model then has one coefficient vector per target,
+      Predict giving the first one. */
+  void SetTargetVectors(MatrixType y)
+  {
+    m_Y = y;
+    m_y.clear();
   }
   void SetWeightVector(VectorType w)
   {
     m_w = w;
     m_weights = true;
   }
+  /** The next training updates the loaded model instead of starting
+      from scratch: the normal equations X^T W X and X^T W y of the
+      model, which are saved with its coefficients, are added to the
+      ones of the new samples. The coefficients are then the fit of the
+      samples of the model and of the new ones, without the former. */
+  void SetWarmStart(bool warmStart)
+  {
+    m_WarmStart = warmStart;
+  }
+  /** Number of threads accumulating the normal equations. The model
+      does not depend on it. */
+  void SetNumberOfThreads(std::size_t nbThreads)
+  {
+    m_NbThreads = nbThreads;
+  }
+  /** Ridge penalties tried by the training. The intercept is not
+      penalized and a penalty is relative to the diagonal of the normal
+      equations of the centered predictors, so that 0.01 shrinks the
+      coefficients of uncorrelated predictors by about 1%. The penalty of each target is the one of
+      the lowest generalized cross-validation error, computed for the
+      whole path from a single eigen decomposition. With an empty path,
+      the default, the fit is the least squares one. */
+  void SetRidgePath(VectorType lambdas)
+  {
+    m_RidgePath = lambdas;
+  }
+  /** Features of the inputs on which the model is fitted. They are
+      computed from the inputs of each sample during the training and
+      the prediction, so that the samples only hold the inputs. The map
+      is saved with the model. */
+  void SetFeatureMap(const FeatureMapType& featureMap)
+  {
+    m_FeatureMap = featureMap;
+  }
+  const FeatureMapType& GetFeatureMap() const
+  {
+    return m_FeatureMap;
+  }
+  /** Number of input variables of the predictions */
+  std::size_t GetNumberOfInputs() const
+  {
+    return m_FeatureMap.IsIdentity() ? m_model.size()-1 : 
+      m_FeatureMap.GetNumberOfInputs();
+  }
   void Train() ITK_OVERRIDE
   {
-    this->multi_linear_fit();
+    if(m_x.empty())
+      {
+      itkExceptionMacro(<< "No training samples.");
+      }
+    auto n = m_x.size();
+    for(const auto& y : m_Y)
+      if(y.size() < n)
+        {
+        itkExceptionMacro(<< "A target vector has " << y.size() 
+                          << " values for " << n << " samples.");
+        }
+    if(m_Y.empty() && m_y.size() < n)
+      {
+      itkExceptionMacro(<< "The target vector has " << m_y.size() 
+                        << " values for " << n << " samples.");
+      }
+    this->multi_linear_fit(n, m_x[0].size(), 
+                           m_Y.empty() ? 1 : m_Y.size(),
+                           [this](std::size_t i, std::size_t j){ 
+                             return m_x[i][j]; 
+                           },
+                           [this](std::size_t i, std::size_t k){ 
+                             return m_Y.empty() ? m_y[i] : m_Y[k][i]; 
+                           });
+  }
+
+  /** Trains the model on samples which are not copied into the
+      predictor matrix. SampleViewType provides Size(), NbInputs(),
+      Input(i) (the input variables of sample i) and Output(i). The
+      weight vector, if any, is indexed as the samples. */
+  template<typename SampleViewType>
+  void Train(const SampleViewType& samples)
+  {
+    if(samples.Size() == 0)
+      {
+      itkExceptionMacro(<< "No training samples.");
+      }
+    this->multi_linear_fit(samples.Size(), samples.NbInputs(), 1,
+                           [&samples](std::size_t i, std::size_t j){ 
+                             return samples.Input(i)[j]; 
+                           },
+                           [&samples](std::size_t i, std::size_t){ 
+                             return samples.Output(i); 
+                           });
+  }
+
+  /** Trains the model of all the output variables of the samples at
+      once, one target per output variable. SampleViewType provides in
+      addition NbOutputs() and Output(i, k), the output variable k of
+      sample i. */
+  template<typename SampleViewType>
+  void TrainTargets(const SampleViewType& samples)
+  {
+    if(samples.Size() == 0)
+      {
+      itkExceptionMacro(<< "No training samples.");
+      }
+    this->multi_linear_fit(samples.Size(), samples.NbInputs(), 
+                           samples.NbOutputs(),
+                           [&samples](std::size_t i, std::size_t j){ 
+                             return samples.Input(i)[j]; 
+                           },
+                           [&samples](std::size_t i, std::size_t k){ 
+                             return samples.Output(i, k); 
+                           });
   }
 
   void SetInputListSample(InputListSampleType * ils)
@@ -126,6 +246,28 @@ public:
     return m_model;
   }
 
+  /** Coefficients of each target */
+  MatrixType GetModels() const
+  {
+    return m_models;
+  }
+
+  std::size_t GetNumberOfTargets() const
+  {
+    return m_models.size();
+  }
+
+  /** Ridge penalty chosen for each target, empty for a least squares
+      fit */
+  VectorType GetRidgeParameters() const
+  {
+    return m_Lambdas;
+  }
+
+  /** Model of the target k alone, with its normal equations, which can
+      be saved, updated or used as the model of an output variable */
+  Pointer GetTargetModel(std::size_t k) const;
+
   MatrixType GetPredictorMatrix() const
   {
     return m_x;
@@ -133,7 +275,7 @@ public:
 
   VectorType GetTargetVector() const
   {
-    return m_y;
+    return m_Y.empty() ? m_y : m_Y[0];
   }
 
   PrecisionType PredictVector(const VectorType x) const
@@ -141,23 +283,20 @@ public:
     return this->DoPredict(x);
   }
 
+  /** Predictions of nbSamples samples given as a row major block of
+      nbSamples x nbInputs values, written to y. The sizes are checked
+      once for the block, and the sums of BatchLanes samples are
+      computed together, which the compiler turns into SIMD
+      instructions. The predictions are the ones of Predict. */
+  void PredictBatch(const PrecisionType* x, std::size_t nbSamples,
+                    std::size_t nbInputs, PrecisionType* y) const;
+
 protected:
 
   PrecisionType DoPredict(const VectorType x) const
   {
-    if(m_model.size()==0)
-      {
-      itkExceptionMacro(<< "Model is not initialized.")
-        }    
-    if(x.size()!=(m_model.size()-1))
-      {
-      itkExceptionMacro(<< "Predictor vector and model have different sizes.")
-        }
-
-    PrecisionType result = m_model[0];
-    for(size_t i=0; i<x.size(); i++)
-      result += m_model[i+1]*x[i];
-    
+    PrecisionType result;
+    this->PredictBatch(x.data(), 1, x.size(), &result);
     return result;
   }
 
@@ -165,13 +304,67 @@ protected:
                              ConfidenceValueType *quality=nullptr, 
                              ProbaSampleType *proba=nullptr) const override
   {
-    VectorType tmp_vec(this->SampleToVector(input));
     TargetSampleType target;
-    target[0] = this->DoPredict(tmp_vec);
+    this->PredictBatch(input.GetDataPointer(), 1, input.Size(), &target[0]);
     return target;
   }
 
-  void multi_linear_fit();
+  /** Predictions of nbSamples rows of nbFeatures features */
+  void predict_features(const PrecisionType* f, std::size_t nbSamples,
+                        std::size_t nbFeatures, PrecisionType* y) const;
+
+  /** Weighted least squares fit of the n samples of nbVars inputs
+      x(i, j), from which the predictors are computed by the feature
+      map, and nbTargets targets y(i, k). The samples are streamed
+      into the normal equations X^T W X and X^T W y_k by the threads,
+      and the m x m system is factorized once and solved for all the
+      targets, so that the memory used does not depend on n. The normal
+      equations of the fit are kept for a later update of the model. */
+  template<typename XType, typename YType>
+  void multi_linear_fit(std::size_t n, std::size_t nbVars, 
+                        std::size_t nbTargets, XType x, YType y);
+
+  /** Normal equations a (row major) and b_k of the predictors x_j-s_j
+      from the ones of the predictors x_j, in place */
+  void shift_normal_equations(VectorType& a, MatrixType& b,
+                              const VectorType& shift, std::size_t m) const;
+
+  /** Solutions of the m x m normal equations a c_k = b_k, by the
+      Cholesky factorization of a, or the minimum norm ones when a
+      predictor is a combination of the other ones */
+  MatrixType solve_normal_equations(VectorType a, MatrixType b,
+                                    std::size_t m) const;
+
+  /** Ridge solutions of the normal equations a c_k = b_k of n samples
+      whose targets have the weighted sums of squares yy_k, the penalty
+      of each target being chosen in the ridge path by generalized
+      cross-validation and returned in lambdas */
+  MatrixType ridge_solve_normal_equations(const VectorType& a, 
+                                          const MatrixType& b,
+                                          const VectorType& yy, 
+                                          std::size_t n, std::size_t m,
+                                          VectorType& lambdas) const;
+
+  /** Cholesky factorization a = L L^T of the symmetric positive
+      definite matrix a (row major), L overwriting its lower
+      triangle. Returns false if a is singular. */
+  bool cholesky_factor(VectorType& a, std::size_t m) const;
+
+  /** Solution of L L^T c = b, in place in b */
+  void cholesky_substitute(const VectorType& l, VectorType& b, 
+                           std::size_t m) const;
+
+  /** Eigen decomposition a = V diag(a_jj) V^T of the symmetric matrix
+      a, in place in a */
+  void eigen_decomposition(VectorType& a, VectorType& v, 
+                           std::size_t m) const;
+
+  /** Solution of (V diag(eigen) V^T + lambda I) c = b, the directions
+      of the eigenvalues which are negligible being left out: for
+      lambda = 0, the minimum norm solution */
+  VectorType eigen_solve(const VectorType& eigen, const VectorType& v, 
+                         const VectorType& b, PrecisionType lambda,
+                         std::size_t m) const;
 
   std::string GetNameOfClass()
   {
@@ -179,7 +372,7 @@ protected:
   }
 
   template<typename MVType>
-  VectorType SampleToVector(MVType mv) const
+  VectorType SampleToVector(const MVType& mv) const
   {
     VectorType tmp_vec(mv.Size());
     for(size_t i=0; i<mv.Size(); ++i)
@@ -188,9 +381,43 @@ protected:
   }
   MatrixType m_x;
   VectorType m_y;
+  // targets of a fit of several targets
+  MatrixType m_Y;
   VectorType m_w;
   bool m_weights;
+  // coefficients of the first target, which are the ones of Predict,
+  // and of all the targets
   VectorType m_model;
+  MatrixType m_models;
+  VectorType m_RidgePath;
+  // ridge penalty of each target
+  VectorType m_Lambdas;
+  bool m_WarmStart{false};
+  // normal equations of the fit: X^T W X (row major) and X^T W y_k, the
+  // first column of X being the constant, with y_k^T W y_k and the
+  // number of samples, which are needed by the cross-validation of the
+  // ridge path
+  VectorType m_XtWX;
+  MatrixType m_XtWy;
+  VectorType m_YtWy;
+  std::size_t m_NbSamples{0};
+  std::size_t m_NbThreads{1};
+  FeatureMapType m_FeatureMap;
+
+  // number of ranges of samples whose normal equations are accumulated
+  // separately, which bounds the number of threads used
+  static constexpr std::size_t NbLanes{64};
+  // number of samples summed before being added to the normal equations
+  // of their range
+  static constexpr std::size_t ChunkSize{4096};
+  // relative size of the pivots and eigenvalues of the scaled normal
+  // equations below which they are singular
+  static constexpr double SingularTolerance{1e-12};
+  // number of samples whose predictions are computed together
+  static constexpr std::size_t BatchLanes{4};
+  // number of samples whose features are computed before their
+  // predictions
+  static constexpr std::size_t FeatureBlockSize{64};
   
 };
 }//namespace otb
@@ -15,44 +15,544 @@
 #define __OTBMLRM_TXX
 
 #include "otbMultiLinearRegressionModel.h"
+#include "otbBVUtil.h"
 #include <fstream>
+#include <sstream>
 #include <iomanip>
+#include <cmath>
+#include <algorithm>
+#include <limits>
 
 namespace otb{
+// the sizes are bound to references by std::min and ?:
 template <typename PrecisionType>
-void  MultiLinearRegressionModel<PrecisionType>::multi_linear_fit()
+constexpr std::size_t MultiLinearRegressionModel<PrecisionType>::NbLanes;
+template <typename PrecisionType>
+constexpr std::size_t MultiLinearRegressionModel<PrecisionType>::ChunkSize;
+template <typename PrecisionType>
+constexpr std::size_t MultiLinearRegressionModel<PrecisionType>::FeatureBlockSize;
+
+template <typename PrecisionType>
+template<typename XType, typename YType>
+void  MultiLinearRegressionModel<PrecisionType>::multi_linear_fit(
+  std::size_t n, std::size_t nbVars, std::size_t nbTargets, XType x, 
+  YType y_of)
 {
-  auto n = m_x.size();
-  auto m = m_x[0].size()+1;
-  auto X = gsl_matrix_alloc (n, m);
-  auto y = gsl_vector_alloc (n);
-  auto w = gsl_vector_alloc (n);
-  auto c = gsl_vector_alloc (m);
-  auto cov = gsl_matrix_alloc (m, m);
-  for (size_t i = 0; i < n; i++)
-    {
-    gsl_matrix_set (X, i, 0, 1.0);
-    for(size_t j=0; j<m-1; j++)
-      gsl_matrix_set(X, i, j+1, m_x[i][j]);
-    gsl_vector_set (y, i, m_y[i]);
-    if(m_weights)
+  if(m_WarmStart && !m_XtWy.empty() && 
+     m_FeatureMap.GetNumberOfInputs() != nbVars)
+    {
+    itkExceptionMacro(<< "The model to update has " 
+                      << m_FeatureMap.GetNumberOfInputs()
+                      << " inputs instead of " << nbVars << ".");
+    }
+  m_FeatureMap.SetNumberOfInputs(nbVars);
+  auto m = m_FeatureMap.GetNumberOfFeatures()+1;
+  if(m_weights && m_w.size() < n)
+    {
+    itkExceptionMacro(<< "The number of weights (" << m_w.size() 
+                      << ") is lower than the number of samples (" << n 
+                      << ").");
+    }
+  if(m_WarmStart && m_XtWy.empty())
+    {
+    itkExceptionMacro(<< "The model to update has no normal equations: "
+                      << "it has to be learned again from scratch.");
+    }
+  if(m_WarmStart && m_XtWX.size() != m*m)
+    {
+    itkExceptionMacro(<< "The model to update has " << m_XtWy[0].size()-1
+                      << " predictors instead of " << m-1 << ".");
+    }
+  if(m_WarmStart && m_XtWy.size() != nbTargets)
+    {
+    itkExceptionMacro(<< "The model to update has " << m_XtWy.size()
+                      << " targets instead of " << nbTargets << ".");
+    }
+  for(auto lambda : m_RidgePath)
+    if(!(lambda >= 0))
       {
-      gsl_vector_set (w, i, 1.0/(m_w[i]*m_w[i]));
+      itkExceptionMacro(<< "The ridge penalties must be non negative.");
       }
-    else
+  // the sums of squares of the targets were not saved by the first
+  // versions of the model
+  bool sumsOfSquares = !m_WarmStart || !m_YtWy.empty();
+  if(!m_RidgePath.empty() && !sumsOfSquares)
+    {
+    itkExceptionMacro(<< "The model to update has no sums of squares of "
+                      << "its targets, which the ridge path needs: it has "
+                      << "to be learned again from scratch.");
+    }
+  // the predictors of sample i, computed from its inputs by the
+  // feature map, to f
+  auto predictors = [&](std::size_t i, VectorType& inputs, PrecisionType* f){
+    if(m_FeatureMap.IsIdentity())
+      {
+      for(size_t j=0; j<nbVars; j++)
+        f[j] = x(i, j);
+      return;
+      }
+    for(size_t j=0; j<nbVars; j++)
+      inputs[j] = x(i, j);
+    m_FeatureMap.Expand(inputs.data(), f);
+  };
+  // the predictors are shifted by the ones of the first sample, which
+  // keeps the sums away from cancellations when the predictors are far
+  // from 0 and makes a constant predictor an exact 0
+  VectorType shift(m, 0), inputs0(nbVars);
+  predictors(0, inputs0, shift.data()+1);
+  // the samples are streamed into the normal equations of a fixed number
+  // of lanes (ranges of samples), by chunks which are summed in order,
+  // and the lanes are summed in order, so that the model does not depend
+  // on the number of threads and the memory does not depend on n
+  std::size_t nbLanes = std::min<std::size_t>(NbLanes, n);
+  std::size_t chunkSize = ChunkSize;
+  std::vector<VectorType> laneXtWX(nbLanes, VectorType(m*m, 0));
+  std::vector<VectorType> laneXtWy(nbLanes, VectorType(nbTargets*m, 0));
+  std::vector<VectorType> laneYtWy(nbLanes, VectorType(nbTargets, 0));
+  otb::parallel_for_blocks(0, nbLanes, m_NbThreads,
+                           [&](std::size_t l_first, std::size_t l_last){
+    VectorType row(m), inputs(nbVars), yi(nbTargets), chunkXtWX(m*m), 
+      chunkXtWy(nbTargets*m), chunkYtWy(nbTargets);
+    row[0] = 1.0;
+    for(auto l = l_first; l < l_last; ++l)
+      {
+      auto range = otb::BV::shard_range(n, l, nbLanes);
+      for(auto first = range.first; first < range.second; first += chunkSize)
+        {
+        auto last = std::min(first+chunkSize, range.second);
+        std::fill(chunkXtWX.begin(), chunkXtWX.end(), 0);
+        std::fill(chunkXtWy.begin(), chunkXtWy.end(), 0);
+        std::fill(chunkYtWy.begin(), chunkYtWy.end(), 0);
+        for(auto i = first; i < last; ++i)
+          {
+          predictors(i, inputs, row.data()+1);
+          for(size_t j=1; j<m; j++)
+            row[j] -= shift[j];
+          for(size_t k=0; k<nbTargets; k++)
+            yi[k] = y_of(i, k);
+          auto wi = m_weights ? 1.0/(m_w[i]*m_w[i]) : 1.0;
+          for(size_t j=0; j<m; j++)
+            {
+            auto wr = wi*row[j];
+            for(size_t k=0; k<nbTargets; k++)
+              chunkXtWy[k*m+j] += wr*yi[k];
+            for(size_t k=0; k<=j; k++)
+              chunkXtWX[j*m+k] += wr*row[k];
+            }
+          for(size_t k=0; k<nbTargets; k++)
+            chunkYtWy[k] += wi*yi[k]*yi[k];
+          }
+        for(size_t j=0; j<m*m; j++)
+          laneXtWX[l][j] += chunkXtWX[j];
+        for(size_t j=0; j<nbTargets*m; j++)
+          laneXtWy[l][j] += chunkXtWy[j];
+        for(size_t k=0; k<nbTargets; k++)
+          laneYtWy[l][k] += chunkYtWy[k];
+        }
+      }
+    });
+  VectorType xtwx(m*m, 0);
+  MatrixType xtwy(nbTargets, VectorType(m, 0));
+  VectorType ytwy(nbTargets, 0);
+  for(std::size_t l = 0; l < nbLanes; ++l)
+    {
+    for(size_t j=0; j<m*m; j++)
+      xtwx[j] += laneXtWX[l][j];
+    for(size_t k=0; k<nbTargets; k++)
+      {
+      for(size_t j=0; j<m; j++)
+        xtwy[k][j] += laneXtWy[l][k*m+j];
+      ytwy[k] += laneYtWy[l][k];
+      }
+    }
+  for(size_t j=0; j<m; j++)
+    for(size_t k=0; k<j; k++)
+      xtwx[k*m+j] = xtwx[j*m+k];
+
+  // the normal equations of the model to update are moved to the
+  // shifted predictors
+  auto nbSamples = n;
+  if(m_WarmStart)
+    {
+    auto old_xtwx = m_XtWX;
+    auto old_xtwy = m_XtWy;
+    shift_normal_equations(old_xtwx, old_xtwy, shift, m);
+    for(size_t j=0; j<m*m; j++)
+      xtwx[j] += old_xtwx[j];
+    for(size_t k=0; k<nbTargets; k++)
+      for(size_t j=0; j<m; j++)
+        xtwy[k][j] += old_xtwy[k][j];
+    if(sumsOfSquares)
+      for(size_t k=0; k<nbTargets; k++)
+        ytwy[k] += m_YtWy[k];
+    nbSamples += m_NbSamples;
+    }
+  m_Lambdas.clear();
+  auto c = m_RidgePath.empty() ? 
+    solve_normal_equations(xtwx, xtwy, m) :
+    ridge_solve_normal_equations(xtwx, xtwy, ytwy, nbSamples, m, m_Lambdas);
+  // back to the predictors: y = c0 + sum_j c_j (x_j - s_j)
+  for(auto& ck : c)
+    for(size_t j=1; j<m; j++)
+      ck[0] -= ck[j]*shift[j];
+  m_models = c;
+  m_model = c[0];
+  // the normal equations of the predictors are kept for a later update
+  VectorType unshift(m);
+  for(size_t j=0; j<m; j++)
+    unshift[j] = -shift[j];
+  shift_normal_equations(xtwx, xtwy, unshift, m);
+  m_XtWX = xtwx;
+  m_XtWy = xtwy;
+  m_YtWy = sumsOfSquares ? ytwy : VectorType{};
+  m_NbSamples = nbSamples;
+}
+
+template <typename PrecisionType>
+void MultiLinearRegressionModel<PrecisionType>::shift_normal_equations(
+  VectorType& a, MatrixType& b, const VectorType& shift, std::size_t m) const
+{
+  // with T the identity whose first row is (1, -s_1, ..., -s_{m-1}),
+  // the predictors x_j - s_j are X T, whose normal equations are
+  // T^T a T and T^T b
+  for(size_t i=0; i<m; i++)
+    for(size_t j=1; j<m; j++)
+      a[i*m+j] -= shift[j]*a[i*m];
+  for(size_t j=1; j<m; j++)
+    {
+    for(size_t k=0; k<m; k++)
+      a[j*m+k] -= shift[j]*a[k];
+    for(auto& bk : b)
+      bk[j] -= shift[j]*bk[0];
+    }
+}
+
+template <typename PrecisionType>
+typename MultiLinearRegressionModel<PrecisionType>::MatrixType
+MultiLinearRegressionModel<PrecisionType>::solve_normal_equations(
+  VectorType a, MatrixType b, std::size_t m) const
+{
+  // the system is scaled to a unit diagonal, the predictors which are
+  // 0 for all the samples being left out
+  VectorType d(m);
+  for(size_t j=0; j<m; j++)
+    d[j] = a[j*m+j] > 0 ? 1.0/std::sqrt(a[j*m+j]) : 0.0;
+  for(size_t j=0; j<m; j++)
+    {
+    for(size_t k=0; k<m; k++)
+      a[j*m+k] *= d[j]*d[k];
+    for(auto& bk : b)
+      bk[j] *= d[j];
+    }
+  // a single factorization for all the targets
+  auto l = a;
+  if(cholesky_factor(l, m))
+    for(auto& bk : b)
+      cholesky_substitute(l, bk, m);
+  else
+    {
+    VectorType v;
+    eigen_decomposition(a, v, m);
+    VectorType eigen(m);
+    for(size_t j=0; j<m; j++)
+      eigen[j] = a[j*m+j];
+    for(auto& bk : b)
+      bk = eigen_solve(eigen, v, bk, 0, m);
+    }
+  for(auto& bk : b)
+    for(size_t j=0; j<m; j++)
+      bk[j] *= d[j];
+  return b;
+}
+
+template <typename PrecisionType>
+typename MultiLinearRegressionModel<PrecisionType>::MatrixType
+MultiLinearRegressionModel<PrecisionType>::ridge_solve_normal_equations(
+  const VectorType& a, const MatrixType& b, const VectorType& yy, 
+  std::size_t n, std::size_t m, VectorType& lambdas) const
+{
+  // the intercept is not penalized: the predictors and the targets are
+  // centered, which leaves the p x p normal equations of the
+  // predictors, scaled to a unit diagonal
+  auto p = m-1;
+  auto sw = a[0];
+  VectorType s(p*p), d(p);
+  for(size_t j=0; j<p; j++)
+    for(size_t k=0; k<p; k++)
+      s[j*p+k] = a[(j+1)*m+k+1]-a[j+1]*a[k+1]/sw;
+  for(size_t j=0; j<p; j++)
+    d[j] = s[j*p+j] > 0 ? 1.0/std::sqrt(s[j*p+j]) : 0.0;
+  for(size_t j=0; j<p; j++)
+    for(size_t k=0; k<p; k++)
+      s[j*p+k] *= d[j]*d[k];
+  VectorType v;
+  eigen_decomposition(s, v, p);
+  VectorType eigen(p);
+  PrecisionType eigen_max{0};
+  for(size_t k=0; k<p; k++)
+    {
+    eigen[k] = std::max<PrecisionType>(s[k*p+k], 0);
+    eigen_max = std::max(eigen_max, eigen[k]);
+    }
+  MatrixType c;
+  lambdas.clear();
+  for(size_t t=0; t<b.size(); t++)
+    {
+    VectorType bc(p), z(p, 0);
+    for(size_t j=0; j<p; j++)
+      bc[j] = (b[t][j+1]-a[j+1]*b[t][0]/sw)*d[j];
+    for(size_t k=0; k<p; k++)
+      for(size_t j=0; j<p; j++)
+        z[k] += v[j*p+k]*bc[j];
+    auto yyc = yy[t]-b[t][0]*b[t][0]/sw;
+    // generalized cross-validation n RSS/(n-df)^2, where the residual
+    // sum of squares and the degrees of freedom of each penalty are
+    // sums over the eigenvalues
+    auto best_gcv = std::numeric_limits<PrecisionType>::infinity();
+    auto best_lambda = m_RidgePath[0];
+    for(auto lambda : m_RidgePath)
+      {
+      auto rss = yyc;
+      PrecisionType df{1};
+      for(size_t k=0; k<p; k++)
+        {
+        auto e = eigen[k]+lambda;
+        if(!(e > SingularTolerance*eigen_max)) continue;
+        rss -= z[k]*z[k]*(eigen[k]+2*lambda)/(e*e);
+        df += eigen[k]/e;
+        }
+      auto gcv = n > df ? n*std::max<PrecisionType>(rss, 0)/((n-df)*(n-df)) :
+        std::numeric_limits<PrecisionType>::infinity();
+      if(gcv < best_gcv)
+        {
+        best_gcv = gcv;
+        best_lambda = lambda;
+        }
+      }
+    auto beta = eigen_solve(eigen, v, bc, best_lambda, p);
+    // back to the predictors, the intercept being the one of the means
+    VectorType ct(m);
+    ct[0] = b[t][0];
+    for(size_t j=0; j<p; j++)
+      {
+      ct[j+1] = beta[j]*d[j];
+      ct[0] -= a[j+1]*ct[j+1];
+      }
+    ct[0] /= sw;
+    c.push_back(ct);
+    lambdas.push_back(best_lambda);
+    }
+  return c;
+}
+
+template <typename PrecisionType>
+bool MultiLinearRegressionModel<PrecisionType>::cholesky_factor(VectorType& a,
+                                                                std::size_t m) const
+{
+  // a = L L^T, L overwriting the lower triangle of a
+  for(size_t j=0; j<m; j++)
+    {
+    auto d = a[j*m+j];
+    for(size_t k=0; k<j; k++)
+      d -= a[j*m+k]*a[j*m+k];
+    // a pivot lost to rounding errors is a predictor which is a
+    // combination of the other ones
+    if(!(d > SingularTolerance*a[j*m+j]))
+      return false;
+    a[j*m+j] = std::sqrt(d);
+    for(size_t i=j+1; i<m; i++)
       {
-      gsl_vector_set (w, i, 1.0);
+      auto v = a[i*m+j];
+      for(size_t k=0; k<j; k++)
+        v -= a[i*m+k]*a[j*m+k];
+      a[i*m+j] = v/a[j*m+j];
       }
     }
-  gsl_multifit_linear_workspace * work 
-    = gsl_multifit_linear_alloc (n, m);
-  double chisq{0};
-  gsl_multifit_wlinear(X, w, y, c, cov, &chisq, work);
-  gsl_multifit_linear_free(work);
+  return true;
+}
+
+template <typename PrecisionType>
+void MultiLinearRegressionModel<PrecisionType>::cholesky_substitute(
+  const VectorType& l, VectorType& b, std::size_t m) const
+{
+  // L z = b then L^T c = z, in place in b
+  for(size_t i=0; i<m; i++)
+    {
+    for(size_t k=0; k<i; k++)
+      b[i] -= l[i*m+k]*b[k];
+    b[i] /= l[i*m+i];
+    }
+  for(size_t i=m; i-- > 0;)
+    {
+    for(size_t k=i+1; k<m; k++)
+      b[i] -= l[k*m+i]*b[k];
+    b[i] /= l[i*m+i];
+    }
+}
 
-  m_model = VectorType{};
+template <typename PrecisionType>
+void MultiLinearRegressionModel<PrecisionType>::eigen_decomposition(
+  VectorType& a, VectorType& v, std::size_t m) const
+{
+  // cyclic Jacobi rotations
+  v.assign(m*m, 0);
   for(size_t j=0; j<m; j++)
-    m_model.push_back(gsl_vector_get(c,j));
+    v[j*m+j] = 1.0;
+  for(std::size_t sweep = 0; sweep < 100; ++sweep)
+    {
+    PrecisionType off{0}, diag{0};
+    for(size_t j=0; j<m; j++)
+      {
+      diag += a[j*m+j]*a[j*m+j];
+      for(size_t k=j+1; k<m; k++)
+        off += a[j*m+k]*a[j*m+k];
+      }
+    if(!(off > 1e-30*diag)) break;
+    for(size_t p=0; p<m; p++)
+      for(size_t q=p+1; q<m; q++)
+        {
+        auto apq = a[p*m+q];
+        if(apq == 0) continue;
+        auto theta = (a[q*m+q]-a[p*m+p])/(2*apq);
+        auto t = (theta >= 0 ? 1.0 : -1.0)/
+          (std::fabs(theta)+std::sqrt(theta*theta+1));
+        auto cs = 1.0/std::sqrt(t*t+1);
+        auto sn = t*cs;
+        for(size_t k=0; k<m; k++)
+          {
+          auto akp = a[k*m+p];
+          auto akq = a[k*m+q];
+          a[k*m+p] = cs*akp-sn*akq;
+          a[k*m+q] = sn*akp+cs*akq;
+          }
+        for(size_t k=0; k<m; k++)
+          {
+          auto apk = a[p*m+k];
+          auto aqk = a[q*m+k];
+          a[p*m+k] = cs*apk-sn*aqk;
+          a[q*m+k] = sn*apk+cs*aqk;
+          auto vkp = v[k*m+p];
+          auto vkq = v[k*m+q];
+          v[k*m+p] = cs*vkp-sn*vkq;
+          v[k*m+q] = sn*vkp+cs*vkq;
+          }
+        }
+    }
+}
+
+template <typename PrecisionType>
+typename MultiLinearRegressionModel<PrecisionType>::VectorType
+MultiLinearRegressionModel<PrecisionType>::eigen_solve(
+  const VectorType& eigen, const VectorType& v, const VectorType& b, 
+  PrecisionType lambda, std::size_t m) const
+{
+  PrecisionType eigen_max{0};
+  for(size_t j=0; j<m; j++)
+    eigen_max = std::max(eigen_max, eigen[j]);
+  // the directions of the small eigenvalues, which are combinations of
+  // the predictors equal to a constant, are left out
+  VectorType c(m, 0);
+  for(size_t k=0; k<m; k++)
+    {
+    auto e = eigen[k]+lambda;
+    if(!(e > SingularTolerance*eigen_max)) continue;
+    PrecisionType vb{0};
+    for(size_t j=0; j<m; j++)
+      vb += v[j*m+k]*b[j];
+    for(size_t j=0; j<m; j++)
+      c[j] += v[j*m+k]*vb/e;
+    }
+  return c;
+}
+
+template <typename PrecisionType>
+typename MultiLinearRegressionModel<PrecisionType>::Pointer
+MultiLinearRegressionModel<PrecisionType>::GetTargetModel(std::size_t k) const
+{
+  if(k >= m_models.size())
+    {
+    itkExceptionMacro(<< "The model has " << m_models.size() 
+                      << " targets, not " << k+1 << ".");
+    }
+  auto target = Self::New();
+  target->m_model = m_models[k];
+  target->m_models = {m_models[k]};
+  if(!m_Lambdas.empty())
+    target->m_Lambdas = {m_Lambdas[k]};
+  if(!m_XtWy.empty())
+    {
+    target->m_XtWX = m_XtWX;
+    target->m_XtWy = {m_XtWy[k]};
+    }
+  if(!m_YtWy.empty())
+    target->m_YtWy = {m_YtWy[k]};
+  target->m_NbSamples = m_NbSamples;
+  target->m_RidgePath = m_RidgePath;
+  target->m_NbThreads = m_NbThreads;
+  target->m_FeatureMap = m_FeatureMap;
+  return target;
+}
+
+template <typename PrecisionType>
+void MultiLinearRegressionModel<PrecisionType>::PredictBatch(
+  const PrecisionType* x, std::size_t nbSamples, std::size_t nbInputs,
+  PrecisionType* y) const
+{
+  if(m_model.size()==0)
+    {
+    itkExceptionMacro(<< "Model is not initialized.");
+    }
+  if(nbInputs!=this->GetNumberOfInputs())
+    {
+    itkExceptionMacro(<< "Predictor vector and model have different sizes.");
+    }
+  if(m_FeatureMap.IsIdentity())
+    {
+    predict_features(x, nbSamples, nbInputs, y);
+    return;
+    }
+  // the features of a block of samples are computed before their
+  // predictions
+  auto nbFeatures = m_model.size()-1;
+  auto blockSize = nbSamples < FeatureBlockSize ? nbSamples : 
+    FeatureBlockSize;
+  VectorType f(blockSize*nbFeatures);
+  for(std::size_t first=0; first<nbSamples; first+=blockSize)
+    {
+    auto size = std::min(blockSize, nbSamples-first);
+    for(std::size_t i=0; i<size; i++)
+      m_FeatureMap.Expand(x+(first+i)*nbInputs, f.data()+i*nbFeatures);
+    predict_features(f.data(), size, nbFeatures, y+first);
+    }
+}
+
+template <typename PrecisionType>
+void MultiLinearRegressionModel<PrecisionType>::predict_features(
+  const PrecisionType* x, std::size_t nbSamples, std::size_t nbInputs,
+  PrecisionType* y) const
+{
+  const auto* c = m_model.data();
+  std::size_t i{0};
+  for(; i+BatchLanes <= nbSamples; i += BatchLanes)
+    {
+    const auto* xi = x+i*nbInputs;
+    PrecisionType sums[BatchLanes];
+    for(std::size_t b=0; b<BatchLanes; b++)
+      sums[b] = c[0];
+    for(std::size_t j=0; j<nbInputs; j++)
+      for(std::size_t b=0; b<BatchLanes; b++)
+        sums[b] += c[j+1]*xi[b*nbInputs+j];
+    for(std::size_t b=0; b<BatchLanes; b++)
+      y[i+b] = sums[b];
+    }
+  for(; i<nbSamples; i++)
+    {
+    const auto* xi = x+i*nbInputs;
+    auto sum = c[0];
+    for(std::size_t j=0; j<nbInputs; j++)
+      sum += c[j+1]*xi[j];
+    y[i] = sum;
+    }
 }
 
 template <typename PrecisionType>
@@ -73,6 +573,47 @@ void  MultiLinearRegressionModel<PrecisionType>::Save(const std::string &
   model_file << std::setprecision(10);
   for(auto& coef: m_model)
     model_file << coef << "\n";
+  // the coefficients of the other targets, one line per target
+  for(size_t k=1; k<m_models.size(); k++)
+    {
+    model_file << "target";
+    for(auto& coef: m_models[k])
+      model_file << ' ' << coef;
+    model_file << "\n";
+    }
+  if(!m_FeatureMap.IsIdentity())
+    model_file << "features " << m_FeatureMap.ToString() << "\n";
+  model_file << std::setprecision(17);
+  if(!m_Lambdas.empty())
+    {
+    model_file << "lambda";
+    for(auto& v: m_Lambdas)
+      model_file << ' ' << v;
+    model_file << "\n";
+    }
+  // the normal equations, which let a later training update the model,
+  // with an xtwy line per target
+  if(!m_XtWy.empty())
+    {
+    model_file << "xtwx";
+    for(auto& v: m_XtWX)
+      model_file << ' ' << v;
+    model_file << "\n";
+    for(auto& xtwy: m_XtWy)
+      {
+      model_file << "xtwy";
+      for(auto& v: xtwy)
+        model_file << ' ' << v;
+      model_file << "\n";
+      }
+    }
+  if(!m_YtWy.empty())
+    {
+    model_file << "ytwy";
+    for(auto& v: m_YtWy)
+      model_file << ' ' << v;
+    model_file << "\nsamples " << m_NbSamples << "\n";
+    }
   model_file.close();
 }
 template <typename PrecisionType>
@@ -90,11 +631,40 @@ void  MultiLinearRegressionModel<PrecisionType>::Load(const std::string &
     itkGenericExceptionMacro(<< "Could not open file " << filename.c_str());
     }
   m_model.clear();
+  m_models.clear();
+  m_Lambdas.clear();
+  m_XtWX.clear();
+  m_XtWy.clear();
+  m_YtWy.clear();
+  m_NbSamples = 0;
+  m_FeatureMap = FeatureMapType();
   std::string line;
   std::getline(model_file, line); //skip header line
+  auto read_values = [](const std::string& values_line, std::size_t skip){
+    std::istringstream ss(values_line.substr(skip));
+    VectorType values;
+    PrecisionType value;
+    while(ss >> value)
+      values.push_back(value);
+    return values;
+  };
   while(std::getline(model_file, line))
     {
-    if(line.size() > 1)
+    if(line.compare(0, 6, "target") == 0)
+      m_models.push_back(read_values(line, 6));
+    else if(line.compare(0, 8, "features") == 0)
+      m_FeatureMap = FeatureMapType::FromString(line.substr(8));
+    else if(line.compare(0, 6, "lambda") == 0)
+      m_Lambdas = read_values(line, 6);
+    else if(line.compare(0, 4, "xtwx") == 0)
+      m_XtWX = read_values(line, 4);
+    else if(line.compare(0, 4, "xtwy") == 0)
+      m_XtWy.push_back(read_values(line, 4));
+    else if(line.compare(0, 4, "ytwy") == 0)
+      m_YtWy = read_values(line, 4);
+    else if(line.compare(0, 7, "samples") == 0)
+      m_NbSamples = std::stoul(line.substr(7));
+    else if(!line.empty())
       {
       std::istringstream ss(line);
       PrecisionType value;
@@ -106,6 +676,33 @@ void  MultiLinearRegressionModel<PrecisionType>::Load(const std::string &
                                << "\n" << line << "\n");
     }
   model_file.close();
+  m_models.insert(m_models.begin(), m_model);
+  auto m = m_model.size();
+  for(const auto& c : m_models)
+    if(c.size() != m)
+      itkGenericExceptionMacro(<< "The targets of model file " << filename
+                               << " have different numbers of "
+                               << "coefficients.");
+  if(m_FeatureMap.IsIdentity() && m > 0)
+    m_FeatureMap.SetNumberOfInputs(m-1);
+  else if(!m_FeatureMap.IsIdentity() && 
+          m != m_FeatureMap.GetNumberOfFeatures()+1)
+    itkGenericExceptionMacro(<< "The feature map of model file " << filename
+                             << " gives " 
+                             << m_FeatureMap.GetNumberOfFeatures()
+                             << " features for " << m << " coefficients.");
+  if(!m_Lambdas.empty() && m_Lambdas.size() != m_models.size())
+    itkGenericExceptionMacro(<< "Bad ridge penalties in model file " 
+                             << filename);
+  // models saved without their normal equations can be used but not
+  // updated
+  bool bad_equations = !m_XtWy.empty() && 
+    (m_XtWy.size() != m_models.size() || m_XtWX.size() != m*m);
+  for(const auto& xtwy : m_XtWy)
+    bad_equations = bad_equations || xtwy.size() != m;
+  if(bad_equations || (!m_YtWy.empty() && m_YtWy.size() != m_XtWy.size()))
+    itkGenericExceptionMacro(<< "Bad normal equations in model file " 
+                             << filename);
 }
 
 template <typename PrecisionType>
@@ -0,0 +1,102 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __OTBPHILOXRNG_H
+#define __OTBPHILOXRNG_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace otb
+{
+namespace BV
+{
+/** Counter-based random number generator (Philox4x32-10, Salmon et
+    al. 2011, "Parallel random numbers: as easy as 1, 2, 3").
+
+    The stream is a pure function of (seed, index, stream): a sample
+    drawn with PhiloxRNG(seed, i) does not depend on which thread or
+    process draws it, nor on how many samples were drawn before. This is
+    what makes threaded, resumed and sharded runs produce the same
+    output as a single sequential run.
+
+    The class satisfies the UniformRandomBitGenerator requirements and
+    can be used with the std distributions.
+*/
+class PhiloxRNG
+{
+public:
+  using result_type = std::uint32_t;
+  using CounterType = std::array<std::uint32_t, 4>;
+  using KeyType = std::array<std::uint32_t, 2>;
+
+  PhiloxRNG(std::uint64_t seed, std::uint64_t index, std::uint32_t stream=0) :
+    m_Key{{static_cast<std::uint32_t>(seed),
+          static_cast<std::uint32_t>(seed>>32)}},
+    m_Counter{{static_cast<std::uint32_t>(index),
+              static_cast<std::uint32_t>(index>>32), stream, 0}},
+    m_Output{}, m_Position{4} {}
+
+  static constexpr result_type min()
+  {
+    return std::numeric_limits<result_type>::min();
+  }
+  static constexpr result_type max()
+  {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  inline
+  result_type operator()()
+  {
+    if(m_Position == 4)
+      {
+      m_Output = Philox4x32(m_Counter, m_Key);
+      ++m_Counter[3];
+      m_Position = 0;
+      }
+    return m_Output[m_Position++];
+  }
+
+  /** The 10 round block function. Exposed for the known answer tests. */
+  static
+  CounterType Philox4x32(CounterType ctr, KeyType key)
+  {
+    for(auto round = 0; round < 10; ++round)
+      {
+      if(round > 0)
+        {
+        key[0] += 0x9E3779B9;
+        key[1] += 0xBB67AE85;
+        }
+      auto p0 = static_cast<std::uint64_t>(0xD2511F53) * ctr[0];
+      auto p1 = static_cast<std::uint64_t>(0xCD9E8D57) * ctr[2];
+      ctr = {{static_cast<std::uint32_t>(p1>>32)^ctr[1]^key[0],
+              static_cast<std::uint32_t>(p1),
+              static_cast<std::uint32_t>(p0>>32)^ctr[3]^key[1],
+              static_cast<std::uint32_t>(p0)}};
+      }
+    return ctr;
+  }
+
+protected:
+  KeyType m_Key;
+  CounterType m_Counter;
+  CounterType m_Output;
+  unsigned int m_Position;
+};
+
+}//namespace BV
+}//namespace otb
+#endif
@@ -56,7 +56,10 @@ def addVI(reflectances_file, red_index, nir_index):
                 rf.write(outline)
 
 
-def generateInputBVDistribution(bvFile, nSamples, simuPars):
+def generateInputBVDistribution(bvFile, nSamples, simuPars, sampling="random", seed=None):
+    """
+    sampling is one of random, lhs or sobol. A seed makes the generation reproducible.
+    """
     app = otb.Registry.CreateApplication("BVInputVariableGeneration")
     app.SetParameterInt("samples", nSamples)
     app.SetParameterFloat("minlai", simuPars['minlai'])
@@ -64,6 +67,9 @@ def generateInputBVDistribution(bvFile, nSamples, simuPars):
     app.SetParameterFloat("modlai", simuPars['modlai'])
     app.SetParameterFloat("stdlai", simuPars['stdlai'])
     app.SetParameterString("distlai", simuPars['distlai'])
+    app.SetParameterString("sampling", sampling)
+    if seed is not None:
+        app.SetParameterInt("seed", seed)
     app.SetParameterString("out", bvFile)
     app.ExecuteAndWriteOutput()
 
@@ -113,7 +119,26 @@ def generateTrainingData(bvFile, simuPars, trainingFile, bvidx, simulate=True, a
         addVI(trainingFile, red_index+1, nir_index+1)
                 
                 
-def learnBVModel(trainingFile, outputFile, regressionType, normalizationFile, bestof=1):
+def learnBVModel(trainingFile, outputFile, regressionType, normalizationFile, bestof=1, noisestd=None, noiseBands=None, noisecopies=1, seed=0, targetlai=None, proposallai=None, laiFile=None, reweighting="resample", kfold=None, kfoldFile=None, search=None, searchBudget=None, searchFile=None, initModel=None, initNormalization=None, reduction=None, reductionSize=None):
+    """
+    If noisestd is given, the noise is added to the reflectances of the training file
+    at learning time, so that the simulations can be done without noise once for all the noise levels.
+    noiseBands is the number of reflectances, which are the first input variables of the files of
+    generateTrainingData: the angles and the vegetation indices following them get no noise.
+    If targetlai is given (a dictionary with the distlai, minlai, maxlai, modlai and stdlai keys, as
+    for generateInputBVDistribution), the training samples, simulated with the proposallai distribution,
+    are reweighted to follow the target distribution, so that one simulation set can be used for
+    several LAI priors. laiFile is the bv file of the simulations when the learned variable is not the LAI.
+    If kfold is given, the regression is evaluated by k-fold cross-validation and the metrics are
+    written to kfoldFile.
+    If search is given (a list of "name=v1,v2" or "name=min:max" strings), the hyperparameters of
+    the regression are searched by successive halving, over searchBudget random configurations
+    if it is given, and the results are written to searchFile.
+    If initModel is given (with the initNormalization file written with it), the mlp or mlr
+    regression goes on from this model instead of starting from scratch.
+    If reduction is given (stratified, kmeans or farthest), the regression is trained on a
+    representative subset of reductionSize training samples.
+    """
     app = otb.Registry.CreateApplication("InverseModelLearning")
     app.SetParameterString("training", trainingFile)
     app.SetParameterString("out", outputFile)
@@ -121,6 +146,54 @@ def learnBVModel(trainingFile, outputFile, regressionType, normalizationFile, be
     app.SetParameterString("regression", regressionType)
     app.SetParameterString("normalization", normalizationFile)
     app.SetParameterInt("bestof", bestof)
+    if noisestd is not None:
+        if noiseBands is None:
+            raise ValueError("noiseBands is needed to add noise to the reflectances")
+        app.SetParameterStringList("noisestd", [str(noisestd)])
+        app.SetParameterInt("noisebands", noiseBands)
+        app.SetParameterInt("noisecopies", noisecopies)
+    app.SetParameterInt("seed", seed)
+    if targetlai is not None:
+        laiSpec = lambda p: [p['distlai'], str(p['minlai']), str(p['maxlai']), str(p['modlai']), str(p['stdlai'])]
+        app.SetParameterStringList("targetlai", laiSpec(targetlai))
+        if proposallai is not None:
+            app.SetParameterStringList("proposallai", laiSpec(proposallai))
+        if laiFile is not None:
+            app.SetParameterString("laifile", laiFile)
+        app.SetParameterString("reweighting", reweighting)
+    if kfold is not None:
+        app.SetParameterInt("kfold", kfold)
+        if kfoldFile is not None:
+            app.SetParameterString("kfoldout", kfoldFile)
+    if search is not None:
+        app.SetParameterStringList("search", search)
+        if searchBudget is not None:
+            app.SetParameterInt("searchbudget", searchBudget)
+        if searchFile is not None:
+            app.SetParameterString("searchout", searchFile)
+    if initModel is not None:
+        app.SetParameterString("init", initModel)
+        app.SetParameterString("initnormalization", initNormalization)
+    if reduction is not None:
+        app.SetParameterString("reduction", reduction)
+        app.SetParameterInt("reductionsize", reductionSize)
+    app.ExecuteAndWriteOutput()
+
+def distillBVModel(modelFile, normalizationFile, inputFile, outputFile, skip=0, synthetic=0, hidden=5, seed=0):
+    """
+    Learns a small mlp, saved in outputFile, which mimics the model on the samples of inputFile
+    (whose first skip fields are not input variables) and on synthetic samples around them.
+    The mlp is applied with the normalization file of the model.
+    """
+    app = otb.Registry.CreateApplication("BVModelDistillation")
+    app.SetParameterString("model", modelFile)
+    app.SetParameterString("normalization", normalizationFile)
+    app.SetParameterString("in", inputFile)
+    app.SetParameterString("out", outputFile)
+    app.SetParameterInt("skip", skip)
+    app.SetParameterInt("synthetic", synthetic)
+    app.SetParameterInt("hidden", hidden)
+    app.SetParameterInt("seed", seed)
     app.ExecuteAndWriteOutput()
 
 def invertBV(reflectanceFile, modelFile, normalizationFile, outputFile, removeFaparFcover=False, red_index=0, nir_index=0):
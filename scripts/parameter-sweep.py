@@ -58,6 +58,6 @@ for useVI in ["yes","no"]:
                         inversion:
                         {
                         bestof : 1
-                        regressor : \"nn\" # nn svr rfr mlr
+                        regressor : \"nn\" # nn svr rfr mlr mlp
                         }
                         """ )
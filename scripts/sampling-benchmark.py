@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# =========================================================================
+#   Program:   otb-bv
+#   Language:  python
+#
+#   Copyright (c) CESBIO. All rights reserved.
+#
+#   See otb-bv-copyright.txt for details.
+#
+#   This software is distributed WITHOUT ANY WARRANTY; without even
+#   the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+#   PURPOSE.  See the above copyright notices for more information.
+#
+# =========================================================================
+
+# Compare the sampling schemes of BVInputVariableGeneration: for each
+# scheme and training size, a LAI model is learned and evaluated on a
+# fixed random test set. The output gives the RMSE for each size and
+# the number of simulations each scheme needs to reach the RMSE of the
+# random sampling with the largest size.
+#
+# Usage: sampling-benchmark.py <rsr file> <working dir> [regressor]
+
+import os
+import sys
+import string
+import math
+import bv_net as bv
+
+if len(sys.argv) < 3:
+    sys.exit('Usage: %s <rsr file> <working dir> [regressor]' % sys.argv[0])
+rsr_file = sys.argv[1]
+working_dir = sys.argv[2]+"/"
+regressor = sys.argv[3] if len(sys.argv) > 3 else "nn"
+
+schemes = ["random", "lhs", "sobol"]
+sizes = [256, 512, 1024, 2048, 4096, 8192]
+repetitions = 3
+nbSamples_test = 20000
+nthreads = 8
+
+if not os.path.exists(working_dir):
+    os.makedirs(working_dir)
+
+varPars = {'minlai': 0.0, 'maxlai': 15.0, 'modlai': 2.0, 'stdlai': 2.0, 'distlai': "lognormal"}
+simuPars = {'rsrFile': rsr_file, 'solarZenithAngle': 30.0, 'sensorZenithAngle': 0.0,
+            'solarSensorAzimuth': 0.0, 'noisestd': 0.0}
+
+def rmse(validation_file):
+    errors = []
+    with open(validation_file, 'r') as vf:
+        for l in vf.readlines():
+            (estimated, reference) = string.split(l)
+            errors.append((float(estimated)-float(reference))**2)
+    return math.sqrt(sum(errors)/len(errors))
+
+# The test set does not depend on the scheme
+test_var_file = working_dir+"input-vars-test"
+test_training_file = working_dir+"training-test"
+simuPars['outputFile'] = working_dir+"reflectances-test"
+bv.generateInputBVDistribution(test_var_file, nbSamples_test, varPars, "random", 1)
+bv.generateTrainingData(test_var_file, simuPars, test_training_file, bv.bvindex["MLAI"], nthreads=nthreads)
+
+results = {}
+for scheme in schemes:
+    for size in sizes:
+        errors = []
+        for rep in range(repetitions):
+            base = working_dir+scheme+"_"+str(size)+"_"+str(rep)
+            simuPars['outputFile'] = base+"_reflectances"
+            bv.generateInputBVDistribution(base+"_input-vars", size, varPars, scheme, 100+rep)
+            bv.generateTrainingData(base+"_input-vars", simuPars, base+"_training", bv.bvindex["MLAI"], nthreads=nthreads)
+            bv.learnBVModel(base+"_training", base+"_model", regressor, base+"_normalization")
+            bv.invertBV(working_dir+"reflectances-test", base+"_model", base+"_normalization", base+"_inversion", True)
+            with open(base+"_inversion", 'r') as ivf:
+                with open(test_training_file, 'r') as tft:
+                    with open(base+"_validation", 'w') as vaf:
+                        for(ivline, tftline) in zip(ivf.readlines(), tft.readlines()):
+                            vaf.write(string.split(ivline)[0]+" "+string.split(tftline)[0]+"\n")
+            errors.append(rmse(base+"_validation"))
+        results[(scheme, size)] = sum(errors)/len(errors)
+        print scheme, size, results[(scheme, size)]
+
+target = results[("random", sizes[-1])]
+print "\nTarget RMSE (random sampling, "+str(sizes[-1])+" samples): "+str(target)
+print "scheme".ljust(10)+string.join([str(s).ljust(10) for s in sizes])+"samples for target"
+for scheme in schemes:
+    needed = [s for s in sizes if results[(scheme, s)] <= target]
+    print scheme.ljust(10)+string.join([("%.4f" % results[(scheme, s)]).ljust(10) for s in sizes])+(str(needed[0]) if needed else "> "+str(sizes[-1]))
@@ -12,6 +12,23 @@
 
 =========================================================================*/
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#if defined(__has_include)
+#if __cplusplus >= 201703L && __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
 #include <boost/algorithm/string.hpp>
 #include "itkMacro.h"
 #include "otbBVUtil.h"
@@ -43,6 +60,207 @@ size_t countColumns(std::string fileName)
 
 }
 
+void truncate_file(const std::string& fileName, std::uintmax_t size)
+{
+  if(truncate(fileName.c_str(), static_cast<off_t>(size)) != 0)
+    {
+    itkGenericExceptionMacro(<< "Could not truncate file " << fileName 
+                             << ": " << std::strerror(errno));
+    }
+}
+
+namespace
+{
+/** Read only memory mapping of a whole file */
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& fileName)
+  {
+    auto fd = open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+      {
+      itkGenericExceptionMacro(<< "Could not open file " << fileName 
+                               << ": " << std::strerror(errno));
+      }
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+      {
+      close(fd);
+      itkGenericExceptionMacro(<< "Could not stat file " << fileName 
+                               << ": " << std::strerror(errno));
+      }
+    m_Size = static_cast<std::size_t>(st.st_size);
+    if(m_Size > 0)
+      {
+      m_Data = mmap(nullptr, m_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(m_Data == MAP_FAILED)
+        {
+        close(fd);
+        itkGenericExceptionMacro(<< "Could not map file " << fileName 
+                                 << ": " << std::strerror(errno));
+        }
+      madvise(m_Data, m_Size, MADV_SEQUENTIAL);
+      }
+    close(fd);
+  }
+
+  ~MappedFile()
+  {
+    if(m_Size > 0)
+      munmap(m_Data, m_Size);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* Begin() const
+  {
+    return static_cast<const char*>(m_Data);
+  }
+
+  const char* End() const
+  {
+    return Begin()+m_Size;
+  }
+
+private:
+  void* m_Data{nullptr};
+  std::size_t m_Size{0};
+};
+
+bool is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/** Parses the value starting at the first non blank character of [p,
+    end) and returns the position after it, or nullptr if there is no
+    valid value. */
+const char* parse_value(const char* p, const char* end, double& value)
+{
+  while(p != end && is_blank(*p)) ++p;
+  if(p == end)
+    return nullptr;
+  if(*p == '+') ++p;
+#if defined(__cpp_lib_to_chars)
+  auto res = std::from_chars(p, end, value);
+  if(res.ec != std::errc())
+    return nullptr;
+  p = res.ptr;
+#else
+  // strtod needs a null terminated string, and the mapped file is not
+  char token[64];
+  std::size_t length{0};
+  while(p != end && !is_blank(*p) && length < sizeof(token)-1)
+    token[length++] = *p++;
+  token[length] = '\0';
+  char* token_end;
+  value = std::strtod(token, &token_end);
+  if(length == 0 || token_end != token+length)
+    return nullptr;
+#endif
+  if(p != end && !is_blank(*p))
+    return nullptr;
+  return p;
+}
+}//namespace
+
+TextTable read_text_table(const std::string& fileName, std::size_t nbColumns,
+                          bool skipHeader, std::size_t nbThreads)
+{
+  MappedFile file(fileName);
+  auto begin = file.Begin();
+  auto end = file.End();
+  auto next_line = [end](const char* p){
+    auto eol = static_cast<const char*>(std::memchr(p, '\n', end-p));
+    return eol ? eol+1 : end;
+  };
+  auto line_end = [end](const char* p){
+    auto eol = static_cast<const char*>(std::memchr(p, '\n', end-p));
+    return eol ? eol : end;
+  };
+  if(skipHeader && begin != end)
+    begin = next_line(begin);
+  // empty and blank lines are not rows
+  auto is_row = [&line_end](const char* p){ 
+    auto eol = line_end(p);
+    return std::find_if(p, eol, [](char c){ return !is_blank(c); }) != eol;
+  };
+
+  // chunks of whole lines
+  nbThreads = std::max<std::size_t>(nbThreads, 1);
+  std::vector<const char*> bounds{begin};
+  for(std::size_t t = 1; t < nbThreads; ++t)
+    {
+    auto p = begin+(end-begin)*t/nbThreads;
+    p = (p == begin) ? begin : next_line(p-1);
+    bounds.push_back(std::max(p, bounds.back()));
+    }
+  bounds.push_back(end);
+  auto nbChunks = bounds.size()-1;
+
+  // first pass: number of rows per chunk
+  std::vector<std::size_t> chunk_rows(nbChunks+1, 0);
+  parallel_for_blocks(0, nbChunks, nbThreads, 
+                      [&](std::size_t first, std::size_t last){
+    for(auto c = first; c < last; ++c)
+      for(auto p = bounds[c]; p != bounds[c+1]; p = next_line(p))
+        if(is_row(p)) ++chunk_rows[c+1];
+    });
+  for(std::size_t c = 0; c < nbChunks; ++c)
+    chunk_rows[c+1] += chunk_rows[c];
+  auto nbRows = chunk_rows[nbChunks];
+
+  TextTable table{nbColumns, {}};
+  if(nbRows == 0)
+    return table;
+  if(nbColumns == 0)
+    {
+    auto p = begin;
+    while(!is_row(p)) p = next_line(p);
+    auto eol = line_end(p);
+    double value;
+    while((p = parse_value(p, eol, value)) != nullptr)
+      ++table.nbColumns;
+    if(table.nbColumns == 0)
+      {
+      itkGenericExceptionMacro(<< "No value in the first row of " << fileName);
+      }
+    }
+  table.values.resize(nbRows*table.nbColumns);
+
+  // second pass: each chunk parses its rows at their final position
+  parallel_for_blocks(0, nbChunks, nbThreads, 
+                      [&](std::size_t first, std::size_t last){
+    for(auto c = first; c < last; ++c)
+      {
+      auto row = chunk_rows[c];
+      for(auto p = bounds[c]; p != bounds[c+1]; p = next_line(p))
+        {
+        if(!is_row(p)) 
+          continue;
+        auto eol = line_end(p);
+        auto values = table.Row(row);
+        auto q = p;
+        for(std::size_t col = 0; col < table.nbColumns; ++col)
+          {
+          q = parse_value(q, eol, values[col]);
+          if(q == nullptr)
+            {
+            itkGenericExceptionMacro(<< "Row " << row+1 << " of " << fileName
+                                     << " has less than " << table.nbColumns
+                                     << " valid values: " 
+                                     << std::string(p, eol));
+            }
+          }
+        ++row;
+        }
+      }
+    });
+  return table;
+}
+
 namespace BV
 {
 
@@ -77,6 +295,612 @@ otb::BV::NormalizationVectorType read_normalization_file(const std::string in_fi
   return var_minmax;
 }
 
+namespace
+{
+const std::string model_list_header{"# Multi-output regression model"};
+
+std::string directory_of(const std::string& filename)
+{
+  auto slash = filename.rfind('/');
+  return slash == std::string::npos ? "" : filename.substr(0, slash+1);
+}
+}
+
+void write_model_list(const std::vector<std::string>& model_filenames,
+                      const std::string out_filename)
+{
+  std::ofstream list_file{out_filename};
+  if(!list_file)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << out_filename);
+    }
+  auto directory = directory_of(out_filename);
+  list_file << model_list_header << "\n";
+  for(const auto& name : model_filenames)
+    {
+    // the models saved next to the list are given by their name only
+    if(!directory.empty() && name.compare(0, directory.size(), directory) == 0)
+      list_file << name.substr(directory.size()) << "\n";
+    else
+      list_file << name << "\n";
+    }
+  list_file.close();
+  if(!list_file)
+    {
+    itkGenericExceptionMacro(<< "Could not write model list " << out_filename);
+    }
+}
+
+std::vector<std::string> read_model_list(const std::string in_filename)
+{
+  std::ifstream list_file{in_filename};
+  std::string line;
+  if(!list_file || !std::getline(list_file, line) || line != model_list_header)
+    return {};
+  auto directory = directory_of(in_filename);
+  std::vector<std::string> model_filenames;
+  while(std::getline(list_file, line))
+    {
+    if(line.empty()) continue;
+    model_filenames.push_back(line[0] == '/' ? line : directory+line);
+    }
+  if(model_filenames.empty())
+    {
+    itkGenericExceptionMacro(<< "No model in the model list " << in_filename);
+    }
+  return model_filenames;
+}
+
+namespace
+{
+const std::string model_container_header{"# BV model container"};
+
+template<typename T>
+void write_container_line(std::ostream& os, const std::string& key,
+                          const std::vector<T>& values)
+{
+  if(values.empty()) return;
+  os << key;
+  for(const auto& v : values)
+    os << ' ' << v;
+  os << '\n';
+}
+
+/** Checks the fields of the header which do not depend on the
+    number of output variables of the models */
+void check_model_container(const ModelContainer& container,
+                           std::size_t nbModels, const std::string& filename)
+{
+  if(container.type.empty() || nbModels == 0)
+    {
+    itkGenericExceptionMacro(<< "The model container " << filename
+                             << " has no model type or no model.");
+    }
+  if(!container.geometry.empty() && container.geometry.size() != 3)
+    {
+    itkGenericExceptionMacro(<< "The geometry of the model container "
+                             << filename << " is not made of the solar "
+                             << "zenith, sensor zenith and azimuth angles.");
+    }
+  auto has_space = [](const std::string& name){
+    return name.empty() ||
+    std::any_of(name.begin(), name.end(),
+                [](char c){ return std::isspace(static_cast<unsigned char>(c)); });
+  };
+  if(has_space(container.type) ||
+     std::any_of(container.targets.begin(), container.targets.end(), has_space) ||
+     std::any_of(container.bands.begin(), container.bands.end(), has_space) ||
+     (!container.sensor.empty() && has_space(container.sensor)))
+    {
+    itkGenericExceptionMacro(<< "The names in the model container "
+                             << filename << " cannot contain spaces.");
+    }
+}
+}
+
+void check_container_outputs(const ModelContainer& container,
+                             std::size_t nbOutputs,
+                             const std::string& filename)
+{
+  if(!container.targets.empty() && container.targets.size() != nbOutputs)
+    {
+    itkGenericExceptionMacro(<< "The model container " << filename << " has "
+                             << container.targets.size() << " targets for "
+                             << nbOutputs << " output variables.");
+    }
+  if(!container.bands.empty() && !container.normalization.empty() &&
+     container.normalization.size() != container.bands.size()+nbOutputs)
+    {
+    itkGenericExceptionMacro(<< "The normalization of the model container "
+                             << filename << " has "
+                             << container.normalization.size()
+                             << " variables for " << container.bands.size()
+                             << " bands and " << nbOutputs << " targets.");
+    }
+}
+
+void write_model_container(const ModelContainer& container,
+                           const std::vector<std::string>& model_filenames,
+                           std::size_t nbOutputs,
+                           const std::string out_filename)
+{
+  check_model_container(container, model_filenames.size(), out_filename);
+  check_container_outputs(container, nbOutputs, out_filename);
+  // the container is written to a temporary file which is then renamed,
+  // so that a job never reads a partial container
+  auto tmp_filename = out_filename+".tmp";
+  std::ofstream container_file{tmp_filename, std::ios::binary};
+  if(!container_file)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << tmp_filename);
+    }
+  container_file << model_container_header << '\n';
+  container_file << "type " << container.type << '\n';
+  write_container_line(container_file, "targets", container.targets);
+  write_container_line(container_file, "bands", container.bands);
+  if(!container.sensor.empty())
+    container_file << "sensor " << container.sensor << '\n';
+  container_file << std::setprecision(17);
+  write_container_line(container_file, "geometry", container.geometry);
+  if(!container.normalization.empty())
+    {
+    container_file << "normalization " << container.normalization.size()
+                   << '\n';
+    for(const auto& p : container.normalization)
+      container_file << p.first << ' ' << p.second << '\n';
+    }
+  container_file << "models " << model_filenames.size() << '\n';
+  for(const auto& name : model_filenames)
+    {
+    std::ifstream model_file{name, std::ios::binary | std::ios::ate};
+    if(!model_file)
+      {
+      std::remove(tmp_filename.c_str());
+      itkGenericExceptionMacro(<< "Could not open file " << name);
+      }
+    auto size = static_cast<std::uintmax_t>(model_file.tellg());
+    if(size == 0)
+      {
+      std::remove(tmp_filename.c_str());
+      itkGenericExceptionMacro(<< "The model file " << name << " is empty.");
+      }
+    model_file.seekg(0);
+    container_file << "model " << size << '\n';
+    container_file << model_file.rdbuf();
+    }
+  container_file.close();
+  if(!container_file ||
+     std::rename(tmp_filename.c_str(), out_filename.c_str()) != 0)
+    {
+    std::remove(tmp_filename.c_str());
+    itkGenericExceptionMacro(<< "Could not write model container "
+                             << out_filename);
+    }
+}
+
+bool read_model_container(const std::string in_filename,
+                          ModelContainer& container)
+{
+  std::ifstream container_file{in_filename, std::ios::binary};
+  std::string line;
+  if(!container_file || !std::getline(container_file, line) ||
+     line != model_container_header)
+    return false;
+  container = ModelContainer{};
+  container.filename = in_filename;
+  std::size_t nbModels{0};
+  while(std::getline(container_file, line))
+    {
+    std::istringstream ss(line);
+    std::string key;
+    ss >> key;
+    if(key.empty()) continue;
+    if(key == "type")
+      ss >> container.type;
+    else if(key == "targets" || key == "bands")
+      {
+      auto& names = key == "targets" ? container.targets : container.bands;
+      for(std::string name; ss >> name; )
+        names.push_back(name);
+      }
+    else if(key == "sensor")
+      ss >> container.sensor;
+    else if(key == "geometry")
+      for(PrecisionType angle; ss >> angle; )
+        container.geometry.push_back(angle);
+    else if(key == "normalization")
+      {
+      std::size_t nbVariables{0};
+      ss >> nbVariables;
+      for(std::size_t var = 0; var < nbVariables; ++var)
+        {
+        PrecisionType minval, maxval;
+        std::istringstream values;
+        if(std::getline(container_file, line))
+          values.str(line);
+        if(!(values >> minval >> maxval))
+          {
+          itkGenericExceptionMacro(<< "Bad normalization in model container "
+                                   << in_filename);
+          }
+        container.normalization.push_back(std::make_pair(minval, maxval));
+        }
+      }
+    else if(key == "models")
+      ss >> nbModels;
+    else if(key == "model")
+      {
+      std::uintmax_t size{0};
+      if(!(ss >> size) || size == 0)
+        {
+        itkGenericExceptionMacro(<< "Bad model size in model container "
+                                 << in_filename << ": " << line);
+        }
+      // the model is only located, it is read when it is loaded
+      auto position = static_cast<std::uintmax_t>(container_file.tellg());
+      container.models.push_back(std::make_pair(position, size));
+      container_file.seekg(static_cast<std::streamoff>(size), std::ios::cur);
+      }
+    else
+      {
+      itkGenericExceptionMacro(<< "Bad header line in model container "
+                               << in_filename << ": " << line);
+      }
+    }
+  container_file.clear();
+  container_file.seekg(0, std::ios::end);
+  auto fileSize = static_cast<std::uintmax_t>(container_file.tellg());
+  if(container.models.size() != nbModels)
+    {
+    itkGenericExceptionMacro(<< "The model container " << in_filename
+                             << " has " << container.models.size()
+                             << " models instead of " << nbModels << ".");
+    }
+  if(nbModels > 0 && container.models.back().first+
+     container.models.back().second > fileSize)
+    {
+    itkGenericExceptionMacro(<< "The model container " << in_filename
+                             << " is truncated.");
+    }
+  check_model_container(container, nbModels, in_filename);
+  return true;
+}
+
+std::string extract_container_model(const ModelContainer& container,
+                                    std::size_t k)
+{
+  if(k >= container.models.size())
+    {
+    itkGenericExceptionMacro(<< "No model " << k << " in model container "
+                             << container.filename);
+    }
+  const char* tmpdir = std::getenv("TMPDIR");
+  std::string pattern{(tmpdir != nullptr && *tmpdir != '\0') ? tmpdir : "/tmp"};
+  pattern += "/otbbv_model_XXXXXX";
+  std::vector<char> name(pattern.begin(), pattern.end());
+  name.push_back('\0');
+  auto fd = mkstemp(name.data());
+  if(fd < 0)
+    {
+    itkGenericExceptionMacro(<< "Could not create a temporary file "
+                             << pattern << ": " << std::strerror(errno));
+    }
+  close(fd);
+  std::string tmp_filename{name.data()};
+  std::ifstream container_file{container.filename, std::ios::binary};
+  container_file.seekg(static_cast<std::streamoff>(container.models[k].first));
+  std::ofstream model_file{tmp_filename, std::ios::binary};
+  auto remaining = container.models[k].second;
+  std::vector<char> buffer(std::min<std::uintmax_t>(remaining, 1<<20));
+  while(remaining > 0 && container_file && model_file)
+    {
+    auto chunk = std::min<std::uintmax_t>(remaining, buffer.size());
+    container_file.read(buffer.data(), static_cast<std::streamsize>(chunk));
+    model_file.write(buffer.data(), container_file.gcount());
+    remaining -= static_cast<std::uintmax_t>(container_file.gcount());
+    }
+  model_file.close();
+  if(remaining > 0 || !model_file)
+    {
+    std::remove(tmp_filename.c_str());
+    itkGenericExceptionMacro(<< "Could not extract model " << k
+                             << " of model container " << container.filename);
+    }
+  return tmp_filename;
+}
+
+std::string describe_model_container(const ModelContainer& container)
+{
+  std::ostringstream description;
+  description << container.models.size() << " " << container.type
+              << " models";
+  for(const auto& target : container.targets)
+    description << " " << target;
+  if(!container.sensor.empty())
+    description << " for " << container.sensor;
+  if(!container.geometry.empty())
+    description << " at angles " << container.geometry[0] << " "
+                << container.geometry[1] << " " << container.geometry[2];
+  return description.str();
+}
+
+std::string sniff_model_type(const std::string in_filename)
+{
+  std::ifstream model_file{in_filename};
+  std::string line;
+  if(!model_file || !std::getline(model_file, line))
+    return "";
+  if(line.find("Multilayer perceptron") != std::string::npos)
+    return "MLP";
+  if(line.find("Multilinear") != std::string::npos)
+    return "MLR";
+  if(line.compare(0, 5, "%YAML") != 0 && line.compare(0, 5, "<?xml") != 0)
+    return "";
+  // OpenCV's statistical models give their type id with their name,
+  // right after the header of the file storage
+  for(int l = 0; l < 3 && std::getline(model_file, line); ++l)
+    {
+    if(line.find("opencv-ml-ann-mlp") != std::string::npos)
+      return "NN";
+    if(line.find("opencv-ml-svm") != std::string::npos)
+      return "SVR";
+    if(line.find("opencv-ml-random-trees") != std::string::npos)
+      return "RF";
+    }
+  return "";
+}
+
+
+void write_manifest(const SimulationManifest& manifest, 
+                    const std::string out_filename)
+{
+  auto tmp_filename = out_filename+".tmp";
+  std::ofstream manifest_file{tmp_filename};
+  if(!manifest_file)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << tmp_filename);
+    }
+  manifest_file << "first " << manifest.first << "\n";
+  manifest_file << "last " << manifest.last << "\n";
+  manifest_file << "total " << manifest.total << "\n";
+  manifest_file << "committed " << manifest.committed << "\n";
+  manifest_file << "bytes " << manifest.bytes << "\n";
+  manifest_file << "seed " << manifest.seed << "\n";
+  manifest_file << "header " << manifest.header << "\n";
+  manifest_file << "complete " << manifest.complete << "\n";
+  manifest_file << "parameters " << manifest.parameters << "\n";
+  manifest_file.close();
+  if(!manifest_file || 
+     std::rename(tmp_filename.c_str(), out_filename.c_str()) != 0)
+    {
+    itkGenericExceptionMacro(<< "Could not write manifest " << out_filename);
+    }
+}
+
+SimulationManifest read_manifest(const std::string in_filename)
+{
+  std::ifstream manifest_file{in_filename};
+  if(!manifest_file)
+    {
+    itkGenericExceptionMacro(<< "Could not open file " << in_filename);
+    }
+  SimulationManifest manifest{0, 0, 0, 0, 0, 0, false, false, ""};
+  std::size_t nb_fields{0};
+  for(std::string line; std::getline(manifest_file, line); )
+    {
+    std::istringstream ss(line);
+    std::string key;
+    ss >> key;
+    if(key == "first") ss >> manifest.first;
+    else if(key == "last") ss >> manifest.last;
+    else if(key == "total") ss >> manifest.total;
+    else if(key == "committed") ss >> manifest.committed;
+    else if(key == "bytes") ss >> manifest.bytes;
+    else if(key == "seed") ss >> manifest.seed;
+    else if(key == "header") ss >> manifest.header;
+    else if(key == "complete") ss >> manifest.complete;
+    else if(key == "parameters")
+      {
+      std::getline(ss >> std::ws, manifest.parameters);
+      ss.clear();
+      }
+    else 
+      continue;
+    if(ss.fail())
+      {
+      itkGenericExceptionMacro(<< "Wrong line format in " << in_filename 
+                               << ": " << line << std::endl);
+      }
+    ++nb_fields;
+    }
+  if(nb_fields != 9)
+    {
+    itkGenericExceptionMacro(<< "Incomplete manifest " << in_filename);
+    }
+  return manifest;
+}
+
+void resume_output(const std::string& out_filename, 
+                   const SimulationManifest& manifest)
+{
+  struct stat st;
+  if(stat(out_filename.c_str(), &st) != 0)
+    {
+    itkGenericExceptionMacro(<< "Could not stat file " << out_filename 
+                             << ": " << std::strerror(errno));
+    }
+  if(static_cast<std::uintmax_t>(st.st_size) < manifest.bytes)
+    {
+    itkGenericExceptionMacro(<< "The output file " << out_filename 
+                             << " is shorter (" << st.st_size 
+                             << " bytes) than the " << manifest.bytes 
+                             << " bytes committed in its manifest.");
+    }
+  truncate_file(out_filename, manifest.bytes);
+}
+
+std::pair<std::size_t, std::size_t> parse_shard(const std::string& shard)
+{
+  std::istringstream ss(shard);
+  long long i{-1}, n{-1};
+  char sep{0};
+  ss >> i >> sep >> n;
+  if(ss.fail() || !(ss >> std::ws).eof() || sep != '/' || n < 1 || i < 0 
+     || i >= n)
+    {
+    itkGenericExceptionMacro(<< "Wrong shard specification " << shard 
+                             << ". It should be i/n with 0 <= i < n.");
+    }
+  return std::make_pair(static_cast<std::size_t>(i), 
+                        static_cast<std::size_t>(n));
+}
+
+double normal_cdf(double x)
+{
+  return 0.5*std::erfc(-x/std::sqrt(2.0));
+}
+
+double normal_quantile(double p)
+{
+  if(p <= 0) return -std::numeric_limits<double>::infinity();
+  if(p >= 1) return std::numeric_limits<double>::infinity();
+  // Acklam's rational approximations
+  const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                      -2.759285104469687e+02, 1.383577518672690e+02,
+                      -3.066479806614716e+01, 2.506628277459239e+00};
+  const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                      -1.556989798598866e+02, 6.680131188771972e+01,
+                      -1.328068155288572e+01};
+  const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                      -2.400758277161838e+00, -2.549732539343734e+00,
+                      4.374664141464968e+00, 2.938163982698783e+00};
+  const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                      2.445134137142996e+00, 3.754408661907416e+00};
+  const double p_low{0.02425};
+  double x;
+  if(p < p_low || p > 1-p_low)
+    {
+    auto q = std::sqrt(-2*std::log(p < p_low ? p : 1-p));
+    x = (((((c[0]*q+c[1])*q+c[2])*q+c[3])*q+c[4])*q+c[5]) /
+      ((((d[0]*q+d[1])*q+d[2])*q+d[3])*q+1);
+    if(p > p_low) x = -x;
+    }
+  else
+    {
+    auto q = p-0.5;
+    auto r = q*q;
+    x = (((((a[0]*r+a[1])*r+a[2])*r+a[3])*r+a[4])*r+a[5])*q /
+      (((((b[0]*r+b[1])*r+b[2])*r+b[3])*r+b[4])*r+1);
+    }
+  // One step of Halley's method. Beyond 37 sigmas exp(x*x/2) overflows
+  // and the approximation is already below the double resolution.
+  if(std::fabs(x) < 37)
+    {
+    auto e = normal_cdf(x)-p;
+    auto u = e*2.50662827463100050242*std::exp(x*x/2);
+    x = x-u/(1+x*u/2);
+    }
+  return x;
+}
+
+double truncated_normal_quantile(double u, double a, double b)
+{
+  if(a >= b) return a;
+  // In the upper tail, use the symmetry to work with small CDF values
+  if(a >= 0) return -truncated_normal_quantile(1-u, -b, -a);
+  const double tail_limit{37};
+  if(b < -tail_limit)
+    {
+    // normal_cdf(b) underflows: the density on [a, b] is approximated by
+    // exp(-|b|(b-x)), whose quantile function is known. The relative
+    // error is of the order of 1/b^2.
+    auto lambda = -b;
+    auto q = -std::expm1(-lambda*(b-a));
+    return std::max(a, b+std::log1p(-q*(1-u))/lambda);
+    }
+  auto pa = normal_cdf(a);
+  auto pb = normal_cdf(b);
+  auto x = normal_quantile(pa+u*(pb-pa));
+  return std::min(std::max(x, a), b);
+}
+
+double VarQuantile(VarParams vpars, double u)
+{
+  double min = vpars.min;
+  double max = vpars.max;
+  double mod = vpars.mod;
+  double stdev = vpars.std;
+  if(vpars.dist == DistType::UNIFORM)
+    return min+u*(max-min);
+  double x;
+  if(vpars.dist == DistType::LOGNORMAL)
+    {
+    // the log of the variable follows a truncated gaussian
+    auto lmin = min > 0 ? std::log(min) : 
+      -std::numeric_limits<double>::infinity();
+    auto lmax = std::log(max);
+    x = std::exp(stdev > 0 ? 
+                 mod+stdev*truncated_normal_quantile(u, (lmin-mod)/stdev,
+                                                     (lmax-mod)/stdev) :
+                 mod);
+    }
+  else
+    {
+    x = stdev > 0 ? 
+      mod+stdev*truncated_normal_quantile(u, (min-mod)/stdev, 
+                                          (max-mod)/stdev) :
+      mod;
+    }
+  return std::min(std::max(x, min), max);
+}
+
+double log_normal_mass(double a, double b)
+{
+  if(a >= b) return -std::numeric_limits<double>::infinity();
+  if(a >= 0) return log_normal_mass(-b, -a);
+  const double tail_limit{37};
+  if(b < -tail_limit)
+    {
+    // same exponential approximation of the tail as in
+    // truncated_normal_quantile
+    return -b*b/2-std::log(-b*2.50662827463100050242)+
+      std::log(-std::expm1(b*(b-a)));
+    }
+  return std::log(normal_cdf(b)-normal_cdf(a));
+}
+
+double VarLogDensity(VarParams vpars, double x)
+{
+  const auto minus_inf = -std::numeric_limits<double>::infinity();
+  double min = vpars.min;
+  double max = vpars.max;
+  double mod = vpars.mod;
+  double stdev = vpars.std;
+  if(x < min || x > max) return minus_inf;
+  if(vpars.dist == DistType::UNIFORM)
+    return max > min ? -std::log(max-min) : 0.0;
+  if(stdev <= 0)
+    {
+    // all the mass is on the (clamped) mode
+    auto m = vpars.dist == DistType::LOGNORMAL ? std::exp(mod) : mod;
+    return x == std::min(std::max(m, min), max) ? 0.0 : minus_inf;
+    }
+  double y = x;
+  double a = (min-mod)/stdev;
+  double b = (max-mod)/stdev;
+  double jacobian{0.0};
+  if(vpars.dist == DistType::LOGNORMAL)
+    {
+    if(x <= 0) return minus_inf;
+    y = std::log(x);
+    a = min > 0 ? (std::log(min)-mod)/stdev : minus_inf;
+    b = (std::log(max)-mod)/stdev;
+    jacobian = y;
+    }
+  auto z = (y-mod)/stdev;
+  return -z*z/2-std::log(stdev*2.50662827463100050242)-jacobian-
+    log_normal_mass(a, b);
+}
 
 /**
 
@@ -104,6 +928,103 @@ double CorrelateValue(double v, double lai, VarParams vpars, VarParams laipars)
     return v;
 }
 
+
+SampleType DrawSample(const BVDistributions& d, const UniformsType& u)
+{
+  SampleType s;
+  s[IVNames::MLAI] = VarQuantile(d.MLAI, u[0]);
+  s[IVNames::ALA] = CorrelateValue(VarQuantile(d.ALA, u[1]), 
+                                   s[IVNames::MLAI], d.ALA, d.MLAI);
+  s[IVNames::CrownCover] = CorrelateValue(VarQuantile(d.CrownCover, u[2]), 
+                                          s[IVNames::MLAI], d.CrownCover, d.MLAI);
+  s[IVNames::HsD] = CorrelateValue(VarQuantile(d.HsD, u[3]), 
+                                   s[IVNames::MLAI], d.HsD, d.MLAI);
+  s[IVNames::N] = CorrelateValue(VarQuantile(d.N, u[4]), 
+                                 s[IVNames::MLAI], d.N, d.MLAI);
+  s[IVNames::Cab] = CorrelateValue(VarQuantile(d.Cab, u[5]), 
+                                   s[IVNames::MLAI], d.Cab, d.MLAI);
+  // We don't use the Car distribution to match INRA's approach and set it to Cab/4
+  s[IVNames::Car] = s[IVNames::Cab]*0.25; 
+  s[IVNames::Cdm] = CorrelateValue(VarQuantile(d.Cdm, u[6]), 
+                                   s[IVNames::MLAI], d.Cdm, d.MLAI);
+  s[IVNames::CwRel] = CorrelateValue(VarQuantile(d.CwRel, u[7]), 
+                                     s[IVNames::MLAI], d.CwRel, d.MLAI);
+  s[IVNames::Cbp] = CorrelateValue(VarQuantile(d.Cbp, u[8]), 
+                                   s[IVNames::MLAI], d.Cbp, d.MLAI);
+  s[IVNames::Bs] = CorrelateValue(VarQuantile(d.Bs, u[9]), 
+                                  s[IVNames::MLAI], d.Bs, d.MLAI);
+  return s;
+}
+
+RegressionMetrics regression_metrics(const std::vector<double>& estimates,
+                                     const std::vector<double>& references)
+{
+  if(estimates.size() != references.size() || estimates.empty())
+    {
+    itkGenericExceptionMacro(<< "The estimates and the reference values "
+                             << "must have the same, non zero, size.");
+    }
+  auto n = estimates.size();
+  double mean_ref{0}, bias{0};
+  for(std::size_t i = 0; i < n; ++i)
+    {
+    mean_ref += references[i];
+    bias += estimates[i]-references[i];
+    }
+  mean_ref /= n;
+  bias /= n;
+  double sse{0}, sst{0};
+  std::vector<double> abs_errors(n);
+  for(std::size_t i = 0; i < n; ++i)
+    {
+    auto err = estimates[i]-references[i];
+    sse += err*err;
+    sst += (references[i]-mean_ref)*(references[i]-mean_ref);
+    abs_errors[i] = std::fabs(err);
+    }
+  std::sort(abs_errors.begin(), abs_errors.end());
+  // nearest rank percentile
+  auto percentile = [&abs_errors, n](double p){
+    auto rank = static_cast<std::size_t>(std::ceil(p*n));
+    return abs_errors[rank > 0 ? rank-1 : 0];
+  };
+  return RegressionMetrics{n, std::sqrt(sse/n), bias,
+      sst > 0 ? 1-sse/sst : std::numeric_limits<double>::quiet_NaN(),
+      percentile(0.5), percentile(0.9), percentile(0.95)};
+}
+
+void normalize_rows(PrecisionType* rows, std::size_t nbRows,
+                    std::size_t nbColumns,
+                    const NormalizationVectorType& var_minmax,
+                    std::size_t nbThreads)
+{
+  if(var_minmax.size() < nbColumns)
+    {
+    itkGenericExceptionMacro(<< "Normalization of " << nbColumns 
+                             << " variables with the min/max of "
+                             << var_minmax.size() << " variables.");
+    }
+  // normalize(x) = 2*((x-min)/(max-min+eps)-0.5) = x*scale+offset
+  std::vector<PrecisionType> scale(nbColumns), offset(nbColumns);
+  for(std::size_t var = 0; var < nbColumns; ++var)
+    {
+    scale[var] = 2/(var_minmax[var].second-var_minmax[var].first
+                    +std::numeric_limits<PrecisionType>::epsilon());
+    offset[var] = -var_minmax[var].first*scale[var]-1;
+    }
+  parallel_for_blocks(0, nbRows, nbThreads, 
+                      [&](std::size_t first, std::size_t last){
+                        auto s = scale.data();
+                        auto o = offset.data();
+                        for(auto r = first; r < last; ++r)
+                          {
+                          auto x = rows+r*nbColumns;
+                          for(std::size_t var = 0; var < nbColumns; ++var)
+                            x[var] = x[var]*s[var]+o[var];
+                          }
+                      });
+}
+
 }//namespace BV 
 }
 
@@ -0,0 +1,165 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "otbMLPRegressionModel.h"
+#include "otbMultiLinearRegressionModel.h"
+#include "otbBVSampleStore.h"
+#include <iostream>
+#include <cmath>
+
+using MLP = otb::MLPRegressionModel<double>;
+
+namespace
+{
+// smooth non linear function of 2 variables sampled on a grid
+otb::BV::SampleStore mlp_samples()
+{
+  otb::BV::SampleStore store(2);
+  for(int i = 0; i < 40; ++i)
+    for(int j = 0; j < 40; ++j)
+      {
+      std::vector<double> x{i/39.0*2-1, j/39.0*4};
+      store.PushBack(x, 3*std::tanh(2*x[0])+0.5*x[1]*x[1]+10);
+      }
+  return store;
+}
+
+double mlp_rmse(const MLP::Pointer& model, const otb::BV::SampleStore& store)
+{
+  double sse{0};
+  for(std::size_t i = 0; i < store.Size(); ++i)
+    {
+    MLP::VectorType x(store.Input(i), store.Input(i)+2);
+    sse += std::pow(model->PredictVector(x)-store.Output(i), 2);
+    }
+  return std::sqrt(sse/store.Size());
+}
+}
+
+int bvMLPRegression(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  auto store = mlp_samples();
+  otb::BV::SampleView samples(store, 0, store.Size());
+
+  // the default network [2, 5, 1] fits the function with Adam and
+  // with L-BFGS
+  auto adam = MLP::New();
+  adam->SetSeed(3);
+  adam->SetBatchSize(64);
+  adam->Train(samples);
+  auto adam_rmse = mlp_rmse(adam, store);
+  auto lbfgs = MLP::New();
+  lbfgs->SetTrainMethod(MLP::TrainMethodType::LBFGS);
+  lbfgs->SetSeed(3);
+  lbfgs->Train(samples);
+  auto lbfgs_rmse = mlp_rmse(lbfgs, store);
+  std::cout << "Adam RMSE " << adam_rmse << " in "
+            << adam->GetNumberOfEpochs() << " epochs, L-BFGS RMSE "
+            << lbfgs_rmse << " in " << lbfgs->GetNumberOfEpochs()
+            << " iterations" << std::endl;
+  if(adam->GetLayerSizes() != std::vector<unsigned int>{2, 5, 1} ||
+     adam_rmse > 0.1 || lbfgs_rmse > 0.1)
+    return EXIT_FAILURE;
+
+  // the model depends on the seed but not on the number of threads:
+  // the batches are larger than a chunk of the loss, so that the
+  // partial sums of several threads are combined
+  auto threaded = MLP::New();
+  threaded->SetSeed(3);
+  threaded->SetBatchSize(1024);
+  threaded->SetNumberOfThreads(3);
+  threaded->SetMaxEpochs(20);
+  auto single = MLP::New();
+  single->SetSeed(3);
+  single->SetBatchSize(1024);
+  single->SetMaxEpochs(20);
+  auto other_seed = MLP::New();
+  other_seed->SetSeed(4);
+  other_seed->SetBatchSize(1024);
+  other_seed->SetMaxEpochs(20);
+  threaded->Train(samples);
+  single->Train(samples);
+  other_seed->Train(samples);
+  MLP::VectorType x{0.3, 1.7};
+  if(threaded->PredictVector(x) != single->PredictVector(x) ||
+     other_seed->PredictVector(x) == single->PredictVector(x))
+    return EXIT_FAILURE;
+  // and L-BFGS uses all the training samples at each iteration
+  auto threaded_lbfgs = MLP::New();
+  threaded_lbfgs->SetTrainMethod(MLP::TrainMethodType::LBFGS);
+  threaded_lbfgs->SetSeed(3);
+  threaded_lbfgs->SetNumberOfThreads(3);
+  threaded_lbfgs->SetMaxEpochs(20);
+  auto single_lbfgs = MLP::New();
+  single_lbfgs->SetTrainMethod(MLP::TrainMethodType::LBFGS);
+  single_lbfgs->SetSeed(3);
+  single_lbfgs->SetMaxEpochs(20);
+  threaded_lbfgs->Train(samples);
+  single_lbfgs->Train(samples);
+  if(threaded_lbfgs->PredictVector(x) != single_lbfgs->PredictVector(x))
+    return EXIT_FAILURE;
+
+  // the sample weights are used by the fit: a network trained with
+  // null weights on half of the samples fits the other half only
+  MLP::VectorType weights(store.Size());
+  for(std::size_t i = 0; i < store.Size(); ++i)
+    weights[i] = store.Input(i)[0] > 0 ? 1 : 0;
+  auto weighted = MLP::New();
+  weighted->SetSeed(3);
+  weighted->SetSampleWeights(weights);
+  weighted->SetTrainMethod(MLP::TrainMethodType::LBFGS);
+  weighted->Train(samples);
+  if(weighted->GetValidationError() > 1e-2)
+    return EXIT_FAILURE;
+
+  // save and load give the same predictions, and the file is told
+  // apart from the multilinear regression ones
+  adam->Save("/tmp/bvMLPRegression.txt");
+  auto loaded = MLP::New();
+  if(!loaded->CanReadFile("/tmp/bvMLPRegression.txt"))
+    return EXIT_FAILURE;
+  loaded->Load("/tmp/bvMLPRegression.txt");
+  if(loaded->PredictVector(x) != adam->PredictVector(x) ||
+     loaded->GetLayerSizes() != adam->GetLayerSizes())
+    return EXIT_FAILURE;
+
+  // a warm start goes on from the loaded network and never ends with a
+  // worse one
+  auto kept = MLP::New();
+  kept->Load("/tmp/bvMLPRegression.txt");
+  kept->SetWarmStart(true);
+  kept->SetSeed(3);
+  kept->SetMaxEpochs(0);
+  kept->Train(samples);
+  auto continued = MLP::New();
+  continued->Load("/tmp/bvMLPRegression.txt");
+  continued->SetWarmStart(true);
+  continued->SetSeed(3);
+  continued->SetBatchSize(64);
+  continued->SetMaxEpochs(50);
+  continued->Train(samples);
+  if(kept->PredictVector(x) != adam->PredictVector(x) ||
+     continued->GetValidationError() > kept->GetValidationError() ||
+     mlp_rmse(continued, store) > 0.1)
+    return EXIT_FAILURE;
+  if(otb::MultiLinearRegressionModel<double>::New()->CanReadFile(
+       "/tmp/bvMLPRegression.txt"))
+    return EXIT_FAILURE;
+  auto mlr = otb::MultiLinearRegressionModel<double>::New();
+  mlr->Train(samples);
+  mlr->Save("/tmp/bvMLPRegressionMLR.txt");
+  if(loaded->CanReadFile("/tmp/bvMLPRegressionMLR.txt"))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
@@ -13,6 +13,14 @@
 =========================================================================*/
 
 #include "otbMultiLinearRegressionModel.h"
+#include "otbBVUtil.h"
+#include "otbBVSampleStore.h"
+#include "otbBVSampleReduction.h"
+#include "otbBVRegressionModels.h"
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 using MRM=otb::MultiLinearRegressionModel<double>;
 MRM::MatrixType x_vec = {
@@ -108,6 +116,468 @@ int bvMultiLinearFitting(int itkNotUsed(argc), char * itkNotUsed(argv)[])
   return EXIT_SUCCESS;
 }
 
+int bvMultiLinearWarmStart(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  auto model = MRM::New();
+  model->SetPredictorMatrix(x_vec);
+  model->SetTargetVector(y_vec);
+  model->SetWeightVector(w_vec);
+  model->Train();
+  auto result = model->GetModel();
+
+  // a model learned on the first samples and updated with the other
+  // ones from its saved normal equations is the fit of all of them
+  auto first_model = MRM::New();
+  first_model->SetPredictorMatrix(MRM::MatrixType(x_vec.begin(), 
+                                                  x_vec.begin()+8));
+  first_model->SetTargetVector(MRM::VectorType(y_vec.begin(), 
+                                               y_vec.begin()+8));
+  first_model->SetWeightVector(MRM::VectorType(w_vec.begin(), 
+                                               w_vec.begin()+8));
+  first_model->Train();
+  first_model->Save("/tmp/mrr_first.txt");
+  auto updated_model = MRM::New();
+  updated_model->Load("/tmp/mrr_first.txt");
+  updated_model->SetWarmStart(true);
+  updated_model->SetPredictorMatrix(MRM::MatrixType(x_vec.begin()+8, 
+                                                    x_vec.end()));
+  updated_model->SetTargetVector(MRM::VectorType(y_vec.begin()+8, 
+                                                 y_vec.end()));
+  updated_model->SetWeightVector(MRM::VectorType(w_vec.begin()+8, 
+                                                 w_vec.end()));
+  updated_model->Train();
+  for(size_t i=0; i<result.size(); i++)
+    if(fabs(updated_model->GetModel()[i]-result[i])>1e-8)
+      {
+      std::cout << "ERROR: Updated model is different from the fit of all "
+                << "the samples\n";
+      return EXIT_FAILURE;
+      }
+  return EXIT_SUCCESS;
+}
+
+/** Samples computed on the fly, so that the fit never stores them */
+struct GeneratedSamples {
+  std::size_t n;
+  std::size_t nbInputs;
+  std::size_t Size() const { return n; }
+  std::size_t NbInputs() const { return nbInputs; }
+  std::vector<double> Input(std::size_t i) const
+  {
+    // far from 0, a duplicated predictor and a constant one
+    std::vector<double> x{1e4+std::sin(0.3*i), std::cos(0.7*i), 
+        2*std::cos(0.7*i), 5};
+    x.resize(nbInputs);
+    return x;
+  }
+  double Output(std::size_t i) const
+  {
+    auto x = Input(i);
+    return 3-2*x[0]+0.5*x[1];
+  }
+};
+
+int bvMultiLinearStreamingFit(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // more samples than the chunks of all the lanes
+  GeneratedSamples samples{600000, 2};
+  MRM::VectorType reference;
+  for(std::size_t nbThreads : {1, 3, 8})
+    {
+    auto model = MRM::New();
+    model->SetNumberOfThreads(nbThreads);
+    model->Train(samples);
+    auto c = model->GetModel();
+    if(fabs(c[0]-3) > 1e-6 || fabs(c[1]+2) > 1e-10 || fabs(c[2]-0.5) > 1e-10)
+      {
+      std::cout << "Wrong fit with " << nbThreads << " threads: " << c[0] 
+                << " " << c[1] << " " << c[2] << "\n";
+      return EXIT_FAILURE;
+      }
+    if(reference.empty())
+      reference = c;
+    else if(c != reference)
+      {
+      std::cout << "The fit depends on the number of threads\n";
+      return EXIT_FAILURE;
+      }
+    }
+
+  // the predictors which are combinations of the other ones do not
+  // prevent the fit
+  GeneratedSamples collinear{10000, 4};
+  auto model = MRM::New();
+  model->Train(collinear);
+  double max_error{0};
+  for(std::size_t i = 0; i < collinear.Size(); i += 7)
+    max_error = std::max(max_error, 
+                         fabs(model->PredictVector(collinear.Input(i))-
+                              collinear.Output(i)));
+  if(max_error > 1e-6)
+    {
+    std::cout << "Wrong fit of collinear predictors: error " << max_error 
+              << "\n";
+    return EXIT_FAILURE;
+    }
+
+  // the batch predictions, tail included, are the ones of PredictVector
+  const std::size_t nbBatch{13};
+  std::vector<double> batch, batch_y(nbBatch);
+  for(std::size_t i = 0; i < nbBatch; ++i)
+    {
+    auto x = collinear.Input(i);
+    batch.insert(batch.end(), x.begin(), x.end());
+    }
+  model->PredictBatch(batch.data(), nbBatch, collinear.NbInputs(),
+                      batch_y.data());
+  for(std::size_t i = 0; i < nbBatch; ++i)
+    if(batch_y[i] != model->PredictVector(collinear.Input(i)))
+      {
+      std::cout << "Batch prediction " << i << " is " << batch_y[i]
+                << " instead of " << model->PredictVector(collinear.Input(i))
+                << "\n";
+      return EXIT_FAILURE;
+      }
+  try
+    {
+    model->PredictBatch(batch.data(), 1, collinear.NbInputs()-1,
+                        batch_y.data());
+    std::cout << "A batch of the wrong size was predicted\n";
+    return EXIT_FAILURE;
+    }
+  catch(itk::ExceptionObject&)
+    {
+    }
+  return EXIT_SUCCESS;
+}
+
+/** Ridge fit of y_vec on x_vec with a single penalty */
+MRM::Pointer RidgeFit(const MRM::VectorType& y, double lambda)
+{
+  auto model = MRM::New();
+  model->SetPredictorMatrix(x_vec);
+  model->SetTargetVector(y);
+  model->SetRidgePath({lambda});
+  model->Train();
+  return model;
+}
+
+int bvMultiLinearTargets(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // the fit of several targets is the fit of each of them
+  MRM::VectorType y2;
+  for(auto y : y_vec)
+    y2.push_back(1-2*y);
+  auto model = MRM::New();
+  model->SetPredictorMatrix(x_vec);
+  model->SetTargetVectors({y_vec, y2});
+  model->SetWeightVector(w_vec);
+  model->Train();
+  for(std::size_t k = 0; k < 2; ++k)
+    {
+    auto single = MRM::New();
+    single->SetPredictorMatrix(x_vec);
+    single->SetTargetVector(k == 0 ? y_vec : y2);
+    single->SetWeightVector(w_vec);
+    single->Train();
+    for(std::size_t j = 0; j < 3; ++j)
+      if(fabs(model->GetModels()[k][j]-single->GetModel()[j]) > 1e-10)
+        {
+        std::cout << "Target " << k << " differs from its single fit\n";
+        return EXIT_FAILURE;
+        }
+    }
+
+  // the coefficients of all the targets are saved and each target can
+  // be used alone
+  model->Save("/tmp/mrr_targets.txt");
+  auto loaded = MRM::New();
+  loaded->Load("/tmp/mrr_targets.txt");
+  MRM::VectorType test_vec = {x_vec[2][0], x_vec[2][1]};
+  if(loaded->GetNumberOfTargets() != 2 ||
+     fabs(loaded->GetTargetModel(1)->PredictVector(test_vec)-
+          model->GetTargetModel(1)->PredictVector(test_vec)) > 1e-6)
+    {
+    std::cout << "Wrong targets in the saved model\n";
+    return EXIT_FAILURE;
+    }
+
+  // the samples of a view are fitted for all their output variables
+  std::vector<double> rows;
+  for(size_t i = 0; i < x_vec.size(); ++i)
+    rows.insert(rows.end(), {x_vec[i][0], x_vec[i][1], y_vec[i], y2[i]});
+  otb::BV::SampleStore store(2, std::move(rows), 2);
+  auto view_model = MRM::New();
+  view_model->TrainTargets(otb::BV::SampleView(store, 0, store.Size()));
+  auto plain_model = MRM::New();
+  plain_model->SetPredictorMatrix(x_vec);
+  plain_model->SetTargetVectors({y_vec, y2});
+  plain_model->Train();
+  if(view_model->GetModels() != plain_model->GetModels())
+    {
+    std::cout << "The fit of a view differs from the one of its samples\n";
+    return EXIT_FAILURE;
+    }
+
+  // a null penalty is the least squares fit, and a large one leaves
+  // the mean of the targets
+  auto ols = MRM::New();
+  ols->SetPredictorMatrix(x_vec);
+  ols->SetTargetVector(y_vec);
+  ols->Train();
+  auto zero = RidgeFit(y_vec, 0);
+  auto large = RidgeFit(y_vec, 1e9);
+  double mean{0};
+  for(auto y : y_vec)
+    mean += y/y_vec.size();
+  for(std::size_t j = 0; j < 3; ++j)
+    if(fabs(zero->GetModel()[j]-ols->GetModel()[j]) > 1e-8 ||
+       fabs(large->GetModel()[j]-(j == 0 ? mean : 0)) > 1e-6)
+      {
+      std::cout << "Wrong ridge fit for coefficient " << j << "\n";
+      return EXIT_FAILURE;
+      }
+
+  // the penalty chosen in the path is the one of the lowest
+  // generalized cross-validation error n RSS/(n-df)^2, computed here
+  // from the fits of each penalty, df being the trace of the hat
+  // matrix whose diagonal is given by the fits of unit targets
+  MRM::VectorType path{0, 0.001, 0.01, 0.1, 1};
+  auto n = static_cast<double>(x_vec.size());
+  double best_gcv{std::numeric_limits<double>::max()}, best_lambda{-1};
+  for(auto lambda : path)
+    {
+    auto fit = RidgeFit(y_vec, lambda);
+    double rss{0}, df{0};
+    for(std::size_t i = 0; i < x_vec.size(); ++i)
+      {
+      rss += pow(fit->PredictVector(x_vec[i])-y_vec[i], 2);
+      MRM::VectorType unit(x_vec.size(), 0);
+      unit[i] = 1;
+      df += RidgeFit(unit, lambda)->PredictVector(x_vec[i]);
+      }
+    auto gcv = n*rss/((n-df)*(n-df));
+    if(gcv < best_gcv)
+      {
+      best_gcv = gcv;
+      best_lambda = lambda;
+      }
+    }
+  auto path_model = MRM::New();
+  path_model->SetPredictorMatrix(x_vec);
+  path_model->SetTargetVectors({y_vec, y2});
+  path_model->SetRidgePath(path);
+  path_model->Train();
+  if(path_model->GetRidgeParameters().size() != 2 ||
+     path_model->GetRidgeParameters()[0] != best_lambda ||
+     path_model->GetRidgeParameters()[1] != best_lambda)
+    {
+    std::cout << "Penalty " << path_model->GetRidgeParameters()[0] 
+              << " chosen instead of " << best_lambda << "\n";
+    return EXIT_FAILURE;
+    }
+
+  // a ridge model updated with new samples is the one of all of them
+  auto first_model = MRM::New();
+  first_model->SetPredictorMatrix(MRM::MatrixType(x_vec.begin(), 
+                                                  x_vec.begin()+8));
+  first_model->SetTargetVector(MRM::VectorType(y_vec.begin(), 
+                                               y_vec.begin()+8));
+  first_model->SetRidgePath({0.01});
+  first_model->Train();
+  first_model->Save("/tmp/mrr_ridge_first.txt");
+  auto updated_model = MRM::New();
+  updated_model->Load("/tmp/mrr_ridge_first.txt");
+  updated_model->SetWarmStart(true);
+  updated_model->SetRidgePath({0.01});
+  updated_model->SetPredictorMatrix(MRM::MatrixType(x_vec.begin()+8, 
+                                                    x_vec.end()));
+  updated_model->SetTargetVector(MRM::VectorType(y_vec.begin()+8, 
+                                                 y_vec.end()));
+  updated_model->Train();
+  auto all_model = RidgeFit(y_vec, 0.01);
+  for(std::size_t j = 0; j < 3; ++j)
+    if(fabs(updated_model->GetModel()[j]-all_model->GetModel()[j]) > 1e-8)
+      {
+      std::cout << "Updated ridge model is different from the fit of all "
+                << "the samples\n";
+      return EXIT_FAILURE;
+      }
+  return EXIT_SUCCESS;
+}
+
+int bvModelContainerTargets(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // a mlr model of several targets gives an output variable per target
+  // to the container holding it
+  MRM::VectorType y2;
+  for(auto y : y_vec)
+    y2.push_back(1-2*y);
+  auto model = MRM::New();
+  model->SetPredictorMatrix(x_vec);
+  model->SetTargetVectors({y_vec, y2});
+  model->SetWeightVector(w_vec);
+  model->Train();
+  std::string modelFileName{"/tmp/bvcontainer_targets.txt"};
+  model->Save(modelFileName);
+  otb::BV::ModelContainer container;
+  container.type = "MLR";
+  container.targets = {"lai", "fcover"};
+  container.bands = {"B1", "B2"};
+  container.normalization = {{0, 1}, {0, 1}, {0, 8}, {0, 1}};
+  std::string fileName{"/tmp/bvcontainer_targets.bvm"};
+  otb::BV::write_model_container(container, {modelFileName}, 2, fileName);
+  otb::BV::ModelContainer read;
+  if(!otb::BV::read_model_container(fileName, read) ||
+     read.models.size() != 1)
+    {
+    std::cout << "Wrong container of a mlr model of 2 targets\n";
+    return EXIT_FAILURE;
+    }
+  auto models = otb::BV::LoadContainerModels(read);
+  otb::BV::RegressionModelType::InputSampleType pix(2);
+  pix[0] = x_vec[2][0];
+  pix[1] = x_vec[2][1];
+  MRM::VectorType test_vec = {x_vec[2][0], x_vec[2][1]};
+  if(models.size() != 2)
+    {
+    std::cout << "Wrong number of models in the container\n";
+    return EXIT_FAILURE;
+    }
+  for(std::size_t k = 0; k < 2; ++k)
+    if(fabs(models[k]->Predict(pix)[0]-
+            model->GetTargetModel(k)->PredictVector(test_vec)) > 1e-6)
+      {
+      std::cout << "Wrong model of target " << k << " in the container\n";
+      return EXIT_FAILURE;
+      }
+
+  // the targets and the normalization are checked against the output
+  // variables, not against the model files
+  container.targets = {"lai"};
+  try
+    {
+    otb::BV::write_model_container(container, {modelFileName}, 2, fileName);
+    std::cout << "A container with 1 target for 2 outputs is accepted\n";
+    return EXIT_FAILURE;
+    }
+  catch(itk::ExceptionObject&)
+    {
+    }
+  read.targets = {"lai"};
+  try
+    {
+    otb::BV::LoadContainerModels(read);
+    std::cout << "A container with 1 target for 2 outputs is loaded\n";
+    return EXIT_FAILURE;
+    }
+  catch(itk::ExceptionObject&)
+    {
+    }
+  return EXIT_SUCCESS;
+}
+
+int bvMultiLinearFeatureMap(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // the squares of the second column of x_vec are computed by a map
+  // of degree 2 from the first one
+  MRM::MatrixType x_raw;
+  for(const auto& x : x_vec)
+    x_raw.push_back({x[0]});
+  MRM::FeatureMapType squares;
+  squares.SetDegree(2);
+  auto model = MRM::New();
+  model->SetFeatureMap(squares);
+  model->SetPredictorMatrix(x_raw);
+  model->SetTargetVector(y_vec);
+  model->SetWeightVector(w_vec);
+  model->Train();
+  auto columns = MRM::New();
+  columns->SetPredictorMatrix(x_vec);
+  columns->SetTargetVector(y_vec);
+  columns->SetWeightVector(w_vec);
+  columns->Train();
+  for(std::size_t j = 0; j < 3; ++j)
+    if(fabs(model->GetModel()[j]-columns->GetModel()[j]) > 1e-10)
+      {
+      std::cout << "The fit of the squares differs from the one of their "
+                << "columns\n";
+      return EXIT_FAILURE;
+      }
+
+  // products and normalized differences: the target is a combination
+  // of them, which the fit finds
+  MRM::FeatureMapType features;
+  features.SetPairwiseProducts(true);
+  features.AddNormalizedDifference(0, 2);
+  MRM::MatrixType x3;
+  MRM::VectorType y3;
+  for(std::size_t i = 0; i < 40; ++i)
+    {
+    MRM::VectorType x{0.1+0.02*i, 0.3+0.1*std::sin(0.7*i), 
+        0.2+0.1*std::cos(0.3*i)};
+    y3.push_back(1+2*x[0]*x[1]-0.5*x[1]*x[2]+3*(x[0]-x[2])/(x[0]+x[2]));
+    x3.push_back(x);
+    }
+  auto ndi_model = MRM::New();
+  ndi_model->SetFeatureMap(features);
+  ndi_model->SetPredictorMatrix(x3);
+  ndi_model->SetTargetVector(y3);
+  ndi_model->Train();
+  if(ndi_model->GetModel().size() != 1+3+3+1 || 
+     ndi_model->GetNumberOfInputs() != 3 ||
+     ndi_model->GetFeatureMap().GetNumberOfDifferences() != 1)
+    {
+    std::cout << "Wrong number of features\n";
+    return EXIT_FAILURE;
+    }
+  std::vector<double> batch, batch_y(x3.size());
+  for(const auto& x : x3)
+    batch.insert(batch.end(), x.begin(), x.end());
+  ndi_model->PredictBatch(batch.data(), x3.size(), 3, batch_y.data());
+  for(std::size_t i = 0; i < x3.size(); ++i)
+    if(fabs(ndi_model->PredictVector(x3[i])-y3[i]) > 1e-8 ||
+       batch_y[i] != ndi_model->PredictVector(x3[i]))
+      {
+      std::cout << "Wrong prediction of sample " << i << ": " 
+                << ndi_model->PredictVector(x3[i]) << " " << batch_y[i]
+                << " instead of " << y3[i] << "\n";
+      return EXIT_FAILURE;
+      }
+
+  // the feature map is saved with the model, which predicts from the
+  // inputs
+  ndi_model->Save("/tmp/mrr_features.txt");
+  auto loaded = MRM::New();
+  loaded->Load("/tmp/mrr_features.txt");
+  if(loaded->GetFeatureMap().ToString() !=
+     ndi_model->GetFeatureMap().ToString() ||
+     fabs(loaded->PredictVector(x3[5])-y3[5]) > 1e-6)
+    {
+    std::cout << "Wrong feature map in the saved model: " 
+              << loaded->GetFeatureMap().ToString() << "\n";
+    return EXIT_FAILURE;
+    }
+
+  // a difference of inputs which do not exist
+  MRM::FeatureMapType bad;
+  bad.AddNormalizedDifference(0, 3);
+  auto bad_model = MRM::New();
+  bad_model->SetFeatureMap(bad);
+  bad_model->SetPredictorMatrix(x3);
+  bad_model->SetTargetVector(y3);
+  try
+    {
+    bad_model->Train();
+    std::cout << "A difference of missing inputs was fitted\n";
+    return EXIT_FAILURE;
+    }
+  catch(...)
+    {
+    }
+  return EXIT_SUCCESS;
+}
+
 int bvMultiLinearFittingConversions(int itkNotUsed(argc), 
                                     char * itkNotUsed(argv)[])
 {
@@ -161,3 +631,270 @@ int bvMultiLinearFittingConversions(int itkNotUsed(argc),
 
   return EXIT_SUCCESS;
 }
+
+int bvRegressionMetrics(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // perfect estimates
+  auto m = otb::BV::regression_metrics(y_vec, y_vec);
+  if(m.n != y_vec.size() || m.rmse != 0 || m.bias != 0 || m.r2 != 1 || 
+     m.p95 != 0)
+    return EXIT_FAILURE;
+
+  // errors 1, 2, ..., 100 with alternating signs, except for the
+  // last one: bias of (50+100)/100 and percentiles given by the ranks
+  std::vector<double> ref(100), est(100);
+  double sse{0};
+  for(std::size_t i = 0; i < 100; ++i)
+    {
+    ref[i] = static_cast<double>(i);
+    double err = (i%2 == 0 || i == 99) ? (i+1.0) : -(i+1.0);
+    est[i] = ref[i]+err;
+    sse += err*err;
+    }
+  m = otb::BV::regression_metrics(est, ref);
+  double sst{0};
+  for(auto r : ref)
+    sst += (r-49.5)*(r-49.5);
+  if(fabs(m.rmse-sqrt(sse/100)) > 1e-12 || fabs(m.bias-1.5) > 1e-12 ||
+     fabs(m.r2-(1-sse/sst)) > 1e-12 || m.p50 != 50 || m.p90 != 90 || 
+     m.p95 != 95)
+    {
+    std::cout << m.rmse << " " << m.bias << " " << m.r2 << " " << m.p50 
+              << " " << m.p90 << " " << m.p95 << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  bool caught = false;
+  try
+    {
+    otb::BV::regression_metrics(est, y_vec);
+    }
+  catch(...)
+    {
+    caught = true;
+    }
+  if(!caught)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+int bvSampleStore(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  otb::BV::SampleStore store(2);
+  for(size_t i = 0; i < x_vec.size(); ++i)
+    store.PushBack(x_vec[i], y_vec[i]);
+  if(store.Size() != x_vec.size() || store.Input(3)[1] != x_vec[3][1] ||
+     store.Output(3) != y_vec[3])
+    return EXIT_FAILURE;
+
+  // a model trained on a view is the one trained on a copy of the
+  // samples of the view
+  otb::BV::SampleView view(store, {14, 2, 5, 7, 9, 11, 0, 3});
+  MRM::MatrixType x_sub;
+  MRM::VectorType y_sub;
+  for(size_t k = 0; k < view.Size(); ++k)
+    {
+    x_sub.push_back(x_vec[view.Index(k)]);
+    y_sub.push_back(y_vec[view.Index(k)]);
+    }
+  auto model = MRM::New();
+  model->SetPredictorMatrix(x_sub);
+  model->SetTargetVector(y_sub);
+  model->Train();
+  auto view_model = MRM::New();
+  view_model->Train(view);
+  if(model->GetModel() != view_model->GetModel())
+    return EXIT_FAILURE;
+
+  auto slice = view.Slice(2, 5);
+  auto range = otb::BV::SampleView(store, 4, 8).Slice(1, 3);
+  if(slice.Size() != 3 || slice.Index(0) != 5 || slice.Output(2) != y_vec[9] ||
+     range.Size() != 2 || range.Index(0) != 5 || range.Input(1)[0] != x_vec[6][0])
+    return EXIT_FAILURE;
+
+  // negative values: the maximum is not the smallest positive number
+  otb::BV::SampleStore negative(1);
+  negative.PushBack(std::vector<double>{-3.0}, -2.0);
+  negative.PushBack(std::vector<double>{-1.0}, -5.0);
+  auto minmax = otb::BV::estimate_var_minmax(
+    otb::BV::SampleView(negative, 0, 2));
+  if(minmax[0].first != -3 || minmax[0].second != -1 ||
+     minmax[1].first != -5 || minmax[1].second != -2)
+    return EXIT_FAILURE;
+  otb::BV::normalize_samples(negative, 0, 2, minmax);
+  if(fabs(negative.Input(0)[0]+1) > 1e-9 || fabs(negative.Input(1)[0]-1) > 1e-9 ||
+     fabs(negative.Output(0)-1) > 1e-9 || fabs(negative.Output(1)+1) > 1e-9)
+    return EXIT_FAILURE;
+
+  // partial min/max merged and threaded normalization of the store
+  // against the per value normalization
+  otb::BV::VarMinMax first_half(3), second_half(3);
+  for(std::size_t i = 0; i < store.Size(); ++i)
+    (i < store.Size()/2 ? first_half : second_half).Add(store.Input(i));
+  first_half.Merge(second_half);
+  auto store_minmax = otb::BV::estimate_var_minmax(
+    otb::BV::SampleView(store, 0, store.Size()));
+  if(first_half.MinMax() != store_minmax)
+    return EXIT_FAILURE;
+  auto normalized = store;
+  otb::BV::normalize_samples(normalized, 0, store.Size(), store_minmax, 3);
+  for(std::size_t i = 0; i < store.Size(); ++i)
+    for(std::size_t var = 0; var < 3; ++var)
+      if(fabs(normalized.Input(i)[var]-
+              otb::BV::normalize(store.Input(i)[var], store_minmax[var])) > 1e-12)
+        return EXIT_FAILURE;
+
+  // samples of 2 output variables: the views give one of them, and a
+  // model trained on the view of an output variable is the one trained
+  // on this variable only
+  std::vector<double> rows;
+  for(size_t i = 0; i < x_vec.size(); ++i)
+    {
+    rows.insert(rows.end(), x_vec[i].begin(), x_vec[i].end());
+    rows.push_back(y_vec[i]);
+    rows.push_back(2*y_vec[i]+x_vec[i][0]);
+    }
+  otb::BV::SampleStore outputs(2, std::move(rows), 2);
+  auto second = otb::BV::SampleView(outputs, 0, outputs.Size()).ForOutput(1);
+  if(outputs.Size() != x_vec.size() || outputs.RowSize() != 4 ||
+     outputs.Output(3) != y_vec[3] || second.Slice(3, 5).Output(0) != 
+     2*y_vec[3]+x_vec[3][0] || second.Input(4)[1] != x_vec[4][1])
+    return EXIT_FAILURE;
+  auto first_model = MRM::New();
+  first_model->Train(second.ForOutput(0));
+  auto single_model = MRM::New();
+  single_model->Train(otb::BV::SampleView(store, 0, store.Size()));
+  if(first_model->GetModel() != single_model->GetModel())
+    return EXIT_FAILURE;
+  auto output_minmax = otb::BV::estimate_var_minmax(second);
+  if(output_minmax.size() != 4 || output_minmax[2] != store_minmax[2])
+    return EXIT_FAILURE;
+  bool caught{false};
+  try
+    {
+    second.ForOutput(2);
+    }
+  catch(...)
+    {
+    caught = true;
+    }
+  if(!caught)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+int bvSampleReduction(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // 20x20 grid of the unit square whose output is the first input
+  otb::BV::SampleStore grid(2);
+  for(int i = 0; i < 20; ++i)
+    for(int j = 0; j < 20; ++j)
+      grid.PushBack(std::vector<double>{i/19.0, j/19.0}, i/19.0);
+  otb::BV::SampleView samples(grid, 0, grid.Size());
+
+  // the stratified subset has a sample in each decile of the output
+  auto stratified = otb::BV::stratified_reduction(samples, 1, 10, 1, 0);
+  if(stratified.size() != 10)
+    return EXIT_FAILURE;
+  std::vector<double> outputs;
+  for(auto k : stratified)
+    outputs.push_back(samples.Output(k));
+  std::sort(outputs.begin(), outputs.end());
+  for(std::size_t s = 0; s < 10; ++s)
+    if(outputs[s] < (2*s)/19.0 || outputs[s] > (2*s+1)/19.0)
+      return EXIT_FAILURE;
+
+  // the farthest point subset covers the square within twice the
+  // radius of a regular 4x4 grid
+  auto farthest = otb::BV::farthest_point_reduction(samples, 1, 16, 1, 0, 3);
+  double radius{0};
+  for(std::size_t k = 0; k < samples.Size(); ++k)
+    {
+    double d{std::numeric_limits<double>::max()};
+    for(auto f : farthest)
+      d = std::min(d, otb::BV::square_distance(samples.Input(k), 
+                                               samples.Input(f), 2));
+    radius = std::max(radius, sqrt(d));
+    }
+  if(farthest.size() != 16 || radius > 2*sqrt(2.0)/8)
+    {
+    std::cout << "Farthest point radius " << radius << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // two clusters of pairs of copies: k-means keeps a pair in each of
+  // them, whatever the number of threads
+  otb::BV::SampleStore clusters(2);
+  for(int i = 0; i < 50; ++i)
+    for(int copy = 0; copy < 2; ++copy)
+      {
+      double c = i%2 ? 10 : 0;
+      clusters.PushBack(std::vector<double>{c+0.01*i, c-0.01*i+0.001*copy}, 
+                        c);
+      }
+  otb::BV::SampleView pairs(clusters, 0, clusters.Size());
+  auto kmeans = otb::BV::kmeans_reduction(pairs, 2, 2, 1, 0, 1);
+  if(kmeans.size() != 2 || kmeans[0]%2 || kmeans[1]%2 ||
+     pairs.Output(kmeans[0]) == pairs.Output(kmeans[1]) ||
+     kmeans != otb::BV::kmeans_reduction(pairs, 2, 2, 1, 0, 3))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+int bvModelResiduals(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // samples of 2 output variables, seen through a view of indices
+  std::vector<double> rows;
+  for(std::size_t i = 0; i < 301; ++i)
+    {
+    double x0 = 0.01*i;
+    double x1 = sin(0.1*i);
+    rows.insert(rows.end(), {x0, x1, 1+x0-x1+0.1*cos(0.7*i), 
+          x0*x1+0.05*sin(1.3*i)});
+    }
+  otb::BV::SampleStore store(2, std::move(rows), 2);
+  std::vector<std::size_t> indices;
+  for(std::size_t i = 0; i < store.Size(); i += 2)
+    indices.push_back((i*7)%store.Size());
+  otb::BV::SampleView samples(store, indices);
+  std::vector<MRM::Pointer> models;
+  for(std::size_t output = 0; output < 2; ++output)
+    {
+    models.push_back(MRM::New());
+    models.back()->Train(samples.ForOutput(output));
+    }
+  auto var_minmax = otb::BV::estimate_var_minmax(samples);
+
+  // the residuals of the threads are the ones of a serial loop over
+  // the samples, with or without normalization
+  for(auto normalization : {false, true})
+    {
+    auto minmax = normalization ? var_minmax : 
+      otb::BV::NormalizationVectorType{};
+    std::vector<double> serial;
+    for(std::size_t output = 0; output < 2; ++output)
+      for(std::size_t k = 0; k < samples.Size(); ++k)
+        {
+        MRM::InputSampleType input(2);
+        input[0] = samples.Input(k)[0];
+        input[1] = samples.Input(k)[1];
+        auto err = models[output]->Predict(input)[0]-
+          samples.ForOutput(output).Output(k);
+        serial.push_back(normalization ? 
+                         otb::BV::normalize(err, var_minmax[2+output]) : err);
+        }
+    for(std::size_t nbThreads : {1, 3, 8})
+      {
+      auto residuals = otb::BV::ModelResiduals(models, samples, 2, minmax,
+                                               nbThreads);
+      if(residuals != serial)
+        {
+        std::cout << "Residuals of " << nbThreads << " threads differ"
+                  << (normalization ? " with normalization" : "") 
+                  << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+    }
+  return EXIT_SUCCESS;
+}
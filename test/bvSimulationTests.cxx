@@ -0,0 +1,451 @@
+/*=========================================================================
+  Program:   otb-bv
+  Language:  C++
+
+  Copyright (c) CESBIO. All rights reserved.
+
+  See otb-bv-copyright.txt for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+#include "itkMacro.h"
+#include "otbBVUtil.h"
+#include "otbPhiloxRNG.h"
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <atomic>
+#include <iterator>
+#include <cstdio>
+
+int bvPhiloxRNG(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using otb::BV::PhiloxRNG;
+  // Known answer tests from the Random123 distribution
+  std::vector<std::tuple<PhiloxRNG::CounterType, PhiloxRNG::KeyType, 
+                         PhiloxRNG::CounterType>> kat{
+    std::make_tuple(PhiloxRNG::CounterType{{0, 0, 0, 0}}, 
+                    PhiloxRNG::KeyType{{0, 0}},
+                    PhiloxRNG::CounterType{{0x6627e8d5, 0xe169c58d, 
+                          0xbc57ac4c, 0x9b00dbd8}}),
+    std::make_tuple(PhiloxRNG::CounterType{{0xffffffff, 0xffffffff, 
+                          0xffffffff, 0xffffffff}}, 
+                    PhiloxRNG::KeyType{{0xffffffff, 0xffffffff}},
+                    PhiloxRNG::CounterType{{0x408f276d, 0x41c83b0e, 
+                          0xa20bc7c6, 0x6d5451fd}}),
+    std::make_tuple(PhiloxRNG::CounterType{{0x243f6a88, 0x85a308d3, 
+                          0x13198a2e, 0x03707344}}, 
+                    PhiloxRNG::KeyType{{0xa4093822, 0x299f31d0}},
+                    PhiloxRNG::CounterType{{0xd16cfe09, 0x94fdcceb, 
+                          0x5001e420, 0x24126ea1}})};
+  for(const auto& k : kat)
+    {
+    if(PhiloxRNG::Philox4x32(std::get<0>(k), std::get<1>(k)) != std::get<2>(k))
+      {
+      std::cout << "Philox4x32 known answer test failed\n";
+      return EXIT_FAILURE;
+      }
+    }
+
+  // The stream of a given index does not depend on other draws
+  PhiloxRNG rng_a(42, 1000);
+  PhiloxRNG rng_b(42, 999);
+  for(auto i=0; i<10; ++i) rng_b();
+  PhiloxRNG rng_c(42, 1000);
+  for(auto i=0; i<10; ++i)
+    {
+    auto a = rng_a();
+    if(a != rng_c())
+      {
+      std::cout << "Same (seed, index) gives different streams\n";
+      return EXIT_FAILURE;
+      }
+    if(a == PhiloxRNG(43, 1000)())
+      {
+      std::cout << "Different seeds give the same stream\n";
+      return EXIT_FAILURE;
+      }
+    }
+
+  // With the same seed, the noise of the simulation of a sample is not
+  // drawn from the streams of its variables
+  for(std::uint64_t sample = 0; sample < 100; ++sample)
+    for(std::uint32_t stream = 0; stream <= otb::BV::NbDrawnVariables; 
+        ++stream)
+      {
+      PhiloxRNG variables(42, sample, stream);
+      PhiloxRNG noise(42, sample, otb::BV::SimulationNoiseStream);
+      for(auto i=0; i<8; ++i)
+        if(variables() == noise())
+          {
+          std::cout << "The noise of sample " << sample 
+                    << " is drawn from the stream " << stream 
+                    << " of its variables\n";
+          return EXIT_FAILURE;
+          }
+      }
+  return EXIT_SUCCESS;
+}
+
+int bvSimulationManifest(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using namespace otb::BV;
+  SimulationManifest manifest{10, 2000, 4000, 500, 123456789, 
+      18446744073709551557ull, true, false, 
+      "bv.txt formosat2.rsr 33.5 20.1 169"};
+  write_manifest(manifest, "/tmp/bvmanifest.progress");
+  if(std::ifstream("/tmp/bvmanifest.progress.tmp").good())
+    {
+    std::cout << "Temporary manifest was not renamed\n";
+    return EXIT_FAILURE;
+    }
+  auto read = read_manifest("/tmp/bvmanifest.progress");
+  if(read.first != manifest.first || read.last != manifest.last ||
+     read.total != manifest.total || read.header != manifest.header ||
+     read.committed != manifest.committed || read.bytes != manifest.bytes ||
+     read.seed != manifest.seed || read.complete != manifest.complete ||
+     read.parameters != manifest.parameters)
+    {
+    std::cout << "Read manifest is different from the written one\n";
+    return EXIT_FAILURE;
+    }
+
+  // Shards are contiguous and cover all the samples
+  if(parse_shard("2/7") != std::make_pair(std::size_t{2}, std::size_t{7}))
+    {
+    std::cout << "Wrong shard parsing\n";
+    return EXIT_FAILURE;
+    }
+  for(auto bad : {"7/7", "-1/3", "1", "1/0", "1/3x", "a/b"})
+    {
+    try
+      {
+      parse_shard(bad);
+      std::cout << "Shard " << bad << " should not be accepted\n";
+      return EXIT_FAILURE;
+      }
+    catch(...)
+      {
+      }
+    }
+  std::size_t next_first{0};
+  for(std::size_t i=0; i<7; ++i)
+    {
+    auto range = shard_range(1003, i, 7);
+    if(range.first != next_first || range.second < range.first)
+      {
+      std::cout << "Shard " << i << " is not contiguous\n";
+      return EXIT_FAILURE;
+      }
+    next_first = range.second;
+    }
+  if(next_first != 1003)
+    {
+    std::cout << "Shards do not cover all the samples\n";
+    return EXIT_FAILURE;
+    }
+
+  // Every index is processed exactly once whatever the number of threads
+  for(auto nbThreads : {1, 3, 8, 64})
+    {
+    std::vector<std::atomic<int>> visits(50);
+    for(auto& v : visits) v = 0;
+    otb::parallel_for_blocks(5, 50, nbThreads, 
+                             [&](std::size_t first, std::size_t last){
+                               for(auto i=first; i<last; ++i) ++visits[i];
+                             });
+    for(std::size_t i=0; i<visits.size(); ++i)
+      {
+      if(visits[i] != (i<5 ? 0 : 1))
+        {
+        std::cout << "Index " << i << " visited " << visits[i] 
+                  << " times with " << nbThreads << " threads\n";
+        return EXIT_FAILURE;
+        }
+      }
+    }
+  return EXIT_SUCCESS;
+}
+
+namespace
+{
+std::string file_content(const std::string& fileName)
+{
+  std::ifstream f(fileName, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(f)),
+                     std::istreambuf_iterator<char>());
+}
+}
+
+int bvSimulationResume(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using namespace otb::BV;
+  // a simulation whose lines only depend on the seed and the sample index
+  auto simulation = [](std::size_t first, std::size_t last, std::ostream& os){
+    for(auto sample = first; sample != last; ++sample)
+      {
+      PhiloxRNG rng(7, sample);
+      os << sample << " " << rng() << " " << rng() << "\n";
+      }
+  };
+  const SimulationManifest start{100, 1100, 1200, 0, 0, 7, false, false, 
+      "bv.txt formosat2.rsr"};
+  const std::string refFileName{"/tmp/bvresume_ref.txt"};
+  const std::string outFileName{"/tmp/bvresume.txt"};
+  const std::string manifestFileName{outFileName+".progress"};
+
+  auto manifest = start;
+  std::ofstream(refFileName, std::ios::binary);
+  append_committed_chunks(manifest, refFileName, refFileName+".progress", 
+                          128, simulation);
+  auto reference = file_content(refFileName);
+  if(!manifest.complete || manifest.committed != 1000 || 
+     manifest.bytes != reference.size())
+    {
+    std::cout << "Wrong manifest of the uninterrupted run\n";
+    return EXIT_FAILURE;
+    }
+
+  // the run is killed while simulating the 4th chunk, after part of it
+  // has reached the output file
+  manifest = start;
+  std::ofstream(outFileName, std::ios::binary);
+  try
+    {
+    append_committed_chunks(manifest, outFileName, manifestFileName, 128,
+                            [&](std::size_t first, std::size_t last, 
+                                std::ostream& os){
+                              if(first >= start.first+3*128)
+                                throw std::runtime_error("killed");
+                              simulation(first, last, os);
+                            });
+    std::cout << "The run was not interrupted\n";
+    return EXIT_FAILURE;
+    }
+  catch(std::runtime_error&)
+    {
+    }
+  std::ofstream(outFileName, std::ios::binary | std::ios::app) 
+    << "484 0.12";
+
+  manifest = read_manifest(manifestFileName);
+  if(manifest.complete || manifest.committed != 3*128)
+    {
+    std::cout << "Wrong manifest of the interrupted run\n";
+    return EXIT_FAILURE;
+    }
+  resume_output(outFileName, manifest);
+  append_committed_chunks(manifest, outFileName, manifestFileName, 128, 
+                          simulation);
+  if(file_content(outFileName) != reference || 
+     !read_manifest(manifestFileName).complete)
+    {
+    std::cout << "The resumed run is different from the uninterrupted one\n";
+    return EXIT_FAILURE;
+    }
+
+  // an output file shorter than its committed bytes is not resumed
+  manifest.complete = false;
+  manifest.bytes = reference.size()+1;
+  try
+    {
+    resume_output(outFileName, manifest);
+    std::cout << "A short output file was resumed\n";
+    return EXIT_FAILURE;
+    }
+  catch(itk::ExceptionObject&)
+    {
+    }
+  if(file_content(outFileName) != reference)
+    {
+    std::cout << "A short output file was modified\n";
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+int bvReadTextTable(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using otb::read_text_table;
+  const std::string fileName{"/tmp/bvtexttable.txt"};
+  {
+  std::ofstream f(fileName);
+  f << "lai refl1 refl2\n";
+  f << "1.5 0.25 -3e-2 7\r\n";
+  f << "\n \n";
+  f << "\t2  nan 1e3\n";
+  f << "+3 0.5 0.125";
+  }
+  // the first row has 4 values and the second one only 3
+  try
+    {
+    read_text_table(fileName, 0, true, 1);
+    std::cout << "A row with missing values was accepted\n";
+    return EXIT_FAILURE;
+    }
+  catch(...)
+    {
+    }
+  auto table = read_text_table(fileName, 3, true, 2);
+  if(table.Rows() != 3 || table.nbColumns != 3 || 
+     table.Row(0)[2] != -3e-2 || table.Row(2)[0] != 3 ||
+     !std::isnan(table.Row(1)[1]) || table.Row(2)[2] != 0.125)
+    {
+    std::cout << "Wrong values in the table\n";
+    return EXIT_FAILURE;
+    }
+
+  // the result does not depend on the number of threads
+  {
+  std::ofstream f(fileName);
+  for(std::size_t i = 0; i < 10007; ++i)
+    f << i << " " << i*0.5 << " " << -static_cast<int>(i%7) << "\n";
+  }
+  for(std::size_t nbThreads : {1, 3, 8, 64})
+    {
+    table = read_text_table(fileName, 0, false, nbThreads);
+    if(table.Rows() != 10007 || table.nbColumns != 3)
+      {
+      std::cout << "Wrong number of rows with " << nbThreads << " threads\n";
+      return EXIT_FAILURE;
+      }
+    for(std::size_t i = 0; i < table.Rows(); ++i)
+      if(table.Row(i)[0] != i || table.Row(i)[1] != i*0.5 || 
+         table.Row(i)[2] != -double(i%7))
+        {
+        std::cout << "Wrong row " << i << " with " << nbThreads 
+                  << " threads\n";
+        return EXIT_FAILURE;
+        }
+    }
+  return EXIT_SUCCESS;
+}
+
+int bvModelList(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  // the models of a model list are found next to it
+  for(const auto& name : {"/tmp/bvModelList.txt_1", "/tmp/bvModelList.txt_2"})
+    std::ofstream(name) << "# Multilinear regression model\n0.5\n-1.25\n2\n";
+  otb::BV::write_model_list({"/tmp/bvModelList.txt_1", "/tmp/bvModelList.txt_2"},
+                            "/tmp/bvModelList.txt");
+  auto models = otb::BV::read_model_list("/tmp/bvModelList.txt");
+  if(models != std::vector<std::string>{"/tmp/bvModelList.txt_1", 
+                                        "/tmp/bvModelList.txt_2"})
+    {
+    std::cout << "Wrong models read from the model list\n";
+    return EXIT_FAILURE;
+    }
+  std::ifstream list_file{"/tmp/bvModelList.txt"};
+  std::string line;
+  std::getline(list_file, line);
+  std::getline(list_file, line);
+  if(line != "bvModelList.txt_1")
+    {
+    std::cout << "The model list does not hold relative names\n";
+    return EXIT_FAILURE;
+    }
+  // a model file is not a model list
+  if(!otb::BV::read_model_list("/tmp/bvModelList.txt_1").empty())
+    {
+    std::cout << "A model file is read as a model list\n";
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+int bvModelContainer(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using namespace otb::BV;
+  std::vector<std::string> models{"# Multilinear regression model\n0.5\n-1.25\n2\n",
+      "%YAML:1.0\nmy_nn: !!opencv-ml-ann-mlp\n   layer_sizes: [3, 5, 1]\n"};
+  std::vector<std::string> modelFileNames{"/tmp/bvcontainer_mlr.txt",
+      "/tmp/bvcontainer_nn.txt"};
+  for(std::size_t k = 0; k < models.size(); ++k)
+    std::ofstream(modelFileNames[k], std::ios::binary) << models[k];
+  if(sniff_model_type(modelFileNames[0]) != "MLR" ||
+     sniff_model_type(modelFileNames[1]) != "NN")
+    {
+    std::cout << "Wrong type of the model files\n";
+    return EXIT_FAILURE;
+    }
+
+  ModelContainer container;
+  container.type = "MLR";
+  container.targets = {"lai", "fcover"};
+  container.bands = {"B1", "B2", "B3"};
+  container.sensor = "formosat2_3b.rsr";
+  container.geometry = {33.5, 20.1, 169};
+  container.normalization = {{0.01, 0.5}, {0, 0.25}, {0.1, 0.7}, {0, 8}, 
+                             {0, 1}};
+  std::string fileName{"/tmp/bvcontainer.bvm"};
+  write_model_container(container, modelFileNames, 2, fileName);
+  ModelContainer read;
+  if(!read_model_container(fileName, read) || read.type != container.type ||
+     read.targets != container.targets || read.bands != container.bands ||
+     read.sensor != container.sensor || read.geometry != container.geometry ||
+     read.normalization != container.normalization ||
+     read.models.size() != models.size())
+    {
+    std::cout << "Read container is different from the written one\n";
+    return EXIT_FAILURE;
+    }
+  if(describe_model_container(read) != 
+     "2 MLR models lai fcover for formosat2_3b.rsr at angles 33.5 20.1 169")
+    {
+    std::cout << "Wrong description: " << describe_model_container(read) 
+              << "\n";
+    return EXIT_FAILURE;
+    }
+  // the models are extracted byte for byte
+  for(std::size_t k = 0; k < models.size(); ++k)
+    {
+    auto extracted = extract_container_model(read, k);
+    std::ifstream f(extracted, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(f)),
+                        std::istreambuf_iterator<char>());
+    std::remove(extracted.c_str());
+    if(content != models[k])
+      {
+      std::cout << "Wrong model " << k << " extracted from the container\n";
+      return EXIT_FAILURE;
+      }
+    }
+
+  // the other files are not containers
+  if(read_model_container(modelFileNames[0], read))
+    {
+    std::cout << "A model file is read as a container\n";
+    return EXIT_FAILURE;
+    }
+  // truncated containers and inconsistent headers are rejected
+  {
+  std::ifstream f(fileName, std::ios::binary);
+  std::string content((std::istreambuf_iterator<char>(f)),
+                      std::istreambuf_iterator<char>());
+  std::ofstream(fileName, std::ios::binary) << content.substr(0, content.size()-10);
+  }
+  try
+    {
+    read_model_container(fileName, read);
+    std::cout << "A truncated container is accepted\n";
+    return EXIT_FAILURE;
+    }
+  catch(...)
+    {
+    }
+  container.targets = {"lai"};
+  try
+    {
+    write_model_container(container, modelFileNames, 2, fileName);
+    std::cout << "A container with 1 target for 2 models is accepted\n";
+    return EXIT_FAILURE;
+    }
+  catch(...)
+    {
+    }
+  return EXIT_SUCCESS;
+}
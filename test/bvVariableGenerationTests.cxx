@@ -14,7 +14,14 @@
 
 #include "itkMacro.h"
 #include "otbBVUtil.h"
+#include "otbPhiloxRNG.h"
+#include "otbBVSampling.h"
 #include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <limits>
 
 int bvCorrelateWithLAI(int itkNotUsed(argc), char * itkNotUsed(argv)[])
 {
@@ -40,3 +47,298 @@ int bvCorrelateWithLAI(int itkNotUsed(argc), char * itkNotUsed(argv)[])
 
   return EXIT_SUCCESS;
 }
+
+namespace
+{
+// Reference sampler written for the test: draw until the value falls
+// inside the bounds
+double rejection_rng(otb::BV::VarParams vpars, std::mt19937& rngen)
+{
+  using namespace otb::BV;
+  double rn{vpars.min};
+  auto sampleInsideBounds = false;
+  while(!sampleInsideBounds)
+    {
+    if(vpars.dist == DistType::GAUSSIAN)
+      rn = std::normal_distribution<>(vpars.mod, vpars.std)(rngen);
+    else if(vpars.dist == DistType::LOGNORMAL)
+      rn = std::lognormal_distribution<>(vpars.mod, vpars.std)(rngen);
+    else
+      rn = std::uniform_real_distribution<>(vpars.min, vpars.max)(rngen);
+    sampleInsideBounds = (rn >= vpars.min && rn <= vpars.max);
+    }
+  return rn;
+}
+
+// Two sample Kolmogorov-Smirnov statistic
+double ks_statistic(std::vector<double> x, std::vector<double> y)
+{
+  std::sort(x.begin(), x.end());
+  std::sort(y.begin(), y.end());
+  double d{0};
+  std::size_t i{0}, j{0};
+  while(i<x.size() && j<y.size())
+    {
+    auto v = std::min(x[i], y[j]);
+    while(i<x.size() && x[i]<=v) ++i;
+    while(j<y.size() && y[j]<=v) ++j;
+    d = std::max(d, std::fabs(static_cast<double>(i)/x.size()-
+                              static_cast<double>(j)/y.size()));
+    }
+  return d;
+}
+}
+
+int bvTruncatedDistributions(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using namespace otb::BV;
+  const std::size_t n{20000};
+  // critical value of the KS test at the 0.001 level
+  const double ks_max{1.95*std::sqrt(2.0/n)};
+
+  std::vector<VarParams> distributions{
+    {0.0, 15.0, 2.0, 2.0, 0, 0, true, 6, DistType::LOGNORMAL},
+    {0.0, 8.0, 0.5, 1.0, 0, 0, true, 6, DistType::LOGNORMAL},
+    {30.0, 80.0, 60.0, 20.0, 55, 65, true, 3, DistType::GAUSSIAN},
+    {20.0, 90.0, 45.0, 30.0, 45, 90, true, 4, DistType::GAUSSIAN},
+    {0.0, 2.00, 0.00, 0.30, 0.00, 0.20, true, 3, DistType::GAUSSIAN},
+    {5.0, 8.0, 2.0, 2.0, 0, 0, true, 6, DistType::GAUSSIAN},
+    {0.60, 0.85, 0.75, 0.08, 0.70, 0.80, true, 4, DistType::UNIFORM}};
+  std::mt19937 reference_rng(3);
+  for(std::size_t dist=0; dist<distributions.size(); ++dist)
+    {
+    std::vector<double> samples, reference;
+    for(std::size_t i=0; i<n; ++i)
+      {
+      PhiloxRNG rng(dist, i);
+      samples.push_back(Rng(distributions[dist], rng));
+      reference.push_back(rejection_rng(distributions[dist], reference_rng));
+      }
+    auto d = ks_statistic(samples, reference);
+    if(d > ks_max)
+      {
+      std::cout << "Distribution " << dist << " differs from the rejection "
+                << "sampler: KS statistic " << d << " > " << ks_max << "\n";
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Bounds far in the tail, where rejection would never end: compare the
+  // mean with the one of the truncated gaussian
+  std::vector<VarParams> tails{
+    {10.0, 12.0, 2.0, 0.5, 0, 0, true, 6, DistType::GAUSSIAN},
+    {-12.0, -10.0, 2.0, 0.5, 0, 0, true, 6, DistType::GAUSSIAN},
+    {60.0, 61.0, 0.0, 1.0, 0, 0, true, 6, DistType::GAUSSIAN}};
+  for(const auto& vpars : tails)
+    {
+    auto a = (vpars.min-vpars.mod)/vpars.std;
+    auto b = (vpars.max-vpars.mod)/vpars.std;
+    // E[X] = mod + std * (phi(a)-phi(b))/(Phi(b)-Phi(a)), which is 
+    // mod + std * (a + 1/a) for large a
+    auto expected = std::fabs(a) < 30 ?
+      vpars.mod + vpars.std*(std::exp(-a*a/2)-std::exp(-b*b/2))/
+      2.50662827463100050242/(a > 0 ? normal_cdf(-a)-normal_cdf(-b) :
+                         normal_cdf(b)-normal_cdf(a)) :
+      vpars.mod + vpars.std*(a+1/a);
+    double sum{0}, sum2{0};
+    for(std::size_t i=0; i<n; ++i)
+      {
+      PhiloxRNG rng(42, i);
+      auto x = Rng(vpars, rng);
+      if(x < vpars.min || x > vpars.max)
+        {
+        std::cout << x << " is outside [" << vpars.min << ", " 
+                  << vpars.max << "]\n";
+        return EXIT_FAILURE;
+        }
+      sum += x;
+      sum2 += x*x;
+      }
+    auto mean = sum/n;
+    auto sd = std::sqrt(sum2/n-mean*mean);
+    if(std::fabs(mean-expected) > 5*sd/std::sqrt(n)+1e-4*std::fabs(expected))
+      {
+      std::cout << "Mean " << mean << " instead of " << expected 
+                << " for bounds [" << vpars.min << ", " << vpars.max << "]\n";
+      return EXIT_FAILURE;
+      }
+    }
+  return EXIT_SUCCESS;
+}
+
+int bvStratifiedSampling(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using namespace otb::BV;
+  const unsigned int dimension{10};
+
+  // Sobol: the 2^k first points have one point in each of the 2^k
+  // intervals of every dimension, whatever the shift
+  const std::size_t k{10};
+  const std::size_t n{std::size_t{1} << k};
+  for(std::uint64_t seed : {0, 7, 123456789})
+    {
+    SobolSequence sobol(dimension, seed);
+    for(unsigned int dim = 0; dim < dimension; ++dim)
+      {
+      std::vector<unsigned int> counts(n, 0);
+      for(std::size_t i = 0; i < n; ++i)
+        {
+        auto u = sobol.Get(i, dim);
+        if(!(u > 0 && u < 1))
+          {
+          std::cout << "Sobol value " << u << " outside (0, 1)\n";
+          return EXIT_FAILURE;
+          }
+        ++counts[static_cast<std::size_t>(u*n)];
+        }
+      if(std::any_of(counts.begin(), counts.end(), 
+                     [](unsigned int c){ return c != 1; }))
+        {
+        std::cout << "Sobol dimension " << dim << " is not stratified\n";
+        return EXIT_FAILURE;
+        }
+      }
+    // the two first dimensions form a (0, k, 2)-net: one point in each
+    // elementary box of volume 2^-k
+    for(std::size_t bits = 0; bits <= k; ++bits)
+      {
+      std::vector<unsigned int> counts(n, 0);
+      for(std::size_t i = 0; i < n; ++i)
+        {
+        auto x = static_cast<std::size_t>(sobol.Get(i, 0)*(1 << bits));
+        auto y = static_cast<std::size_t>(sobol.Get(i, 1)*(1 << (k-bits)));
+        ++counts[(x << (k-bits)) + y];
+        }
+      if(std::any_of(counts.begin(), counts.end(), 
+                     [](unsigned int c){ return c != 1; }))
+        {
+        std::cout << "Sobol dimensions 0 and 1 are not a (0, m, 2)-net\n";
+        return EXIT_FAILURE;
+        }
+      }
+    }
+
+  // Latin hypercube: the permutation is a bijection for any size and
+  // every dimension has one point per stratum
+  for(std::size_t size : {1, 2, 3, 1000, 4097})
+    {
+    std::vector<unsigned int> seen(size, 0);
+    for(std::size_t i = 0; i < size; ++i)
+      ++seen[permute_index(i, size, 42)];
+    if(std::any_of(seen.begin(), seen.end(), 
+                   [](unsigned int c){ return c != 1; }))
+      {
+      std::cout << "permute_index is not a permutation of " << size << "\n";
+      return EXIT_FAILURE;
+      }
+    for(unsigned int dim = 0; dim < dimension; ++dim)
+      {
+      std::vector<unsigned int> counts(size, 0);
+      for(std::size_t i = 0; i < size; ++i)
+        {
+        auto u = lhs_value(i, size, dim, 7);
+        if(!(u > 0 && u < 1))
+          {
+          std::cout << "LHS value " << u << " outside (0, 1)\n";
+          return EXIT_FAILURE;
+          }
+        ++counts[static_cast<std::size_t>(u*size)];
+        }
+      if(std::any_of(counts.begin(), counts.end(), 
+                     [](unsigned int c){ return c != 1; }))
+        {
+        std::cout << "LHS dimension " << dim << " is not stratified for " 
+                  << size << " samples\n";
+        return EXIT_FAILURE;
+        }
+      }
+    }
+
+  // the permutations of the dimensions are not the same
+  std::size_t same{0};
+  for(std::size_t i = 0; i < 1000; ++i)
+    if(static_cast<std::size_t>(lhs_value(i, 1000, 0, 7)*1000) == 
+       static_cast<std::size_t>(lhs_value(i, 1000, 1, 7)*1000)) ++same;
+  if(same > 10)
+    {
+    std::cout << "LHS dimensions 0 and 1 are correlated\n";
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+int bvImportanceWeights(int itkNotUsed(argc), char * itkNotUsed(argv)[])
+{
+  using namespace otb::BV;
+  // the densities integrate to 1
+  std::vector<VarParams> distributions{
+    {0.0, 15.0, 2.0, 2.0, 0, 0, true, 6, DistType::LOGNORMAL},
+    {0.5, 8.0, 0.5, 1.0, 0, 0, true, 6, DistType::LOGNORMAL},
+    {30.0, 80.0, 60.0, 20.0, 55, 65, true, 3, DistType::GAUSSIAN},
+    {10.0, 12.0, 2.0, 0.5, 0, 0, true, 6, DistType::GAUSSIAN},
+    {60.0, 61.0, 0.0, 1.0, 0, 0, true, 6, DistType::GAUSSIAN},
+    {0.60, 0.85, 0.75, 0.08, 0.70, 0.80, true, 4, DistType::UNIFORM}};
+  auto integrate = [](VarParams vpars, std::function<double(double)> f) {
+    const std::size_t steps{200000};
+    auto h = (vpars.max-vpars.min)/steps;
+    double sum{0};
+    for(std::size_t i = 0; i <= steps; ++i)
+      {
+      auto x = vpars.min+i*h;
+      sum += (i == 0 || i == steps ? 0.5 : 1.0)*f(x)*
+        std::exp(VarLogDensity(vpars, x));
+      }
+    return sum*h;
+  };
+  for(const auto& vpars : distributions)
+    {
+    auto mass = integrate(vpars, [](double){ return 1.0; });
+    if(std::fabs(mass-1) > 1e-3)
+      {
+      std::cout << "Density on [" << vpars.min << ", " << vpars.max 
+                << "] integrates to " << mass << "\n";
+      return EXIT_FAILURE;
+      }
+    }
+  if(VarLogDensity(distributions[2], 29.0) != 
+     -std::numeric_limits<double>::infinity())
+    {
+    std::cout << "Density is not 0 outside the bounds\n";
+    return EXIT_FAILURE;
+    }
+
+  // samples of the proposal weighted by target/proposal give the
+  // moments of the target
+  VarParams proposal{0.0, 15.0, 2.0, 2.0, 0, 0, true, 6, DistType::LOGNORMAL};
+  std::vector<VarParams> targets{
+    {0.0, 8.0, 3.0, 1.5, 0, 0, true, 6, DistType::GAUSSIAN},
+    {0.0, 15.0, 1.0, 0.5, 0, 0, true, 6, DistType::LOGNORMAL},
+    {1.0, 6.0, 0.0, 0.0, 0, 0, true, 6, DistType::UNIFORM}};
+  const std::size_t n{50000};
+  for(const auto& target : targets)
+    {
+    double sum_w{0}, sum_w2{0}, sum_wx{0}, sum_wx2{0};
+    for(std::size_t i = 0; i < n; ++i)
+      {
+      PhiloxRNG rng(11, i);
+      auto x = VarQuantile(proposal, uniform_01(rng));
+      auto w = std::exp(VarLogDensity(target, x)-
+                        VarLogDensity(proposal, x));
+      sum_w += w;
+      sum_w2 += w*w;
+      sum_wx += w*x;
+      sum_wx2 += w*x*x;
+      }
+    auto mean = sum_wx/sum_w;
+    auto sd = std::sqrt(sum_wx2/sum_w-mean*mean);
+    auto ess = sum_w*sum_w/sum_w2;
+    auto expected = integrate(target, [](double x){ return x; });
+    if(std::fabs(mean-expected) > 5*sd/std::sqrt(ess))
+      {
+      std::cout << "Weighted mean " << mean << " instead of " << expected 
+                << " (effective sample size " << ess << ")\n";
+      return EXIT_FAILURE;
+      }
+    }
+  return EXIT_SUCCESS;
+}
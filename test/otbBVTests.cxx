@@ -17,8 +17,27 @@ void RegisterTests()
 {
   REGISTER_TEST(bvProSailSimulatorFunctor);
   REGISTER_TEST(bvMultiLinearFitting);
+  REGISTER_TEST(bvMultiLinearWarmStart);
   REGISTER_TEST(bvMultiLinearFittingConversions);
+  REGISTER_TEST(bvMultiLinearStreamingFit);
+  REGISTER_TEST(bvMultiLinearTargets);
+  REGISTER_TEST(bvModelContainerTargets);
+  REGISTER_TEST(bvMultiLinearFeatureMap);
+  REGISTER_TEST(bvMLPRegression);
+  REGISTER_TEST(bvRegressionMetrics);
+  REGISTER_TEST(bvSampleStore);
+  REGISTER_TEST(bvSampleReduction);
+  REGISTER_TEST(bvModelResiduals);
   REGISTER_TEST(bvMultiTemporalInversion);
   REGISTER_TEST(bvMultiTemporalInversionFromFile);
   REGISTER_TEST(bvCorrelateWithLAI);
+  REGISTER_TEST(bvTruncatedDistributions);
+  REGISTER_TEST(bvStratifiedSampling);
+  REGISTER_TEST(bvImportanceWeights);
+  REGISTER_TEST(bvPhiloxRNG);
+  REGISTER_TEST(bvSimulationManifest);
+  REGISTER_TEST(bvSimulationResume);
+  REGISTER_TEST(bvReadTextTable);
+  REGISTER_TEST(bvModelList);
+  REGISTER_TEST(bvModelContainer);
 }